@@ -984,6 +984,7 @@ static void account_clone(GtkWidget *widget, gpointer data)
 
 	ACP_FASSIGN(imap_auth_type);
 	ACP_FASSIGN(imap_batch_size);
+	ACP_FASSIGN(imap_pool_size);
 
 	/* send */
 	ACP_FASSIGN(gen_msgid);
@@ -1069,6 +1070,7 @@ static void account_clone(GtkWidget *widget, gpointer data)
         ACP_FDUP(imap_dir);
 	ACP_FASSIGN(imap_subsonly);
 	ACP_FASSIGN(low_bandwidth);
+	ACP_FASSIGN(imap_use_idle);
 
         ACP_FASSIGN(set_sent_folder);
         ACP_FDUP(sent_folder);
@@ -1949,7 +1951,13 @@ gboolean password_get(const gchar *user,
 	return FALSE;
 }
 
+/* Created and deleted in pairs, possibly from several threads at once
+ * (message view, decoding of flowed parts, searches): the list is made
+ * by the first create and freed by the last delete, and doesn't change
+ * in between. */
 static GSList *account_sigsep_list = NULL;
+static guint account_sigsep_refcnt = 0;
+static GMutex account_sigsep_mutex;
 
 /* create a list of unique signatures from accounts list */
 void account_sigsep_matchlist_create(void)
@@ -1957,8 +1965,11 @@ void account_sigsep_matchlist_create(void)
 	GList *cur_ac = NULL;
 	PrefsAccount *ac_prefs = NULL;
 
-	if (account_sigsep_list)
+	g_mutex_lock(&account_sigsep_mutex);
+	if (account_sigsep_refcnt++ > 0) {
+		g_mutex_unlock(&account_sigsep_mutex);
 		return;
+	}
 
 	account_sigsep_list = g_slist_prepend(account_sigsep_list, g_strdup("-- "));
 	for (cur_ac = account_get_list();
@@ -1974,15 +1985,18 @@ void account_sigsep_matchlist_create(void)
 			}
 		}
 	}
+	g_mutex_unlock(&account_sigsep_mutex);
 }
 
 /* delete the list of signatures created by account_sigsep_matchlist_create() */
 void account_sigsep_matchlist_delete(void)
 {
-	if (account_sigsep_list) {
+	g_mutex_lock(&account_sigsep_mutex);
+	if (account_sigsep_refcnt > 0 && --account_sigsep_refcnt == 0) {
 		slist_free_strings_full(account_sigsep_list);
 		account_sigsep_list = NULL;
 	}
+	g_mutex_unlock(&account_sigsep_mutex);
 }
 
 /* match a string against all signatures in list, using the specified format */
@@ -963,10 +963,108 @@ static CodeConvFunc conv_get_code_conv_func(const gchar *src_charset_str,
 	return code_conv;
 }
 
+/* iconv_open() has to look the converters up (and load gconv modules on
+ * glibc), so descriptors are kept in a small most-recently-used list
+ * once a conversion is done with them. A descriptor is taken out of the
+ * list while in use, so that threads never share one; pairs iconv can't
+ * convert are remembered with a (iconv_t)-1 descriptor. */
+#define CONV_ICONV_CACHE_SIZE	16
+
+typedef struct _ConvIconvCacheEntry {
+	gchar *src_code;
+	gchar *dest_code;
+	iconv_t cd;
+} ConvIconvCacheEntry;
+
+static GQueue conv_iconv_cache = G_QUEUE_INIT;
+static GMutex conv_iconv_cache_mutex;
+
+static void conv_iconv_cache_entry_free(ConvIconvCacheEntry *entry)
+{
+	if (entry->cd != (iconv_t)-1)
+		iconv_close(entry->cd);
+	g_free(entry->src_code);
+	g_free(entry->dest_code);
+	g_free(entry);
+}
+
+static GList *conv_iconv_cache_find(const gchar *src_code,
+				    const gchar *dest_code)
+{
+	GList *cur;
+
+	for (cur = conv_iconv_cache.head; cur != NULL; cur = cur->next) {
+		ConvIconvCacheEntry *entry = cur->data;
+
+		if (!g_ascii_strcasecmp(entry->src_code, src_code) &&
+		    !g_ascii_strcasecmp(entry->dest_code, dest_code))
+			return cur;
+	}
+
+	return NULL;
+}
+
+/* must be called with the cache locked */
+static void conv_iconv_cache_add(ConvIconvCacheEntry *entry)
+{
+	g_queue_push_head(&conv_iconv_cache, entry);
+	while (conv_iconv_cache.length > CONV_ICONV_CACHE_SIZE)
+		conv_iconv_cache_entry_free(g_queue_pop_tail(&conv_iconv_cache));
+}
+
+static ConvIconvCacheEntry *conv_iconv_acquire(const gchar *src_code,
+					       const gchar *dest_code)
+{
+	ConvIconvCacheEntry *entry;
+	GList *link;
+
+	g_mutex_lock(&conv_iconv_cache_mutex);
+	if ((link = conv_iconv_cache_find(src_code, dest_code)) != NULL) {
+		entry = link->data;
+		g_queue_unlink(&conv_iconv_cache, link);
+		if (entry->cd == (iconv_t)-1) {
+			g_queue_push_head_link(&conv_iconv_cache, link);
+			entry = NULL;
+		} else {
+			g_list_free_1(link);
+		}
+		g_mutex_unlock(&conv_iconv_cache_mutex);
+		return entry;
+	}
+	g_mutex_unlock(&conv_iconv_cache_mutex);
+
+	entry = g_new0(ConvIconvCacheEntry, 1);
+	entry->src_code = g_strdup(src_code);
+	entry->dest_code = g_strdup(dest_code);
+	entry->cd = iconv_open(dest_code, src_code);
+	if (entry->cd != (iconv_t)-1)
+		return entry;
+
+	g_mutex_lock(&conv_iconv_cache_mutex);
+	if (conv_iconv_cache_find(src_code, dest_code) == NULL)
+		conv_iconv_cache_add(entry);
+	else
+		conv_iconv_cache_entry_free(entry);
+	g_mutex_unlock(&conv_iconv_cache_mutex);
+
+	return NULL;
+}
+
+static void conv_iconv_release(ConvIconvCacheEntry *entry)
+{
+	/* back to the initial shift state, whatever the last conversion
+	 * left behind */
+	iconv(entry->cd, NULL, NULL, NULL, NULL);
+
+	g_mutex_lock(&conv_iconv_cache_mutex);
+	conv_iconv_cache_add(entry);
+	g_mutex_unlock(&conv_iconv_cache_mutex);
+}
+
 static gchar *conv_iconv_strdup(const gchar *inbuf,
 			 const gchar *src_code, const gchar *dest_code)
 {
-	iconv_t cd;
+	ConvIconvCacheEntry *entry;
 	gchar *outbuf;
 
 	cm_return_val_if_fail(inbuf != NULL, NULL);
@@ -992,13 +1090,13 @@ static gchar *conv_iconv_strdup(const gchar *inbuf,
 	if (!strcasecmp(dest_code, CS_US_ASCII))
 		return g_strdup(inbuf);
 
-	cd = iconv_open(dest_code, src_code);
-	if (cd == (iconv_t)-1)
+	entry = conv_iconv_acquire(src_code, dest_code);
+	if (entry == NULL)
 		return NULL;
 
-	outbuf = conv_iconv_strdup_with_cd(inbuf, cd);
+	outbuf = conv_iconv_strdup_with_cd(inbuf, entry->cd);
 
-	iconv_close(cd);
+	conv_iconv_release(entry);
 
 	return outbuf;
 }
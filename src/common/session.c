@@ -659,6 +659,7 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 	GByteArray *data_buf;
 	gint terminator_len;
 	gboolean complete = FALSE;
+	guint prev_len, end = 0;
 	guint data_len;
 	gint ret;
 
@@ -698,6 +699,7 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 	if (session->read_buf_len == 0)
 		return TRUE;
 
+	prev_len = data_buf->len;
 	g_byte_array_append(data_buf, session->read_buf_p,
 			    session->read_buf_len);
 
@@ -705,17 +707,29 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 	session->read_buf_p = session->read_buf;
 
 	/* check if data is terminated */
-	if (data_buf->len >= terminator_len) {
-		if (memcmp(data_buf->data, session->read_data_terminator,
-			   terminator_len) == 0)
-			complete = TRUE;
-		else if (data_buf->len >= terminator_len + 2 &&
-			 memcmp(data_buf->data + data_buf->len -
-				(terminator_len + 2), "\r\n", 2) == 0 &&
-			 memcmp(data_buf->data + data_buf->len -
-				terminator_len, session->read_data_terminator,
-				terminator_len) == 0)
-			complete = TRUE;
+	if (data_buf->len >= terminator_len &&
+	    memcmp(data_buf->data, session->read_data_terminator,
+		   terminator_len) == 0) {
+		complete = TRUE;
+		end = terminator_len;
+	} else {
+		/* the terminator may be followed by replies to commands
+		 * sent ahead (pipelining), look for it in what was just
+		 * read rather than at the very end */
+		guint i = prev_len > terminator_len + 2 ?
+			prev_len - (terminator_len + 2) : 0;
+
+		for (; i + terminator_len + 2 <= data_buf->len; i++) {
+			if (data_buf->data[i] == '\r' &&
+			    data_buf->data[i + 1] == '\n' &&
+			    memcmp(data_buf->data + i + 2,
+				   session->read_data_terminator,
+				   terminator_len) == 0) {
+				complete = TRUE;
+				end = i + 2 + terminator_len;
+				break;
+			}
+		}
 	}
 
 	/* incomplete read */
@@ -740,6 +754,14 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 		session->io_tag = 0;
 	}
 
+	/* whatever follows goes back for the next read */
+	if (end < data_buf->len) {
+		session->read_buf_len = data_buf->len - end;
+		memcpy(session->read_buf, data_buf->data + end,
+		       session->read_buf_len);
+		g_byte_array_set_size(data_buf, end);
+	}
+
 	data_len = data_buf->len - terminator_len;
 
 	/* callback */
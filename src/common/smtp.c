@@ -57,6 +57,7 @@ static gint smtp_helo(SMTPSession *session);
 static gint smtp_rcpt(SMTPSession *session);
 static gint smtp_data(SMTPSession *session);
 static gint smtp_send_data(SMTPSession *session);
+static gint smtp_bdat(SMTPSession *session);
 static gint smtp_make_ready(SMTPSession *session);
 static gint smtp_eom(SMTPSession *session);
 
@@ -102,6 +103,8 @@ Session *smtp_session_new(void *prefs_account)
 	session->forced_auth_type          = 0;
 	session->auth_type                 = 0;
 	session->esmtp_flags               = 0;
+	session->pipelined                 = FALSE;
+	session->chunking                  = FALSE;
 
 	session->error_val                 = SM_OK;
 	session->error_msg                 = NULL;
@@ -123,14 +126,46 @@ static void smtp_session_destroy(Session *session)
 	g_free(smtp_session->error_msg);
 }
 
+/* send_data comes dot-stuffed; BDAT wants the message as it is */
+static void smtp_unstuff_data(SMTPSession *session)
+{
+	guchar *src = session->send_data;
+	guchar *end = src + session->send_data_len;
+	guchar *dest = src;
+	gboolean in_body = FALSE;
+	gboolean bol = TRUE;
+
+	while (src < end) {
+		if (bol && in_body && *src == '.')
+			src++;
+		else if (bol && !in_body && src + 1 < end &&
+			 src[0] == '\r' && src[1] == '\n')
+			in_body = TRUE;
+		if (src == end)
+			break;
+		bol = (*src == '\n');
+		*dest++ = *src++;
+	}
+	*dest = '\0';
+	session->send_data_len = dest - session->send_data;
+}
+
 gint smtp_from(SMTPSession *session)
 {
 	gchar buf[MESSAGEBUFSIZE];
 	gchar *mail_size = NULL;
+	GString *cmds;
+	GSList *cur;
 
 	cm_return_val_if_fail(session->from != NULL, SM_ERROR);
 
 	session->state = SMTP_FROM;
+
+	if (session->is_esmtp && (session->esmtp_flags & ESMTP_CHUNKING) != 0
+	    && !session->chunking) {
+		smtp_unstuff_data(session);
+		session->chunking = TRUE;
+	}
 	
 	if (session->is_esmtp && (session->esmtp_flags & ESMTP_SIZE)!=0)
 		mail_size = g_strdup_printf(" SIZE=%d", session->send_data_len);
@@ -147,9 +182,40 @@ gint smtp_from(SMTPSession *session)
 
 	g_free(mail_size);
 
-	if (session_send_msg(SESSION(session), buf) < 0)
+	if (!session->is_esmtp || (session->esmtp_flags & ESMTP_PIPELINING) == 0) {
+		if (session_send_msg(SESSION(session), buf) < 0)
+			return SM_ERROR;
+		log_print(LOG_PROTOCOL, "%sSMTP> %s\n", (session->is_esmtp?"E":""), buf);
+
+		return SM_OK;
+	}
+
+	/* all of the envelope in one write, then the replies are read
+	 * in order, and DATA too unless the body goes with BDAT */
+	log_print(LOG_PROTOCOL, "ESMTP> %s\n", buf);
+	cmds = g_string_new(buf);
+	for (cur = session->to_list; cur != NULL; cur = cur->next) {
+		gchar *to = (gchar *)cur->data;
+
+		if (strchr(to, '<'))
+			g_snprintf(buf, sizeof(buf), "RCPT TO:%s", to);
+		else
+			g_snprintf(buf, sizeof(buf), "RCPT TO:<%s>", to);
+		log_print(LOG_PROTOCOL, "ESMTP> %s\n", buf);
+		g_string_append_printf(cmds, "\r\n%s", buf);
+	}
+	if (!session->chunking) {
+		log_print(LOG_PROTOCOL, "ESMTP> DATA\n");
+		g_string_append(cmds, "\r\nDATA");
+	}
+	session->pipelined = TRUE;
+	session->cur_to = session->to_list;
+
+	if (session_send_msg(SESSION(session), cmds->str) < 0) {
+		g_string_free(cmds, TRUE);
 		return SM_ERROR;
-	log_print(LOG_PROTOCOL, "%sSMTP> %s\n", (session->is_esmtp?"E":""), buf);
+	}
+	g_string_free(cmds, TRUE);
 
 	return SM_OK;
 }
@@ -299,6 +365,10 @@ static gint smtp_ehlo(SMTPSession *session)
 	session->state = SMTP_EHLO;
 
 	session->avail_auth_type = 0;
+	/* forget what was announced before STARTTLS (RFC 3207);
+	 * the TLS state itself is kept in tls_init_done */
+	session->esmtp_flags = 0;
+	session->max_message_size = 0;
 
 	g_snprintf(buf, sizeof(buf), "EHLO %s",
 		   session->hostname ? session->hostname : get_domain_name());
@@ -339,6 +409,10 @@ static gint smtp_ehlo_recv(SMTPSession *session, const gchar *msg)
 			p += 9;
 			session->avail_auth_type |= SMTPAUTH_TLS_AVAILABLE;
 		}
+		if (g_ascii_strncasecmp(p, "PIPELINING", 10) == 0)
+			session->esmtp_flags |= ESMTP_PIPELINING;
+		if (g_ascii_strncasecmp(p, "CHUNKING", 8) == 0)
+			session->esmtp_flags |= ESMTP_CHUNKING;
 		return SM_OK;
 	} else if ((msg[0] == '1' || msg[0] == '2' || msg[0] == '3') &&
 	    (msg[3] == ' ' || msg[3] == '\0'))
@@ -506,6 +580,35 @@ static gint smtp_send_data(SMTPSession *session)
 	return SM_OK;
 }
 
+/* the command and the whole body in a single chunk */
+static gint smtp_bdat(SMTPSession *session)
+{
+	gchar *cmd;
+	gsize cmd_len;
+	guchar *data;
+
+	session->state = SMTP_SEND_DATA;
+
+	cmd = g_strdup_printf("BDAT %u LAST\r\n", session->send_data_len);
+	cmd_len = strlen(cmd);
+	log_print(LOG_PROTOCOL, "ESMTP> BDAT %u LAST\n", session->send_data_len);
+
+	data = g_malloc(cmd_len + session->send_data_len + 1);
+	memcpy(data, cmd, cmd_len);
+	memcpy(data + cmd_len, session->send_data, session->send_data_len + 1);
+	g_free(cmd);
+
+	g_free(session->send_data);
+	session->send_data = data;
+	session->send_data_len += cmd_len;
+
+	if (session_send_data(SESSION(session), session->send_data,
+			      session->send_data_len) < 0)
+		return SM_ERROR;
+
+	return SM_OK;
+}
+
 static gint smtp_make_ready(SMTPSession *session)
 {
 	session->state = SMTP_MAIL_SENT_OK;
@@ -684,12 +787,33 @@ static gint smtp_session_recv_msg(Session *session, const gchar *msg)
 		ret = smtp_from(smtp_session);
 		break;
 	case SMTP_FROM:
+		if (smtp_session->pipelined) {
+			/* the RCPT replies follow */
+			smtp_session->state = SMTP_RCPT;
+			return session_recv_msg(session);
+		}
 		if (smtp_session->cur_to)
 			ret = smtp_rcpt(smtp_session);
 		break;
 	case SMTP_RCPT:
+		if (smtp_session->pipelined) {
+			if (smtp_session->cur_to)
+				smtp_session->cur_to = smtp_session->cur_to->next;
+			if (smtp_session->cur_to)
+				return session_recv_msg(session);
+			if (smtp_session->chunking) {
+				ret = smtp_bdat(smtp_session);
+			} else {
+				/* the reply to DATA */
+				smtp_session->state = SMTP_DATA;
+				return session_recv_msg(session);
+			}
+			break;
+		}
 		if (smtp_session->cur_to)
 			ret = smtp_rcpt(smtp_session);
+		else if (smtp_session->chunking)
+			ret = smtp_bdat(smtp_session);
 		else
 			ret = smtp_data(smtp_session);
 		break;
@@ -720,5 +844,12 @@ static gint smtp_session_recv_msg(Session *session, const gchar *msg)
 
 static gint smtp_session_send_data_finished(Session *session, guint len)
 {
-	return smtp_eom(SMTP_SESSION(session));
+	SMTPSession *smtp_session = SMTP_SESSION(session);
+
+	/* BDAT LAST needs no terminator, just read the reply */
+	if (smtp_session->chunking) {
+		smtp_session->state = SMTP_EOM;
+		return session_recv_msg(session);
+	}
+	return smtp_eom(smtp_session);
 }
@@ -46,7 +46,9 @@ typedef enum
 {
 	ESMTP_8BITMIME	= 1 << 0,
 	ESMTP_SIZE	= 1 << 1,
-	ESMTP_ETRN	= 1 << 2
+	ESMTP_ETRN	= 1 << 2,
+	ESMTP_PIPELINING = 1 << 3,
+	ESMTP_CHUNKING	= 1 << 4
 } ESMTPFlag;
 
 typedef enum
@@ -113,6 +115,12 @@ struct _SMTPSession
 	gchar *error_msg;
 	gboolean is_esmtp;
 	ESMTPFlag esmtp_flags;
+
+	/* MAIL and RCPT sent in one go (RFC 2920), the replies are
+	 * still to be read */
+	gboolean pipelined;
+	/* the body goes with BDAT (RFC 3030), without dot-stuffing */
+	gboolean chunking;
 	
 	void *dialog;
 
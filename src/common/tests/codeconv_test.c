@@ -1,6 +1,7 @@
 #include "config.h"
 
 #include <glib.h>
+#include <string.h>
 
 #include "codeconv.h"
 
@@ -81,6 +82,95 @@ test_filename_to_utf8(gconstpointer user_data)
 	g_test_trap_assert_passed();
 }
 
+struct cs_td {
+	const gchar *charset;
+	const gchar *pre; /* Input string */
+	const gchar *post; /* Expected output, in UTF-8 */
+};
+
+static const struct cs_td codeset_data[] = {
+	{ "ISO-8859-1", "Re: caf\xe9 cr\xe8me", "Re: caf\xc3\xa9 cr\xc3\xa8me" },
+	{ "ISO-8859-2", "\xa3\xf3" "d\xbc", "\xc5\x81\xc3\xb3" "d\xc5\xba" },
+	{ "ISO-8859-15", "10 \xa4", "10 \xe2\x82\xac" },
+	{ "KOI8-R", "\xf0\xd2\xc9\xd7\xc5\xd4",
+	  "\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82" },
+	{ "Shift_JIS", "\x93\xfa\x96\x7b\x8c\xea",
+	  "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e" },
+	{ NULL, NULL, NULL }
+};
+
+/* more pairs than the iconv descriptor cache holds */
+static const gchar *ascii_charsets[] = {
+	"ISO-8859-1", "ISO-8859-2", "ISO-8859-3", "ISO-8859-4",
+	"ISO-8859-5", "ISO-8859-6", "ISO-8859-7", "ISO-8859-8",
+	"ISO-8859-9", "ISO-8859-10", "ISO-8859-13", "ISO-8859-14",
+	"ISO-8859-15", "ISO-8859-16", "KOI8-R", "KOI8-U",
+	"WINDOWS-1250", "WINDOWS-1251", "WINDOWS-1252", "CP866",
+	NULL
+};
+
+static void
+test_codeset_strdup(void)
+{
+	gchar *out;
+	gint round, i;
+
+	/* the second round uses cached descriptors, which must have been
+	 * reset by the first one */
+	for (round = 0; round < 2; round++) {
+		for (i = 0; codeset_data[i].charset != NULL; i++) {
+			out = conv_codeset_strdup(codeset_data[i].pre,
+					codeset_data[i].charset, CS_UTF_8);
+			g_assert_cmpstr(out, ==, codeset_data[i].post);
+			g_free(out);
+		}
+	}
+
+	for (round = 0; round < 2; round++) {
+		for (i = 0; ascii_charsets[i] != NULL; i++) {
+			out = conv_codeset_strdup("Subject",
+					ascii_charsets[i], CS_UTF_8);
+			g_assert_cmpstr(out, ==, "Subject");
+			g_free(out);
+		}
+	}
+
+	/* unknown charsets keep failing once remembered */
+	for (round = 0; round < 2; round++) {
+		out = conv_codeset_strdup("abc", "X-NO-SUCH-CHARSET", CS_UTF_8);
+		g_assert_null(out);
+	}
+}
+
+static void
+test_codeset_strdup_bench(void)
+{
+	GTimer *timer;
+	guint conversions = 0;
+	gsize bytes = 0;
+	gdouble elapsed;
+	gint i;
+
+	timer = g_timer_new();
+
+	do {
+		for (i = 0; codeset_data[i].charset != NULL; i++) {
+			g_free(conv_codeset_strdup(codeset_data[i].pre,
+					codeset_data[i].charset, CS_UTF_8));
+			bytes += strlen(codeset_data[i].pre);
+			conversions++;
+		}
+	} while ((elapsed = g_timer_elapsed(timer, NULL)) < 2.0);
+
+	g_test_message("%u conversions, %" G_GSIZE_FORMAT " bytes in %.2fs",
+		       conversions, bytes, elapsed);
+	g_test_maximized_result(conversions / elapsed,
+				"%.0f conversions/second",
+				conversions / elapsed);
+
+	g_timer_destroy(timer);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -98,6 +188,12 @@ main(int argc, char *argv[])
 			&to_utf8_empty,
 			test_filename_to_utf8);
 
+	g_test_add_func("/common/codeconv/codeset_strdup",
+			test_codeset_strdup);
+	if (g_test_perf())
+		g_test_add_func("/common/codeconv/codeset_strdup/bench",
+				test_codeset_strdup_bench);
+
 	/* TODO: more tests */
 
 	return g_test_run();
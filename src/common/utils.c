@@ -461,6 +461,28 @@ gint subject_compare_for_sort(const gchar *s1, const gchar *s2)
 	return g_utf8_collate(str1, str2);
 }
 
+/* Returns a key ordering subjects like subject_compare_for_sort() does
+ * when compared with strcmp(), or NULL if the subject isn't valid UTF-8 */
+gchar *subject_collate_key_for_sort(const gchar *s)
+{
+	gchar *str, *key;
+
+	if (!s) return NULL;
+
+	str = g_strdup(s);
+	trim_subject_for_sort(str);
+
+	if (!g_utf8_validate(str, -1, NULL)) {
+		g_warning("message subject \"%s\" failed UTF-8 validation", str);
+		g_free(str);
+		return NULL;
+	}
+
+	key = g_utf8_collate_key(str, -1);
+	g_free(str);
+	return key;
+}
+
 void trim_subject(gchar *str)
 {
 	register gchar *srcp;
@@ -320,6 +320,7 @@ gint subject_compare			(const gchar	*s1,
 					 const gchar	*s2);
 gint subject_compare_for_sort		(const gchar	*s1,
 					 const gchar	*s2);
+gchar *subject_collate_key_for_sort	(const gchar	*s);
 void trim_subject			(gchar		*str);
 void eliminate_parenthesis		(gchar		*str,
 					 gchar		 op,
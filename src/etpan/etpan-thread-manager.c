@@ -464,6 +464,29 @@ etpan_thread_manager_get_thread(struct etpan_thread_manager * manager)
   return NULL;
 }
 
+/* A thread of its own, never handed out by etpan_thread_manager_get_thread(),
+   for ops that may block for a long time. */
+struct etpan_thread *
+etpan_thread_manager_get_private_thread(struct etpan_thread_manager * manager)
+{
+  struct etpan_thread * thread;
+  
+  thread = etpan_thread_manager_create_thread(manager);
+  if (thread == NULL)
+    return NULL;
+  
+  thread->bound_count ++;
+  
+  return thread;
+}
+
+/* the ops already scheduled still run before the thread exits */
+void etpan_thread_manager_release_thread(struct etpan_thread_manager * manager,
+    struct etpan_thread * thread)
+{
+  etpan_thread_manager_terminate_thread(manager, thread);
+}
+
 static unsigned int etpan_thread_get_load(struct etpan_thread * thread)
 {
   unsigned int load;
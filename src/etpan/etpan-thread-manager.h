@@ -39,6 +39,12 @@ etpan_thread_manager_get_thread(struct etpan_thread_manager * manager);
 
 void etpan_thread_unbind(struct etpan_thread * thread);
 
+struct etpan_thread *
+etpan_thread_manager_get_private_thread(struct etpan_thread_manager * manager);
+
+void etpan_thread_manager_release_thread(struct etpan_thread_manager * manager,
+    struct etpan_thread * thread);
+
 /* ** op schedule ** */
 
 int etpan_thread_op_schedule(struct etpan_thread * thread,
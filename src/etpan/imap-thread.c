@@ -55,9 +55,14 @@ static struct etpan_thread_manager * thread_manager = NULL;
 static chash * courier_workaround_hash = NULL;
 static chash * imap_hash = NULL;
 static chash * session_hash = NULL;
+static chash * idle_hash = NULL;
+static chash * side_login_hash = NULL;
+static chash * pool_hash = NULL;
 static guint thread_manager_signal = 0;
 static GIOChannel * io_channel = NULL;
 
+static void side_login_free_all(void);
+
 static int do_mailimap_socket_connect(mailimap * imap, const char * server,
 			       gushort port, ProxyInfo * proxy_info)
 {
@@ -339,6 +344,9 @@ void imap_main_init(gboolean skip_ssl_cert_check)
 	
 	imap_hash = chash_new(CHASH_COPYKEY, CHASH_DEFAULTSIZE);
 	session_hash = chash_new(CHASH_COPYKEY, CHASH_DEFAULTSIZE);
+	idle_hash = chash_new(CHASH_COPYKEY, CHASH_DEFAULTSIZE);
+	side_login_hash = chash_new(CHASH_COPYKEY, CHASH_DEFAULTSIZE);
+	pool_hash = chash_new(CHASH_COPYKEY, CHASH_DEFAULTSIZE);
 	courier_workaround_hash = chash_new(CHASH_COPYKEY, CHASH_DEFAULTSIZE);
 	
 	thread_manager = etpan_thread_manager_new();
@@ -377,6 +385,10 @@ void imap_main_done(gboolean have_connectivity)
 	etpan_thread_manager_free(thread_manager);
 	
 	chash_free(courier_workaround_hash);
+	chash_free(pool_hash);
+	side_login_free_all();
+	chash_free(side_login_hash);
+	chash_free(idle_hash);
 	chash_free(session_hash);
 	chash_free(imap_hash);
 }
@@ -404,6 +416,8 @@ void imap_done(Folder * folder)
 	chashdatum value;
 	int r;
 	
+	imap_threaded_clear_side_login(folder);
+
 	key.data = &folder;
 	key.len = sizeof(folder);
 	
@@ -760,9 +774,200 @@ int imap_threaded_capability(Folder *folder, struct mailimap_capability_data **
 		*caps = result.caps;
 
 	return result.error;
-	
+
 }
-	
+
+struct enable_param {
+	mailimap * imap;
+	const char * capability;
+};
+
+struct enable_result {
+	int error;
+};
+
+static void enable_run(struct etpan_thread_op * op)
+{
+	int r;
+	struct enable_param * param;
+	struct enable_result * result;
+	struct mailimap_capability_data * caps;
+	struct mailimap_capability_data * enabled = NULL;
+	struct mailimap_capability * cap;
+	clist * cap_list;
+
+	param = op->param;
+	result = op->result;
+
+	CHECK_IMAP();
+
+	cap_list = clist_new();
+	cap = mailimap_capability_new(MAILIMAP_CAPABILITY_NAME, NULL,
+				      strdup(param->capability));
+	clist_append(cap_list, cap);
+	caps = mailimap_capability_data_new(cap_list);
+
+	r = mailimap_enable(param->imap, caps, &enabled);
+	mailimap_capability_data_free(caps);
+	if (enabled != NULL)
+		mailimap_capability_data_free(enabled);
+
+	result->error = r;
+	debug_print("imap enable run - end %i\n", r);
+}
+
+int imap_threaded_enable(Folder *folder, const char *capability)
+{
+	struct enable_param param;
+	struct enable_result result;
+
+	debug_print("imap enable %s - begin\n", capability);
+
+	param.imap = get_imap(folder);
+	param.capability = capability;
+
+	threaded_run(folder, &param, &result, enable_run);
+
+	debug_print("imap enable - end %d\n", result.error);
+
+	return result.error;
+}
+
+/* COMPRESS=DEFLATE (RFC 4978). To report how well it does, the stream
+ * is counted below and above the compression layer: each counter takes
+ * a copy of the driver of the stream it watches with read and write
+ * diverted, so it works whatever the stream is (socket, TLS). */
+
+struct imap_byte_counter {
+	mailstream_low_driver driver;
+	mailstream_low_driver * orig;
+	uint64_t read;
+	uint64_t written;
+	struct imap_byte_counter * wire;	/* set on the uncompressed side */
+	char * server;
+};
+
+static ssize_t counter_read(mailstream_low * s, void * buf, size_t count)
+{
+	struct imap_byte_counter * counter = (struct imap_byte_counter *) s->driver;
+	ssize_t r;
+
+	r = counter->orig->mailstream_read(s, buf, count);
+	if (r > 0)
+		counter->read += r;
+
+	return r;
+}
+
+static ssize_t counter_write(mailstream_low * s, const void * buf, size_t count)
+{
+	struct imap_byte_counter * counter = (struct imap_byte_counter *) s->driver;
+	ssize_t r;
+
+	r = counter->orig->mailstream_write(s, buf, count);
+	if (r > 0)
+		counter->written += r;
+
+	return r;
+}
+
+static void counter_free(mailstream_low * s)
+{
+	struct imap_byte_counter * counter = (struct imap_byte_counter *) s->driver;
+	struct imap_byte_counter * wire = counter->wire;
+
+	/* the wire counter is freed along with the compression layer,
+	 * so it's reported before */
+	if (wire != NULL && wire->read + wire->written > 0) {
+		log_print(LOG_PROTOCOL, "IMAP* %s: %"G_GUINT64_FORMAT" KiB received, "
+			  "%"G_GUINT64_FORMAT" KiB sent, %"G_GUINT64_FORMAT" KiB "
+			  "on the wire (compression ratio %.1f)\n",
+			  counter->server ? counter->server : "",
+			  counter->read / 1024, counter->written / 1024,
+			  (wire->read + wire->written) / 1024,
+			  (double) (counter->read + counter->written) /
+			  (double) (wire->read + wire->written));
+	}
+
+	s->driver = counter->orig;
+	free(counter->server);
+	free(counter);
+	s->driver->mailstream_free(s);
+}
+
+static struct imap_byte_counter * counter_attach(mailstream_low * s)
+{
+	struct imap_byte_counter * counter;
+
+	counter = calloc(1, sizeof(* counter));
+	if (counter == NULL)
+		return NULL;
+
+	counter->driver = * s->driver;
+	counter->driver.mailstream_read = counter_read;
+	counter->driver.mailstream_write = counter_write;
+	counter->driver.mailstream_free = counter_free;
+	counter->orig = s->driver;
+	s->driver = &counter->driver;
+
+	return counter;
+}
+
+struct compress_param {
+	mailimap * imap;
+	const char * server;
+};
+
+struct compress_result {
+	int error;
+};
+
+static void compress_run(struct etpan_thread_op * op)
+{
+	int r;
+	struct compress_param * param;
+	struct compress_result * result;
+	struct imap_byte_counter * wire;
+	struct imap_byte_counter * plain;
+
+	param = op->param;
+	result = op->result;
+
+	CHECK_IMAP();
+
+	wire = counter_attach(mailstream_get_low(param->imap->imap_stream));
+
+	r = mailimap_compress(param->imap);
+
+	if (r == MAILIMAP_NO_ERROR && wire != NULL) {
+		plain = counter_attach(mailstream_get_low(param->imap->imap_stream));
+		if (plain != NULL) {
+			plain->wire = wire;
+			plain->server = param->server ? strdup(param->server) : NULL;
+		}
+	}
+
+	result->error = r;
+	debug_print("imap compress run - end %i\n", r);
+}
+
+int imap_threaded_compress(Folder * folder)
+{
+	struct compress_param param;
+	struct compress_result result;
+
+	debug_print("imap compress - begin\n");
+
+	param.imap = get_imap(folder);
+	param.server = folder->account ? folder->account->recv_server : NULL;
+
+	threaded_run(folder, &param, &result, compress_run);
+
+	debug_print("imap compress - end %d\n", result.error);
+
+	return result.error;
+}
+
 struct disconnect_param {
 	mailimap * imap;
 };
@@ -1108,6 +1313,10 @@ int imap_threaded_status(Folder * folder, const char * mb,
 		mailimap_status_att_list_add(status_att_list,
 				     MAILIMAP_STATUS_ATT_UNSEEN);
 	}
+	if (mask & 1 << 5) {
+		mailimap_status_att_list_add(status_att_list,
+				     MAILIMAP_STATUS_ATT_HIGHESTMODSEQ);
+	}
 	param.imap = get_imap(folder);
 	param.mb = mb;
 	param.status_att_list = status_att_list;
@@ -1123,6 +1332,298 @@ int imap_threaded_status(Folder * folder, const char * mb,
 	return result.error;
 }
 
+/* LIST-STATUS (RFC 5819) gives the status of all the mailboxes at once.
+ * libetpan can't send it and only keeps the last STATUS response it
+ * parses, so the command is written and its response read on the
+ * stream here. */
+
+#define LIST_STATUS_TAG "LS"
+
+static const char * list_status_atts[] = {
+	"MESSAGES", "RECENT", "UIDNEXT", "UIDVALIDITY", "UNSEEN", "HIGHESTMODSEQ"
+};
+
+struct list_status_param {
+	mailimap * imap;
+	guint mask;
+	gboolean subs_only;
+	const char * base;
+	char delimiter;
+};
+
+struct list_status_result {
+	int error;
+	GHashTable * statuses;
+	gboolean unsolicited;
+};
+
+/* Reads a response line; the literals in it are read along and
+ * turned into quoted strings */
+static gboolean list_status_read_line(mailstream * stream, MMAPString * buf,
+				      GString * line)
+{
+	g_string_truncate(line, 0);
+
+	for (;;) {
+		char * str;
+		char * brace;
+		char * end;
+		size_t len;
+		guint64 size;
+
+		str = mailstream_read_line_remove_eol(stream, buf);
+		if (str == NULL)
+			return FALSE;
+
+		len = strlen(str);
+		brace = strrchr(str, '{');
+		if (len == 0 || str[len - 1] != '}' || brace == NULL) {
+			g_string_append(line, str);
+			return TRUE;
+		}
+		size = g_ascii_strtoull(brace + 1, &end, 10);
+		if (end == brace + 1 || (*end != '}' && *end != '+')) {
+			g_string_append(line, str);
+			return TRUE;
+		}
+
+		g_string_append_len(line, str, brace - str);
+		g_string_append_c(line, '"');
+		while (size > 0) {
+			char chunk[1024];
+			ssize_t r, i;
+
+			r = mailstream_read(stream, chunk, MIN(size, sizeof(chunk)));
+			if (r <= 0)
+				return FALSE;
+			for (i = 0; i < r; i++) {
+				if (chunk[i] == '"' || chunk[i] == '\\')
+					g_string_append_c(line, '\\');
+				g_string_append_c(line, chunk[i]);
+			}
+			size -= r;
+		}
+		g_string_append_c(line, '"');
+	}
+}
+
+static gchar * list_status_parse_mailbox(const gchar ** p)
+{
+	const gchar * s = * p;
+	GString * mb;
+
+	if (* s == '"') {
+		mb = g_string_new(NULL);
+		for (s++; * s != '\0' && * s != '"'; s++) {
+			if (* s == '\\' && s[1] != '\0')
+				s++;
+			g_string_append_c(mb, * s);
+		}
+		if (* s != '"') {
+			g_string_free(mb, TRUE);
+			return NULL;
+		}
+		* p = s + 1;
+	} else {
+		while (* s != '\0' && * s != ' ' && * s != '(')
+			s++;
+		if (s == * p)
+			return NULL;
+		mb = g_string_new_len(* p, s - * p);
+		* p = s;
+	}
+
+	/* INBOX is case-insensitive */
+	if (!g_ascii_strcasecmp(mb->str, "INBOX"))
+		g_string_assign(mb, "INBOX");
+
+	return g_string_free(mb, FALSE);
+}
+
+static void list_status_append_quoted(GString * cmd, const gchar * str)
+{
+	g_string_append_c(cmd, '"');
+	for (; * str != '\0'; str++) {
+		if (* str == '"' || * str == '\\')
+			g_string_append_c(cmd, '\\');
+		g_string_append_c(cmd, * str);
+	}
+	g_string_append_c(cmd, '"');
+}
+
+/* "* STATUS <mailbox> (<att> <value> ...)" */
+static void list_status_parse(const gchar * line, GHashTable * statuses)
+{
+	IMAPMailboxStatus * status;
+	const gchar * p;
+	gchar * mb;
+
+	p = line + strlen("* STATUS ");
+	mb = list_status_parse_mailbox(&p);
+	if (mb == NULL)
+		return;
+	while (* p == ' ')
+		p++;
+	if (* p != '(') {
+		g_free(mb);
+		return;
+	}
+	p++;
+
+	status = g_new0(IMAPMailboxStatus, 1);
+	while (* p != '\0' && * p != ')') {
+		const gchar * att = p;
+		gchar * end;
+		guint64 value;
+		guint i;
+
+		while (* p != '\0' && * p != ' ' && * p != ')')
+			p++;
+		for (i = 0; i < G_N_ELEMENTS(list_status_atts); i++) {
+			if (strlen(list_status_atts[i]) == (size_t) (p - att) &&
+			    !g_ascii_strncasecmp(att, list_status_atts[i], p - att))
+				break;
+		}
+		while (* p == ' ')
+			p++;
+		value = g_ascii_strtoull(p, &end, 10);
+		if (end == p)
+			break;
+		p = end;
+		while (* p == ' ')
+			p++;
+
+		switch (i) {
+		case 0: status->messages = value; break;
+		case 1: status->recent = value; break;
+		case 2: status->uid_next = value; break;
+		case 3: status->uid_validity = value; break;
+		case 4: status->unseen = value; break;
+		case 5: status->highest_modseq = value; break;
+		default: continue;
+		}
+		status->mask |= 1 << i;
+	}
+
+	g_hash_table_replace(statuses, mb, status);
+}
+
+static void list_status_run(struct etpan_thread_op * op)
+{
+	struct list_status_param * param;
+	struct list_status_result * result;
+	mailstream * stream;
+	MMAPString * buf;
+	GString * cmd;
+	GString * line;
+	const gchar * sep = "";
+	guint i;
+
+	param = op->param;
+	result = op->result;
+
+	CHECK_IMAP();
+
+	stream = param->imap->imap_stream;
+	if (stream == NULL) {
+		result->error = MAILIMAP_ERROR_BAD_STATE;
+		return;
+	}
+
+	cmd = g_string_new(LIST_STATUS_TAG " LIST ");
+	if (param->subs_only)
+		g_string_append(cmd, "(SUBSCRIBED) ");
+	if (param->base != NULL && * param->base != '\0') {
+		/* only what is under the root folder, and INBOX which
+		 * is always shown (patterns list of RFC 5258) */
+		gchar * pattern;
+
+		pattern = g_strdup_printf("%s%c*", param->base,
+					  param->delimiter);
+		g_string_append(cmd, "\"\" (");
+		list_status_append_quoted(cmd, pattern);
+		g_string_append(cmd, " \"INBOX\")");
+		g_free(pattern);
+	} else {
+		g_string_append(cmd, "\"\" \"*\"");
+	}
+	g_string_append(cmd, " RETURN (STATUS (");
+	for (i = 0; i < G_N_ELEMENTS(list_status_atts); i++) {
+		if (param->mask & 1 << i) {
+			g_string_append_printf(cmd, "%s%s", sep, list_status_atts[i]);
+			sep = " ";
+		}
+	}
+	g_string_append(cmd, "))\r\n");
+
+	if (mailstream_write(stream, cmd->str, cmd->len) != (ssize_t) cmd->len ||
+	    mailstream_flush(stream) < 0) {
+		g_string_free(cmd, TRUE);
+		result->error = MAILIMAP_ERROR_STREAM;
+		return;
+	}
+	g_string_free(cmd, TRUE);
+
+	result->statuses = g_hash_table_new_full(g_str_hash, g_str_equal,
+						 g_free, g_free);
+	result->error = MAILIMAP_ERROR_STREAM;
+
+	buf = mmap_string_new("");
+	line = g_string_new(NULL);
+	while (list_status_read_line(stream, buf, line)) {
+		if (!strncmp(line->str, LIST_STATUS_TAG " ",
+			     strlen(LIST_STATUS_TAG " "))) {
+			if (!g_ascii_strncasecmp(line->str + strlen(LIST_STATUS_TAG " "),
+						 "OK", 2))
+				result->error = MAILIMAP_NO_ERROR;
+			else
+				result->error = MAILIMAP_ERROR_LIST;
+			break;
+		}
+		if (!g_ascii_strncasecmp(line->str, "* STATUS ", 9))
+			list_status_parse(line->str, result->statuses);
+		else if (!g_ascii_strncasecmp(line->str, "* BYE", 5))
+			break;
+		else if (g_ascii_strncasecmp(line->str, "* LIST ", 7))
+			/* EXISTS, EXPUNGE... about the selected mailbox */
+			result->unsolicited = TRUE;
+	}
+	g_string_free(line, TRUE);
+	mmap_string_free(buf);
+
+	debug_print("imap list-status run - end %i\n", result->error);
+}
+
+int imap_threaded_list_status(Folder * folder, guint mask,
+			      gboolean subs_only,
+			      const char * base, char delimiter,
+			      GHashTable ** statuses,
+			      gboolean * unsolicited)
+{
+	struct list_status_param param;
+	struct list_status_result result;
+
+	debug_print("imap list-status - begin\n");
+
+	param.imap = get_imap(folder);
+	param.mask = mask;
+	param.subs_only = subs_only;
+	param.base = base;
+	param.delimiter = delimiter;
+	result.error = MAILIMAP_NO_ERROR;
+	result.statuses = NULL;
+	result.unsolicited = FALSE;
+
+	threaded_run(folder, &param, &result, list_status_run);
+
+	debug_print("imap list-status - end\n");
+
+	* statuses = result.statuses;
+	* unsolicited = result.unsolicited;
+
+	return result.error;
+}
+
 
 
 struct noop_param {
@@ -1150,6 +1651,46 @@ static void noop_run(struct etpan_thread_op * op)
 	debug_print("imap noop run - end %i\n", r);
 }
 
+/* With QRESYNC enabled the server reports expunges with VANISHED rather
+ * than EXPUNGE; counts the UIDs of the last response, as far as an
+ * unsigned int goes */
+static unsigned int imap_vanished_count(mailimap * imap)
+{
+	clistiter * cur;
+	unsigned int count = 0;
+
+	if (imap->imap_response_info == NULL ||
+	    imap->imap_response_info->rsp_extension_list == NULL)
+		return 0;
+
+	for (cur = clist_begin(imap->imap_response_info->rsp_extension_list);
+	     cur != NULL; cur = clist_next(cur)) {
+		struct mailimap_extension_data * ext = clist_content(cur);
+		struct mailimap_qresync_vanished * vanished;
+		clistiter * item_cur;
+
+		if (ext->ext_extension != &mailimap_extension_qresync ||
+		    ext->ext_type != MAILIMAP_QRESYNC_TYPE_VANISHED)
+			continue;
+		vanished = ext->ext_data;
+		if (vanished->qr_known_uids == NULL)
+			continue;
+		for (item_cur = clist_begin(vanished->qr_known_uids->set_list);
+		     item_cur != NULL; item_cur = clist_next(item_cur)) {
+			struct mailimap_set_item * item = clist_content(item_cur);
+			uint32_t first = MIN(item->set_first, item->set_last);
+			uint32_t last = MAX(item->set_first, item->set_last);
+			unsigned int n = last - first;
+
+			n = (n == G_MAXUINT) ? n : n + 1;
+
+			count = (count > G_MAXUINT - n) ? G_MAXUINT : count + n;
+		}
+	}
+
+	return count;
+}
+
 int imap_threaded_noop(Folder * folder, unsigned int * p_exists, 
 		       unsigned int *p_recent, 
 		       unsigned int *p_expunge,
@@ -1188,6 +1729,8 @@ int imap_threaded_noop(Folder * folder, unsigned int * p_exists,
 	} else {
 		* p_expunge = 0;
 	}	
+	if (result.error == 0 && imap)
+		* p_expunge += imap_vanished_count(imap);
 	debug_print("imap noop - end [EXISTS %d RECENT %d EXPUNGE %d UNSEEN %d UIDNEXT %d UIDVAL %d]\n",
 		*p_exists, *p_recent, *p_expunge, *p_unseen,
 		*p_uidnext, *p_uidval);
@@ -1414,10 +1957,12 @@ int imap_threaded_delete(Folder * folder, const char * mb)
 struct select_param {
 	mailimap * imap;
 	const char * mb;
+	gboolean condstore;
 };
 
 struct select_result {
 	int error;
+	uint64_t highestmodseq;
 };
 
 static void select_run(struct etpan_thread_op * op)
@@ -1431,7 +1976,12 @@ static void select_run(struct etpan_thread_op * op)
 
 	CHECK_IMAP();
 
-	r = mailimap_select(param->imap, param->mb);
+	result->highestmodseq = 0;
+	if (param->condstore)
+		r = mailimap_select_condstore(param->imap, param->mb,
+					      &result->highestmodseq);
+	else
+		r = mailimap_select(param->imap, param->mb);
 	
 	result->error = r;
 	debug_print("imap select run - end %i\n", r);
@@ -1440,7 +1990,7 @@ static void select_run(struct etpan_thread_op * op)
 int imap_threaded_select(Folder * folder, const char * mb,
 			 gint * exists, gint * recent, gint * unseen,
 			 guint32 * uid_validity,gint *can_create_flags,
-			 GSList **ok_flags)
+			 GSList **ok_flags, guint64 *highestmodseq)
 {
 	struct select_param param;
 	struct select_result result;
@@ -1451,10 +2001,14 @@ int imap_threaded_select(Folder * folder, const char * mb,
 	imap = get_imap(folder);
 	param.imap = imap;
 	param.mb = mb;
+	param.condstore = (highestmodseq != NULL);
 	
 	if (threaded_run(folder, &param, &result, select_run))
 		return MAILIMAP_ERROR_INVAL;
 
+	if (highestmodseq)
+		* highestmodseq = result.highestmodseq;
+
 	if (result.error != MAILIMAP_NO_ERROR)
 		return result.error;
 	
@@ -2229,9 +2783,132 @@ result_to_uid_flags_list(clist * fetch_result, carray ** result)
 	return res;
 }
 
+/* Keeps the UIDs of a set as ranges: a VANISHED (1:4000000000) is
+ * legal and must not be expanded */
+static gint imap_uid_range_cmp(gconstpointer a, gconstpointer b)
+{
+	const IMAPUidRange * ra = a;
+	const IMAPUidRange * rb = b;
+
+	if (ra->first != rb->first)
+		return ra->first < rb->first ? -1 : 1;
+	return 0;
+}
+
+static void imap_uid_ranges_add_set(GArray * ranges, struct mailimap_set * set)
+{
+	clistiter * cur;
+
+	if (set == NULL || set->set_list == NULL)
+		return;
+
+	for (cur = clist_begin(set->set_list) ; cur != NULL ;
+	     cur = clist_next(cur)) {
+		struct mailimap_set_item * item;
+		IMAPUidRange range;
+
+		item = clist_content(cur);
+		/* 0 stands for "*", the largest UID */
+		range.first = item->set_first ? item->set_first : G_MAXUINT32;
+		range.last = item->set_last ? item->set_last : G_MAXUINT32;
+		if (range.first > range.last) {
+			uint32_t tmp = range.first;
+			range.first = range.last;
+			range.last = tmp;
+		}
+		g_array_append_val(ranges, range);
+	}
+}
+
+/* Sorts the ranges and merges the overlapping ones, for
+ * imap_uid_ranges_contain() */
+static void imap_uid_ranges_normalize(GArray * ranges)
+{
+	guint i, j;
+
+	g_array_sort(ranges, imap_uid_range_cmp);
+	for (i = 0, j = 1; j < ranges->len; j++) {
+		IMAPUidRange * prev = &g_array_index(ranges, IMAPUidRange, i);
+		IMAPUidRange * range = &g_array_index(ranges, IMAPUidRange, j);
+
+		if (range->first <= prev->last ||
+		    (prev->last != G_MAXUINT32 && range->first == prev->last + 1)) {
+			prev->last = MAX(prev->last, range->last);
+		} else {
+			i++;
+			g_array_index(ranges, IMAPUidRange, i) = * range;
+		}
+	}
+	if (ranges->len > 0)
+		g_array_set_size(ranges, i + 1);
+}
+
+gboolean imap_uid_ranges_contain(GArray * ranges, guint32 uid)
+{
+	guint lo = 0, hi;
+
+	if (ranges == NULL)
+		return FALSE;
+
+	hi = ranges->len;
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		IMAPUidRange * range = &g_array_index(ranges, IMAPUidRange, mid);
+
+		if (uid < range->first)
+			hi = mid;
+		else if (uid > range->last)
+			lo = mid + 1;
+		else
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* The highest MODSEQ in a list of FETCH responses; CHANGEDSINCE makes
+ * the server send it with each message */
+static uint64_t imap_fetch_list_max_modseq(clist * fetch_result)
+{
+	clistiter * cur;
+	uint64_t max_modseq = 0;
+
+	if (fetch_result == NULL)
+		return 0;
+
+	for (cur = clist_begin(fetch_result) ; cur != NULL ;
+	     cur = clist_next(cur)) {
+		struct mailimap_msg_att * msg_att = clist_content(cur);
+		clistiter * item_cur;
+
+		if (msg_att->att_list == NULL)
+			continue;
+		for (item_cur = clist_begin(msg_att->att_list) ; item_cur != NULL ;
+		     item_cur = clist_next(item_cur)) {
+			struct mailimap_msg_att_item * item = clist_content(item_cur);
+			struct mailimap_extension_data * ext;
+			struct mailimap_condstore_fetch_mod_resp * mod;
+
+			if (item->att_type != MAILIMAP_MSG_ATT_ITEM_EXTENSION)
+				continue;
+			ext = item->att_data.att_extension_data;
+			if (ext->ext_extension != &mailimap_extension_condstore ||
+			    ext->ext_type != MAILIMAP_CONDSTORE_TYPE_FETCH_DATA)
+				continue;
+			mod = ext->ext_data;
+			if (mod->cs_modseq_value > max_modseq)
+				max_modseq = mod->cs_modseq_value;
+		}
+	}
+
+	return max_modseq;
+}
+
 static int imap_get_messages_flags_list(mailimap * imap,
 					uint32_t first_index,
-					carray ** result)
+					uint64_t modseq,
+					carray ** result,
+					GArray ** vanished,
+					uint64_t * max_modseq)
 {
 	carray * env_list;
 	int r;
@@ -2281,8 +2958,27 @@ static int imap_get_messages_flags_list(mailimap * imap,
 
 	mailstream_logger = imap_logger_fetch;
 	
-	r = mailimap_uid_fetch(imap, set,
-			       fetch_type, &fetch_result);
+	/* With a known mod-sequence only the messages changed since then
+	 * are returned; QRESYNC also reports the UIDs expunged meanwhile. */
+	if (modseq == 0) {
+		r = mailimap_uid_fetch(imap, set,
+				       fetch_type, &fetch_result);
+	} else if (vanished != NULL) {
+		struct mailimap_qresync_vanished * qr_vanished = NULL;
+
+		r = mailimap_uid_fetch_qresync(imap, set, fetch_type, modseq,
+					       &fetch_result, &qr_vanished);
+		if (r == MAILIMAP_NO_ERROR && qr_vanished != NULL) {
+			* vanished = g_array_new(FALSE, FALSE, sizeof(IMAPUidRange));
+			imap_uid_ranges_add_set(* vanished, qr_vanished->qr_known_uids);
+			imap_uid_ranges_normalize(* vanished);
+		}
+		if (qr_vanished != NULL)
+			mailimap_qresync_vanished_free(qr_vanished);
+	} else {
+		r = mailimap_uid_fetch_changedsince(imap, set, fetch_type,
+						    modseq, &fetch_result);
+	}
 
 	mailstream_logger = imap_logger_cmd;
 	mailimap_fetch_type_free(fetch_type);
@@ -2295,6 +2991,7 @@ static int imap_get_messages_flags_list(mailimap * imap,
 
 	env_list = NULL;
 	r = result_to_uid_flags_list(fetch_result, &env_list);
+	* max_modseq = imap_fetch_list_max_modseq(fetch_result);
 	mailimap_fetch_list_free(fetch_result);
 	
 	* result = env_list;
@@ -2311,11 +3008,27 @@ static int imap_get_messages_flags_list(mailimap * imap,
 
 
 
+struct fetch_uid_flags_param {
+	mailimap * imap;
+	uint32_t first_index;
+	uint64_t modseq;
+	gboolean qresync;
+};
+
+struct fetch_uid_flags_result {
+	int error;
+	carray * fetch_result;
+	GArray * vanished;
+	uint64_t max_modseq;
+};
+
 static void fetch_uid_flags_run(struct etpan_thread_op * op)
 {
-	struct fetch_uid_param * param;
-	struct fetch_uid_result * result;
+	struct fetch_uid_flags_param * param;
+	struct fetch_uid_flags_result * result;
 	carray * fetch_result;
+	GArray * vanished;
+	uint64_t max_modseq;
 	int r;
 	
 	param = op->param;
@@ -2324,29 +3037,53 @@ static void fetch_uid_flags_run(struct etpan_thread_op * op)
 	CHECK_IMAP();
 
 	fetch_result = NULL;
+	vanished = NULL;
+	max_modseq = 0;
 	r = imap_get_messages_flags_list(param->imap, param->first_index,
-					 &fetch_result);
+					 param->modseq, &fetch_result,
+					 param->qresync ? &vanished : NULL,
+					 &max_modseq);
 	
 	result->error = r;
 	result->fetch_result = fetch_result;
+	result->vanished = vanished;
+	result->max_modseq = max_modseq;
 	debug_print("imap fetch_uid run - end %i\n", r);
 }
 
 int imap_threaded_fetch_uid_flags(Folder * folder, uint32_t first_index,
 				  carray ** fetch_result)
 {
-	struct fetch_uid_param param;
-	struct fetch_uid_result result;
-	mailimap * imap;
-	
+	return imap_threaded_fetch_uid_flags_changedsince(folder, first_index,
+							  0, fetch_result, NULL,
+							  NULL);
+}
+
+int imap_threaded_fetch_uid_flags_changedsince(Folder * folder,
+					       uint32_t first_index,
+					       guint64 modseq,
+					       carray ** fetch_result,
+					       GArray ** vanished,
+					       guint64 * max_modseq)
+{
+	struct fetch_uid_flags_param param;
+	struct fetch_uid_flags_result result;
+	mailimap * imap;
+	
 	debug_print("imap fetch_uid - begin\n");
 	
 	imap = get_imap(folder);
 	param.imap = imap;
 	param.first_index = first_index;
+	param.modseq = modseq;
+	param.qresync = (modseq != 0 && vanished != NULL);
 	
 	mailstream_logger = imap_logger_noop;
-	log_print(LOG_PROTOCOL, "IMAP- [fetching flags...]\n");
+	if (modseq != 0)
+		log_print(LOG_PROTOCOL, "IMAP- [fetching flags changed since %"
+			  G_GUINT64_FORMAT "...]\n", modseq);
+	else
+		log_print(LOG_PROTOCOL, "IMAP- [fetching flags...]\n");
 
 	threaded_run(folder, &param, &result, fetch_uid_flags_run);
 
@@ -2359,6 +3096,10 @@ int imap_threaded_fetch_uid_flags(Folder * folder, uint32_t first_index,
 	debug_print("imap fetch_uid - end\n");
 	
 	* fetch_result = result.fetch_result;
+	if (vanished)
+		* vanished = result.vanished;
+	if (max_modseq)
+		* max_modseq = result.max_modseq;
 	
 	return result.error;
 }
@@ -2607,6 +3348,39 @@ struct fetch_content_result {
 	int error;
 };
 
+/* Writes a fetched message to its cache file */
+static int fetch_content_write(const char * filename,
+			       const char * content, size_t content_size)
+{
+	int fd;
+	FILE * f;
+
+	fd = g_open(filename, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return MAILIMAP_ERROR_FETCH;
+
+	f = claws_fdopen(fd, "wb");
+	if (f == NULL) {
+		close(fd);
+		goto unlink;
+	}
+
+	if (claws_fwrite(content, 1, content_size, f) < content_size) {
+		claws_fclose(f);
+		goto unlink;
+	}
+
+	if (claws_safe_fclose(f) == EOF)
+		goto unlink;
+
+	return MAILIMAP_NO_ERROR;
+
+unlink:
+	if (claws_unlink(filename) < 0)
+		FILE_OP_ERROR(filename, "claws_unlink");
+	return MAILIMAP_ERROR_FETCH;
+}
+
 static void fetch_content_run(struct etpan_thread_op * op)
 {
 	struct fetch_content_param * param;
@@ -2614,8 +3388,6 @@ static void fetch_content_run(struct etpan_thread_op * op)
 	char * content;
 	size_t content_size;
 	int r;
-	int fd;
-	FILE * f;
 	
 	param = op->param;
 	result = op->result;
@@ -2634,41 +3406,9 @@ static void fetch_content_run(struct etpan_thread_op * op)
 	result->error = r;
 	
 	if (r == MAILIMAP_NO_ERROR) {
-		fd = g_open(param->filename, O_RDWR | O_CREAT, 0600);
-		if (fd < 0) {
-			result->error = MAILIMAP_ERROR_FETCH;
-			goto free;
-		}
-		
-		f = claws_fdopen(fd, "wb");
-		if (f == NULL) {
-			result->error = MAILIMAP_ERROR_FETCH;
-			goto close;
-		}
-		
-		r = claws_fwrite(content, 1, content_size, f);
-		if (r < content_size) {
-			result->error = MAILIMAP_ERROR_FETCH;
-			goto do_fclose;
-		}
-		
-		r = claws_safe_fclose(f);
-		if (r == EOF) {
-			result->error = MAILIMAP_ERROR_FETCH;
-			goto unlink;
-		}
-		goto free;
-		
-	do_fclose:
-		claws_fclose(f);
-		goto unlink;
-	close:
-		close(fd);
-	unlink:
-		if (claws_unlink(param->filename) < 0)
-                        FILE_OP_ERROR(param->filename, "claws_unlink");
-	
-	free:
+		result->error = fetch_content_write(param->filename,
+						    content, content_size);
+
 		/* mmap_string_unref is a simple free in libetpan
 		 * when it has MMAP_UNAVAILABLE defined */
 		if (mmap_string_unref(content) != 0)
@@ -2705,6 +3445,140 @@ int imap_threaded_fetch_content(Folder * folder, uint32_t msg_index,
 }
 
 
+struct fetch_content_batch_param {
+	mailimap * imap;
+	struct mailimap_set * set;
+	GHashTable * filenames;
+};
+
+struct fetch_content_batch_result {
+	int error;
+	GSList * fetched;
+};
+
+struct fetch_content_batch_ctx {
+	GHashTable * filenames;
+	GSList * fetched;
+};
+
+/* Called by libetpan as each FETCH response is parsed: the message
+ * goes to its file at once and its body is dropped, so that a batch
+ * never holds more than one message in memory */
+static void fetch_content_batch_msg_att(struct mailimap_msg_att * msg_att,
+					void * context)
+{
+	struct fetch_content_batch_ctx * ctx = context;
+	struct mailimap_msg_att_body_section * body = NULL;
+	uint32_t uid = 0;
+	const char * filename;
+	clistiter * cur;
+
+	if (msg_att->att_list == NULL)
+		return;
+
+	for (cur = clist_begin(msg_att->att_list); cur != NULL;
+	     cur = clist_next(cur)) {
+		struct mailimap_msg_att_item * item = clist_content(cur);
+
+		if (item->att_type != MAILIMAP_MSG_ATT_ITEM_STATIC)
+			continue;
+		switch (item->att_data.att_static->att_type) {
+		case MAILIMAP_MSG_ATT_UID:
+			uid = item->att_data.att_static->att_data.att_uid;
+			break;
+		case MAILIMAP_MSG_ATT_BODY_SECTION:
+			body = item->att_data.att_static->att_data.att_body_section;
+			break;
+		}
+	}
+
+	if (uid == 0 || body == NULL || body->sec_body_part == NULL)
+		return;
+
+	filename = g_hash_table_lookup(ctx->filenames, GUINT_TO_POINTER(uid));
+	if (filename != NULL &&
+	    fetch_content_write(filename, body->sec_body_part,
+				body->sec_length) == MAILIMAP_NO_ERROR)
+		ctx->fetched = g_slist_prepend(ctx->fetched,
+					       GUINT_TO_POINTER(uid));
+
+	if (mmap_string_unref(body->sec_body_part) != 0)
+		free(body->sec_body_part);
+	body->sec_body_part = NULL;
+}
+
+static void fetch_content_batch_run(struct etpan_thread_op * op)
+{
+	struct fetch_content_batch_param * param;
+	struct fetch_content_batch_result * result;
+	struct fetch_content_batch_ctx ctx;
+	struct mailimap_fetch_type * fetch_type;
+	struct mailimap_fetch_att * fetch_att;
+	struct mailimap_section * section;
+	clist * fetch_result = NULL;
+	int r;
+
+	param = op->param;
+	result = op->result;
+
+	CHECK_IMAP();
+
+	fetch_type = mailimap_fetch_type_new_fetch_att_list_empty();
+	mailimap_fetch_type_new_fetch_att_list_add(fetch_type,
+						   mailimap_fetch_att_new_uid());
+	section = mailimap_section_new(NULL);
+	fetch_att = mailimap_fetch_att_new_body_peek_section(section);
+	mailimap_fetch_type_new_fetch_att_list_add(fetch_type, fetch_att);
+
+	ctx.filenames = param->filenames;
+	ctx.fetched = NULL;
+	mailimap_set_msg_att_handler(param->imap,
+				     fetch_content_batch_msg_att, &ctx);
+	mailstream_logger = imap_logger_fetch;
+
+	r = mailimap_uid_fetch(param->imap, param->set, fetch_type,
+			       &fetch_result);
+
+	mailstream_logger = imap_logger_cmd;
+	mailimap_set_msg_att_handler(param->imap, NULL, NULL);
+	mailimap_fetch_type_free(fetch_type);
+
+	if (r == MAILIMAP_NO_ERROR && fetch_result != NULL)
+		mailimap_fetch_list_free(fetch_result);
+
+	result->error = r;
+	result->fetched = ctx.fetched;
+
+	debug_print("imap fetch_content_batch run - end %i\n", result->error);
+}
+
+int imap_threaded_fetch_content_batch(Folder * folder,
+				      struct mailimap_set * set,
+				      GHashTable * filenames,
+				      GSList ** fetched)
+{
+	struct fetch_content_batch_param param;
+	struct fetch_content_batch_result result;
+
+	debug_print("imap fetch_content_batch - begin\n");
+
+	param.imap = get_imap(folder);
+	param.set = set;
+	param.filenames = filenames;
+	result.error = MAILIMAP_NO_ERROR;
+	result.fetched = NULL;
+
+	threaded_run(folder, &param, &result, fetch_content_batch_run);
+
+	debug_print("imap fetch_content_batch - end\n");
+
+	/* even on error, what was written before it is usable */
+	* fetched = result.fetched;
+
+	return result.error;
+}
+
+
 
 static int imap_flags_to_flags(struct mailimap_msg_att_dynamic * att_dyn, GSList **s_tags)
 {
@@ -3560,6 +4434,739 @@ int imap_threaded_connect_cmd(Folder * folder, const char * command,
 }
 #endif /* G_OS_WIN32 */
 
+/* Side connections: further connections of an account, each on a thread
+ * of its own, logged in with what the main session used. They serve the
+ * IDLE watcher and the pool used to fetch messages while the main
+ * connection is busy. */
+
+struct imap_side_login {
+	gchar * server;
+	int port;
+	SSLType ssl_type;
+	ProxyInfo * proxy_info;
+	gchar * login;
+	gchar * password;
+	gchar * type;
+};
+
+struct imap_side {
+	Folder * folder;
+	struct etpan_thread * thread;
+	mailimap * imap;
+	struct imap_side_login login;
+	gchar * mailbox;
+	gboolean read_only;
+	int error;
+};
+
+static void * folder_hash_get(chash * hash, Folder * folder)
+{
+	chashdatum key;
+	chashdatum value;
+
+	key.data = &folder;
+	key.len = sizeof(folder);
+
+	if (hash == NULL || chash_get(hash, &key, &value) < 0)
+		return NULL;
+
+	return value.data;
+}
+
+static void folder_hash_set(chash * hash, Folder * folder, void * data)
+{
+	chashdatum key;
+	chashdatum value;
+
+	key.data = &folder;
+	key.len = sizeof(folder);
+	value.data = data;
+	value.len = 0;
+
+	chash_set(hash, &key, &value, NULL);
+}
+
+static void folder_hash_delete(chash * hash, Folder * folder)
+{
+	chashdatum key;
+
+	key.data = &folder;
+	key.len = sizeof(folder);
+
+	chash_delete(hash, &key, NULL);
+}
+
+static void side_login_clear(struct imap_side_login * login)
+{
+	g_free(login->server);
+	g_free(login->login);
+	if (login->password != NULL) {
+		memset(login->password, 0, strlen(login->password));
+		g_free(login->password);
+	}
+	g_free(login->type);
+	memset(login, 0, sizeof(* login));
+}
+
+static void side_login_copy(struct imap_side_login * dest,
+			    const struct imap_side_login * src)
+{
+	side_login_clear(dest);
+	dest->server = g_strdup(src->server);
+	dest->port = src->port;
+	dest->ssl_type = src->ssl_type;
+	dest->proxy_info = src->proxy_info;
+	dest->login = g_strdup(src->login);
+	dest->password = g_strdup(src->password);
+	dest->type = g_strdup(src->type);
+}
+
+void imap_threaded_set_side_login(Folder * folder,
+				  const char * server, int port,
+				  SSLType ssl_type, ProxyInfo * proxy_info,
+				  const char * login, const char * password,
+				  const char * type)
+{
+	struct imap_side_login * side_login;
+
+	side_login = folder_hash_get(side_login_hash, folder);
+	if (side_login == NULL) {
+		side_login = g_new0(struct imap_side_login, 1);
+		folder_hash_set(side_login_hash, folder, side_login);
+	}
+	side_login_clear(side_login);
+	side_login->server = g_strdup(server);
+	side_login->port = port;
+	side_login->ssl_type = ssl_type;
+	side_login->proxy_info = proxy_info;
+	side_login->login = g_strdup(login);
+	side_login->password = g_strdup(password);
+	side_login->type = g_strdup(type);
+}
+
+/* forgets how the folder logged in; running side connections keep
+ * their own copy */
+void imap_threaded_clear_side_login(Folder * folder)
+{
+	struct imap_side_login * side_login;
+
+	side_login = folder_hash_get(side_login_hash, folder);
+	if (side_login == NULL)
+		return;
+
+	folder_hash_delete(side_login_hash, folder);
+	side_login_clear(side_login);
+	g_free(side_login);
+}
+
+static void side_login_free_all(void)
+{
+	chashiter * iter;
+	chashdatum value;
+
+	for (iter = chash_begin(side_login_hash); iter != NULL;
+	     iter = chash_next(side_login_hash, iter)) {
+		chash_value(iter, &value);
+		side_login_clear(value.data);
+		g_free(value.data);
+	}
+}
+
+static gboolean side_init(struct imap_side * side, Folder * folder)
+{
+	struct imap_side_login * side_login;
+
+	side_login = folder_hash_get(side_login_hash, folder);
+	if (side_login == NULL)
+		return FALSE;
+
+	side->thread = etpan_thread_manager_get_private_thread(thread_manager);
+	if (side->thread == NULL)
+		return FALSE;
+
+	side->folder = folder;
+	side_login_copy(&side->login, side_login);
+
+	return TRUE;
+}
+
+/* refreshes the credentials before a reconnection */
+static void side_update_login(struct imap_side * side)
+{
+	struct imap_side_login * side_login;
+
+	side_login = folder_hash_get(side_login_hash, side->folder);
+	if (side_login != NULL)
+		side_login_copy(&side->login, side_login);
+}
+
+static void side_imap_free(mailimap * imap, gboolean logout)
+{
+	if (imap == NULL)
+		return;
+	if (logout && imap->imap_stream != NULL)
+		mailimap_logout(imap);
+	if (imap->imap_stream != NULL) {
+		mailstream_close(imap->imap_stream);
+		imap->imap_stream = NULL;
+	}
+	mailimap_free(imap);
+}
+
+static void side_close_run(struct etpan_thread_op * op)
+{
+	side_imap_free(op->imap, TRUE);
+}
+
+/* logs out in the background; the thread is kept */
+static void side_disconnect(struct imap_side * side)
+{
+	struct etpan_thread_op * op;
+
+	g_free(side->mailbox);
+	side->mailbox = NULL;
+	if (side->imap == NULL)
+		return;
+
+	op = etpan_thread_op_new();
+	op->imap = side->imap;
+	op->run = side_close_run;
+	op->cleanup = etpan_thread_op_free;
+	if (etpan_thread_op_schedule(side->thread, op) != 0)
+		etpan_thread_op_free(op);
+	side->imap = NULL;
+}
+
+static void side_done(struct imap_side * side)
+{
+	side_disconnect(side);
+	etpan_thread_manager_release_thread(thread_manager, side->thread);
+	side_login_clear(&side->login);
+}
+
+static void side_connect_run(struct etpan_thread_op * op)
+{
+	struct imap_side * side = op->param;
+	int r;
+
+	side_imap_free(side->imap, FALSE);
+	side->imap = mailimap_new(0, NULL);
+
+#ifdef USE_GNUTLS
+	if (side->login.ssl_type == SSL_TUNNEL)
+		r = do_mailimap_ssl_connect_with_callback(side->imap,
+				side->login.server, side->login.port,
+				etpan_connect_ssl_context_cb, side->folder->account,
+				side->login.proxy_info);
+	else
+#endif
+		r = do_mailimap_socket_connect(side->imap,
+				side->login.server, side->login.port,
+				side->login.proxy_info);
+
+	if (r == MAILIMAP_NO_ERROR_AUTHENTICATED ||
+	    r == MAILIMAP_NO_ERROR_NON_AUTHENTICATED)
+		r = MAILIMAP_NO_ERROR;
+
+#ifdef USE_GNUTLS
+	if (r == MAILIMAP_NO_ERROR && side->login.ssl_type == SSL_STARTTLS) {
+		struct etpan_thread_op tls_op;
+		struct connect_param param;
+		struct starttls_result result;
+
+		memset(&tls_op, 0, sizeof(tls_op));
+		param.imap = side->imap;
+		param.account = side->folder->account;
+		param.server = side->login.server;
+		param.port = side->login.port;
+		param.proxy_info = side->login.proxy_info;
+		tls_op.param = &param;
+		tls_op.result = &result;
+		starttls_run(&tls_op);
+		r = result.error;
+	}
+#endif
+	side->error = r;
+	debug_print("imap side connect run - end %i\n", r);
+}
+
+/* has to run in the main thread, it may ask the user */
+static gboolean side_check_certificate(struct imap_side * side)
+{
+#ifdef USE_GNUTLS
+	gboolean accept_if_valid = FALSE;
+
+	if (side->login.ssl_type == SSL_NONE || etpan_skip_ssl_cert_check)
+		return TRUE;
+
+	if (side->folder->account)
+		accept_if_valid = side->folder->account->ssl_certs_auto_accept;
+	if (etpan_certificate_check(side->imap->imap_stream,
+				    side->login.server, side->login.port,
+				    accept_if_valid) != TRUE) {
+		log_warning(LOG_PROTOCOL, _("IMAP: certificate check failed for %s\n"),
+			    side->login.server);
+		return FALSE;
+	}
+#endif
+	return TRUE;
+}
+
+static void side_login_run(struct etpan_thread_op * op)
+{
+	struct imap_side * side = op->param;
+	struct etpan_thread_op login_op;
+	struct login_param param;
+	struct login_result result;
+
+	memset(&login_op, 0, sizeof(login_op));
+	param.imap = side->imap;
+	param.login = side->login.login;
+	param.password = side->login.password;
+	param.type = side->login.type;
+	param.server = side->login.server;
+	login_op.param = &param;
+	login_op.result = &result;
+	login_run(&login_op);
+
+	side->error = result.error;
+	if (side->error == MAILIMAP_NO_ERROR && side->mailbox != NULL) {
+		if (side->read_only)
+			side->error = mailimap_examine(side->imap, side->mailbox);
+		else
+			side->error = mailimap_select(side->imap, side->mailbox);
+	}
+	debug_print("imap side login run - end %i\n", side->error);
+}
+
+static void side_select_run(struct etpan_thread_op * op)
+{
+	struct imap_side * side = op->param;
+
+	side->error = mailimap_select(side->imap, side->mailbox);
+	debug_print("imap side select run - end %i\n", side->error);
+}
+
+/* like threaded_run(), on the thread of a side connection */
+static int side_run(struct imap_side * side, void * param, void * result,
+		    void (* func)(struct etpan_thread_op * ))
+{
+	struct etpan_thread_op * op;
+
+	op = etpan_thread_op_new();
+	op->imap = side->imap;
+	op->param = param;
+	op->result = result;
+	op->run = func;
+	op->callback = generic_cb;
+	op->callback_data = op;
+
+	if (etpan_thread_op_schedule(side->thread, op) != 0) {
+		etpan_thread_op_free(op);
+		return MAILIMAP_ERROR_BAD_STATE;
+	}
+	while (!op->finished) {
+		gtk_main_iteration();
+	}
+	etpan_thread_op_free(op);
+
+	return MAILIMAP_NO_ERROR;
+}
+
+/* IDLE (RFC 2177) on a side connection parked on one mailbox. Each step
+ * is an op; the callbacks run in the main thread and chain the next. */
+
+#define IMAP_IDLE_TIMEOUT	(25 * 60)	/* servers may drop us after 30 */
+#define IMAP_IDLE_RETRY_MIN	30
+#define IMAP_IDLE_RETRY_MAX	(30 * 60)
+
+enum {
+	IMAP_IDLE_STEP_CONNECT,
+	IMAP_IDLE_STEP_LOGIN,
+	IMAP_IDLE_STEP_WAIT
+};
+
+struct imap_idle {
+	struct imap_side side;
+
+	IMAPIdleFunc func;
+	gpointer data;
+
+	int step;
+	gboolean busy;
+	gint stopping;
+	guint retry_tag;
+	guint retry_delay;
+	gboolean changed;
+};
+
+static void imap_idle_schedule(struct imap_idle * idle, int step);
+
+static void idle_wait_run(struct etpan_thread_op * op)
+{
+	struct imap_idle * idle = op->param;
+	mailimap * imap = idle->side.imap;
+	uint32_t exists = 0;
+	gboolean has_data;
+	int r;
+
+	idle->changed = FALSE;
+	if (imap->imap_selection_info != NULL)
+		exists = imap->imap_selection_info->sel_exists;
+
+	r = mailimap_idle(imap);
+	if (r != MAILIMAP_NO_ERROR) {
+		idle->side.error = r;
+		return;
+	}
+
+	if (mailstream_setup_idle(imap->imap_stream) < 0) {
+		idle->side.error = MAILIMAP_ERROR_STREAM;
+		return;
+	}
+	/* imap_threaded_idle_stop() interrupts the wait, unless it ran
+	 * before the setup above */
+	if (g_atomic_int_get(&idle->stopping))
+		r = MAILSTREAM_IDLE_INTERRUPTED;
+	else
+		r = mailstream_wait_idle(imap->imap_stream, IMAP_IDLE_TIMEOUT);
+	mailstream_unsetup_idle(imap->imap_stream);
+
+	if (r == MAILSTREAM_IDLE_ERROR || r == MAILSTREAM_IDLE_CANCELLED) {
+		idle->side.error = MAILIMAP_ERROR_STREAM;
+		return;
+	}
+	has_data = (r == MAILSTREAM_IDLE_HASDATA);
+
+	r = mailimap_idle_done(imap);
+	idle->side.error = r;
+	if (r != MAILIMAP_NO_ERROR || !has_data)
+		return;
+
+	/* "* OK still here" and the like are no reason to rescan */
+	if (imap->imap_selection_info != NULL &&
+	    imap->imap_selection_info->sel_exists != exists)
+		idle->changed = TRUE;
+	if (imap->imap_response_info != NULL) {
+		if (imap->imap_response_info->rsp_expunged != NULL &&
+		    !clist_isempty(imap->imap_response_info->rsp_expunged))
+			idle->changed = TRUE;
+		if (imap->imap_response_info->rsp_fetch_list != NULL &&
+		    !clist_isempty(imap->imap_response_info->rsp_fetch_list))
+			idle->changed = TRUE;
+	}
+	debug_print("imap idle wait run - end, changed %d\n", idle->changed);
+}
+
+static void imap_idle_free(struct imap_idle * idle)
+{
+	if (idle->retry_tag != 0)
+		g_source_remove(idle->retry_tag);
+
+	side_done(&idle->side);
+	g_free(idle);
+}
+
+static gboolean imap_idle_retry(gpointer data)
+{
+	struct imap_idle * idle = data;
+
+	idle->retry_tag = 0;
+	imap_idle_schedule(idle, IMAP_IDLE_STEP_CONNECT);
+
+	return FALSE;
+}
+
+static void imap_idle_op_cb(int cancelled, void * result, void * callback_data)
+{
+	struct imap_idle * idle = callback_data;
+
+	idle->busy = FALSE;
+	if (g_atomic_int_get(&idle->stopping)) {
+		imap_idle_free(idle);
+		return;
+	}
+
+	if (idle->side.error != MAILIMAP_NO_ERROR) {
+		if (idle->step == IMAP_IDLE_STEP_LOGIN &&
+		    idle->side.error == MAILIMAP_ERROR_LOGIN) {
+			/* restarted on the next login of the main session */
+			log_warning(LOG_PROTOCOL, _("IMAP IDLE: can't log in to %s\n"),
+				    idle->side.login.server);
+			return;
+		}
+		debug_print("imap idle: error %d at step %d, retrying in %ds\n",
+			    idle->side.error, idle->step, idle->retry_delay);
+		idle->retry_tag = g_timeout_add_seconds(idle->retry_delay,
+							imap_idle_retry, idle);
+		idle->retry_delay = MIN(idle->retry_delay * 2, IMAP_IDLE_RETRY_MAX);
+		return;
+	}
+
+	switch (idle->step) {
+	case IMAP_IDLE_STEP_CONNECT:
+		if (!side_check_certificate(&idle->side))
+			return;
+		imap_idle_schedule(idle, IMAP_IDLE_STEP_LOGIN);
+		break;
+	case IMAP_IDLE_STEP_LOGIN:
+		log_message(LOG_PROTOCOL, _("IMAP IDLE: waiting for changes in %s on %s\n"),
+			    idle->side.mailbox, idle->side.login.server);
+		idle->retry_delay = IMAP_IDLE_RETRY_MIN;
+		imap_idle_schedule(idle, IMAP_IDLE_STEP_WAIT);
+		break;
+	case IMAP_IDLE_STEP_WAIT:
+		if (idle->changed && idle->func != NULL)
+			idle->func(idle->side.folder, idle->data);
+		imap_idle_schedule(idle, IMAP_IDLE_STEP_WAIT);
+		break;
+	}
+}
+
+static void imap_idle_schedule(struct imap_idle * idle, int step)
+{
+	struct etpan_thread_op * op;
+
+	op = etpan_thread_op_new();
+	op->param = idle;
+	op->result = idle;
+	switch (step) {
+	case IMAP_IDLE_STEP_CONNECT:
+		side_update_login(&idle->side);
+		op->param = &idle->side;
+		op->run = side_connect_run;
+		break;
+	case IMAP_IDLE_STEP_LOGIN:
+		op->param = &idle->side;
+		op->run = side_login_run;
+		break;
+	default:
+		op->run = idle_wait_run;
+		break;
+	}
+	op->imap = idle->side.imap;
+	op->callback = imap_idle_op_cb;
+	op->callback_data = idle;
+	op->cleanup = etpan_thread_op_free;
+
+	idle->step = step;
+	idle->side.error = MAILIMAP_NO_ERROR;
+	idle->busy = TRUE;
+	if (etpan_thread_op_schedule(idle->side.thread, op) != 0) {
+		etpan_thread_op_free(op);
+		idle->busy = FALSE;
+	}
+}
+
+int imap_threaded_idle_start(Folder * folder, const char * mailbox,
+			     IMAPIdleFunc func, gpointer data)
+{
+	struct imap_idle * idle;
+
+	idle = folder_hash_get(idle_hash, folder);
+	if (idle != NULL) {
+		if (!strcmp(idle->side.mailbox, mailbox)) {
+			/* keep the running connection; a parked one is
+			 * retried with the new credentials */
+			if (!idle->busy && idle->retry_tag == 0)
+				imap_idle_schedule(idle, IMAP_IDLE_STEP_CONNECT);
+			return MAILIMAP_NO_ERROR;
+		}
+		imap_threaded_idle_stop(folder);
+	}
+
+	idle = g_new0(struct imap_idle, 1);
+	if (!side_init(&idle->side, folder)) {
+		g_free(idle);
+		return MAILIMAP_ERROR_BAD_STATE;
+	}
+	idle->side.mailbox = g_strdup(mailbox);
+	idle->side.read_only = TRUE;
+	idle->func = func;
+	idle->data = data;
+	idle->retry_delay = IMAP_IDLE_RETRY_MIN;
+
+	folder_hash_set(idle_hash, folder, idle);
+
+	debug_print("imap idle - starting on %s\n", mailbox);
+	imap_idle_schedule(idle, IMAP_IDLE_STEP_CONNECT);
+
+	return MAILIMAP_NO_ERROR;
+}
+
+void imap_threaded_idle_stop(Folder * folder)
+{
+	struct imap_idle * idle;
+
+	idle = folder_hash_get(idle_hash, folder);
+	if (idle == NULL)
+		return;
+
+	folder_hash_delete(idle_hash, folder);
+
+	debug_print("imap idle - stopping\n");
+	if (!idle->busy) {
+		imap_idle_free(idle);
+		return;
+	}
+
+	/* freed by the callback of the running op */
+	g_atomic_int_set(&idle->stopping, 1);
+	if (idle->step == IMAP_IDLE_STEP_WAIT && idle->side.imap != NULL &&
+	    idle->side.imap->imap_stream != NULL)
+		mailstream_interrupt_idle(idle->side.imap->imap_stream);
+}
+
+/* The pool: up to max_conns side connections used for fetching message
+ * contents, so that showing a message doesn't wait behind a long
+ * operation on the main connection. */
+
+struct imap_pool_conn {
+	struct imap_side side;
+	gboolean busy;
+	gboolean orphan;	/* the pool was closed while busy */
+};
+
+struct imap_pool {
+	GSList * conns;
+};
+
+static struct imap_pool_conn * pool_get_conn(Folder * folder, guint max_conns)
+{
+	struct imap_pool * pool;
+	struct imap_pool_conn * conn;
+	GSList * cur;
+
+	pool = folder_hash_get(pool_hash, folder);
+	if (pool == NULL) {
+		pool = g_new0(struct imap_pool, 1);
+		folder_hash_set(pool_hash, folder, pool);
+	}
+
+	for (cur = pool->conns; cur != NULL; cur = cur->next) {
+		conn = cur->data;
+		if (!conn->busy) {
+			conn->busy = TRUE;
+			return conn;
+		}
+	}
+	if (g_slist_length(pool->conns) >= max_conns)
+		return NULL;
+
+	conn = g_new0(struct imap_pool_conn, 1);
+	if (!side_init(&conn->side, folder)) {
+		g_free(conn);
+		return NULL;
+	}
+	conn->busy = TRUE;
+	pool->conns = g_slist_append(pool->conns, conn);
+
+	return conn;
+}
+
+static void pool_conn_free(struct imap_pool_conn * conn)
+{
+	side_done(&conn->side);
+	g_free(conn);
+}
+
+static int pool_conn_prepare(struct imap_pool_conn * conn, const char * mailbox)
+{
+	struct imap_side * side = &conn->side;
+
+	if (side->imap == NULL || side->imap->imap_stream == NULL) {
+		side_update_login(side);
+		if (side_run(side, side, side, side_connect_run) != MAILIMAP_NO_ERROR)
+			return MAILIMAP_ERROR_BAD_STATE;
+		if (side->error != MAILIMAP_NO_ERROR)
+			return side->error;
+		if (!side_check_certificate(side))
+			return MAILIMAP_ERROR_SSL;
+		if (side_run(side, side, side, side_login_run) != MAILIMAP_NO_ERROR)
+			return MAILIMAP_ERROR_BAD_STATE;
+		if (side->error != MAILIMAP_NO_ERROR)
+			return side->error;
+	}
+
+	if (side->mailbox == NULL || strcmp(side->mailbox, mailbox)) {
+		g_free(side->mailbox);
+		side->mailbox = g_strdup(mailbox);
+		if (side_run(side, side, side, side_select_run) != MAILIMAP_NO_ERROR)
+			return MAILIMAP_ERROR_BAD_STATE;
+		if (side->error != MAILIMAP_NO_ERROR) {
+			g_free(side->mailbox);
+			side->mailbox = NULL;
+			return side->error;
+		}
+	}
+
+	return MAILIMAP_NO_ERROR;
+}
+
+int imap_threaded_pool_fetch_content(Folder * folder, guint max_conns,
+				     const char * mailbox, uint32_t msg_index,
+				     int with_body, const char * filename)
+{
+	struct imap_pool_conn * conn;
+	struct fetch_content_param param;
+	struct fetch_content_result result;
+	int r;
+
+	conn = pool_get_conn(folder, max_conns);
+	if (conn == NULL)
+		return MAILIMAP_ERROR_BAD_STATE;
+
+	debug_print("imap pool fetch_content - begin\n");
+	imap_folder_ref(folder);
+
+	r = pool_conn_prepare(conn, mailbox);
+	if (r == MAILIMAP_NO_ERROR && !conn->orphan) {
+		param.imap = conn->side.imap;
+		param.msg_index = msg_index;
+		param.filename = filename;
+		param.with_body = with_body;
+		r = side_run(&conn->side, &param, &result, fetch_content_run);
+		if (r == MAILIMAP_NO_ERROR)
+			r = result.error;
+	}
+
+	/* start afresh next time */
+	if (r != MAILIMAP_NO_ERROR && !conn->orphan)
+		side_disconnect(&conn->side);
+
+	conn->busy = FALSE;
+	if (conn->orphan)
+		pool_conn_free(conn);
+
+	imap_folder_unref(folder);
+	debug_print("imap pool fetch_content - end %d\n", r);
+
+	return r;
+}
+
+void imap_threaded_pool_close(Folder * folder)
+{
+	struct imap_pool * pool;
+	GSList * cur;
+
+	pool = folder_hash_get(pool_hash, folder);
+	if (pool == NULL)
+		return;
+
+	folder_hash_delete(pool_hash, folder);
+
+	for (cur = pool->conns; cur != NULL; cur = cur->next) {
+		struct imap_pool_conn * conn = cur->data;
+
+		if (conn->busy)
+			conn->orphan = TRUE;
+		else
+			pool_conn_free(conn);
+	}
+	g_slist_free(pool->conns);
+	g_free(pool);
+}
+
 void imap_threaded_cancel(Folder * folder)
 {
 	mailimap * imap;
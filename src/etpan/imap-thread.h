@@ -36,6 +36,26 @@ typedef enum
 	IMAP_FLAG_HAM		= 1 << 7
 } IMAPFlags;
 
+/* the status of a mailbox from LIST-STATUS; mask tells which values
+ * were received, with the bits of the mask of imap_threaded_status() */
+typedef struct _IMAPMailboxStatus
+{
+	guint mask;
+	guint32 messages;
+	guint32 recent;
+	guint32 uid_next;
+	guint32 uid_validity;
+	guint32 unseen;
+	guint64 highest_modseq;
+} IMAPMailboxStatus;
+
+/* a range of UIDs, as in the VANISHED of QRESYNC */
+typedef struct _IMAPUidRange
+{
+	guint32 first;
+	guint32 last;
+} IMAPUidRange;
+
 void imap_main_set_timeout(int sec);
 void imap_main_init(gboolean skip_ssl_cert_check);
 void imap_main_done(gboolean have_connectivity);
@@ -46,6 +66,8 @@ void imap_done(Folder * folder);
 int imap_threaded_connect(Folder * folder, const char * server, int port, ProxyInfo *proxy_info);
 int imap_threaded_connect_ssl(Folder * folder, const char * server, int port, ProxyInfo *proxy_info);
 int imap_threaded_capability(Folder *folder, struct mailimap_capability_data ** caps);
+int imap_threaded_enable(Folder *folder, const char *capability);
+int imap_threaded_compress(Folder * folder);
 
 #ifndef G_OS_WIN32
 int imap_threaded_connect_cmd(Folder * folder, const char * command,
@@ -65,6 +87,11 @@ int imap_threaded_login(Folder * folder,
 int imap_threaded_status(Folder * folder, const char * mb,
 		struct mailimap_mailbox_data_status ** data_status,
 		guint mask);
+int imap_threaded_list_status(Folder * folder, guint mask,
+			      gboolean subs_only,
+			      const char * base, char delimiter,
+			      GHashTable ** statuses,
+			      gboolean * unsolicited);
 int imap_threaded_close(Folder * folder);
 
 int imap_threaded_noop(Folder * folder, unsigned int * p_exists, 
@@ -81,7 +108,7 @@ int imap_threaded_delete(Folder * folder, const char * mb);
 int imap_threaded_select(Folder * folder, const char * mb,
 			 gint * exists, gint * recent, gint * unseen,
 			 guint32 * uid_validity, gint * can_create_flags,
-			 GSList **ok_flags);
+			 GSList **ok_flags, guint64 *highestmodseq);
 int imap_threaded_examine(Folder * folder, const char * mb,
 			  gint * exists, gint * recent, gint * unseen,
 			  guint32 * uid_validity);
@@ -144,12 +171,23 @@ void imap_fetch_uid_list_free(carray * uid_list);
 
 int imap_threaded_fetch_uid_flags(Folder * folder, uint32_t first_index,
 				  carray ** fetch_result);
+int imap_threaded_fetch_uid_flags_changedsince(Folder * folder,
+					       uint32_t first_index,
+					       guint64 modseq,
+					       carray ** fetch_result,
+					       GArray ** vanished,
+					       guint64 * max_modseq);
+gboolean imap_uid_ranges_contain(GArray * ranges, guint32 uid);
 
 void imap_fetch_uid_flags_list_free(carray * uid_flags_list);
 
 int imap_threaded_fetch_content(Folder * folder, uint32_t msg_index,
 				int with_body,
 				const char * filename);
+int imap_threaded_fetch_content_batch(Folder * folder,
+				      struct mailimap_set * set,
+				      GHashTable * filenames,
+				      GSList ** fetched);
 
 struct imap_fetch_env_info {
 	uint32_t uid;
@@ -179,4 +217,22 @@ int imap_threaded_store(Folder * folder, struct mailimap_set * set,
 
 void imap_threaded_cancel(Folder * folder);
 
+void imap_threaded_set_side_login(Folder * folder,
+				  const char * server, int port,
+				  SSLType ssl_type, ProxyInfo * proxy_info,
+				  const char * login, const char * password,
+				  const char * type);
+void imap_threaded_clear_side_login(Folder * folder);
+
+typedef void (* IMAPIdleFunc)(Folder * folder, gpointer data);
+
+int imap_threaded_idle_start(Folder * folder, const char * mailbox,
+			     IMAPIdleFunc func, gpointer data);
+void imap_threaded_idle_stop(Folder * folder);
+
+int imap_threaded_pool_fetch_content(Folder * folder, guint max_conns,
+				     const char * mailbox, uint32_t msg_index,
+				     int with_body, const char * filename);
+void imap_threaded_pool_close(Folder * folder);
+
 #endif
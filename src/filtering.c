@@ -852,6 +852,7 @@ static gboolean filter_msginfo(GSList * filtering_list, MsgInfo * info, PrefsAcc
 	
 	cm_return_val_if_fail(info != NULL, TRUE);
 	
+	matcher_begin_message(info);
 	for (l = filtering_list, final = FALSE, apply_next = FALSE; l != NULL; l = g_slist_next(l)) {
 		FilteringProp * filtering = (FilteringProp *) l->data;
 
@@ -894,6 +895,7 @@ static gboolean filter_msginfo(GSList * filtering_list, MsgInfo * info, PrefsAcc
 			}
 		}
 	}
+	matcher_end_message();
 
     /* put in inbox if the last rule was not a final one, or
      * a final rule could not be applied.
@@ -32,6 +32,10 @@
 #include <unistd.h>
 #include <stdlib.h>
 
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "alertpanel.h"
 #include "folder.h"
 #include "session.h"
@@ -57,6 +61,7 @@
 #include "compose.h"
 #include "main.h"
 #include "msgcache.h"
+#include "msgindex.h"
 #include "privacy.h"
 #include "prefs_common.h"
 #include "prefs_migration.h"
@@ -87,6 +92,9 @@ void folder_init		(Folder		*folder,
 static gchar *folder_item_get_cache_file	(FolderItem	*item);
 static gchar *folder_item_get_mark_file	(FolderItem	*item);
 static gchar *folder_item_get_tags_file	(FolderItem	*item);
+static gchar *folder_item_get_index_file	(FolderItem	*item);
+static MsgIndex *folder_item_get_msgindex	(FolderItem	*item);
+static void folder_item_discard_msgindex	(FolderItem	*item);
 static GNode *folder_get_xml_node	(Folder 	*folder);
 static Folder *folder_get_from_xml	(GNode 		*node);
 static void folder_update_op_count_rec	(GNode		*node);
@@ -441,6 +449,10 @@ void folder_item_remove(FolderItem *item)
 		msgcache_destroy(item->cache);
 		item->cache = NULL;
 	}
+	if (item->msgindex != NULL) {
+		msgindex_destroy(item->msgindex);
+		item->msgindex = NULL;
+	}
 
 	tags_file = folder_item_get_tags_file(item);
 	if (tags_file) {
@@ -2201,6 +2213,7 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 		item->cache_dirty = TRUE;
 		item->mark_dirty = TRUE;
 		item->tags_dirty = TRUE;
+		folder_item_discard_msgindex(item);
 		cache_list = NULL;
 	}
 
@@ -2284,6 +2297,8 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 		 */
 		if (cache_cur_num < folder_cur_num) {
 			msgcache_remove_msg(item->cache, cache_cur_num);
+			if (item->msgindex)
+				msgindex_remove_msg(item->msgindex, cache_cur_num);
 			debug_print("Removed message %u from cache.\n", cache_cur_num);
 
 			/* Move to next cache number */
@@ -2310,6 +2325,8 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 			msginfo = msgcache_get_msg(item->cache, folder_cur_num);
 			if (msginfo && folder->klass->is_msg_changed && folder->klass->is_msg_changed(folder, item, msginfo)) {
 				msgcache_remove_msg(item->cache, msginfo->msgnum);
+				if (item->msgindex)
+					msgindex_remove_msg(item->msgindex, msginfo->msgnum);
 				new_list = g_slist_prepend(new_list, GINT_TO_POINTER(msginfo->msgnum));
 				procmsg_msginfo_free(&msginfo);
 
@@ -2368,6 +2385,7 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 
 	if (newmsg_list != NULL) {
 		GSList *elem, *to_filter = NULL;
+		MsgIndex *index = folder_item_get_msgindex(item);
 		gboolean do_filter = (filtering == TRUE) &&
 			(item->folder->account != NULL) &&
 			(item->folder->account->filter_on_recv) &&
@@ -2379,6 +2397,8 @@ gint folder_item_scan_full(FolderItem *item, gboolean filtering)
 			MsgInfo *msginfo = (MsgInfo *) elem->data;
 
 			msgcache_add_msg(item->cache, msginfo);
+			if (index)
+				msgindex_add_msg(index, msginfo);
 			if (!do_filter) {
 				exists_list = g_slist_prepend(exists_list, msginfo);
 
@@ -2575,6 +2595,10 @@ gboolean folder_item_free_cache(FolderItem *item, gboolean force)
 	folder_item_write_cache(item);
 	msgcache_destroy(item->cache);
 	item->cache = NULL;
+	if (item->msgindex) {
+		msgindex_destroy(item->msgindex);
+		item->msgindex = NULL;
+	}
 	return TRUE;
 }
 
@@ -2683,6 +2707,8 @@ static void folder_item_read_cache(FolderItem *item)
 			item->cache_dirty = TRUE;
 			item->mark_dirty = TRUE;
 			item->tags_dirty = TRUE;
+			/* rebuilt along with the cache */
+			folder_item_discard_msgindex(item);
 			folder_item_scan_full(item, TRUE);
 
 			msgcache_read_mark(item->cache, mark_file);
@@ -2797,6 +2823,16 @@ void folder_item_write_cache(FolderItem *item)
 		}
 	}
 
+	if (!prefs_common.index_messages) {
+		/* it wouldn't be kept up to date */
+		folder_item_discard_msgindex(item);
+	} else if (item->msgindex && msgindex_is_dirty(item->msgindex)) {
+		gchar *index_file = folder_item_get_index_file(item);
+
+		msgindex_write(item->msgindex, index_file);
+		g_free(index_file);
+	}
+
 	g_free(cache_file);
 	g_free(mark_file);
 	g_free(tags_file);
@@ -2818,6 +2854,8 @@ MsgInfo *folder_item_get_msginfo(FolderItem *item, gint num)
 	msginfo = get_msginfo(item, num);
 	if (msginfo != NULL) {
 		msgcache_add_msg(item->cache, msginfo);
+		if (item->msgindex)
+			msgindex_remove_msg(item->msgindex, num);
 		return msginfo;
 	}
 	
@@ -3094,6 +3132,8 @@ static void copy_msginfo_flags(MsgInfo *source, MsgInfo *dest)
 
 static void add_msginfo_to_cache(FolderItem *item, MsgInfo *newmsginfo, MsgInfo *flagsource)
 {
+	MsgIndex *index;
+
 	/* update folder stats */
 	if (MSG_IS_NEW(newmsginfo->flags))
 		item->new_msgs++;
@@ -3121,6 +3161,8 @@ static void add_msginfo_to_cache(FolderItem *item, MsgInfo *newmsginfo, MsgInfo
 		folder_item_read_cache(item);
 
 	msgcache_add_msg(item->cache, newmsginfo);
+	if ((index = folder_item_get_msgindex(item)) != NULL)
+		msgindex_add_msg(index, newmsginfo);
 	copy_msginfo_flags(flagsource, newmsginfo);
 	folder_item_update_with_msg(item,  F_ITEM_UPDATE_MSGCNT | F_ITEM_UPDATE_CONTENT | F_ITEM_UPDATE_ADDMSG, newmsginfo);
 	folder_item_update_thaw();
@@ -3159,6 +3201,8 @@ static void remove_msginfo_from_cache(FolderItem *item, MsgInfo *msginfo)
 	hooks_invoke(MSGINFO_UPDATE_HOOKLIST, &msginfo_update);
 
 	msgcache_remove_msg(item->cache, msginfo->msgnum);
+	if (item->msgindex)
+		msgindex_remove_msg(item->msgindex, msginfo->msgnum);
 	folder_item_update_with_msg(msginfo->folder, F_ITEM_UPDATE_MSGCNT | F_ITEM_UPDATE_CONTENT | F_ITEM_UPDATE_REMOVEMSG, msginfo);
 }
 
@@ -3832,6 +3876,8 @@ gint folder_item_remove_msgs(FolderItem *item, GSList *msglist)
 			ret = folder_item_remove_msg(item, msginfo->msgnum);
 		if (ret != 0) break;
 		msgcache_remove_msg(item->cache, msginfo->msgnum);
+		if (item->msgindex)
+			msgindex_remove_msg(item->msgindex, msginfo->msgnum);
 		cur = cur->next;
 	}
 	g_slist_free(real_list);
@@ -3881,6 +3927,7 @@ gint folder_item_remove_all_msg(FolderItem *item)
 
 		if (result == 0) {
 			folder_item_free_cache(item, TRUE);
+			folder_item_discard_msgindex(item);
 			item->cache = msgcache_new();
 			item->cache_dirty = TRUE;
 			item->mark_dirty = TRUE;
@@ -3988,7 +4035,8 @@ void folder_item_discard_cache(FolderItem *item)
 	if (is_file_exist(cache))
 		claws_unlink(cache);
 	g_free(cache);
-	
+
+	folder_item_discard_msgindex(item);
 }
 
 static gchar *folder_item_get_cache_file(FolderItem *item)
@@ -4038,6 +4086,58 @@ static gchar *folder_item_get_mark_file(FolderItem *item)
 	return file;
 }
 
+static gchar *folder_item_get_index_file(FolderItem *item)
+{
+	gchar *path;
+	gchar *file;
+
+	cm_return_val_if_fail(item != NULL, NULL);
+	cm_return_val_if_fail(item->path != NULL, NULL);
+
+	path = folder_item_get_path(item);
+	cm_return_val_if_fail(path != NULL, NULL);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, INDEX_FILE, NULL);
+	g_free(path);
+
+	return file;
+}
+
+/* The message index is built from the message files, so it's only
+ * kept for folders which have them on disk. */
+static MsgIndex *folder_item_get_msgindex(FolderItem *item)
+{
+	gchar *index_file;
+
+	if (item->msgindex != NULL)
+		return item->msgindex;
+	if (!prefs_common.index_messages || item->no_select ||
+	    item->path == NULL || FOLDER_TYPE(item->folder) != F_MH)
+		return NULL;
+
+	index_file = folder_item_get_index_file(item);
+	item->msgindex = msgindex_read(index_file);
+	g_free(index_file);
+
+	return item->msgindex;
+}
+
+static void folder_item_discard_msgindex(FolderItem *item)
+{
+	gchar *index_file;
+
+	if (item->msgindex != NULL) {
+		msgindex_destroy(item->msgindex);
+		item->msgindex = NULL;
+	}
+	if (item->path == NULL || FOLDER_TYPE(item->folder) != F_MH)
+		return;
+
+	index_file = folder_item_get_index_file(item);
+	if (index_file && is_file_exist(index_file))
+		claws_unlink(index_file);
+	g_free(index_file);
+}
+
 static gchar *folder_item_get_tags_file(FolderItem *item)
 {
 	gchar *path;
@@ -4805,6 +4905,198 @@ MsgNumberList *folder_item_get_number_list(FolderItem *item)
 	return nums;
 }
 
+/* Whether a message has to be matched, or is ruled out by the message
+ * index. Messages are queued for indexing the first time they're
+ * searched, and are matched until they're indexed. The
+ * index is looked up each time, as the cache of the folder (and its
+ * index) may be freed while the search lets the UI run. */
+static gboolean folder_item_search_candidate(FolderItem *item,
+					     gboolean use_index,
+					     MatcherList *predicate,
+					     MsgInfo *msginfo)
+{
+	MsgIndex *index;
+
+	if (!use_index || (index = folder_item_get_msgindex(item)) == NULL)
+		return TRUE;
+
+	if (!msgindex_has_msg(index, msginfo->msgnum))
+		msgindex_add_msg(index, msginfo);
+
+	return matcherlist_match_index(predicate, index, msginfo->msgnum);
+}
+
+#ifdef USE_PTHREAD
+/* Searches reading the message files are spread across threads. Only
+ * the main thread uses the folder and the message cache: it gets the
+ * MsgInfo, the file and the tag names of each message, and the workers
+ * match them, each with its own copy of the conditions. The signature
+ * separators used to decode flowed parts are made once, here. */
+#define FOLDER_SEARCH_THREADED_MIN	64
+#define FOLDER_SEARCH_MAX_THREADS	8
+/* messages handed to the workers ahead, per worker */
+#define FOLDER_SEARCH_QUEUE_LEN		4
+
+typedef struct _FolderSearchJob {
+	guint index;
+	MsgInfo *msginfo;
+	gchar *file;
+	GSList *tags;
+	gboolean matched;
+} FolderSearchJob;
+
+typedef struct _FolderSearchWorker {
+	pthread_t pt;
+	MatcherList *predicate;
+	GAsyncQueue *jobs;
+	GAsyncQueue *done;
+} FolderSearchWorker;
+
+static FolderSearchJob folder_search_stop;
+
+static void *folder_search_thread(void *data)
+{
+	FolderSearchWorker *worker = (FolderSearchWorker *)data;
+	FolderSearchJob *job;
+
+	while ((job = g_async_queue_pop(worker->jobs)) != &folder_search_stop) {
+		matcher_begin_message_file(job->msginfo, job->file, job->tags);
+		job->tags = NULL;
+		job->matched = matcherlist_match(worker->predicate, job->msginfo);
+		matcher_end_message();
+		g_async_queue_push(worker->done, job);
+	}
+
+	return NULL;
+}
+
+static gint folder_item_search_msgs_threaded(FolderItem *container,
+					     GSList *nums,
+					     gint msgcount,
+					     MatcherList *predicate,
+					     gboolean use_index,
+					     GSList **result,
+					     SearchProgressNotify progress_cb,
+					     gpointer progress_data)
+{
+	FolderSearchWorker *workers;
+	GAsyncQueue *jobs, *done;
+	FolderSearchJob *job;
+	gboolean *matched;
+	guint *msgnums;
+	guint n_workers, n_started, i;
+	guint dispatched = 0, in_flight = 0;
+	guint processed_count = 0;
+	gint matched_count = 0;
+	gboolean stop = FALSE, error = FALSE;
+	GSList *cur = nums;
+
+	n_workers = CLAMP(g_get_num_processors(), 1, FOLDER_SEARCH_MAX_THREADS);
+	account_sigsep_matchlist_create();
+	jobs = g_async_queue_new();
+	done = g_async_queue_new();
+	workers = g_new0(FolderSearchWorker, n_workers);
+	for (n_started = 0; n_started < n_workers; n_started++) {
+		FolderSearchWorker *worker = &workers[n_started];
+
+		worker->predicate = matcherlist_copy(predicate);
+		worker->jobs = jobs;
+		worker->done = done;
+		if (pthread_create(&worker->pt, NULL,
+				   folder_search_thread, worker) != 0) {
+			matcherlist_free(worker->predicate);
+			break;
+		}
+	}
+	debug_print("searching %d messages with %d threads\n",
+		    msgcount, n_started);
+
+	matched = g_new0(gboolean, msgcount);
+	msgnums = g_new0(guint, msgcount);
+
+	while (cur != NULL || in_flight > 0) {
+		while (!stop && cur != NULL &&
+		       in_flight < MAX(n_started, 1) * FOLDER_SEARCH_QUEUE_LEN) {
+			guint msgnum = GPOINTER_TO_UINT(cur->data);
+			MsgInfo *msg = folder_item_get_msginfo(container, msgnum);
+
+			cur = cur->next;
+			if (msg == NULL) {
+				error = stop = TRUE;
+				break;
+			}
+
+			job = g_new0(FolderSearchJob, 1);
+			job->index = dispatched++;
+			job->msginfo = msg;
+			in_flight++;
+			if (!folder_item_search_candidate(container, use_index,
+							  predicate, msg)) {
+				g_async_queue_push(done, job);
+				continue;
+			}
+			if (n_started > 0)
+				job->file = procmsg_get_message_file(msg);
+			/* without its file, it's matched as usual */
+			if (job->file != NULL) {
+				job->tags = matcher_get_tag_names(msg);
+				g_async_queue_push(jobs, job);
+			} else {
+				job->matched = matcherlist_match(predicate, msg);
+				g_async_queue_push(done, job);
+			}
+		}
+		if (stop)
+			cur = NULL;
+		if (in_flight == 0)
+			break;
+
+		job = g_async_queue_pop(done);
+		in_flight--;
+
+		msgnums[job->index] = job->msginfo->msgnum;
+		if (job->matched) {
+			matched[job->index] = TRUE;
+			matched_count++;
+		}
+		processed_count++;
+
+		procmsg_msginfo_free(&job->msginfo);
+		g_free(job->file);
+		g_free(job);
+
+		if (!stop && progress_cb != NULL
+		    && !progress_cb(progress_data, FALSE, processed_count,
+			    matched_count, msgcount))
+			stop = TRUE;
+	}
+
+	for (i = 0; i < n_started; i++)
+		g_async_queue_push(jobs, &folder_search_stop);
+	for (i = 0; i < n_started; i++) {
+		pthread_join(workers[i].pt, NULL);
+		matcherlist_free(workers[i].predicate);
+	}
+	g_free(workers);
+	g_async_queue_unref(jobs);
+	g_async_queue_unref(done);
+	account_sigsep_matchlist_delete();
+
+	/* in the order of the number list */
+	*result = NULL;
+	for (i = 0; !error && i < dispatched; i++) {
+		if (matched[i])
+			*result = g_slist_prepend(*result,
+					GUINT_TO_POINTER(msgnums[i]));
+	}
+	*result = g_slist_reverse(*result);
+	g_free(matched);
+	g_free(msgnums);
+
+	return error ? -1 : matched_count;
+}
+#endif
+
 gint folder_item_search_msgs_local	(Folder			*folder,
 					 FolderItem		*container,
 					 MsgNumberList		**msgs,
@@ -4819,6 +5111,7 @@ gint folder_item_search_msgs_local	(Folder			*folder,
 	guint processed_count = 0;
 	gint msgcount;
 	GSList *nums = NULL;
+	gboolean use_index;
 
 	if (*msgs == NULL) {
 		nums = folder_item_get_number_list(container);
@@ -4831,6 +5124,30 @@ gint folder_item_search_msgs_local	(Folder			*folder,
 	if (msgcount < 0)
 		return -1;
 
+	use_index = matcherlist_uses_index(predicate);
+
+#ifdef USE_PTHREAD
+	/* Only where the message files are on disk already: for IMAP,
+	 * NNTP and the like, getting the file of each message up front
+	 * would download them all, while matching one by one fetches no
+	 * more than the conditions need. */
+	if (msgcount >= FOLDER_SEARCH_THREADED_MIN &&
+	    FOLDER_IS_LOCAL(container->folder) &&
+	    matcherlist_needs_file(predicate) &&
+	    matcherlist_is_thread_safe(predicate)) {
+		matched_count = folder_item_search_msgs_threaded(container,
+				nums, msgcount, predicate, use_index, &result,
+				progress_cb, progress_data);
+		if (matched_count < 0)
+			return -1;
+
+		g_slist_free(nums);
+		*msgs = result;
+
+		return matched_count;
+	}
+#endif
+
 	for (cur = nums; cur != NULL; cur = cur->next) {
 		guint msgnum = GPOINTER_TO_UINT(cur->data);
 		MsgInfo *msg = folder_item_get_msginfo(container, msgnum);
@@ -4840,7 +5157,9 @@ gint folder_item_search_msgs_local	(Folder			*folder,
 			return -1;
 		}
 
-		if (matcherlist_match(predicate, msg)) {
+		if (folder_item_search_candidate(container, use_index,
+						 predicate, msg) &&
+		    matcherlist_match(predicate, msg)) {
 			result = g_slist_prepend(result, GUINT_TO_POINTER(msg->msgnum));
 			matched_count++;
 		}
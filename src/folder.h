@@ -743,6 +743,8 @@ struct _FolderItem
 	gboolean mark_dirty;
 	gboolean tags_dirty;
 
+	struct _MsgIndex *msgindex;
+
 	/* special flags */
 	guint no_sub         : 1; /* no child allowed?    */
 	guint no_select      : 1; /* not selectable?      */
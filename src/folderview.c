@@ -51,6 +51,7 @@
 #include "statusbar.h"
 #include "hooks.h"
 #include "folderutils.h"
+#include "imap.h"
 #include "partial_download.h"
 #include "prefs_folder_column.h"
 #include "filtering.h"
@@ -1148,6 +1149,16 @@ void folderview_rescan_tree(Folder *folder, gboolean rebuild)
 	inc_unlock();
 }
 
+static gboolean folderview_check_new_wanted(FolderItem *item, Folder *folder)
+{
+	if (!item || !item->path || !item->folder) return FALSE;
+	if (item->no_select) return FALSE;
+	if (folder && folder != item->folder) return FALSE;
+	if (!folder && !FOLDER_IS_LOCAL(item->folder)) return FALSE;
+	if (!item->prefs->newmailcheck) return FALSE;
+	return TRUE;
+}
+
 /** folderview_check_new()
  *  Scan and update the folder and return the 
  *  count the number of new messages since last check. 
@@ -1172,15 +1183,17 @@ gint folderview_check_new(Folder *folder)
 		inc_lock();
 		main_window_lock(folderview->mainwin);
 
+		if (folder && FOLDER_TYPE(folder) == F_IMAP)
+			imap_check_begin(folder);
+
+		/* the rows are redrawn once, when all is checked */
+		gtk_cmclist_freeze(GTK_CMCLIST(ctree));
+
 		for (node = GTK_CMCTREE_NODE(GTK_CMCLIST(ctree)->row_list);
 		     node != NULL; node = gtkut_ctree_node_next(ctree, node)) {
 			gchar *str = NULL;
 			item = gtk_cmctree_node_get_row_data(ctree, node);
-			if (!item || !item->path || !item->folder) continue;
-			if (item->no_select) continue;
-			if (folder && folder != item->folder) continue;
-			if (!folder && !FOLDER_IS_LOCAL(item->folder)) continue;
-			if (!item->prefs->newmailcheck) continue;
+			if (!folderview_check_new_wanted(item, folder)) continue;
 			if (item->processing_pending == TRUE) {
 				debug_print("skipping %s, processing pending\n",
 					item->path ? item->path : item->name);
@@ -1238,6 +1251,9 @@ gint folderview_check_new(Folder *folder)
 			former_new_msgs += former_new;
 			STATUSBAR_POP(folderview->mainwin);
 		}
+		gtk_cmclist_thaw(GTK_CMCLIST(ctree));
+		if (folder && FOLDER_TYPE(folder) == F_IMAP)
+			imap_check_end(folder);
 		folderview->scanning_folder = NULL;
 		main_window_unlock(folderview->mainwin);
 		inc_unlock();
@@ -127,10 +127,51 @@ LIST_WIDTH (GtkCMCList * clist)
   return 0;
 }
 
-/* returns the GList item for the nth row */
-#define	ROW_ELEMENT(clist, row)	(((row) == (clist)->rows - 1) ? \
-				 (clist)->row_list_end : \
-				 g_list_nth ((clist)->row_list, (row)))
+/* returns the GList item for the nth row, walking from the nearest of
+ * the start of the list, its end and the row looked up last, so that
+ * going through rows one after the other doesn't walk the list again */
+static inline GList *
+row_element (GtkCMCList *clist,
+	     gint        row)
+{
+  GList *list;
+  gint pos;
+
+  if (row < 0 || row >= clist->rows || !clist->row_list_end)
+    return g_list_nth (clist->row_list, row);
+
+  if (row <= clist->rows - 1 - row)
+    {
+      list = clist->row_list;
+      pos = 0;
+    }
+  else
+    {
+      list = clist->row_list_end;
+      pos = clist->rows - 1;
+    }
+  if (clist->row_cursor &&
+      ABS (row - clist->row_cursor_pos) < ABS (row - pos))
+    {
+      list = clist->row_cursor;
+      pos = clist->row_cursor_pos;
+    }
+
+  for (; pos < row && list; pos++)
+    list = list->next;
+  for (; pos > row && list; pos--)
+    list = list->prev;
+
+  if (list)
+    {
+      clist->row_cursor = list;
+      clist->row_cursor_pos = pos;
+    }
+
+  return list;
+}
+
+#define	ROW_ELEMENT(clist, row)	row_element ((clist), (row))
 
 
 /* redraw the list if it's not frozen */
@@ -1050,6 +1091,8 @@ gtk_cmclist_init (GtkCMCList *clist)
   clist->row_height = 0;
   clist->row_list = NULL;
   clist->row_list_end = NULL;
+  clist->row_cursor = NULL;
+  clist->row_cursor_pos = 0;
 
   clist->columns = 0;
 
@@ -2773,6 +2816,7 @@ real_insert_row (GtkCMCList *clist,
 
     }
   clist->rows++;
+  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
   if (row < ROW_FROM_YPIXEL (clist, 0))
     clist->voffset -= (clist->row_height + CELL_SPACING);
@@ -2837,6 +2881,7 @@ real_remove_row (GtkCMCList *clist,
   if (clist->row_list_end == list)
     clist->row_list_end = g_list_previous (list);
   list = g_list_remove (list, clist_row);
+  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
   if (row < ROW_FROM_YPIXEL (clist, 0))
     clist->voffset += clist->row_height + CELL_SPACING;
@@ -2891,6 +2936,7 @@ real_clear (GtkCMCList *clist)
   clist->row_list = NULL;
   clist->row_list_end = NULL;
   clist->rows = 0;
+  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
   for (list = free_list; list; list = list->next)
     row_delete (clist, GTK_CMCLIST_ROW (list));
   g_list_free (free_list);
@@ -2952,6 +2998,7 @@ real_row_move (GtkCMCList *clist,
   if (dest_row == clist->rows)
     clist->row_list_end = clist->row_list_end->next;
   clist->rows++;
+  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
   /* sync selection */
   if (source_row > dest_row)
@@ -3933,7 +3980,7 @@ fake_unselect_all (GtkCMCList *clist,
   for (list = clist->undo_selection; list; list = list->next)
     {
       if ((i = GPOINTER_TO_INT (list->data)) == row ||
-	  !(work = g_list_nth (clist->row_list, i)))
+	  !(work = ROW_ELEMENT (clist, i)))
 	continue;
 
       GTK_CMCLIST_ROW (work)->state = GTK_STATE_NORMAL;
@@ -4060,7 +4107,7 @@ resync_selection (GtkCMCList *clist,
 	  list = list->next;
 	  if (row < i || row > e)
 	    {
-	      clist_row = g_list_nth (clist->row_list, row)->data;
+	      clist_row = ROW_ELEMENT (clist, row)->data;
 	      if (clist_row->selectable)
 		{
 		  clist_row->state = GTK_STATE_SELECTED;
@@ -4076,7 +4123,7 @@ resync_selection (GtkCMCList *clist,
 
   if (clist->anchor < clist->drag_pos)
     {
-      for (list = g_list_nth (clist->row_list, i); i <= e;
+      for (list = ROW_ELEMENT (clist, i); i <= e;
 	   i++, list = list->next)
 	if (GTK_CMCLIST_ROW (list)->selectable)
 	  {
@@ -4104,7 +4151,7 @@ resync_selection (GtkCMCList *clist,
     }
   else
     {
-      for (list = g_list_nth (clist->row_list, e); i <= e;
+      for (list = ROW_ELEMENT (clist, e); i <= e;
 	   e--, list = list->prev)
 	if (GTK_CMCLIST_ROW (list)->selectable)
 	  {
@@ -4220,7 +4267,7 @@ update_extended_selection (GtkCMCList *clist,
   /* restore the elements between s1 and e1 */
   if (s1 >= 0)
     {
-      for (i = s1, list = g_list_nth (clist->row_list, i); i <= e1;
+      for (i = s1, list = ROW_ELEMENT (clist, i); i <= e1;
 	   i++, list = list->next)
 	if (GTK_CMCLIST_ROW (list)->selectable)
 	  {
@@ -4258,7 +4305,7 @@ update_extended_selection (GtkCMCList *clist,
   /* extend the selection between s2 and e2 */
   if (s2 >= 0)
     {
-      for (i = s2, list = g_list_nth (clist->row_list, i); i <= e2;
+      for (i = s2, list = ROW_ELEMENT (clist, i); i <= e2;
 	   i++, list = list->next)
 	if (GTK_CMCLIST_ROW (list)->selectable &&
 	    GTK_CMCLIST_ROW (list)->state != clist->anchor_state)
@@ -6596,7 +6643,7 @@ gtk_cmclist_focus_in (GtkWidget     *widget,
     {
       GList *list;
 
-      list = g_list_nth (clist->row_list, clist->focus_row);
+      list = ROW_ELEMENT (clist, clist->focus_row);
       if (list && GTK_CMCLIST_ROW (list)->selectable)
 	g_signal_emit (G_OBJECT (clist), clist_signals[SELECT_ROW], 0,
 			 clist->focus_row, -1, event);
@@ -7286,6 +7333,7 @@ real_sort_list (GtkCMCList *clist)
     }
    
   clist->row_list = gtk_cmclist_mergesort (clist, clist->row_list, clist->rows);
+  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
   work = clist->selection;
 
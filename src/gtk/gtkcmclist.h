@@ -109,6 +109,9 @@ typedef enum
 
 #define GTK_CMCLIST_ROW(_glist_) ((GtkCMCListRow *)((_glist_)->data))
 
+/* to be used by whatever relinks the rows of a list */
+#define GTK_CMCLIST_RESET_ROW_CURSOR(clist)  (GTK_CMCLIST (clist)->row_cursor = NULL)
+
 /* pointer casting for cells */
 #define GTK_CMCELL_TEXT(cell)     (((GtkCMCellText *) &(cell)))
 #define GTK_CMCELL_PIXBUF(cell)   (((GtkCMCellPixbuf *) &(cell)))
@@ -236,6 +239,12 @@ struct _GtkCMCList
   gint drag_highlight_row;
   GtkCMCListDragPos drag_highlight_pos;
   int draw_now;
+
+  /* the row looked up last by its number, where the next lookup can
+   * start from; to be reset whenever rows are added, removed or
+   * moved */
+  GList *row_cursor;
+  gint row_cursor_pos;
 };
 
 struct _GtkCMCListClass
@@ -1605,6 +1605,7 @@ gtk_cmctree_link (GtkCMCTree     *ctree,
   if (clist->row_list_end == NULL ||
       clist->row_list_end->next == (GList *)node)
     clist->row_list_end = list_end;
+  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
   if (visible && update_focus_row)
     {
@@ -1706,6 +1707,7 @@ gtk_cmctree_unlink (GtkCMCTree     *ctree,
       list = (GList *)GTK_CMCTREE_NODE_PREV (node);
       list->next = (GList *)work;
     }
+  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
   /* update tree */
   parent = GTK_CMCTREE_ROW (node)->parent;
@@ -2019,6 +2021,7 @@ real_tree_expand (GtkCMCTree     *ctree,
 
       list = (GList *)node;
       list->next = (GList *)(GTK_CMCTREE_ROW (node)->children);
+      GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
       if (visible && !GTK_CMCLIST_AUTO_RESIZE_BLOCKED (clist))
 	{
@@ -2035,6 +2038,7 @@ real_tree_expand (GtkCMCTree     *ctree,
 	    clist->focus_row += tmp;
 
 	  clist->rows += tmp;
+	  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 	  CLIST_REFRESH (clist);
 	}
     }
@@ -2122,6 +2126,7 @@ real_tree_collapse (GtkCMCTree     *ctree,
 	  list->next = NULL;
 	  clist->row_list_end = (GList *)node;
 	}
+      GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
       if (visible)
 	{
@@ -2132,6 +2137,7 @@ real_tree_collapse (GtkCMCTree     *ctree,
 	  if (row < clist->focus_row)
 	    clist->focus_row -= tmp;
 	  clist->rows -= tmp;
+	  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 	  CLIST_REFRESH (clist);
 	}
     }
@@ -3250,6 +3256,7 @@ real_clear (GtkCMCList *clist)
   work = GTK_CMCTREE_NODE (clist->row_list);
   clist->row_list = NULL;
   clist->row_list_end = NULL;
+  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
   GTK_CMCLIST_SET_FLAG (clist, CMCLIST_AUTO_RESIZE_BLOCKED);
   while (work)
@@ -4692,51 +4699,93 @@ gtk_cmctree_set_expander_style (GtkCMCTree              *ctree,
  ***********************************************************/
 
 
+static gint
+tree_sort_compare (gconstpointer a,
+		   gconstpointer b,
+		   gpointer      data)
+{
+  GtkCMCList *clist = data;
+  GtkCMCTreeNode *node1 = *(GtkCMCTreeNode **)a;
+  GtkCMCTreeNode *node2 = *(GtkCMCTreeNode **)b;
+  gint res;
+
+  res = clist->compare (clist, GTK_CMCTREE_ROW (node1), GTK_CMCTREE_ROW (node2));
+
+  return (clist->sort_type == GTK_SORT_ASCENDING) ? res : -res;
+}
+
 static void
 tree_sort (GtkCMCTree     *ctree,
 	   GtkCMCTreeNode *node,
 	   gpointer      data)
 {
-  GtkCMCTreeNode *list_start;
-  GtkCMCTreeNode *cmp;
   GtkCMCTreeNode *work;
+  GtkCMCTreeNode *old_end;
+  GList *before;
+  GList *after;
+  GList *prev_end;
+  GList *list;
+  GPtrArray *nodes;
   GtkCMCList *clist;
+  guint i;
 
   clist = GTK_CMCLIST (ctree);
 
   if (node)
-    list_start = GTK_CMCTREE_ROW (node)->children;
+    work = GTK_CMCTREE_ROW (node)->children;
   else
-    list_start = GTK_CMCTREE_NODE (clist->row_list);
+    work = GTK_CMCTREE_NODE (clist->row_list);
+
+  if (!work || !GTK_CMCTREE_ROW (work)->sibling)
+    return;
+
+  nodes = g_ptr_array_new ();
+  for (; work; work = GTK_CMCTREE_ROW (work)->sibling)
+    g_ptr_array_add (nodes, work);
 
-  while (list_start)
+  /* the rows of the sibling chain, children included, are the range
+   * between before and after; it is relinked in place once sorted */
+  work = g_ptr_array_index (nodes, 0);
+  before = (GList *)GTK_CMCTREE_NODE_PREV (work);
+  if (before && before->next != (GList *)work)
+    before = NULL;
+  old_end = gtk_cmctree_last_visible
+    (ctree, g_ptr_array_index (nodes, nodes->len - 1));
+  after = (GList *)GTK_CMCTREE_NODE_NEXT (old_end);
+
+  /* merge sort, so rows comparing equal keep their order */
+  g_qsort_with_data (nodes->pdata, nodes->len, sizeof (gpointer),
+		     tree_sort_compare, clist);
+
+  prev_end = (GList *)GTK_CMCTREE_NODE_PREV (work);
+  for (i = 0; i < nodes->len; i++)
     {
-      cmp = list_start;
-      work = GTK_CMCTREE_ROW (cmp)->sibling;
-      while (work)
-	{
-	  if (clist->sort_type == GTK_SORT_ASCENDING)
-	    {
-	      if (clist->compare 
-		  (clist, GTK_CMCTREE_ROW (work), GTK_CMCTREE_ROW (cmp)) < 0)
-		cmp = work;
-	    }
-	  else
-	    {
-	      if (clist->compare 
-		  (clist, GTK_CMCTREE_ROW (work), GTK_CMCTREE_ROW (cmp)) > 0)
-		cmp = work;
-	    }
-	  work = GTK_CMCTREE_ROW (work)->sibling;
-	}
-      if (cmp == list_start)
-	list_start = GTK_CMCTREE_ROW (cmp)->sibling;
-      else
-	{
-	  gtk_cmctree_unlink (ctree, cmp, FALSE);
-	  gtk_cmctree_link (ctree, cmp, node, list_start, FALSE);
-	}
+      work = g_ptr_array_index (nodes, i);
+      list = (GList *)work;
+
+      GTK_CMCTREE_ROW (work)->sibling = (i + 1 < nodes->len) ?
+	g_ptr_array_index (nodes, i + 1) : NULL;
+      list->prev = prev_end;
+      if (i > 0)
+	prev_end->next = list;
+      prev_end = (GList *)gtk_cmctree_last_visible (ctree, work);
     }
+  prev_end->next = after;
+  if (after)
+    after->prev = prev_end;
+
+  work = g_ptr_array_index (nodes, 0);
+  if (before)
+    before->next = (GList *)work;
+  if (node)
+    GTK_CMCTREE_ROW (node)->children = work;
+  else
+    clist->row_list = (GList *)work;
+  if (clist->row_list_end == (GList *)old_end)
+    clist->row_list_end = prev_end;
+  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
+
+  g_ptr_array_free (nodes, TRUE);
 }
 
 void
@@ -945,6 +945,7 @@ gtk_sctree_real_tree_collapse (GtkCMCTree     *ctree,
 	  list->next = NULL;
 	  clist->row_list_end = (GList *)node;
 	}
+      GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
       if (visible)
 	{
@@ -957,6 +958,7 @@ gtk_sctree_real_tree_collapse (GtkCMCTree     *ctree,
 		    clist->focus_row -= tmp;
 	  }
 	  clist->rows -= tmp;
+	  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 	  CLIST_REFRESH (clist);
 	}
     }
@@ -1070,50 +1072,16 @@ void gtk_sctree_set_recursive_expand(GtkSCTree  *sctree, gboolean rec_exp)
  *             Tree sorting functions                      *
  ***********************************************************/
 
-static void sink(GtkCMCList *clist, GPtrArray *numbers, gint root, gint bottom)
+static gint stree_sort_compare(gconstpointer a, gconstpointer b, gpointer data)
 {
-	gint j, k ;
-	GtkCMCTreeNode *temp;
-
-	j = 2 * root;
-	k = j + 1;
-
-	/* find the maximum element of numbers[root],
-	   numbers[2*root] and numbers[2*root+1] */
-	if (j <= bottom) {
-		if (clist->compare( clist, GTK_CMCTREE_ROW (g_ptr_array_index(numbers, root)),
-				    GTK_CMCTREE_ROW(g_ptr_array_index( numbers, j))) >= 0)
-			j = root;
-		if (k <= bottom)
-			if (clist->compare( clist, GTK_CMCTREE_ROW (g_ptr_array_index(numbers, k)),
-					    GTK_CMCTREE_ROW (g_ptr_array_index( numbers, j))) > 0)
-				j = k;
-		/* if numbers[root] wasn't the maximum element then
-		   sink again */
-		if (root != j) {
-			temp = g_ptr_array_index( numbers,root);
-			g_ptr_array_index( numbers, root) = g_ptr_array_index( numbers, j);
-			g_ptr_array_index( numbers, j) = temp;
-			sink( clist, numbers, j, bottom);
-		}
-	}
-}
+	GtkCMCList *clist = data;
+	GtkCMCTreeNode *node1 = *(GtkCMCTreeNode **)a;
+	GtkCMCTreeNode *node2 = *(GtkCMCTreeNode **)b;
+	gint res;
 
-static void heap_sort(GtkCMCList *clist, GPtrArray *numbers, gint array_size)
-{
-	gint i;
-	GtkCMCTreeNode *temp;
-	
-	/* build the Heap */
-	for (i = (array_size / 2); i >= 1; i--)
-		sink( clist, numbers, i, array_size);
-	/* output the Heap */
-	for (i = array_size; i >= 2; i--) {
-		temp = g_ptr_array_index( numbers, 1);
-		g_ptr_array_index( numbers, 1) = g_ptr_array_index( numbers, i);
-		g_ptr_array_index( numbers, i) = temp;
-		sink( clist, numbers, 1, i-1);
-	}
+	res = clist->compare(clist, GTK_CMCTREE_ROW (node1), GTK_CMCTREE_ROW (node2));
+
+	return (clist->sort_type == GTK_SORT_ASCENDING) ? res : -res;
 }
 
 static void
@@ -1137,7 +1105,6 @@ stree_sort (GtkCMCTree    *ctree,
 	viewable_array = g_ptr_array_new();
 
 	if (work) {
-		g_ptr_array_add( row_array, NULL);
 		while (work) {
 			/* add all rows to row_array */
 			g_ptr_array_add( row_array, work);
@@ -1148,27 +1115,20 @@ stree_sort (GtkCMCTree    *ctree,
 			work = next;
 		}
 
-		heap_sort( clist, row_array, (row_array->len)-1);
+		/* a merge sort: rows comparing equal keep their order */
+		g_qsort_with_data(row_array->pdata, row_array->len,
+				  sizeof(gpointer), stree_sort_compare, clist);
 
 		if (node)
 			list_start = GTK_CMCTREE_ROW (node)->children;
 		else
 			list_start = GTK_CMCTREE_NODE (clist->row_list);
 
-		if (clist->sort_type == GTK_SORT_ASCENDING) {
-			for (i=(row_array->len)-1; i>=1; i--) {
-				work = g_ptr_array_index( row_array, i);
-				gtk_sctree_link( ctree, work, node, list_start, FALSE);
-				list_start = work;
-				/* insert work at the beginning of the list */
-			}
-		} else {
-			for (i=1; i<row_array->len; i++) {
-				work = g_ptr_array_index( row_array, i);
-				gtk_sctree_link( ctree, work, node, list_start, FALSE);
-				list_start = work;
-				/* insert work at the beginning of the list */
-			}
+		for (i = row_array->len - 1; i >= 0; i--) {
+			work = g_ptr_array_index( row_array, i);
+			gtk_sctree_link( ctree, work, node, list_start, FALSE);
+			list_start = work;
+			/* insert work at the beginning of the list */
 		}
 
 		for (i=0; i<viewable_array->len; i++) {
@@ -1342,6 +1302,7 @@ gtk_sctree_unlink (GtkCMCTree     *ctree,
 		list = (GList *)GTK_CMCTREE_NODE_PREV (node);
 		list->next = (GList *)work;
 	}
+	GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
 	/* update tree */
 	parent = GTK_CMCTREE_ROW (node)->parent;
@@ -1493,6 +1454,7 @@ gtk_sctree_link (GtkCMCTree     *ctree,
 	if (clist->row_list_end == NULL ||
 	    clist->row_list_end->next == (GList *)node)
 		clist->row_list_end = list_end;
+	GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
 	if (visible && update_focus_row) {
 		gint pos;
@@ -1787,6 +1749,7 @@ gtk_sctree_real_tree_expand (GtkCMCTree     *ctree,
 
       list = (GList *)node;
       list->next = (GList *)(GTK_CMCTREE_ROW (node)->children);
+      GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 
       if (visible && !GTK_CMCLIST_AUTO_RESIZE_BLOCKED (clist))
 	{
@@ -1804,6 +1767,7 @@ gtk_sctree_real_tree_expand (GtkCMCTree     *ctree,
 		    clist->focus_row += tmp;
 	  }
 	  clist->rows += tmp;
+	  GTK_CMCLIST_RESET_ROW_CURSOR (clist);
 	  CLIST_REFRESH (clist);
 	}
     }
@@ -97,6 +97,10 @@ struct _IMAPFolder
 	guint max_set_size;
 	gchar *search_charset;
 	gboolean search_charset_supported;
+	guint idle_scan_tag;
+	/* mailbox -> IMAPMailboxStatus, from LIST-STATUS while checking
+	 * for new mail, see imap_check_begin() */
+	GHashTable *check_status;
 };
 
 struct _IMAPSession
@@ -107,6 +111,9 @@ struct _IMAPSession
 
 	GSList *capability;
 	gboolean uidplus;
+	gboolean condstore;
+	gboolean qresync;
+	const gchar *login_type;	/* mechanism the login succeeded with */
 
 	gchar *mbox;
 	guint cmd_count;
@@ -119,6 +126,7 @@ struct _IMAPSession
 	guint unseen;
 	guint uid_validity;
 	guint uid_next;
+	guint64 highest_modseq;
 
 	Folder * folder;
 	gboolean busy;
@@ -154,6 +162,11 @@ struct _IMAPNameSpace
 
 #define IMAP_CMD_LIMIT	1000
 
+/* how many messages, and how many bytes of them, imap_cache_msgs()
+ * asks for in one FETCH */
+#define IMAP_CACHE_BATCH_MSGS	100
+#define IMAP_CACHE_BATCH_SIZE	(8 * 1024 * 1024)
+
 enum {
 	ITEM_CAN_CREATE_FLAGS_UNKNOWN = 0,
 	ITEM_CAN_CREATE_FLAGS,
@@ -181,6 +194,12 @@ struct _IMAPFolderItem
 	GHashTable *tags_unset_table;
 	GSList *ok_flags;
 
+	/* HIGHESTMODSEQ the cached flags and uid_list are in sync with,
+	 * 0 if unknown or the server lacks CONDSTORE */
+	guint64 modseq;
+	/* HIGHESTMODSEQ uid_list was fetched at; becomes modseq once the
+	 * flags are fetched too */
+	guint64 uid_list_modseq;
 };
 
 static XMLTag *imap_item_get_xml(Folder *folder, FolderItem *item);
@@ -198,6 +217,19 @@ static IMAPSession *imap_session_new	(Folder         *folder,
 					 const PrefsAccount 	*account);
 static gint 	imap_session_authenticate(IMAPSession 	*session,
 				      	  PrefsAccount 	*account);
+static void	imap_enable_modseq	(IMAPSession	*session);
+static void	imap_enable_compress	(IMAPSession	*session);
+static void	imap_side_login_set	(IMAPSession	*session,
+					 PrefsAccount	*account,
+					 const gchar	*pass);
+static void	imap_idle_start		(IMAPSession	*session,
+					 PrefsAccount	*account);
+static void	imap_idle_stop		(Folder		*folder);
+static gint	imap_pool_fetch		(Folder		*folder,
+					 FolderItem	*item,
+					 guint32	 uid,
+					 const gchar	*filename,
+					 gboolean	 body);
 static void 	imap_session_destroy	(Session 	*session);
 
 static gchar   *imap_fetch_msg		(Folder 	*folder, 
@@ -330,6 +362,7 @@ static gint imap_status			(IMAPSession	*session,
 					 guint32	*uid_next,
 					 guint32	*uid_validity,
 					 gint		*unseen,
+					 guint64	*highest_modseq,
 					 gboolean	 block);
 static void	imap_commit_tags	(FolderItem 	*item, 
 					 MsgInfo	*msginfo,
@@ -368,6 +401,7 @@ static gint imap_cmd_select	(IMAPSession	*session,
 				 guint32	*uid_validity,
 				 gint		*can_create_flags,
 				 GSList		**ok_flags,
+				 guint64	*highest_modseq,
 				 gboolean	 block);
 static gint imap_cmd_close	(IMAPSession 	*session);
 static gint imap_cmd_examine	(IMAPSession	*session,
@@ -781,10 +815,15 @@ static Folder *imap_folder_new(const gchar *name, const gchar *path)
 
 static void imap_folder_destroy(Folder *folder)
 {
+	imap_idle_stop(folder);
+	imap_threaded_pool_close(folder);
+
 	while (imap_folder_get_refcnt(folder) > 0)
 		gtk_main_iteration();
 
 	g_free(IMAP_FOLDER(folder)->search_charset);
+	if (IMAP_FOLDER(folder)->check_status != NULL)
+		g_hash_table_destroy(IMAP_FOLDER(folder)->check_status);
 
 	folder_remote_folder_destroy(REMOTE_FOLDER(folder));
 	imap_done(folder);
@@ -1437,19 +1476,163 @@ try_again:
 		return ok;
 	} 
 
+	statusbar_pop_all();
+	session->authenticated = TRUE;
+	imap_enable_modseq(session);
+	imap_enable_compress(session);
+	imap_side_login_set(session, account, pass);
+	imap_idle_start(session, account);
+
 	if (acc_pass) {
 		memset(acc_pass, 0, strlen(acc_pass));
 		g_free(acc_pass);
 	}
-	statusbar_pop_all();
-	session->authenticated = TRUE;
 	return MAILIMAP_NO_ERROR;
 }
 
+/* Servers may announce CONDSTORE/QRESYNC only once logged in, so the
+ * capabilities are asked for again. */
+static void imap_enable_modseq(IMAPSession *session)
+{
+	session->condstore = FALSE;
+	session->qresync = FALSE;
+
+	imap_free_capabilities(session);
+	if (imap_get_capabilities(session) != MAILIMAP_NO_ERROR)
+		return;
+
+	session->condstore = imap_has_capability(session, "CONDSTORE");
+	if (imap_has_capability(session, "QRESYNC")
+	 && imap_threaded_enable(session->folder, "QRESYNC") == MAILIMAP_NO_ERROR) {
+		session->condstore = TRUE;
+		session->qresync = TRUE;
+	}
+	debug_print("IMAP session: CONDSTORE %d QRESYNC %d\n",
+		    session->condstore, session->qresync);
+}
+
+/* Headers and text compress well; the ratio is logged when the
+ * connection closes. */
+static void imap_enable_compress(IMAPSession *session)
+{
+	int r;
+
+	if (!imap_has_capability(session, "COMPRESS=DEFLATE"))
+		return;
+
+	r = imap_threaded_compress(session->folder);
+	if (r != MAILIMAP_NO_ERROR) {
+		log_warning(LOG_PROTOCOL, _("IMAP: couldn't enable compression\n"));
+		return;
+	}
+	log_print(LOG_PROTOCOL, "IMAP* COMPRESS=DEFLATE enabled\n");
+}
+
+static gboolean imap_idle_scan_inbox(gpointer data)
+{
+	Folder *folder = FOLDER(data);
+	RemoteFolder *rfolder = REMOTE_FOLDER(folder);
+	FolderItem *inbox = folder->inbox;
+
+	if (inbox != NULL && !prefs_common.work_offline) {
+		/* don't get in the way of a running check or operation,
+		 * try again in a moment */
+		if (inc_is_active() || inbox->scanning != ITEM_NOT_SCANNING
+		 || (rfolder->session && IMAP_SESSION(rfolder->session)->busy))
+			return TRUE;
+
+		debug_print("IMAP IDLE: scanning %s\n", inbox->path);
+		IMAP_FOLDER_ITEM(inbox)->should_update = TRUE;
+		inc_lock();
+		folder_item_scan(inbox);
+		inc_unlock();
+	}
+	IMAP_FOLDER(folder)->idle_scan_tag = 0;
+	return FALSE;
+}
+
+static void imap_idle_changed(Folder *folder, gpointer data)
+{
+	if (IMAP_FOLDER(folder)->idle_scan_tag == 0)
+		IMAP_FOLDER(folder)->idle_scan_tag =
+			g_timeout_add_seconds(1, imap_idle_scan_inbox, folder);
+}
+
+static void imap_idle_stop(Folder *folder)
+{
+	imap_threaded_idle_stop(folder);
+	if (IMAP_FOLDER(folder)->idle_scan_tag != 0) {
+		g_source_remove(IMAP_FOLDER(folder)->idle_scan_tag);
+		IMAP_FOLDER(folder)->idle_scan_tag = 0;
+	}
+}
+
+/* Remembers how the session logged in, for the further connections of
+ * IDLE and of the fetch pool. */
+static void imap_side_login_set(IMAPSession *session, PrefsAccount *account,
+				const gchar *pass)
+{
+	SSLType ssl_type = SSL_NONE;
+
+	if (session->login_type == NULL)
+		return;
+#ifndef G_OS_WIN32
+	if (account->set_tunnelcmd)
+		return;
+#endif
+#ifdef USE_GNUTLS
+	ssl_type = account->ssl_imap;
+#endif
+	imap_threaded_set_side_login(session->folder, SESSION(session)->server,
+				     SESSION(session)->port, ssl_type,
+				     SESSION(session)->proxy_info,
+				     account->userid, pass ? pass : "",
+				     session->login_type);
+}
+
+/* Parks a second connection in IDLE on the Inbox, so that new mail is
+ * noticed as soon as the server announces it instead of at the next
+ * check. */
+static void imap_idle_start(IMAPSession *session, PrefsAccount *account)
+{
+	Folder *folder = session->folder;
+	gchar *real_path;
+	gint ok = MAILIMAP_NO_ERROR;
+
+	if (!account->imap_use_idle || folder->inbox == NULL
+	 || folder->inbox->path == NULL || session->login_type == NULL
+	 || !imap_has_capability(session, "IDLE")) {
+		imap_idle_stop(folder);
+		return;
+	}
+#ifndef G_OS_WIN32
+	if (account->set_tunnelcmd) {
+		imap_idle_stop(folder);
+		return;
+	}
+#endif
+
+	real_path = imap_get_real_path(session, IMAP_FOLDER(folder),
+				       folder->inbox->path, &ok);
+	if (is_fatal(ok)) {
+		g_free(real_path);
+		return;
+	}
+	imap_threaded_idle_start(folder, real_path, imap_idle_changed, NULL);
+	g_free(real_path);
+}
+
 static void imap_session_destroy(Session *session)
 {
+	Folder *folder = IMAP_SESSION(session)->folder;
+
 	if (session->state != SESSION_DISCONNECTED)
-		imap_threaded_disconnect(IMAP_SESSION(session)->folder);
+		imap_threaded_disconnect(folder);
+
+	/* unless a newer session logged in since */
+	if (folder != NULL && (REMOTE_FOLDER(folder)->session == NULL ||
+			       REMOTE_FOLDER(folder)->session == session))
+		imap_threaded_clear_side_login(folder);
 	
 	imap_free_capabilities(IMAP_SESSION(session));
 	g_free(IMAP_SESSION(session)->mbox);
@@ -1636,6 +1819,28 @@ static void imap_commit_tags(FolderItem *item, MsgInfo *msginfo, GSList *tags_se
 	}
 }
 
+/* Strips the CRs of a message just fetched into the cache, and records
+ * whether the cache now has the whole of it */
+static void imap_fetched_msg_finish(FolderItem *item, gint uid,
+				    const gchar *filename, gboolean whole)
+{
+	gint ok = file_strip_crs(filename);
+
+	if (ok == 0 && whole) {
+		MsgInfo *cached = msgcache_get_msg(item->cache,uid);
+		if (cached) {
+			procmsg_msginfo_set_flags(cached, MSG_FULLY_CACHED, 0);
+			procmsg_msginfo_free(&cached);
+		}
+	} else if (ok == -1) {
+		MsgInfo *cached = msgcache_get_msg(item->cache,uid);
+		if (cached) {
+			procmsg_msginfo_unset_flags(cached, MSG_FULLY_CACHED, 0);
+			procmsg_msginfo_free(&cached);
+		}
+	}
+}
+
 static gchar *imap_fetch_msg_full(Folder *folder, FolderItem *item, gint uid,
 				  gboolean headers, gboolean body)
 {
@@ -1704,6 +1909,10 @@ static gchar *imap_fetch_msg_full(Folder *folder, FolderItem *item, gint uid,
 		}
 	}
 
+	if (imap_pool_fetch(folder, item, (guint32)uid, filename, body)
+	    == MAILIMAP_NO_ERROR)
+		goto fetched;
+
 	debug_print("getting session...\n");
 	session = imap_session_get(folder);
 	
@@ -1737,21 +1946,8 @@ static gchar *imap_fetch_msg_full(Folder *folder, FolderItem *item, gint uid,
 	session_set_access_time(SESSION(session));
 	unlock_session(session);
 
-	ok = file_strip_crs(filename);
-
-	if (ok == 0 && headers && body) {
-		MsgInfo *cached = msgcache_get_msg(item->cache,uid);
-		if (cached) {
-			procmsg_msginfo_set_flags(cached, MSG_FULLY_CACHED, 0);
-			procmsg_msginfo_free(&cached);
-		}
-	} else if (ok == -1) {
-		MsgInfo *cached = msgcache_get_msg(item->cache,uid);
-		if (cached) {
-			procmsg_msginfo_unset_flags(cached, MSG_FULLY_CACHED, 0);
-			procmsg_msginfo_free(&cached);
-		}
-	}
+fetched:
+	imap_fetched_msg_finish(item, uid, filename, headers && body);
 	return filename;
 }
 
@@ -1808,6 +2004,140 @@ void imap_cache_msg(FolderItem *item, gint msgnum)
 	}
 }
 
+/** imap_cache_msgs()
+ *  Caches a list of messages for offline use. Rather than a FETCH per
+ *  message, the messages that aren't fully cached yet are fetched in
+ *  batches of UIDs, each batch capped in count and in total size so
+ *  that cancelling takes effect soon.
+ *  \param item the folder of the messages
+ *  \param msglist the MsgInfos of the messages to cache
+ */
+void imap_cache_msgs(FolderItem *item, GSList *msglist)
+{
+	Folder *folder;
+	IMAPSession *session;
+	GSList *todo = NULL, *cur;
+	gchar *path;
+	gint total, done = 0;
+	gint ok;
+
+	g_return_if_fail(item != NULL);
+	g_return_if_fail(item->folder != NULL);
+	g_return_if_fail(FOLDER_CLASS(item->folder) == &imap_class);
+	folder = item->folder;
+
+	for (cur = msglist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+		if (!imap_is_msg_fully_cached(folder, item, msginfo->msgnum))
+			todo = g_slist_prepend(todo, msginfo);
+	}
+	if (todo == NULL)
+		return;
+	todo = g_slist_reverse(todo);
+
+	if (prefs_common.work_offline && 
+	    !inc_offline_should_override(FALSE,
+		_("Claws Mail needs network access in order "
+		  "to access the IMAP server."))) {
+		g_slist_free(todo);
+		return;
+	}
+
+	path = folder_item_get_path(item);
+	if (!is_dir_exist(path)) {
+		if(is_file_exist(path))
+			claws_unlink(path);
+		make_dir_hier(path);
+	}
+	g_free(path);
+
+	debug_print("getting session...\n");
+	session = imap_session_get(folder);
+	if (!session) {
+		g_slist_free(todo);
+		return;
+	}
+	lock_session(session); /* unlocked later in the function */
+
+	ok = imap_select(session, IMAP_FOLDER(folder), item,
+			 NULL, NULL, NULL, NULL, NULL, FALSE);
+	if (ok != MAILIMAP_NO_ERROR) {
+		g_warning("can't select mailbox %s", item->path);
+		g_slist_free(todo);
+		return;
+	}
+
+	total = g_slist_length(todo);
+	statusbar_print_all(_("Fetching messages for offline use..."));
+
+	cur = todo;
+	while (cur != NULL && !session->cancelled) {
+		GHashTable *filenames;
+		MsgNumberList *numlist = NULL;
+		GSList *seq_list, *set, *fetched = NULL, *f;
+		goffset size = 0;
+		gint count = 0;
+
+		statusbar_progress_all(done, total, 1);
+
+		/* a message bigger than the size cap gets a batch of its own */
+		filenames = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						  NULL, g_free);
+		for (; cur != NULL && count < IMAP_CACHE_BATCH_MSGS; cur = cur->next) {
+			MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+			if (count > 0 && size + msginfo->size > IMAP_CACHE_BATCH_SIZE)
+				break;
+			g_hash_table_insert(filenames,
+					    GUINT_TO_POINTER(msginfo->msgnum),
+					    imap_get_cached_filename(item, msginfo->msgnum));
+			numlist = g_slist_prepend(numlist,
+						  GINT_TO_POINTER(msginfo->msgnum));
+			size += msginfo->size;
+			count++;
+		}
+
+		seq_list = imap_get_lep_set_from_numlist(IMAP_FOLDER(folder), numlist);
+		for (set = seq_list; set != NULL && ok == MAILIMAP_NO_ERROR;
+		     set = set->next) {
+			session_set_access_time(SESSION(session));
+			ok = imap_threaded_fetch_content_batch(folder, set->data,
+							       filenames, &fetched);
+			for (f = fetched; f != NULL; f = f->next) {
+				guint uid = GPOINTER_TO_UINT(f->data);
+
+				imap_fetched_msg_finish(item, uid,
+					g_hash_table_lookup(filenames,
+							    GUINT_TO_POINTER(uid)),
+					TRUE);
+			}
+			g_slist_free(fetched);
+		}
+		imap_lep_set_free(seq_list);
+		g_slist_free(numlist);
+		g_hash_table_destroy(filenames);
+
+		done += count;
+		if (ok != MAILIMAP_NO_ERROR)
+			break;
+	}
+
+	statusbar_progress_all(0, 0, 0);
+	statusbar_pop_all();
+	g_slist_free(todo);
+
+	if (ok != MAILIMAP_NO_ERROR) {
+		/* unlocks the session, or drops it if it's broken */
+		imap_handle_error(SESSION(session), NULL, ok);
+		debug_print("cache msgs err %d\n", ok);
+		return;
+	}
+
+	session_set_access_time(SESSION(session));
+	unlock_session(session);
+}
+
 static gint imap_add_msg(Folder *folder, FolderItem *dest, 
 			 const gchar *file, MsgFlags *flags)
 {
@@ -4023,6 +4353,7 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 	gint exists_, recent_, unseen_;
 	guint32 uid_validity_;
 	gint can_create_flags_;
+	guint64 highest_modseq = 0;
 	const gchar *path = item ? item->path:NULL;
 
 	if (!item) {
@@ -4055,6 +4386,7 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 	session->exists = 0;
 	session->recent = 0;
 	session->expunge = 0;
+	session->highest_modseq = 0;
 
 	real_path = imap_get_real_path(session, folder, path, &ok);
 	if (is_fatal(ok)) {
@@ -4065,7 +4397,8 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 	IMAP_FOLDER_ITEM(item)->ok_flags = NULL;
 	ok = imap_cmd_select(session, real_path,
 			     exists, recent, unseen, uid_validity, can_create_flags, 
-			     &(IMAP_FOLDER_ITEM(item)->ok_flags), block);
+			     &(IMAP_FOLDER_ITEM(item)->ok_flags),
+			     session->condstore ? &highest_modseq : NULL, block);
 	if (ok != MAILIMAP_NO_ERROR) {
 		log_warning(LOG_PROTOCOL, _("can't select folder: %s\n"), real_path);
 	} else {
@@ -4076,9 +4409,11 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 		session->expunge = 0;
 		session->unseen = *unseen;
 		session->uid_validity = *uid_validity;
-		debug_print("select: exists %d recent %d expunge %d uid_validity %d can_create_flags %d\n", 
+		session->highest_modseq = highest_modseq;
+		debug_print("select: exists %d recent %d expunge %d uid_validity %d can_create_flags %d"
+			" highestmodseq %" G_GUINT64_FORMAT "\n",
 			session->exists, session->recent, session->expunge,
-			session->uid_validity, *can_create_flags);
+			session->uid_validity, *can_create_flags, session->highest_modseq);
 	}
 	if (*can_create_flags) {
 		IMAP_FOLDER_ITEM(item)->can_create_flags = ITEM_CAN_CREATE_FLAGS;
@@ -4094,7 +4429,7 @@ static gint imap_status(IMAPSession *session, IMAPFolder *folder,
 			const gchar *path, IMAPFolderItem *item,
 			gint *messages,
 			guint32 *uid_next, guint32 *uid_validity,
-			gint *unseen, gboolean block)
+			gint *unseen, guint64 *highest_modseq, gboolean block)
 {
 	int r = MAILIMAP_NO_ERROR;
 	clistiter * iter;
@@ -4124,6 +4459,10 @@ static gint imap_status(IMAPSession *session, IMAPFolder *folder,
 		mask |= 1 << 4;
 		*unseen = 0;
 	}
+	if (highest_modseq) {
+		mask |= 1 << 5;
+		*highest_modseq = 0;
+	}
 	
 	if (session->mbox != NULL &&
 	    !strcmp(session->mbox, item->item.path)) {
@@ -4189,6 +4528,16 @@ static gint imap_status(IMAPSession *session, IMAPFolder *folder,
 					got_values |= 1 << 4;
 				}
 				break;
+
+			case MAILIMAP_STATUS_ATT_HIGHESTMODSEQ:
+				if (highest_modseq && info->st_ext_data != NULL) {
+					struct mailimap_condstore_status_info * cs_info;
+
+					cs_info = info->st_ext_data->ext_data;
+					* highest_modseq = cs_info->cs_highestmodseq_value;
+					got_values |= 1 << 5;
+				}
+				break;
 			}
 		}
 	}
@@ -4260,6 +4609,7 @@ static gint imap_cmd_login(IMAPSession *session,
 	} else {
 		log_print(LOG_PROTOCOL, "IMAP< Login to %s successful\n",
 				SESSION(session)->server);
+		session->login_type = type;
 		ok = MAILIMAP_NO_ERROR;
 	}
 	return ok;
@@ -4279,7 +4629,7 @@ static gint imap_cmd_noop(IMAPSession *session)
 
 	if ((exists && exists != session->exists)
 	 || (recent && recent != session->recent)
-	 || (expunge && expunge != session->expunge)
+	 || expunge /* EXPUNGE or VANISHED in this very response */
 	 || (unseen && unseen != session->unseen)) {
 		session->folder_content_changed = TRUE;
 	}
@@ -4321,12 +4671,14 @@ static gint imap_cmd_starttls(IMAPSession *session)
 static gint imap_cmd_select(IMAPSession *session, const gchar *folder,
 			    gint *exists, gint *recent, gint *unseen,
 			    guint32 *uid_validity, gint *can_create_flags,
-			    GSList **ok_flags, gboolean block)
+			    GSList **ok_flags, guint64 *highest_modseq,
+			    gboolean block)
 {
 	int r;
 
 	r = imap_threaded_select(session->folder, folder,
-				 exists, recent, unseen, uid_validity, can_create_flags, ok_flags);
+				 exists, recent, unseen, uid_validity, can_create_flags, ok_flags,
+				 highest_modseq);
 	if (r != MAILIMAP_NO_ERROR) {
 		imap_handle_error(SESSION(session), NULL, r);
 		debug_print("select err %d\n", r);
@@ -4473,6 +4825,43 @@ static gint imap_cmd_fetch(IMAPSession *session, guint32 uid,
 }
 
 
+/* While the main connection is busy (a long scan, a big copy...), the
+ * message is fetched over one of the extra connections instead of
+ * waiting for it. */
+static gint imap_pool_fetch(Folder *folder, FolderItem *item, guint32 uid,
+			    const gchar *filename, gboolean body)
+{
+	IMAPSession *session = IMAP_SESSION(REMOTE_FOLDER(folder)->session);
+	gchar *real_path;
+	gint ok = MAILIMAP_NO_ERROR;
+	int r;
+
+	if (session == NULL || !session->authenticated || !session->busy
+	 || folder->account->imap_pool_size == 0 || prefs_common.work_offline
+	 || item->path == NULL)
+		return -1;
+
+	real_path = imap_get_real_path(session, IMAP_FOLDER(folder),
+				       item->path, &ok);
+	if (is_fatal(ok)) {
+		g_free(real_path);
+		return -1;
+	}
+
+	debug_print("IMAP: fetching message %d over an extra connection\n", uid);
+	statusbar_print_all(_("Fetching message..."));
+	r = imap_threaded_pool_fetch_content(folder,
+					     folder->account->imap_pool_size,
+					     real_path, uid, body ? 1 : 0,
+					     filename);
+	statusbar_pop_all();
+	g_free(real_path);
+
+	if (r != MAILIMAP_NO_ERROR)
+		debug_print("IMAP: extra connection fetch failed (%d)\n", r);
+	return r;
+}
+
 static gint imap_cmd_append(IMAPSession *session, 
 			    IMAPFolderItem *item,
 			    const gchar *destfolder,
@@ -4636,12 +5025,50 @@ static gboolean imap_rename_folder_func(GNode *node, gpointer data)
 	return FALSE;
 }
 
+/* Applies the result of a UID FETCH CHANGEDSINCE ... VANISHED to the
+ * known UID list: vanished UIDs are dropped, changed ones not known yet
+ * are new messages. */
+static GSList *imap_uid_list_apply_changes(GSList *known, carray *changed,
+					   GArray *vanished)
+{
+	GHashTable *known_table;
+	GSList *uidlist = NULL, *cur;
+	unsigned int i;
+
+	known_table = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	for (cur = known; cur != NULL; cur = cur->next) {
+		if (imap_uid_ranges_contain(vanished,
+					    GPOINTER_TO_UINT(cur->data)))
+			continue;
+		g_hash_table_insert(known_table, cur->data, cur->data);
+		uidlist = g_slist_prepend(uidlist, cur->data);
+	}
+
+	for (i = 0; i < carray_count(changed); i += 3) {
+		uint32_t *puid = carray_get(changed, i);
+		gpointer uid = GUINT_TO_POINTER(*puid);
+
+		if (g_hash_table_lookup(known_table, uid)
+		 || imap_uid_ranges_contain(vanished, *puid))
+			continue;
+		g_hash_table_insert(known_table, uid, uid);
+		uidlist = g_slist_prepend(uidlist, uid);
+	}
+
+	g_hash_table_destroy(known_table);
+
+	return uidlist;
+}
+
 static gint get_list_of_uids(IMAPSession *session, Folder *folder, IMAPFolderItem *item, GSList **msgnum_list)
 {
 	GSList *uidlist, *elem;
+	GSList *known_uids;
 	int r = -1;
 	clist * lep_uidlist;
 	gint ok, nummsgs = 0;
+	guint64 list_modseq;
 
 	if (session == NULL) {
 		return -1;
@@ -4653,11 +5080,47 @@ static gint get_list_of_uids(IMAPSession *session, Folder *folder, IMAPFolderIte
 		return -1;
 	}
 
-	g_slist_free(item->uid_list);
+	known_uids = item->uid_list;
 	item->uid_list = NULL;
+	item->uid_list_modseq = 0;
+	/* the list is fetched after the server reported this, so it
+	 * includes every change up to it */
+	list_modseq = session->condstore ? session->highest_modseq : 0;
 
 	uidlist = NULL;
 	
+	/* QRESYNC lets us update the list we already have instead of
+	 * fetching every UID of the folder again */
+	if (session->qresync && item->modseq != 0 && known_uids != NULL
+	    && session->uid_validity == item->item.mtime) {
+		carray * lep_uidtab;
+		GArray * vanished = NULL;
+		guint64 max_modseq = 0;
+
+		r = imap_threaded_fetch_uid_flags_changedsince(folder, 1,
+				item->modseq, &lep_uidtab, &vanished,
+				&max_modseq);
+		if (r == MAILIMAP_NO_ERROR) {
+			debug_print("get_list_of_uids: %d changed, %d vanished ranges since modseq %"
+				    G_GUINT64_FORMAT "\n",
+				    carray_count(lep_uidtab) / 3,
+				    vanished ? vanished->len : 0, item->modseq);
+			uidlist = imap_uid_list_apply_changes(known_uids,
+					lep_uidtab, vanished);
+			imap_fetch_uid_flags_list_free(lep_uidtab);
+			if (vanished != NULL)
+				g_array_free(vanished, TRUE);
+			list_modseq = MAX(list_modseq, max_modseq);
+			goto got_uids;
+		}
+		imap_handle_error(SESSION(session), NULL, r);
+		if (is_fatal(r)) {
+			g_slist_free(known_uids);
+			return -1;
+		}
+		r = -1;
+	}
+
 	if (folder->account && folder->account->low_bandwidth) {
 		r = imap_threaded_search(folder, IMAP_SEARCH_TYPE_SIMPLE,
 				NULL, NULL, NULL, &lep_uidlist);
@@ -4670,8 +5133,10 @@ static gint get_list_of_uids(IMAPSession *session, Folder *folder, IMAPFolderIte
 		carray * lep_uidtab;
 		if (r != -1) { /* inited */
 			imap_handle_error(SESSION(session), NULL, r);
-			if (is_fatal(r))
+			if (is_fatal(r)) {
+				g_slist_free(known_uids);
 				return -1;
+			}
 		}
 		r = imap_threaded_fetch_uid(folder, 1,
 				    &lep_uidtab);
@@ -4681,10 +5146,14 @@ static gint get_list_of_uids(IMAPSession *session, Folder *folder, IMAPFolderIte
 		}
 	}
 	
+got_uids:
+	g_slist_free(known_uids);
+
 	if (r != MAILIMAP_NO_ERROR) {
 		imap_handle_error(SESSION(session), NULL, r);
 		return -1;
 	}
+	item->uid_list_modseq = list_modseq;
 
 	for (elem = uidlist; elem != NULL; elem = g_slist_next(elem)) {
 		guint msgnum;
@@ -4765,6 +5234,8 @@ gint imap_get_num_list(Folder *folder, FolderItem *_item, GSList **msgnum_list,
 		debug_print("get_num_list: trashing num list\n");
 		debug_print("Freeing imap uid cache\n");
 		item->lastuid = 0;
+		item->modseq = 0;
+		item->uid_list_modseq = 0;
 		g_slist_free(item->uid_list);
 		item->uid_list = NULL;
 
@@ -4928,12 +5399,145 @@ MsgInfo *imap_get_msginfo(Folder *folder, FolderItem *item, gint uid)
 	return msginfo;
 }
 
+/* Takes the status of the item out of what LIST-STATUS returned when
+ * the check began, if it's there */
+static gboolean imap_check_status_take(IMAPSession *session,
+				       IMAPFolder *folder,
+				       IMAPFolderItem *item,
+				       gint *messages,
+				       guint32 *uid_next, guint32 *uid_validity,
+				       gint *unseen, guint64 *highest_modseq)
+{
+	IMAPMailboxStatus *status;
+	gchar *real_path;
+	const gchar *mb;
+	guint mask = (1 << 0) | (1 << 2) | (1 << 3) | (1 << 4);
+	gint ok;
+
+	if (folder->check_status == NULL)
+		return FALSE;
+
+	real_path = imap_get_real_path(session, folder, item->item.path, &ok);
+	if (is_fatal(ok)) {
+		g_free(real_path);
+		return FALSE;
+	}
+	mb = g_ascii_strcasecmp(real_path, "INBOX") ? real_path : "INBOX";
+
+	status = g_hash_table_lookup(folder->check_status, mb);
+	if (status == NULL || (status->mask & mask) != mask) {
+		g_free(real_path);
+		return FALSE;
+	}
+
+	*messages = status->messages;
+	*uid_next = status->uid_next;
+	*uid_validity = status->uid_validity;
+	*unseen = status->unseen;
+	if (highest_modseq && (status->mask & (1 << 5)))
+		*highest_modseq = status->highest_modseq;
+
+	/* only good once: anything later asks the server again */
+	g_hash_table_remove(folder->check_status, mb);
+	g_free(real_path);
+
+	return TRUE;
+}
+
+/** imap_check_begin()
+ *  Gets the status of all the mailboxes of the account in one command
+ *  when the server has LIST-STATUS (RFC 5819), so that checking each
+ *  folder for new mail doesn't need a STATUS round trip.
+ *  \param folder the IMAP folder about to be checked
+ */
+void imap_check_begin(Folder *folder)
+{
+	IMAPSession *session;
+	GHashTable *statuses = NULL;
+	gboolean unsolicited = FALSE;
+	gboolean subs_only = FALSE;
+	gchar *real_path = NULL;
+	gchar separator = '/';
+	guint mask = (1 << 0) | (1 << 2) | (1 << 3) | (1 << 4);
+	gint r;
+
+	g_return_if_fail(folder != NULL);
+	g_return_if_fail(FOLDER_CLASS(folder) == &imap_class);
+
+	imap_check_end(folder);
+
+	session = imap_session_get(folder);
+	if (session == NULL || !imap_has_capability(session, "LIST-STATUS"))
+		return;
+
+	if (session->condstore)
+		mask |= 1 << 5;
+
+	/* the same mailboxes as imap_scan_tree(): the subscribed ones
+	 * only if asked, under the account's root folder */
+	if (folder->account)
+		subs_only = folder->account->imap_subsonly;
+	if (folder->node && FOLDER_ITEM(folder->node->data)->path) {
+		const gchar *root = FOLDER_ITEM(folder->node->data)->path;
+
+		r = MAILIMAP_NO_ERROR;
+		separator = imap_get_path_separator(session,
+						    IMAP_FOLDER(folder),
+						    root, &r);
+		if (!is_fatal(r))
+			real_path = imap_get_real_path(session,
+						       IMAP_FOLDER(folder),
+						       root, &r);
+		if (is_fatal(r)) {
+			g_free(real_path);
+			return;
+		}
+	}
+
+	lock_session(session);
+	r = imap_threaded_list_status(folder, mask, subs_only,
+				      real_path, separator,
+				      &statuses, &unsolicited);
+	g_free(real_path);
+	if (unsolicited)
+		session->folder_content_changed = TRUE;
+	if (r != MAILIMAP_NO_ERROR) {
+		imap_handle_error(SESSION(session), NULL, r);
+		debug_print("list-status err %d\n", r);
+		if (statuses != NULL)
+			g_hash_table_destroy(statuses);
+		unlock_session(session);
+		return;
+	}
+	unlock_session(session);
+
+	debug_print("list-status: %d mailboxes\n",
+		    statuses ? g_hash_table_size(statuses) : 0);
+	IMAP_FOLDER(folder)->check_status = statuses;
+}
+
+/** imap_check_end()
+ *  Forgets the statuses got by imap_check_begin().
+ *  \param folder the IMAP folder that was checked
+ */
+void imap_check_end(Folder *folder)
+{
+	g_return_if_fail(folder != NULL);
+	g_return_if_fail(FOLDER_CLASS(folder) == &imap_class);
+
+	if (IMAP_FOLDER(folder)->check_status != NULL) {
+		g_hash_table_destroy(IMAP_FOLDER(folder)->check_status);
+		IMAP_FOLDER(folder)->check_status = NULL;
+	}
+}
+
 gboolean imap_scan_required(Folder *folder, FolderItem *_item)
 {
 	IMAPSession *session;
 	IMAPFolderItem *item = (IMAPFolderItem *)_item;
 	gint ok, exists = 0, unseen = 0;
 	guint32 uid_next = 0, uid_val = 0;
+	guint64 highest_modseq = 0;
 	gboolean selected_folder;
 	
 	g_return_val_if_fail(folder != NULL, FALSE);
@@ -4975,6 +5579,7 @@ gboolean imap_scan_required(Folder *folder, FolderItem *_item)
 				if (session->uid_validity && session->uid_validity != item->item.mtime) {
 					item->item.mtime = session->uid_validity;
 					item->should_trash_cache = TRUE;
+					item->modseq = 0;
 				}
 				unlock_session(session);
 				return TRUE;
@@ -4985,16 +5590,22 @@ gboolean imap_scan_required(Folder *folder, FolderItem *_item)
 			if (session->uid_validity && session->uid_validity != item->item.mtime) {
 				item->item.mtime = session->uid_validity;
 				item->should_trash_cache = TRUE;
+				item->modseq = 0;
 			}
 			unlock_session(session);
 			return TRUE;
 		}
-	} else {
+	} else if (!imap_check_status_take(session, IMAP_FOLDER(folder), item,
+					   &exists, &uid_next, &uid_val, &unseen,
+					   session->condstore ? &highest_modseq : NULL)) {
 		ok = imap_status(session, IMAP_FOLDER(folder), item->item.path, IMAP_FOLDER_ITEM(item),
-				 &exists, &uid_next, &uid_val, &unseen, FALSE);
+				 &exists, &uid_next, &uid_val, &unseen,
+				 session->condstore ? &highest_modseq : NULL, FALSE);
 		if (ok != MAILIMAP_NO_ERROR) {
 			return FALSE;
 		}
+	}
+	if (!selected_folder) {
 		
 		debug_print("exists %d, item->item.total_msgs %d\n"
 			    "\tunseen %d, item->item.unread_msgs %d\n"
@@ -5002,10 +5613,14 @@ gboolean imap_scan_required(Folder *folder, FolderItem *_item)
 			    "\tuid_val %d, item->item.mtime %ld\n",
 			    exists, item->item.total_msgs, unseen, item->item.unread_msgs,
 			    uid_next, item->uid_next, uid_val, (long)(item->item.mtime));
+		/* with CONDSTORE any flag change moves HIGHESTMODSEQ, so
+		 * changes that keep the counters equal are noticed too */
 		if (exists != item->item.total_msgs
 		    || unseen != item->item.unread_msgs 
 		    || uid_next != item->uid_next
-		    || uid_val != item->item.mtime) {
+		    || uid_val != item->item.mtime
+		    || (highest_modseq != 0 && item->modseq != 0
+			&& highest_modseq != item->modseq)) {
 			debug_print("CHANGED (status)! scan_required\n");
 			item->last_change = time(NULL);
 			item->should_update = TRUE;
@@ -5013,6 +5628,7 @@ gboolean imap_scan_required(Folder *folder, FolderItem *_item)
 			if (uid_val != item->item.mtime) {
 				item->item.mtime = uid_val;
 				item->should_trash_cache = TRUE;
+				item->modseq = 0;
 			}
 			unlock_session(session);
 			return TRUE;
@@ -5259,6 +5875,7 @@ static /*gint*/ void *imap_get_flags_thread(void *data)
 	gboolean selected_folder;
 	gint exists_cnt, unseen_cnt;
 	gboolean got_alien_tags = FALSE;
+	guint64 since_modseq = 0, highest_modseq = 0, max_modseq = 0;
 
 	session = imap_session_get(folder);
 
@@ -5401,12 +6018,31 @@ static /*gint*/ void *imap_get_flags_thread(void *data)
 		}
 
 	} else {
-		r = imap_threaded_fetch_uid_flags(folder, 1, &lep_uidtab);
+		/* With CONDSTORE only fetch what changed since the last
+		 * sync; the other messages keep their cached flags. */
+		if (session->condstore && session->uid_validity == fitem->mtime) {
+			since_modseq = IMAP_FOLDER_ITEM(fitem)->modseq;
+			highest_modseq = session->highest_modseq;
+		}
+		r = imap_threaded_fetch_uid_flags_changedsince(folder, 1,
+				since_modseq, &lep_uidtab, NULL, &max_modseq);
 		if (r == MAILIMAP_NO_ERROR) {
+			IMAPFolderItem *iitem = IMAP_FOLDER_ITEM(fitem);
+
 			flags_hash = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
 			tags_hash = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
 			imap_flags_hash_from_lep_uid_flags_tab(lep_uidtab, flags_hash, tags_hash);
 			imap_fetch_uid_flags_list_free(lep_uidtab);
+			/* both the UID list and the flags are now known up
+			 * to the lower of the two mod-sequences they were
+			 * fetched at */
+			highest_modseq = MAX(highest_modseq, max_modseq);
+			if (full_search && highest_modseq != 0
+			    && iitem->uid_list_modseq != 0) {
+				iitem->modseq = MIN(iitem->uid_list_modseq,
+						    highest_modseq);
+				iitem->uid_list_modseq = 0;
+			}
 		} else {
 			imap_handle_error(SESSION(session), NULL, r);
 			goto bail;
@@ -5468,9 +6104,16 @@ bail:
 			}
 		} else {
 			if (flags_hash != NULL) {
-
-				flags = GPOINTER_TO_INT(g_hash_table_lookup(flags_hash, 
-						GINT_TO_POINTER(msginfo->msgnum)));
+				gpointer value;
+
+				if (g_hash_table_lookup_extended(flags_hash,
+						GINT_TO_POINTER(msginfo->msgnum),
+						NULL, &value))
+					flags = GPOINTER_TO_INT(value);
+				else if (since_modseq != 0)
+					continue; /* unchanged since the last sync */
+				else
+					flags = 0;
 			}
 
 			if ((flags & MSG_UNREAD) == 0)
@@ -6107,6 +6750,10 @@ void imap_disconnect_all(gboolean have_connectivity)
 		PrefsAccount *account = list->data;
 		if (account->protocol == A_IMAP4) {
 			RemoteFolder *folder = (RemoteFolder *)account->folder;
+			if (folder) {
+				imap_idle_stop(FOLDER(folder));
+				imap_threaded_pool_close(FOLDER(folder));
+			}
 			if (folder && folder->session) {
 				if (imap_is_busy(FOLDER(folder)))
 					imap_threaded_cancel(FOLDER(folder));
@@ -6276,6 +6923,18 @@ void imap_cache_msg(FolderItem *item, gint msgnum)
 {
 }
 
+void imap_cache_msgs(FolderItem *item, GSList *msglist)
+{
+}
+
+void imap_check_begin(Folder *folder)
+{
+}
+
+void imap_check_end(Folder *folder)
+{
+}
+
 void imap_cancel_all(void)
 {
 }
@@ -6318,6 +6977,8 @@ static void imap_item_set_xml(Folder *folder, FolderItem *item, XMLTag *tag)
 			IMAP_FOLDER_ITEM(item)->last_sync = atoi(attr->value);
 		if (!strcmp(attr->name, "last_change"))
 			IMAP_FOLDER_ITEM(item)->last_change = atoi(attr->value);
+		if (!strcmp(attr->name, "modseq"))
+			IMAP_FOLDER_ITEM(item)->modseq = g_ascii_strtoull(attr->value, NULL, 10);
 	}
 	if (IMAP_FOLDER_ITEM(item)->last_change == 0)
 		IMAP_FOLDER_ITEM(item)->last_change = time(NULL);
@@ -6337,6 +6998,12 @@ static XMLTag *imap_item_get_xml(Folder *folder, FolderItem *item)
 			IMAP_FOLDER_ITEM(item)->last_sync));
 	xml_tag_add_attr(tag, xml_attr_new_int("last_change", 
 			IMAP_FOLDER_ITEM(item)->last_change));
+	if (IMAP_FOLDER_ITEM(item)->modseq != 0) {
+		gchar *modseq = g_strdup_printf("%" G_GUINT64_FORMAT,
+				IMAP_FOLDER_ITEM(item)->modseq);
+		xml_tag_add_attr(tag, xml_attr_new("modseq", modseq));
+		g_free(modseq);
+	}
 
 #endif
 	return tag;
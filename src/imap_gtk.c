@@ -440,9 +440,8 @@ void imap_gtk_synchronise(FolderItem *item, gint days)
 	GTK_EVENTS_FLUSH();
 	if (item->no_select == FALSE) {
 		GSList *mlist;
+		GSList *to_cache = NULL;
 		GSList *cur;
-		gint num = 0;
-		gint total = item->total_msgs;
 		time_t t = time(NULL);
 
 		mlist = folder_item_get_msg_list(item);
@@ -450,13 +449,13 @@ void imap_gtk_synchronise(FolderItem *item, gint days)
 			MsgInfo *msginfo = (MsgInfo *)cur->data;
 			gint age = (t - msginfo->date_t) / (60*60*24);
 			if (days == 0 || age <= days)
-				imap_cache_msg(msginfo->folder, msginfo->msgnum);
-			statusbar_progress_all(num++,total, 100);
-			if (num % 100 == 0)
-				GTK_EVENTS_FLUSH();
+				to_cache = g_slist_prepend(to_cache, msginfo);
 		}
+		to_cache = g_slist_reverse(to_cache);
 
-		statusbar_progress_all(0,0,0);
+		imap_cache_msgs(item, to_cache);
+
+		g_slist_free(to_cache);
 		procmsg_msg_list_free(mlist);
 	}
 
@@ -47,6 +47,8 @@
 #include "tags.h"
 #include "folder_item_prefs.h"
 #include "procmsg.h"
+#include "procmime.h"
+#include "folder.h"
 #include "file-utils.h"
 
 /*!
@@ -454,6 +456,38 @@ static gboolean match_with_addresses_in_addressbook
 	return found;
 }
 
+/*!
+ *\brief	Case insensitive search of an ASCII string in another,
+ *		jumping to either case of its first character with strpbrk()
+ *
+ *\param	haystack String to search in
+ *\param	needle String to search for
+ *
+ *\return	const gchar * The first occurrence, or NULL
+ */
+static const gchar *matcher_ascii_strcasestr(const gchar *haystack,
+					     const gchar *needle)
+{
+	gchar first[3];
+	size_t len;
+
+	if (*needle == '\0')
+		return haystack;
+
+	first[0] = g_ascii_tolower(*needle);
+	first[1] = g_ascii_toupper(*needle);
+	first[2] = '\0';
+	len = strlen(needle);
+
+	while ((haystack = strpbrk(haystack, first)) != NULL) {
+		if (!g_ascii_strncasecmp(haystack, needle, len))
+			return haystack;
+		haystack++;
+	}
+
+	return NULL;
+}
+
 /*!
  *\brief	Find out if a string matches a condition
  *
@@ -470,18 +504,27 @@ static gboolean matcherprop_string_match(MatcherProp *prop, const gchar *str,
 	const gchar *down_expr;
 	gboolean ret = FALSE;
 	gboolean should_free = FALSE;
+	gboolean ascii_fold = FALSE;
 	if (str == NULL)
 		return FALSE;
 
 	if (prop->matchtype == MATCHTYPE_REGEXPCASE ||
 	    prop->matchtype == MATCHTYPE_MATCHCASE) {
-		str1 = g_utf8_casefold(str, -1);
 		if (!prop->casefold_expr) {
 			prop->casefold_expr = g_utf8_casefold(prop->expr, -1);
 		}
 		down_expr = prop->casefold_expr;
 
-		should_free = TRUE;
+		/* casefolding ASCII only lowers it, which REG_ICASE and
+		 * matcher_ascii_strcasestr() ignore anyway: don't copy
+		 * the string then */
+		if (is_ascii_str(str)) {
+			str1 = (gchar *)str;
+			ascii_fold = TRUE;
+		} else {
+			str1 = g_utf8_casefold(str, -1);
+			should_free = TRUE;
+		}
 	} else {
 		str1 = (gchar *)str;
 		down_expr = (gchar *)prop->expr;
@@ -536,7 +579,11 @@ static gboolean matcherprop_string_match(MatcherProp *prop, const gchar *str,
 		break;
 	case MATCHTYPE_MATCHCASE:
 	case MATCHTYPE_MATCH:
-		ret = (strstr(str1, down_expr) != NULL);
+		if (ascii_fold)
+			ret = is_ascii_str(down_expr) &&
+			      matcher_ascii_strcasestr(str1, down_expr) != NULL;
+		else
+			ret = (strstr(str1, down_expr) != NULL);
 
 		/* debug output */
 		if (debug_filtering_session
@@ -570,6 +617,8 @@ free_strs:
 	return ret;
 }
 
+static gboolean matcher_msg_context_tags(MsgInfo *info, GSList **names);
+
 /*!
  *\brief	Find out if a tag matches a condition
  *
@@ -584,8 +633,21 @@ static gboolean matcherprop_tag_match(MatcherProp *prop, MsgInfo *msginfo,
 {
 	gboolean ret = FALSE;
 	GSList *cur;
+	GSList *names;
+
+	if (msginfo == NULL)
+		return FALSE;
 
-	if (msginfo == NULL || msginfo->tags == NULL)
+	if (matcher_msg_context_tags(msginfo, &names)) {
+		for (cur = names; cur; cur = cur->next) {
+			if (matcherprop_string_match(prop, (gchar *)cur->data,
+						     debug_context))
+				return TRUE;
+		}
+		return FALSE;
+	}
+
+	if (msginfo->tags == NULL)
 		return FALSE;
 
 	for (cur = msginfo->tags; cur; cur = cur->next) {
@@ -900,9 +962,17 @@ static gboolean matcherprop_match(MatcherProp *prop,
 	case MATCHCRITERIA_NOT_TAG:
 		return !matcherprop_tag_match(prop, info, context_str[CONTEXT_TAG]);
 	case MATCHCRITERIA_TAGGED:
-		return info->tags != NULL;
 	case MATCHCRITERIA_NOT_TAGGED:
-		return info->tags == NULL;
+	{
+		GSList *names;
+		gboolean tagged;
+
+		if (matcher_msg_context_tags(info, &names))
+			tagged = names != NULL;
+		else
+			tagged = info->tags != NULL;
+		return prop->criteria == MATCHCRITERIA_TAGGED ? tagged : !tagged;
+	}
 	case MATCHCRITERIA_AGE_GREATER:
 		age_mult_hours = 24;
 		/* Fallthrough intended */
@@ -1302,6 +1372,26 @@ MatcherList *matcherlist_new_from_lines(gchar *lines, gboolean bool_and,
 	return matcherlist_new(matchers, bool_and);
 }
 
+/*!
+ *\brief	Copy a list of matchers, for instance for another
+ *		thread to match with it
+ *
+ *\param	src List of matchers
+ *
+ *\return	MatcherList * The copy
+ */
+MatcherList *matcherlist_copy(const MatcherList *src)
+{
+	GSList *matchers = NULL;
+	GSList *l;
+
+	for (l = src->matchers; l != NULL; l = g_slist_next(l))
+		matchers = g_slist_prepend(matchers,
+				matcherprop_copy((MatcherProp *) l->data));
+
+	return matcherlist_new(g_slist_reverse(matchers), src->bool_and);
+}
+
 /*!
  *\brief	Frees a list of matchers
  *
@@ -1485,6 +1575,251 @@ static gboolean matcherprop_criteria_message(MatcherProp *matcher)
 	}
 }
 
+/* Filtering checks every rule of a list against the same message:
+ * between matcher_begin_message() and matcher_end_message(), the
+ * header lines, the MIME structure and the lines of the text parts
+ * scanned are kept, instead of being read again for each rule. */
+typedef struct _MatcherMsgContext {
+	MsgInfo *info;
+	gchar *file;
+	GPtrArray *headers;
+	MimeInfo *mimeinfo;
+	/* MimeInfo * of a text part -> GPtrArray of its lines */
+	GHashTable *part_lines;
+	/* names of the tags, when matched outside of the main thread */
+	GSList *tags;
+	gboolean has_tags;
+	struct _MatcherMsgContext *prev;
+} MatcherMsgContext;
+
+static GPrivate matcher_msg_context;
+
+static void matcher_part_lines_free(gpointer data)
+{
+	g_ptr_array_free((GPtrArray *)data, TRUE);
+}
+
+/*!
+ *\brief	Keep what is read of a message for the following
+ *		matcherlist_match() calls on it, in this thread
+ *
+ *\param	info Message info
+ *\param	file Message file, or NULL to get it from the folder
+ *		when needed. Matching can be done outside of the main
+ *		thread when it's given.
+ *\param	tags Names of the tags of the message, from
+ *		matcher_get_tag_names() on the main thread, when file
+ *		is given; the list is taken
+ */
+void matcher_begin_message_file(MsgInfo *info, const gchar *file,
+				GSList *tags)
+{
+	MatcherMsgContext *ctx;
+
+	cm_return_if_fail(info != NULL);
+
+	ctx = g_new0(MatcherMsgContext, 1);
+	ctx->info = info;
+	ctx->file = g_strdup(file);
+	ctx->tags = tags;
+	ctx->has_tags = (file != NULL);
+	ctx->prev = g_private_get(&matcher_msg_context);
+	ctx->part_lines = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						NULL, matcher_part_lines_free);
+	g_private_set(&matcher_msg_context, ctx);
+}
+
+void matcher_begin_message(MsgInfo *info)
+{
+	matcher_begin_message_file(info, NULL, NULL);
+}
+
+/*!
+ *\brief	Drop what was kept since the last matcher_begin_message()
+ */
+void matcher_end_message(void)
+{
+	MatcherMsgContext *ctx = g_private_get(&matcher_msg_context);
+
+	if (ctx == NULL)
+		return;
+
+	g_private_set(&matcher_msg_context, ctx->prev);
+	if (ctx->headers)
+		g_ptr_array_free(ctx->headers, TRUE);
+	g_hash_table_destroy(ctx->part_lines);
+	procmime_mimeinfo_free_all(&ctx->mimeinfo);
+	slist_free_strings_full(ctx->tags);
+	g_free(ctx->file);
+	g_free(ctx);
+}
+
+/*!
+ *\brief	Get the names of the tags of a message, for matching it
+ *		outside of the main thread, which owns the tags
+ *
+ *\param	info Message info
+ *
+ *\return	GSList * The names, to give to matcher_begin_message_file()
+ */
+GSList *matcher_get_tag_names(MsgInfo *info)
+{
+	GSList *names = NULL;
+	GSList *cur;
+
+	cm_return_val_if_fail(info != NULL, NULL);
+
+	for (cur = info->tags; cur != NULL; cur = cur->next) {
+		const gchar *str = tags_get_tag(GPOINTER_TO_INT(cur->data));
+
+		if (str != NULL)
+			names = g_slist_prepend(names, g_strdup(str));
+	}
+
+	return g_slist_reverse(names);
+}
+
+static MatcherMsgContext *matcher_msg_context_get(MsgInfo *info)
+{
+	MatcherMsgContext *ctx = g_private_get(&matcher_msg_context);
+
+	return (ctx && ctx->info == info) ? ctx : NULL;
+}
+
+/* The tag names of the message given with matcher_begin_message_file(),
+ * if any; the tags of the MsgInfo are only read on the main thread */
+static gboolean matcher_msg_context_tags(MsgInfo *info, GSList **names)
+{
+	MatcherMsgContext *ctx = matcher_msg_context_get(info);
+
+	if (ctx == NULL || !ctx->has_tags)
+		return FALSE;
+	*names = ctx->tags;
+	return TRUE;
+}
+
+static GPtrArray *matcher_msg_context_headers(MatcherMsgContext *ctx,
+					      gboolean read_body)
+{
+	gchar *file;
+	FILE *fp;
+	gchar *buf = NULL;
+
+	if (ctx->headers)
+		return ctx->headers;
+
+	if (ctx->file)
+		file = g_strdup(ctx->file);
+	else
+		file = procmsg_get_message_file_full(ctx->info, TRUE, read_body);
+	if (file == NULL)
+		return NULL;
+
+	if ((fp = claws_fopen(file, "rb")) == NULL) {
+		FILE_OP_ERROR(file, "claws_fopen");
+		g_free(file);
+		return NULL;
+	}
+	g_free(file);
+
+	ctx->headers = g_ptr_array_new_with_free_func(g_free);
+	while (procheader_get_one_field(&buf, fp, NULL) != -1) {
+		g_ptr_array_add(ctx->headers, buf);
+		buf = NULL;
+	}
+	claws_fclose(fp);
+
+	return ctx->headers;
+}
+
+/*!
+ *\brief	Check if a list of conditions matches a header line
+ *
+ *\param	matchers List of conditions
+ *\param	buf Header line
+ *
+ *\return	gboolean TRUE if the header is matched by the list of
+ *		conditions and no other header needs to be checked.
+ */
+static gboolean matcherlist_match_header_line(MatcherList *matchers,
+					      gchar *buf)
+{
+	GSList *l;
+
+	for (l = matchers->matchers ; l != NULL ; l = g_slist_next(l)) {
+		MatcherProp *matcher = (MatcherProp *) l->data;
+		gint match = MATCH_ANY;
+
+		if (matcher->done)
+			continue;
+
+		/* determine the match range (all, any are our concern here) */
+		if (matcher->criteria == MATCHCRITERIA_NOT_HEADERS_PART ||
+		    matcher->criteria == MATCHCRITERIA_NOT_HEADERS_CONT ||
+		    matcher->criteria == MATCHCRITERIA_NOT_MESSAGE) {
+			match = MATCH_ALL;
+
+		} else if (matcher->criteria == MATCHCRITERIA_FOUND_IN_ADDRESSBOOK ||
+		 		   matcher->criteria == MATCHCRITERIA_NOT_FOUND_IN_ADDRESSBOOK) {
+			Header *header = NULL;
+
+			/* address header is one of the headers we have to match when checking
+			   for any address header or all address headers? */
+			header = procheader_parse_header(buf);
+			if (header &&
+				(procheader_headername_equal(header->name, "From") ||
+				 procheader_headername_equal(header->name, "To") ||
+				 procheader_headername_equal(header->name, "Cc") ||
+				 procheader_headername_equal(header->name, "Reply-To") ||
+				 procheader_headername_equal(header->name, "Sender") ||
+				 procheader_headername_equal(header->name, "Resent-From") ||
+				 procheader_headername_equal(header->name, "Resent-To"))) {
+
+				if (strcasecmp(matcher->header, "Any") == 0)
+					match = MATCH_ANY;
+				else if (strcasecmp(matcher->header, "All") == 0)
+					match = MATCH_ALL;
+				else
+					match = MATCH_ONE;
+			} else {
+				if (!header)
+					continue;
+				/* matching one address header exactly, is that the right one?
+				   further call to matcherprop_match_one_header() will tell us */
+			}
+			procheader_header_free(header);
+		}
+
+		/* ZERO line must NOT match for the rule to match.
+		 */
+		if (match == MATCH_ALL) {
+			if (matcherprop_match_one_header(matcher, buf)) {
+				matcher->result = TRUE;
+			} else {
+				matcher->result = FALSE;
+				matcher->done = TRUE;
+			}
+		/* else, just one line matching is enough for the rule to match
+		 */
+		} else if (matcherprop_criteria_headers(matcher) ||
+		           matcherprop_criteria_message(matcher)) {
+			if (matcherprop_match_one_header(matcher, buf)) {
+				matcher->result = TRUE;
+				matcher->done = TRUE;
+			}
+		}
+		
+		/* if the rule matched and the matchers are OR, no need to
+		 * check the others */
+		if (matcher->result && matcher->done) {
+			if (!matchers->bool_and)
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
 /*!
  *\brief	Check if a list of conditions matches one header in
  *		a message file.
@@ -1497,82 +1832,13 @@ static gboolean matcherprop_criteria_message(MatcherProp *matcher)
  */
 static gboolean matcherlist_match_headers(MatcherList *matchers, FILE *fp)
 {
-	GSList *l;
 	gchar *buf = NULL;
 	gint ret;
 
 	while ((ret = procheader_get_one_field(&buf, fp, NULL)) != -1) {
-		for (l = matchers->matchers ; l != NULL ; l = g_slist_next(l)) {
-			MatcherProp *matcher = (MatcherProp *) l->data;
-			gint match = MATCH_ANY;
-
-			if (matcher->done)
-				continue;
-
-			/* determine the match range (all, any are our concern here) */
-			if (matcher->criteria == MATCHCRITERIA_NOT_HEADERS_PART ||
-			    matcher->criteria == MATCHCRITERIA_NOT_HEADERS_CONT ||
-			    matcher->criteria == MATCHCRITERIA_NOT_MESSAGE) {
-				match = MATCH_ALL;
-
-			} else if (matcher->criteria == MATCHCRITERIA_FOUND_IN_ADDRESSBOOK ||
-			 		   matcher->criteria == MATCHCRITERIA_NOT_FOUND_IN_ADDRESSBOOK) {
-				Header *header = NULL;
-
-				/* address header is one of the headers we have to match when checking
-				   for any address header or all address headers? */
-				header = procheader_parse_header(buf);
-				if (header &&
-					(procheader_headername_equal(header->name, "From") ||
-					 procheader_headername_equal(header->name, "To") ||
-					 procheader_headername_equal(header->name, "Cc") ||
-					 procheader_headername_equal(header->name, "Reply-To") ||
-					 procheader_headername_equal(header->name, "Sender") ||
-					 procheader_headername_equal(header->name, "Resent-From") ||
-					 procheader_headername_equal(header->name, "Resent-To"))) {
-
-					if (strcasecmp(matcher->header, "Any") == 0)
-						match = MATCH_ANY;
-					else if (strcasecmp(matcher->header, "All") == 0)
-						match = MATCH_ALL;
-					else
-						match = MATCH_ONE;
-				} else {
-					if (!header)
-						continue;
-					/* matching one address header exactly, is that the right one?
-					   further call to matcherprop_match_one_header() will tell us */
-				}
-				procheader_header_free(header);
-			}
-
-			/* ZERO line must NOT match for the rule to match.
-			 */
-			if (match == MATCH_ALL) {
-				if (matcherprop_match_one_header(matcher, buf)) {
-					matcher->result = TRUE;
-				} else {
-					matcher->result = FALSE;
-					matcher->done = TRUE;
-				}
-			/* else, just one line matching is enough for the rule to match
-			 */
-			} else if (matcherprop_criteria_headers(matcher) ||
-			           matcherprop_criteria_message(matcher)) {
-				if (matcherprop_match_one_header(matcher, buf)) {
-					matcher->result = TRUE;
-					matcher->done = TRUE;
-				}
-			}
-			
-			/* if the rule matched and the matchers are OR, no need to
-			 * check the others */
-			if (matcher->result && matcher->done) {
-				if (!matchers->bool_and) {
-					g_free(buf);
-					return TRUE;
-				}
-			}
+		if (matcherlist_match_header_line(matchers, buf)) {
+			g_free(buf);
+			return TRUE;
 		}
 		g_free(buf);
 		buf = NULL;
@@ -1599,16 +1865,68 @@ static gboolean matcherprop_criteria_body(const MatcherProp *matcher)
 	}
 }
 	
+static gboolean matcherlist_match_binary_line(MatcherList *matchers,
+					      const gchar *buf)
+{
+	GSList *l;
+
+	for (l = matchers->matchers ; l != NULL ; l = g_slist_next(l)) {
+		MatcherProp *matcher = (MatcherProp *) l->data;
+
+		if (matcher->done) 
+			continue;
+
+		/* Don't scan non-text parts when looking in body, only
+		 * when looking in whole message
+		 */
+		if (matcher->criteria == MATCHCRITERIA_NOT_BODY_PART ||
+		    matcher->criteria == MATCHCRITERIA_BODY_PART)
+			continue;
+
+		/* if the criteria is ~body_part or ~message, ZERO lines
+		 * must match for the rule to match.
+		 */
+		if (matcher->criteria == MATCHCRITERIA_NOT_BODY_PART ||
+		    matcher->criteria == MATCHCRITERIA_NOT_MESSAGE) {
+			if (matcherprop_string_match(matcher, buf, 
+						context_str[CONTEXT_BODY_LINE])) {
+				matcher->result = FALSE;
+				matcher->done = TRUE;
+			} else
+				matcher->result = TRUE;
+		/* else, just one line has to match */
+		} else if (matcherprop_criteria_body(matcher) ||
+			   matcherprop_criteria_message(matcher)) {
+			if (matcherprop_string_match(matcher, buf,
+						context_str[CONTEXT_BODY_LINE])) {
+				matcher->result = TRUE;
+				matcher->done = TRUE;
+			}
+		}
+
+		/* if the matchers are OR'ed and the rule matched,
+		 * no need to check the others. */
+		if (matcher->result && matcher->done) {
+			if (!matchers->bool_and)
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Non-text parts can be big: they're read again for each rule rather
+ * than kept, and only up to the first line matching. */
 static gboolean matcherlist_match_binary_content(MatcherList *matchers, MimeInfo *partinfo)
 {
 	FILE *outfp;
+	gchar *mem;
 	gchar buf[BUFFSIZE];
-	GSList *l;
 
 	if (!partinfo || partinfo->type == MIMETYPE_TEXT)
 		return FALSE;
-	else
-		outfp = procmime_get_binary_content(partinfo);
+
+	outfp = procmime_open_decoded_part(partinfo, &mem);
 
 	if (!outfp)
 		return FALSE;
@@ -1616,52 +1934,13 @@ static gboolean matcherlist_match_binary_content(MatcherList *matchers, MimeInfo
 	while (claws_fgets(buf, sizeof(buf), outfp) != NULL) {
 		strretchomp(buf);
 
-		for (l = matchers->matchers ; l != NULL ; l = g_slist_next(l)) {
-			MatcherProp *matcher = (MatcherProp *) l->data;
-
-			if (matcher->done) 
-				continue;
-
-			/* Don't scan non-text parts when looking in body, only
-			 * when looking in whole message
-			 */
-			if (matcher->criteria == MATCHCRITERIA_NOT_BODY_PART ||
-			    matcher->criteria == MATCHCRITERIA_BODY_PART)
-				continue;
-
-			/* if the criteria is ~body_part or ~message, ZERO lines
-			 * must match for the rule to match.
-			 */
-			if (matcher->criteria == MATCHCRITERIA_NOT_BODY_PART ||
-			    matcher->criteria == MATCHCRITERIA_NOT_MESSAGE) {
-				if (matcherprop_string_match(matcher, buf, 
-							context_str[CONTEXT_BODY_LINE])) {
-					matcher->result = FALSE;
-					matcher->done = TRUE;
-				} else
-					matcher->result = TRUE;
-			/* else, just one line has to match */
-			} else if (matcherprop_criteria_body(matcher) ||
-				   matcherprop_criteria_message(matcher)) {
-				if (matcherprop_string_match(matcher, buf,
-							context_str[CONTEXT_BODY_LINE])) {
-					matcher->result = TRUE;
-					matcher->done = TRUE;
-				}
-			}
-
-			/* if the matchers are OR'ed and the rule matched,
-			 * no need to check the others. */
-			if (matcher->result && matcher->done) {
-				if (!matchers->bool_and) {
-					claws_fclose(outfp);
-					return TRUE;
-				}
-			}
+		if (matcherlist_match_binary_line(matchers, buf)) {
+			procmime_close_decoded_part(outfp, mem);
+			return TRUE;
 		}
 	}
 
-	claws_fclose(outfp);
+	procmime_close_decoded_part(outfp, mem);
 	return FALSE;
 }
 
@@ -1712,12 +1991,35 @@ static gboolean match_content_cb(const gchar *buf, gpointer data)
 	return all_done;
 }
 
-static gboolean matcherlist_match_text_content(MatcherList *matchers, MimeInfo *partinfo)
+static gboolean collect_content_cb(const gchar *buf, gpointer data)
+{
+	g_ptr_array_add((GPtrArray *)data, g_strdup(buf));
+	return FALSE;
+}
+
+static gboolean matcherlist_match_text_content(MatcherList *matchers, MimeInfo *partinfo,
+					       MatcherMsgContext *ctx)
 {
+	GPtrArray *lines;
+	guint i;
+
 	if (partinfo->type != MIMETYPE_TEXT)
 		return FALSE;
 
-	return procmime_scan_text_content(partinfo, match_content_cb, matchers);
+	if (!ctx)
+		return procmime_scan_text_content(partinfo, match_content_cb, matchers);
+
+	lines = g_hash_table_lookup(ctx->part_lines, partinfo);
+	if (lines == NULL) {
+		lines = g_ptr_array_new_with_free_func(g_free);
+		procmime_scan_text_content(partinfo, collect_content_cb, lines);
+		g_hash_table_insert(ctx->part_lines, partinfo, lines);
+	}
+	for (i = 0; i < lines->len; i++)
+		if (match_content_cb(g_ptr_array_index(lines, i), matchers))
+			return TRUE;
+
+	return FALSE;
 }
 
 /*!
@@ -1731,13 +2033,27 @@ static gboolean matcherlist_match_text_content(MatcherList *matchers, MimeInfo *
  */
 static gboolean matcherlist_match_body(MatcherList *matchers, gboolean body_only, MsgInfo *info)
 {
+	MatcherMsgContext *ctx = matcher_msg_context_get(info);
 	MimeInfo *mimeinfo = NULL;
 	MimeInfo *partinfo = NULL;
 	gboolean first_text_found = FALSE;
+	gboolean result = FALSE;
 
 	cm_return_val_if_fail(info != NULL, FALSE);
 
-	mimeinfo = procmime_scan_message(info);
+	if (ctx) {
+		if (!ctx->mimeinfo && !ctx->file)
+			ctx->mimeinfo = procmime_scan_message(info);
+		else if (!ctx->mimeinfo) {
+			if (!folder_has_parent_of_type(info->folder, F_QUEUE) &&
+			    !folder_has_parent_of_type(info->folder, F_DRAFT))
+				ctx->mimeinfo = procmime_scan_file(ctx->file);
+			else
+				ctx->mimeinfo = procmime_scan_queue_file(ctx->file);
+		}
+		mimeinfo = ctx->mimeinfo;
+	} else
+		mimeinfo = procmime_scan_message(info);
 
 	/* Skip headers */
 	partinfo = procmime_mimeinfo_next(mimeinfo);
@@ -1749,21 +2065,58 @@ static gboolean matcherlist_match_body(MatcherList *matchers, gboolean body_only
 
 		if (partinfo->type == MIMETYPE_TEXT) {
 			first_text_found = TRUE;
-			if (matcherlist_match_text_content(matchers, partinfo)) {
-				procmime_mimeinfo_free_all(&mimeinfo);
-				return TRUE;
+			if (matcherlist_match_text_content(matchers, partinfo, ctx)) {
+				result = TRUE;
+				break;
 			}
 		} else if (matcherlist_match_binary_content(matchers, partinfo)) {
-			procmime_mimeinfo_free_all(&mimeinfo);
-			return TRUE;
+			result = TRUE;
+			break;
 		}
 
 		if (body_only && first_text_found)
 			break;
 	}
-	procmime_mimeinfo_free_all(&mimeinfo);
+	if (!ctx)
+		procmime_mimeinfo_free_all(&mimeinfo);
 
-	return FALSE;
+	return result;
+}
+
+/*!
+ *\brief	Combine the results of the header and body conditions
+ *
+ *\param	matchers Criteria
+ *\param	result Default result
+ *
+ *\return	gboolean TRUE if matched
+ */
+static gboolean matcherlist_match_result(MatcherList *matchers, gboolean result)
+{
+	GSList *l;
+
+	for (l = matchers->matchers; l != NULL; l = g_slist_next(l)) {
+		MatcherProp *matcher = (MatcherProp *) l->data;
+
+		if (matcherprop_criteria_headers(matcher) ||
+		    matcherprop_criteria_body(matcher)	  ||
+		    matcherprop_criteria_message(matcher)) {
+			if (matcher->result) {
+				if (!matchers->bool_and) {
+					result = TRUE;
+					break;
+				}
+			}
+			else {
+				if (matchers->bool_and) {
+					result = FALSE;
+					break;
+				}
+			}
+		}			
+	}
+
+	return result;
 }
 
 /*!
@@ -1784,6 +2137,7 @@ static gboolean matcherlist_match_file(MatcherList *matchers, MsgInfo *info,
 	GSList *l;
 	FILE *fp;
 	gchar *file;
+	MatcherMsgContext *ctx;
 
 	/* file need to be read ? */
 
@@ -1809,6 +2163,28 @@ static gboolean matcherlist_match_file(MatcherList *matchers, MsgInfo *info,
 	if (!read_headers && !read_body)
 		return result;
 
+	if ((ctx = matcher_msg_context_get(info)) != NULL) {
+		GPtrArray *headers = NULL;
+		guint i;
+
+		if (read_headers) {
+			headers = matcher_msg_context_headers(ctx, read_body);
+			if (headers == NULL)
+				return result;
+		}
+		for (i = 0; headers && i < headers->len; i++) {
+			if (matcherlist_match_header_line(matchers,
+					g_ptr_array_index(headers, i))) {
+				read_body = FALSE;
+				break;
+			}
+		}
+		if (read_body)
+			matcherlist_match_body(matchers, body_only, info);
+
+		return matcherlist_match_result(matchers, result);
+	}
+
 	file = procmsg_get_message_file_full(info, read_headers, read_body);
 	if (file == NULL)
 		return FALSE;
@@ -1833,32 +2209,146 @@ static gboolean matcherlist_match_file(MatcherList *matchers, MsgInfo *info,
 		matcherlist_match_body(matchers, body_only, info);
 	}
 	
+	g_free(file);
+
+	claws_fclose(fp);
+	
+	return matcherlist_match_result(matchers, result);
+}
+
+/*!
+ *\brief	Check if a list of conditions needs the message file
+ *
+ *\param	matchers List of conditions
+ *
+ *\return	gboolean TRUE if headers or body are matched
+ */
+gboolean matcherlist_needs_file(const MatcherList *matchers)
+{
+	GSList *l;
+
 	for (l = matchers->matchers; l != NULL; l = g_slist_next(l)) {
 		MatcherProp *matcher = (MatcherProp *) l->data;
 
 		if (matcherprop_criteria_headers(matcher) ||
-		    matcherprop_criteria_body(matcher)	  ||
-		    matcherprop_criteria_message(matcher)) {
-			if (matcher->result) {
-				if (!matchers->bool_and) {
-					result = TRUE;
-					break;
-				}
-			}
-			else {
-				if (matchers->bool_and) {
-					result = FALSE;
-					break;
-				}
-			}
-		}			
+		    matcherprop_criteria_body(matcher) ||
+		    matcherprop_criteria_message(matcher))
+			return TRUE;
 	}
 
-	g_free(file);
+	return FALSE;
+}
 
-	claws_fclose(fp);
-	
-	return result;
+/*!
+ *\brief	Check if a list of conditions can be matched outside of
+ *		the main thread, given the message file with
+ *		matcher_begin_message_file(), with the tag names got
+ *		from the main thread. Address book lookups and test
+ *		commands need the main thread.
+ *
+ *\param	matchers List of conditions
+ *
+ *\return	gboolean TRUE if it can
+ */
+gboolean matcherlist_is_thread_safe(const MatcherList *matchers)
+{
+	GSList *l;
+
+	for (l = matchers->matchers; l != NULL; l = g_slist_next(l)) {
+		MatcherProp *matcher = (MatcherProp *) l->data;
+
+		switch (matcher->criteria) {
+		case MATCHCRITERIA_FOUND_IN_ADDRESSBOOK:
+		case MATCHCRITERIA_NOT_FOUND_IN_ADDRESSBOOK:
+		case MATCHCRITERIA_TEST:
+		case MATCHCRITERIA_NOT_TEST:
+			return FALSE;
+		default:
+			break;
+		}
+	}
+
+	return TRUE;
+}
+
+/*!
+ *\brief	Get the string a condition looks for in the lines of a
+ *		message, if a message index can tell it's absent
+ *
+ *\param	matcher Matcher structure
+ *
+ *\return	const gchar * The string as it's searched for, or NULL
+ */
+static const gchar *matcherprop_index_str(MatcherProp *matcher)
+{
+	if ((matcher->criteria != MATCHCRITERIA_BODY_PART &&
+	     matcher->criteria != MATCHCRITERIA_MESSAGE) ||
+	    matcher->expr == NULL)
+		return NULL;
+
+	switch (matcher->matchtype) {
+	case MATCHTYPE_MATCH:
+		return matcher->expr;
+	case MATCHTYPE_MATCHCASE:
+		if (!matcher->casefold_expr)
+			matcher->casefold_expr = g_utf8_casefold(matcher->expr, -1);
+		return matcher->casefold_expr;
+	default:
+		return NULL;
+	}
+}
+
+/*!
+ *\brief	Check if a message index can rule messages out for a
+ *		list of conditions
+ *
+ *\param	matchers List of conditions
+ *
+ *\return	gboolean TRUE if one of the conditions can be looked up
+ */
+gboolean matcherlist_uses_index(MatcherList *matchers)
+{
+	GSList *l;
+
+	for (l = matchers->matchers; l != NULL; l = g_slist_next(l)) {
+		if (matcherprop_index_str((MatcherProp *)l->data) != NULL)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*!
+ *\brief	Check with a message index if a message may match a list
+ *		of conditions, without reading it
+ *
+ *\param	matchers List of conditions
+ *\param	index Message index of the message's folder
+ *\param	msgnum Number of the message
+ *
+ *\return	gboolean FALSE if the message can't match, TRUE if
+ *		matcherlist_match() has to tell
+ */
+gboolean matcherlist_match_index(MatcherList *matchers, MsgIndex *index,
+				 guint msgnum)
+{
+	GSList *l;
+
+	for (l = matchers->matchers; l != NULL; l = g_slist_next(l)) {
+		MatcherProp *matcher = (MatcherProp *) l->data;
+		const gchar *str = matcherprop_index_str(matcher);
+		gboolean possible;
+
+		possible = (str == NULL) ||
+			   msgindex_may_contain(index, msgnum, str,
+				matcher->criteria == MATCHCRITERIA_MESSAGE);
+		if (matchers->bool_and && !possible)
+			return FALSE;
+		if (!matchers->bool_and && possible)
+			return TRUE;
+	}
+
+	return matchers->bool_and;
 }
 
 /*!
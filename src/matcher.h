@@ -25,6 +25,7 @@
 #include <glib.h>
 #include "proctypes.h"
 #include "matchertypes.h"
+#include "msgindex.h"
 
 /* constants generated by yacc */
 #include "matcher_parser_lex.h"
@@ -171,12 +172,25 @@ MatcherList * matcherlist_new		(GSList		*matchers,
 MatcherList * matcherlist_new_from_lines(gchar		*lines,
 					 gboolean	bool_and,
 					 gboolean	case_sensitive);
+MatcherList *matcherlist_copy		(const MatcherList	*src);
 void matcherlist_free			(MatcherList	*cond);
 
 MatcherList *matcherlist_parse		(gchar		**str);
 
 gboolean matcherlist_match		(MatcherList	*cond, 
 					 MsgInfo	*info);
+gboolean matcherlist_needs_file		(const MatcherList	*matchers);
+gboolean matcherlist_is_thread_safe	(const MatcherList	*matchers);
+gboolean matcherlist_uses_index		(MatcherList	*matchers);
+gboolean matcherlist_match_index	(MatcherList	*matchers,
+					 MsgIndex	*index,
+					 guint		 msgnum);
+void matcher_begin_message		(MsgInfo	*info);
+void matcher_begin_message_file		(MsgInfo	*info,
+					 const gchar	*file,
+					 GSList		*tags);
+GSList *matcher_get_tag_names		(MsgInfo	*info);
+void matcher_end_message		(void);
 
 gint matcher_parse_keyword		(gchar		**str);
 gint matcher_parse_number		(gchar		**str);
@@ -30,6 +30,13 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#ifndef G_OS_WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 #include "folder.h"
 #include "folder_item_prefs.h"
@@ -43,6 +50,8 @@
 #include "timing.h"
 #include "msgcache.h"
 #include "file-utils.h"
+#include "prefs_common.h"
+#include "inc.h"
 
 /* Define possible missing constants for Windows. */
 #ifdef G_OS_WIN32
@@ -56,6 +65,28 @@
 # endif
 #endif
 
+typedef struct _MHFolderItem	MHFolderItem;
+typedef struct _MHStat		MHStat;
+
+struct _MHFolderItem
+{
+	FolderItem item;
+
+	/* message number -> MHStat, as of the last scan */
+	GHashTable *stat_index;
+#ifdef HAVE_SYS_INOTIFY_H
+	int watch;		/* inotify watch descriptor, 0 if none */
+	gboolean watch_valid;	/* stat_index and changed tell it all */
+	GHashTable *changed;	/* message numbers touched since */
+#endif
+};
+
+struct _MHStat
+{
+	ino_t ino;
+	goffset size;
+	time_t mtime;
+};
 
 static void	mh_folder_init		(Folder		*folder,
 					 const gchar	*name,
@@ -64,6 +95,9 @@ static void	mh_folder_init		(Folder		*folder,
 static Folder	*mh_folder_new		(const gchar	*name,
 					 const gchar	*path);
 static void     mh_folder_destroy	(Folder		*folder);
+static FolderItem *mh_folder_item_new	(Folder		*folder);
+static void	mh_folder_item_destroy	(Folder		*folder,
+					 FolderItem	*item);
 static gchar   *mh_fetch_msg		(Folder		*folder,
 					 FolderItem	*item,
 					 gint		 num);
@@ -139,6 +173,9 @@ static gint mh_get_flags		(Folder *folder, FolderItem *item,
                            		 MsgInfoList *msginfo_list, GHashTable *msgflags);
 #endif
 static void mh_write_sequences		(FolderItem 	*item, gboolean remove_unseen);
+#ifdef HAVE_SYS_INOTIFY_H
+static void mh_unwatch_item		(FolderItem	*item);
+#endif
 
 static FolderClass mh_class;
 
@@ -159,6 +196,8 @@ FolderClass *mh_get_class(void)
 		mh_class.create_tree = mh_create_tree;
 
 		/* FolderItem functions */
+		mh_class.item_new = mh_folder_item_new;
+		mh_class.item_destroy = mh_folder_item_destroy;
 		mh_class.item_get_path = mh_item_get_path;
 		mh_class.create_folder = mh_create_folder;
 		mh_class.rename_folder = mh_rename_folder;
@@ -208,38 +247,333 @@ static void mh_folder_init(Folder *folder, const gchar *name, const gchar *path)
 
 }
 
-gboolean mh_scan_required(Folder *folder, FolderItem *item)
+static FolderItem *mh_folder_item_new(Folder *folder)
+{
+	return (FolderItem *)g_new0(MHFolderItem, 1);
+}
+
+static void mh_folder_item_destroy(Folder *folder, FolderItem *item)
+{
+	MHFolderItem *mitem = (MHFolderItem *)item;
+
+	cm_return_if_fail(item != NULL);
+
+#ifdef HAVE_SYS_INOTIFY_H
+	mh_unwatch_item(item);
+#endif
+	if (mitem->stat_index)
+		g_hash_table_destroy(mitem->stat_index);
+	g_free(item);
+}
+
+/* Plugins borrow some of our functions for their own items */
+static GHashTable *mh_item_stat_index(FolderItem *item)
+{
+	if (item->folder == NULL || item->folder->klass != &mh_class)
+		return NULL;
+	return ((MHFolderItem *)item)->stat_index;
+}
+
+static void mh_item_stat_forget(FolderItem *item, gint num)
+{
+	GHashTable *index = mh_item_stat_index(item);
+
+	if (index == NULL)
+		return;
+	g_hash_table_remove(index, GINT_TO_POINTER(num));
+#ifdef HAVE_SYS_INOTIFY_H
+	if (((MHFolderItem *)item)->changed)
+		g_hash_table_add(((MHFolderItem *)item)->changed,
+				 GINT_TO_POINTER(num));
+#endif
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/* Live watching of the folder directories with inotify. The message
+ * numbers touched by events are queued on the item; the next scan only
+ * looks at those, and a scan is started on its own when the directory
+ * changed behind our back (procmail, fdm, mbsync...). */
+
+#define MH_WATCH_EVENTS	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+			 IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static int mh_watch_fd = -1;
+static GHashTable *mh_watches = NULL;		/* wd -> MHFolderItem */
+static GHashTable *mh_watch_pending = NULL;	/* MHFolderItem set */
+static guint mh_watch_scan_tag = 0;
+
+static gboolean mh_watch_scan_pending(gpointer data)
+{
+	GList *items, *cur;
+
+	/* don't get in the way, try again in a moment */
+	if (inc_is_active())
+		return TRUE;
+
+	items = g_hash_table_get_keys(mh_watch_pending);
+	for (cur = items; cur != NULL; cur = cur->next) {
+		if (((FolderItem *)cur->data)->scanning != ITEM_NOT_SCANNING) {
+			g_list_free(items);
+			return TRUE;
+		}
+	}
+	g_hash_table_remove_all(mh_watch_pending);
+	mh_watch_scan_tag = 0;
+
+	inc_lock();
+	for (cur = items; cur != NULL; cur = cur->next) {
+		FolderItem *item = cur->data;
+
+		/* our own changes are already accounted for */
+		if (mh_scan_required(item->folder, item)) {
+			debug_print("MH watch: scanning %s\n", item->path);
+			folder_item_scan(item);
+		}
+	}
+	inc_unlock();
+	g_list_free(items);
+
+	return FALSE;
+}
+
+static void mh_watch_set_pending(MHFolderItem *mitem)
+{
+	g_hash_table_add(mh_watch_pending, mitem);
+	if (mh_watch_scan_tag == 0)
+		mh_watch_scan_tag = g_timeout_add_seconds(1, mh_watch_scan_pending, NULL);
+}
+
+static void mh_watch_invalidate(gpointer key, gpointer value, gpointer data)
+{
+	MHFolderItem *mitem = value;
+
+	mitem->watch_valid = FALSE;
+	mh_watch_set_pending(mitem);
+}
+
+static void mh_watch_handle_event(const struct inotify_event *ev)
+{
+	MHFolderItem *mitem;
+	gint num;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		debug_print("MH watch: event queue overflow\n");
+		g_hash_table_foreach(mh_watches, mh_watch_invalidate, NULL);
+		return;
+	}
+
+	mitem = g_hash_table_lookup(mh_watches, GINT_TO_POINTER(ev->wd));
+	if (mitem == NULL)
+		return;
+
+	if (ev->mask & IN_IGNORED) {
+		/* the directory is gone */
+		g_hash_table_remove(mh_watches, GINT_TO_POINTER(ev->wd));
+		mitem->watch = 0;
+		mitem->watch_valid = FALSE;
+		return;
+	}
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+		mitem->watch_valid = FALSE;
+		return;
+	}
+
+	if (ev->len == 0 || (num = to_number(ev->name)) <= 0)
+		return;
+
+	g_hash_table_add(mitem->changed, GINT_TO_POINTER(num));
+	mh_watch_set_pending(mitem);
+}
+
+static void mh_watch_read_events(void)
+{
+	gchar buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len;
+	gchar *ptr;
+
+	if (mh_watch_fd < 0)
+		return;
+
+	while ((len = read(mh_watch_fd, buf, sizeof(buf))) > 0) {
+		for (ptr = buf; ptr < buf + len;
+		     ptr += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *)ptr;
+			mh_watch_handle_event(ev);
+		}
+	}
+}
+
+static gboolean mh_watch_io_cb(GIOChannel *source, GIOCondition condition,
+			       gpointer data)
+{
+	mh_watch_read_events();
+	return TRUE;
+}
+
+static gboolean mh_watch_init(void)
+{
+	GIOChannel *chan;
+
+	if (mh_watch_fd >= 0)
+		return TRUE;
+
+	mh_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (mh_watch_fd < 0) {
+		FILE_OP_ERROR("inotify", "inotify_init1");
+		return FALSE;
+	}
+	mh_watches = g_hash_table_new(g_direct_hash, g_direct_equal);
+	mh_watch_pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	chan = g_io_channel_unix_new(mh_watch_fd);
+	g_io_add_watch(chan, G_IO_IN, mh_watch_io_cb, NULL);
+	g_io_channel_unref(chan);
+
+	return TRUE;
+}
+
+static void mh_watch_item(FolderItem *item, const gchar *path)
+{
+	MHFolderItem *mitem = (MHFolderItem *)item;
+	int wd;
+
+	if (!prefs_common.mh_watch_folders || mitem->watch != 0
+	    || !mh_watch_init())
+		return;
+
+	wd = inotify_add_watch(mh_watch_fd, path, MH_WATCH_EVENTS);
+	if (wd < 0) {
+		debug_print("MH watch: can't watch %s: %s\n", path, g_strerror(errno));
+		return;
+	}
+	mitem->watch = wd;
+	mitem->watch_valid = FALSE;
+	if (mitem->changed == NULL)
+		mitem->changed = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_hash_table_insert(mh_watches, GINT_TO_POINTER(wd), mitem);
+}
+
+static void mh_unwatch_item(FolderItem *item)
+{
+	MHFolderItem *mitem = (MHFolderItem *)item;
+
+	if (mh_watch_fd < 0)
+		return;
+
+	g_hash_table_remove(mh_watch_pending, mitem);
+	if (mitem->watch != 0) {
+		g_hash_table_remove(mh_watches, GINT_TO_POINTER(mitem->watch));
+		inotify_rm_watch(mh_watch_fd, mitem->watch);
+		mitem->watch = 0;
+	}
+	if (mitem->changed != NULL) {
+		g_hash_table_destroy(mitem->changed);
+		mitem->changed = NULL;
+	}
+	mitem->watch_valid = FALSE;
+}
+
+static gboolean mh_watch_item_func(GNode *node, gpointer data)
 {
+	FolderItem *item = node->data;
 	gchar *path;
-	GStatBuf s;
+
+	if (item->path == NULL)
+		return FALSE;
 
 	path = folder_item_get_path(item);
-	cm_return_val_if_fail(path != NULL, FALSE);
+	if (path != NULL)
+		mh_watch_item(item, path);
+	g_free(path);
 
-	if (g_stat(path, &s) < 0) {
-		FILE_OP_ERROR(path, "stat");
-		g_free(path);
-		return FALSE;
+	return FALSE;
+}
+
+/* Builds the list from the last scan and the numbers touched since */
+static gint mh_scan_changes(FolderItem *item, const gchar *path, GSList **list)
+{
+	MHFolderItem *mitem = (MHFolderItem *)item;
+	GHashTableIter iter;
+	gpointer key;
+	struct stat s;
+	MHStat *st;
+	gint nummsgs = 0, nstats = 0;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		FILE_OP_ERROR(path, "open");
+		return -1;
 	}
 
-	if ((s.st_mtime > item->mtime) &&
-		(s.st_mtime - 3600 != item->mtime)) {
+	g_hash_table_iter_init(&iter, mitem->changed);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		gint num = GPOINTER_TO_INT(key);
+
+		nstats++;
+		if (fstatat(fd, itos(num), &s, 0) < 0) {
+			g_hash_table_remove(mitem->stat_index, key);
+			continue;
+		}
+		st = g_new(MHStat, 1);
+		st->ino = s.st_ino;
+		st->size = s.st_size;
+		st->mtime = s.st_mtime;
+		g_hash_table_replace(mitem->stat_index, key, st);
+	}
+	close(fd);
+	g_hash_table_remove_all(mitem->changed);
+
+	g_hash_table_iter_init(&iter, mitem->stat_index);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		*list = g_slist_prepend(*list, key);
+		nummsgs++;
+	}
+
+	debug_print("mh_scan_changes(): %d messages, %d stat'ed\n", nummsgs, nstats);
+	return nummsgs;
+}
+#endif
+
+static gboolean mh_scan_required_mtime(FolderItem *item, const gchar *path,
+				       time_t mtime)
+{
+	if ((mtime > item->mtime) &&
+		(mtime - 3600 != item->mtime)) {
 		debug_print("MH scan required, folder updated: %s (%ld > %ld)\n",
 			    path,
-			    (long int) s.st_mtime,
+			    (long int) mtime,
 			    (long int) item->mtime);
-		g_free(path);
 		return TRUE;
 	}
 
 	debug_print("MH scan not required: %s (%ld <= %ld)\n",
 		    path,
-		    (long int) s.st_mtime,
+		    (long int) mtime,
 		    (long int) item->mtime);
-	g_free(path);
 	return FALSE;
 }
 
+gboolean mh_scan_required(Folder *folder, FolderItem *item)
+{
+	gchar *path;
+	GStatBuf s;
+	gboolean required;
+
+	path = folder_item_get_path(item);
+	cm_return_val_if_fail(path != NULL, FALSE);
+
+	if (g_stat(path, &s) < 0) {
+		FILE_OP_ERROR(path, "stat");
+		g_free(path);
+		return FALSE;
+	}
+
+	required = mh_scan_required_mtime(item, path, s.st_mtime);
+	g_free(path);
+	return required;
+}
+
 static void mh_get_last_num(Folder *folder, FolderItem *item)
 {
 	gchar *path, *fullpath;
@@ -283,6 +617,81 @@ static void mh_get_last_num(Folder *folder, FolderItem *item)
 	item->last_num = max;
 }
 
+#ifndef G_OS_WIN32
+/* Lists the folder in one pass over the directory. The inode numbers
+ * come with the entries; only the files whose inode isn't the one of
+ * the last scan are stat'ed, relative to the directory. */
+static gint mh_scan_dir(FolderItem *item, const gchar *path, GSList **list)
+{
+	MHFolderItem *mitem = (MHFolderItem *)item;
+	GHashTable *old_index = mitem->stat_index;
+	GHashTable *index;
+	DIR *dp;
+	struct dirent *d;
+	struct stat s;
+	MHStat *st;
+	gint num, nummsgs = 0, nstats = 0;
+	int fd;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	mh_watch_read_events();
+	if (mitem->watch != 0 && mitem->watch_valid && old_index != NULL)
+		return mh_scan_changes(item, path, list);
+
+	/* watch first, so that nothing happening while reading is missed */
+	mh_watch_item(item, path);
+	if (mitem->watch != 0) {
+		g_hash_table_remove_all(mitem->changed);
+		mitem->watch_valid = TRUE;
+	}
+#endif
+
+	if ((dp = opendir(path)) == NULL) {
+		FILE_OP_ERROR(path, "opendir");
+#ifdef HAVE_SYS_INOTIFY_H
+		mitem->watch_valid = FALSE;
+#endif
+		return -1;
+	}
+	fd = dirfd(dp);
+
+	index = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				      NULL, g_free);
+
+	while ((d = readdir(dp)) != NULL) {
+		if ((num = to_number(d->d_name)) <= 0)
+			continue;
+
+		st = old_index ? g_hash_table_lookup(old_index,
+						     GINT_TO_POINTER(num)) : NULL;
+		if (st != NULL && st->ino == d->d_ino) {
+			g_hash_table_steal(old_index, GINT_TO_POINTER(num));
+		} else if (fstatat(fd, d->d_name, &s, 0) == 0) {
+			st = g_new(MHStat, 1);
+			st->ino = d->d_ino;
+			st->size = s.st_size;
+			st->mtime = s.st_mtime;
+			nstats++;
+		} else {
+			st = NULL;
+		}
+		if (st != NULL)
+			g_hash_table_insert(index, GINT_TO_POINTER(num), st);
+
+		*list = g_slist_prepend(*list, GINT_TO_POINTER(num));
+		nummsgs++;
+	}
+	closedir(dp);
+
+	if (old_index)
+		g_hash_table_destroy(old_index);
+	mitem->stat_index = index;
+
+	debug_print("mh_scan_dir(): %d messages, %d stat'ed\n", nummsgs, nstats);
+	return nummsgs;
+}
+#endif
+
 gint mh_get_num_list(Folder *folder, FolderItem *item, GSList **list, gboolean *old_uids_valid)
 {
 
@@ -301,6 +710,17 @@ gint mh_get_num_list(Folder *folder, FolderItem *item, GSList **list, gboolean *
 	path = folder_item_get_path(item);
 	cm_return_val_if_fail(path != NULL, -1);
 
+#ifndef G_OS_WIN32
+	if (item->folder->klass == &mh_class) {
+		nummsgs = mh_scan_dir(item, path, list);
+		g_free(path);
+		if (nummsgs < 0)
+			return -1;
+		mh_set_mtime(folder, item);
+		return nummsgs;
+	}
+#endif
+
 	if ((dp = g_dir_open(path, 0, &error)) == NULL) {
 		g_message("Couldn't open current directory: %s (%d).\n",
 				error->message, error->code);
@@ -388,6 +808,8 @@ static gchar *mh_get_new_msg_filename(FolderItem *dest)
 		} else
 			break;
 	}
+	/* a file of the same number may have been there unnoticed */
+	mh_item_stat_forget(dest, dest->last_num + 1);
 
 	g_free(destpath);
 
@@ -648,6 +1070,7 @@ static gint mh_remove_msg(Folder *folder, FolderItem *item, gint num)
 		g_free(file);
 		return -1;
 	}
+	mh_item_stat_forget(item, num);
 
 	if (item->mtime == last_mtime && !need_scan) {
 		mh_set_mtime(folder, item);
@@ -700,6 +1123,7 @@ static gint mh_remove_msgs(Folder *folder, FolderItem *item,
 			g_free(file);
 			continue;
 		}
+		mh_item_stat_forget(item, msginfo->msgnum);
 		
 		g_free(file);
 	}
@@ -728,6 +1152,13 @@ static gint mh_remove_all_msg(Folder *folder, FolderItem *item)
 	val = remove_all_numbered_files(path);
 	g_free(path);
 
+	if (mh_item_stat_index(item)) {
+		g_hash_table_remove_all(mh_item_stat_index(item));
+#ifdef HAVE_SYS_INOTIFY_H
+		((MHFolderItem *)item)->watch_valid = FALSE;
+#endif
+	}
+
 	mh_write_sequences(item, TRUE);
 
 	return val;
@@ -745,9 +1176,21 @@ static gboolean mh_is_msg_changed(Folder *folder, FolderItem *item,
 	GStatBuf s;
 	int r;
 #endif
+	GHashTable *index;
+	MHStat *st;
 	gchar *path;
 	gchar *parent_path;
 
+	/* while scanning, what the directory pass found is fresh enough */
+	index = mh_item_stat_index(item);
+	if (index != NULL && item->scanning != ITEM_NOT_SCANNING &&
+	    (st = g_hash_table_lookup(index, GINT_TO_POINTER(msginfo->msgnum)))) {
+		return msginfo->size != st->size || (
+			(msginfo->mtime - st->mtime != 0) &&
+			(msginfo->mtime - st->mtime != 3600) &&
+			(msginfo->mtime - st->mtime != -3600));
+	}
+
 	parent_path = folder_item_get_path(item);
 	path = g_strdup_printf("%s%c%d", parent_path,
 			G_DIR_SEPARATOR, msginfo->msgnum);
@@ -805,6 +1248,12 @@ static gint mh_scan_tree(Folder *folder)
 	mh_remove_missing_folder_items(folder);
 	mh_scan_tree_recursive(item);
 
+#ifdef HAVE_SYS_INOTIFY_H
+	if (folder->klass == &mh_class)
+		g_node_traverse(folder->node, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+				mh_watch_item_func, NULL);
+#endif
+
 	return 0;
 }
 
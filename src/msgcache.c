@@ -98,8 +98,52 @@ struct _MsgCache {
 	GHashTable	*msgid_table;
 	guint		 memusage;
 	time_t		 last_access;
+
+	/* thread index: msgnum -> parent msgnum, saved with the cache */
+	GHashTable	*parent_table;
+	/* msgid -> msgnums of the messages referring to it, built on the
+	 * first change to the cache so the index can be kept up to date */
+	GHashTable	*refers_table;
+};
+
+/* The cache file is a table of fixed-width records followed by a heap
+ * of NUL-terminated strings. The whole file is kept mapped for as long
+ * as a MsgInfo read from it is alive, and the MsgInfo header strings
+ * point straight into it. */
+struct _MsgCacheHeap {
+	guint		 refcnt;
+	gchar		*data;
+	gsize		 len;
+	gboolean	 mapped;
+};
+
+enum {
+	REC_NUM,
+	REC_SIZE,
+	REC_MTIME,
+	REC_DATE_T,
+	REC_TMP_FLAGS,
+	REC_PLANNED_DOWNLOAD,
+	REC_TOTAL_SIZE,
+	REC_FROMNAME,
+	REC_DATE,
+	REC_FROM,
+	REC_TO,
+	REC_CC,
+	REC_NEWSGROUPS,
+	REC_SUBJECT,
+	REC_MSGID,
+	REC_INREPLYTO,
+	REC_XREF,
+	REC_REFS,
+	REC_REFS_NUM,
+	REC_PARENT,
+	REC_N_FIELDS
 };
 
+#define MSGCACHE_RECORD_LEN	(REC_N_FIELDS * 4)
+#define MSGCACHE_HEAP_NONE	0xffffffffU
+
 typedef struct _StringConverter StringConverter;
 struct _StringConverter {
 	gchar *(*convert) (StringConverter *converter, gchar *srcstr);
@@ -126,6 +170,7 @@ MsgCache *msgcache_new(void)
 	cache = g_new0(MsgCache, 1),
 	cache->msgnum_table = g_hash_table_new(g_int_hash, g_int_equal);
 	cache->msgid_table = g_hash_table_new(g_str_hash, g_str_equal);
+	cache->parent_table = g_hash_table_new(g_direct_hash, g_direct_equal);
 	cache->last_access = time(NULL);
 
 	return cache;
@@ -137,6 +182,254 @@ static gboolean msgcache_msginfo_free_func(gpointer num, gpointer msginfo, gpoin
 	return TRUE;
 }											  
 
+static MsgCacheHeap *msgcache_heap_new(gchar *data, gsize len, gboolean mapped)
+{
+	MsgCacheHeap *heap;
+
+	heap = g_new0(MsgCacheHeap, 1);
+	heap->refcnt = 1;
+	heap->data = data;
+	heap->len = len;
+	heap->mapped = mapped;
+
+	return heap;
+}
+
+MsgCacheHeap *msgcache_heap_ref(MsgCacheHeap *heap)
+{
+	cm_return_val_if_fail(heap != NULL, NULL);
+
+	heap->refcnt++;
+
+	return heap;
+}
+
+void msgcache_heap_unref(MsgCacheHeap *heap)
+{
+	cm_return_if_fail(heap != NULL);
+
+	heap->refcnt--;
+	if (heap->refcnt > 0)
+		return;
+
+#ifndef G_OS_WIN32
+	if (heap->mapped)
+		munmap(heap->data, heap->len);
+	else
+#endif
+		g_free(heap->data);
+	g_free(heap);
+}
+
+/*
+ *  Thread index
+ *
+ *  Keeps the parent of every cached message, chosen the way
+ *  procmsg_get_thread_tree() chooses it: the In-Reply-To message if it
+ *  is in the folder, else the closest one from References. It is
+ *  updated as messages come and go, so threading a folder no longer
+ *  needs to look at every reference of every message.
+ */
+
+static guint msgcache_thread_get_parent(MsgCache *cache, guint num)
+{
+	return GPOINTER_TO_UINT(g_hash_table_lookup(cache->parent_table,
+						    GUINT_TO_POINTER(num)));
+}
+
+static void msgcache_thread_set_parent(MsgCache *cache, guint num, guint parent)
+{
+	if (parent != 0)
+		g_hash_table_insert(cache->parent_table, GUINT_TO_POINTER(num),
+				    GUINT_TO_POINTER(parent));
+	else
+		g_hash_table_remove(cache->parent_table, GUINT_TO_POINTER(num));
+}
+
+static gboolean msgcache_thread_is_ancestor(MsgCache *cache, guint ancestor, guint num)
+{
+	guint steps = g_hash_table_size(cache->parent_table);
+
+	for (; num != 0; num = msgcache_thread_get_parent(cache, num)) {
+		if (num == ancestor)
+			return TRUE;
+		/* a damaged cache file may contain a loop */
+		if (steps-- == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static guint msgcache_thread_lookup(MsgCache *cache, MsgInfo *msginfo,
+				    const gchar *msgid)
+{
+	MsgInfo *parent;
+
+	if (msgid == NULL)
+		return 0;
+
+	parent = g_hash_table_lookup(cache->msgid_table, msgid);
+	if (parent == NULL || parent->msgnum == msginfo->msgnum)
+		return 0;
+	/* circular reference */
+	if (msgcache_thread_is_ancestor(cache, msginfo->msgnum, parent->msgnum))
+		return 0;
+
+	return parent->msgnum;
+}
+
+static guint msgcache_thread_resolve(MsgCache *cache, MsgInfo *msginfo)
+{
+	GSList *cur;
+	guint parent;
+
+	if ((parent = msgcache_thread_lookup(cache, msginfo, msginfo->inreplyto)) != 0)
+		return parent;
+
+	for (cur = msginfo->references; cur != NULL; cur = cur->next)
+		if ((parent = msgcache_thread_lookup(cache, msginfo, cur->data)) != 0)
+			return parent;
+
+	return 0;
+}
+
+static void msgcache_thread_refers_add(MsgCache *cache, const gchar *msgid, guint num)
+{
+	gpointer key, list;
+
+	if (msgid == NULL || *msgid == '\0')
+		return;
+
+	if (!g_hash_table_lookup_extended(cache->refers_table, msgid, &key, &list)) {
+		key = g_strdup(msgid);
+		list = NULL;
+	}
+	list = g_slist_prepend(list, GUINT_TO_POINTER(num));
+	g_hash_table_insert(cache->refers_table, key, list);
+}
+
+static void msgcache_thread_refers_remove(MsgCache *cache, const gchar *msgid, guint num)
+{
+	gpointer key, list;
+
+	if (msgid == NULL || *msgid == '\0')
+		return;
+
+	if (!g_hash_table_lookup_extended(cache->refers_table, msgid, &key, &list))
+		return;
+	list = g_slist_remove(list, GUINT_TO_POINTER(num));
+	if (list != NULL)
+		g_hash_table_insert(cache->refers_table, key, list);
+	else {
+		g_hash_table_remove(cache->refers_table, key);
+		g_free(key);
+	}
+}
+
+static void msgcache_thread_mention(MsgCache *cache, MsgInfo *msginfo, gboolean add)
+{
+	GSList *cur;
+
+	if (add)
+		msgcache_thread_refers_add(cache, msginfo->inreplyto, msginfo->msgnum);
+	else
+		msgcache_thread_refers_remove(cache, msginfo->inreplyto, msginfo->msgnum);
+
+	for (cur = msginfo->references; cur != NULL; cur = cur->next) {
+		if (add)
+			msgcache_thread_refers_add(cache, cur->data, msginfo->msgnum);
+		else
+			msgcache_thread_refers_remove(cache, cur->data, msginfo->msgnum);
+	}
+}
+
+static void msgcache_thread_mention_func(gpointer key, gpointer value, gpointer user_data)
+{
+	msgcache_thread_mention((MsgCache *)user_data, (MsgInfo *)value, TRUE);
+}
+
+static void msgcache_refers_free_func(gpointer key, gpointer value, gpointer user_data)
+{
+	g_free(key);
+	g_slist_free(value);
+}
+
+/* Returns TRUE if the table had to be built, in which case it already
+ * reflects the current content of the cache. */
+static gboolean msgcache_thread_build_refers(MsgCache *cache)
+{
+	if (cache->refers_table != NULL)
+		return FALSE;
+
+	cache->refers_table = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_foreach(cache->msgnum_table, msgcache_thread_mention_func, cache);
+
+	return TRUE;
+}
+
+/* Re-threads the messages that refer to msgid */
+static void msgcache_thread_reresolve(MsgCache *cache, const gchar *msgid)
+{
+	GSList *cur;
+
+	if (msgid == NULL)
+		return;
+
+	for (cur = g_hash_table_lookup(cache->refers_table, msgid);
+	     cur != NULL; cur = cur->next) {
+		guint num = GPOINTER_TO_UINT(cur->data);
+		MsgInfo *child = g_hash_table_lookup(cache->msgnum_table, &num);
+
+		if (child != NULL)
+			msgcache_thread_set_parent(cache, num,
+				msgcache_thread_resolve(cache, child));
+	}
+}
+
+/* msginfo has just been put into the msgnum and msgid tables */
+static void msgcache_thread_add(MsgCache *cache, MsgInfo *msginfo)
+{
+	if (!msgcache_thread_build_refers(cache))
+		msgcache_thread_mention(cache, msginfo, TRUE);
+
+	msgcache_thread_set_parent(cache, msginfo->msgnum,
+				   msgcache_thread_resolve(cache, msginfo));
+	msgcache_thread_reresolve(cache, msginfo->msgid);
+}
+
+/* msginfo has just been taken out of the msgnum and msgid tables */
+static void msgcache_thread_remove(MsgCache *cache, MsgInfo *msginfo)
+{
+	if (!msgcache_thread_build_refers(cache))
+		msgcache_thread_mention(cache, msginfo, FALSE);
+
+	msgcache_thread_set_parent(cache, msginfo->msgnum, 0);
+	msgcache_thread_reresolve(cache, msginfo->msgid);
+}
+
+static void msgcache_thread_rebuild_func(gpointer key, gpointer value, gpointer user_data)
+{
+	MsgCache *cache = (MsgCache *)user_data;
+	MsgInfo *msginfo = (MsgInfo *)value;
+
+	msgcache_thread_set_parent(cache, msginfo->msgnum,
+				   msgcache_thread_resolve(cache, msginfo));
+}
+
+static void msgcache_thread_rebuild(MsgCache *cache)
+{
+	g_hash_table_remove_all(cache->parent_table);
+	g_hash_table_foreach(cache->msgnum_table, msgcache_thread_rebuild_func, cache);
+}
+
+guint msgcache_get_thread_parent(MsgCache *cache, guint num)
+{
+	cm_return_val_if_fail(cache != NULL, 0);
+
+	return msgcache_thread_get_parent(cache, num);
+}
+
 void msgcache_destroy(MsgCache *cache)
 {
 	cm_return_if_fail(cache != NULL);
@@ -144,6 +437,11 @@ void msgcache_destroy(MsgCache *cache)
 	g_hash_table_foreach_remove(cache->msgnum_table, msgcache_msginfo_free_func, NULL);
 	g_hash_table_destroy(cache->msgid_table);
 	g_hash_table_destroy(cache->msgnum_table);
+	g_hash_table_destroy(cache->parent_table);
+	if (cache->refers_table != NULL) {
+		g_hash_table_foreach(cache->refers_table, msgcache_refers_free_func, NULL);
+		g_hash_table_destroy(cache->refers_table);
+	}
 	g_free(cache);
 }
 
@@ -158,6 +456,7 @@ void msgcache_add_msg(MsgCache *cache, MsgInfo *msginfo)
 	g_hash_table_insert(cache->msgnum_table, &newmsginfo->msgnum, newmsginfo);
 	if(newmsginfo->msgid != NULL)
 		g_hash_table_insert(cache->msgid_table, newmsginfo->msgid, newmsginfo);
+	msgcache_thread_add(cache, newmsginfo);
 	cache->memusage += procmsg_msginfo_memusage(msginfo);
 	cache->last_access = time(NULL);
 
@@ -180,6 +479,7 @@ void msgcache_remove_msg(MsgCache *cache, guint msgnum)
 	if(msginfo->msgid)
 		g_hash_table_remove(cache->msgid_table, msginfo->msgid);
 	g_hash_table_remove(cache->msgnum_table, &msginfo->msgnum);
+	msgcache_thread_remove(cache, msginfo);
 
 	msginfo->folder->cache_dirty = TRUE;
 
@@ -202,6 +502,7 @@ void msgcache_update_msg(MsgCache *cache, MsgInfo *msginfo)
 		g_hash_table_remove(cache->msgid_table, oldmsginfo->msgid);
 	if (oldmsginfo) {
 		g_hash_table_remove(cache->msgnum_table, &oldmsginfo->msgnum);
+		msgcache_thread_remove(cache, oldmsginfo);
 		cache->memusage -= procmsg_msginfo_memusage(oldmsginfo);
 		procmsg_msginfo_free(&oldmsginfo);
 	}
@@ -210,6 +511,7 @@ void msgcache_update_msg(MsgCache *cache, MsgInfo *msginfo)
 	g_hash_table_insert(cache->msgnum_table, &newmsginfo->msgnum, newmsginfo);
 	if(newmsginfo->msgid)
 		g_hash_table_insert(cache->msgid_table, newmsginfo->msgid, newmsginfo);
+	msgcache_thread_add(cache, newmsginfo);
 	cache->memusage += procmsg_msginfo_memusage(newmsginfo);
 	cache->last_access = time(NULL);
 	
@@ -559,6 +861,202 @@ static void strconv_charset_free(StringConverter *conv)
 	g_free(charsetconv->dstcharset);
 }
 
+static inline guint32 msgcache_get_u32(const gchar *data)
+{
+	const guchar *x = (const guchar *)data;
+
+	return ((guint32)x[0]) | ((guint32)x[1] << 8) |
+	       ((guint32)x[2] << 16) | ((guint32)x[3] << 24);
+}
+
+#define GET_RECORD_INT(field) msgcache_get_u32(walk_data + (field) * 4)
+
+#define GET_HEAP_STR(data, field)						\
+{										\
+	guint32 off = GET_RECORD_INT(field);					\
+	if (off == MSGCACHE_HEAP_NONE)						\
+		data = NULL;							\
+	else if (off >= strings_len) {						\
+		g_warning("%s: cache heap corrupted at record %u",		\
+			  cache_file, i);					\
+		procmsg_msginfo_free(&msginfo);					\
+		error = TRUE;							\
+		goto bail_err;							\
+	} else									\
+		data = strings + off;						\
+}
+
+static MsgCache *msgcache_read_cache_heap(FolderItem *item, FILE *fp,
+					  const gchar *cache_file,
+					  MsgTmpFlags tmp_flags)
+{
+	MsgCache *cache;
+	MsgCacheHeap *heap;
+	MsgInfo *msginfo;
+	gchar *charset = NULL;
+	gchar *data = NULL, *walk_data, *strings;
+	gsize data_len, strings_len;
+	gboolean mapped = FALSE, error = FALSE;
+	guint memusage = 0;
+	guint32 count, i;
+	struct stat st;
+	long pos;
+
+	if (msgcache_read_cache_data_str(fp, &charset, NULL) < 0)
+		return NULL;
+	/* heaps are always written in UTF-8 */
+	if (charset == NULL || strcmp(charset, CS_UTF_8) != 0) {
+		g_warning("%s: unexpected cache charset %s", cache_file,
+			  charset ? charset : "(none)");
+		g_free(charset);
+		return NULL;
+	}
+	g_free(charset);
+
+	pos = ftell(fp);
+	if (pos < 0 || fstat(fileno(fp), &st) < 0)
+		return NULL;
+	data_len = st.st_size;
+	if (data_len < (gsize)pos + 4) {
+		g_warning("%s: cache file truncated", cache_file);
+		return NULL;
+	}
+
+#ifndef G_OS_WIN32
+	if (msgcache_use_mmap_read == TRUE) {
+		data = mmap(NULL, data_len, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+		if (data == MAP_FAILED)
+			data = NULL;
+		else
+			mapped = TRUE;
+	}
+#endif
+	/* A long-lived view would keep the file locked on Windows and
+	 * make the next msgcache_write() fail to replace it, so read it
+	 * into memory there instead. */
+	if (data == NULL) {
+		data = g_try_malloc(data_len);
+		if (data == NULL)
+			return NULL;
+		if (fseek(fp, 0, SEEK_SET) != 0 ||
+		    claws_fread(data, 1, data_len, fp) != data_len) {
+			g_warning("%s: failed to read cache file", cache_file);
+			g_free(data);
+			return NULL;
+		}
+		memusage += data_len;
+	}
+	heap = msgcache_heap_new(data, data_len, mapped);
+
+	walk_data = data + pos;
+	count = msgcache_get_u32(walk_data);
+	walk_data += 4;
+
+	if (count > (data_len - pos - 4) / MSGCACHE_RECORD_LEN) {
+		g_warning("%s: cache record table truncated", cache_file);
+		msgcache_heap_unref(heap);
+		return NULL;
+	}
+	strings = walk_data + (gsize)count * MSGCACHE_RECORD_LEN;
+	strings_len = data + data_len - strings;
+	/* a terminated heap makes every in-range offset a valid string */
+	if (strings_len > 0 && strings[strings_len - 1] != '\0') {
+		g_warning("%s: cache heap not terminated", cache_file);
+		msgcache_heap_unref(heap);
+		return NULL;
+	}
+
+	debug_print("\tReading %u cache records from %s...\n", count, cache_file);
+
+	cache = msgcache_new();
+
+	for (i = 0; i < count; i++, walk_data += MSGCACHE_RECORD_LEN) {
+		guint32 refs_off, refs_num;
+
+		msginfo = procmsg_msginfo_new();
+		msginfo->heap = msgcache_heap_ref(heap);
+
+		msginfo->msgnum = GET_RECORD_INT(REC_NUM);
+		msginfo->size = GET_RECORD_INT(REC_SIZE);
+		msginfo->mtime = GET_RECORD_INT(REC_MTIME);
+		msginfo->date_t = GET_RECORD_INT(REC_DATE_T);
+		msginfo->flags.tmp_flags = GET_RECORD_INT(REC_TMP_FLAGS);
+		msginfo->planned_download = GET_RECORD_INT(REC_PLANNED_DOWNLOAD);
+		msginfo->total_size = GET_RECORD_INT(REC_TOTAL_SIZE);
+
+		GET_HEAP_STR(msginfo->fromname, REC_FROMNAME);
+		GET_HEAP_STR(msginfo->date, REC_DATE);
+		GET_HEAP_STR(msginfo->from, REC_FROM);
+		GET_HEAP_STR(msginfo->to, REC_TO);
+		GET_HEAP_STR(msginfo->cc, REC_CC);
+		GET_HEAP_STR(msginfo->newsgroups, REC_NEWSGROUPS);
+		GET_HEAP_STR(msginfo->subject, REC_SUBJECT);
+		GET_HEAP_STR(msginfo->msgid, REC_MSGID);
+		GET_HEAP_STR(msginfo->inreplyto, REC_INREPLYTO);
+		GET_HEAP_STR(msginfo->xref, REC_XREF);
+
+		refs_off = GET_RECORD_INT(REC_REFS);
+		refs_num = GET_RECORD_INT(REC_REFS_NUM);
+		if (refs_num > 0) {
+			gchar *ref;
+
+			if (refs_off >= strings_len) {
+				g_warning("%s: cache heap corrupted at record %u",
+					  cache_file, i);
+				procmsg_msginfo_free(&msginfo);
+				error = TRUE;
+				goto bail_err;
+			}
+			ref = strings + refs_off;
+			for (; refs_num != 0; refs_num--) {
+				if (ref >= strings + strings_len) {
+					g_warning("%s: cache references corrupted at record %u",
+						  cache_file, i);
+					procmsg_msginfo_free(&msginfo);
+					error = TRUE;
+					goto bail_err;
+				}
+				if (*ref)
+					msginfo->references =
+						g_slist_prepend(msginfo->references, ref);
+				ref += strlen(ref) + 1;
+			}
+			msginfo->references = g_slist_reverse(msginfo->references);
+		}
+
+		msgcache_thread_set_parent(cache, msginfo->msgnum,
+					   GET_RECORD_INT(REC_PARENT));
+
+		msginfo->folder = item;
+		msginfo->flags.tmp_flags |= tmp_flags;
+		memusage += procmsg_msginfo_memusage(msginfo);
+
+		g_hash_table_insert(cache->msgnum_table, &msginfo->msgnum, msginfo);
+		if(msginfo->msgid)
+			g_hash_table_insert(cache->msgid_table, msginfo->msgid, msginfo);
+	}
+
+bail_err:
+	/* from here on the heap lives as long as its messages do */
+	msgcache_heap_unref(heap);
+
+	if (error) {
+		msgcache_destroy(cache);
+		return NULL;
+	}
+
+	cache->last_access = time(NULL);
+	cache->memusage = memusage;
+
+	debug_print("done. (%d items read)\n", g_hash_table_size(cache->msgnum_table));
+	debug_print("Cache size: %d messages, %u bytes\n", g_hash_table_size(cache->msgnum_table), cache->memusage);
+
+	return cache;
+}
+
+#undef GET_HEAP_STR
+#undef GET_RECORD_INT
+
 MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 {
 	MsgCache *cache;
@@ -583,15 +1081,31 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 
 	swapping = TRUE;
 
+	if (folder_has_parent_of_type(item, F_QUEUE)) {
+		tmp_flags |= MSG_QUEUED;
+	} else if (folder_has_parent_of_type(item, F_DRAFT)) {
+		tmp_flags |= MSG_DRAFT;
+	}
+
+	if ((fp = msgcache_open_data_file
+		(cache_file, CACHE_VERSION, DATA_READ, NULL, 0)) != NULL) {
+		cache = msgcache_read_cache_heap(item, fp, cache_file, tmp_flags);
+		claws_fclose(fp);
+		return cache;
+	}
+
+	/* Fall back to the pre-heap format, which is rewritten in the
+	 * current one on the next msgcache_write(). */
+
 	/* In case we can't open the mark file with MARK_VERSION, check if we can open it with the
 	 * swapped MARK_VERSION. As msgcache_open_data_file swaps it too, if this succeeds, 
 	 * it means it's the old version (not little-endian) on a big-endian machine. The code has
 	 * no effect on x86 as their file doesn't change. */
 
 	if ((fp = msgcache_open_data_file
-		(cache_file, CACHE_VERSION, DATA_READ, file_buf, sizeof(file_buf))) == NULL) {
+		(cache_file, CACHE_VERSION_LEGACY, DATA_READ, file_buf, sizeof(file_buf))) == NULL) {
 		if ((fp = msgcache_open_data_file
-		(cache_file, bswap_32(CACHE_VERSION), DATA_READ, file_buf, sizeof(file_buf))) == NULL)
+		(cache_file, bswap_32(CACHE_VERSION_LEGACY), DATA_READ, file_buf, sizeof(file_buf))) == NULL)
 			return NULL;
 		else
 			swapping = FALSE;
@@ -599,12 +1113,6 @@ MsgCache *msgcache_read_cache(FolderItem *item, const gchar *cache_file)
 
 	debug_print("\tReading %sswapped message cache from %s...\n", swapping?"":"un", cache_file);
 
-	if (folder_has_parent_of_type(item, F_QUEUE)) {
-		tmp_flags |= MSG_QUEUED;
-	} else if (folder_has_parent_of_type(item, F_DRAFT)) {
-		tmp_flags |= MSG_DRAFT;
-	}
-
 	if (msgcache_read_cache_data_str(fp, &srccharset, NULL) < 0) {
 		claws_fclose(fp);
 		return NULL;
@@ -783,6 +1291,9 @@ bail_err:
 		return NULL;
 	}
 
+	/* older caches have no thread index */
+	msgcache_thread_rebuild(cache);
+
 	cache->last_access = time(NULL);
 	cache->memusage = memusage;
 
@@ -999,40 +1510,119 @@ bail_err:
 	}
 }
 
-static int msgcache_write_cache(MsgInfo *msginfo, FILE *fp)
+static void msgcache_collect_func(gpointer key, gpointer value, gpointer user_data)
 {
-	MsgTmpFlags flags = msginfo->flags.tmp_flags & MSG_CACHED_FLAG_MASK;
-	GSList *cur;
+	g_ptr_array_add((GPtrArray *)user_data, value);
+}
+
+/* Returns the heap offset of str, appending it to the heap unless an
+ * identical string is already there */
+static guint32 msgcache_heap_add_str(GHashTable *offsets, GPtrArray *strings,
+				     gsize *heap_len, const gchar *str)
+{
+	gpointer off;
+
+	/* like the old format, store empty strings as NULL */
+	if (str == NULL || *str == '\0')
+		return MSGCACHE_HEAP_NONE;
+
+	if ((off = g_hash_table_lookup(offsets, str)) != NULL)
+		return GPOINTER_TO_UINT(off) - 1;
+
+	off = GUINT_TO_POINTER(*heap_len + 1);
+	g_hash_table_insert(offsets, (gpointer)str, off);
+	g_ptr_array_add(strings, (gpointer)str);
+	*heap_len += strlen(str) + 1;
+
+	return GPOINTER_TO_UINT(off) - 1;
+}
+
+#define WRITE_HEAP_STR(data, fp)					\
+{									\
+	guint32 off = msgcache_heap_add_str(offsets, strings,		\
+					    &heap_len, data);		\
+	WRITE_CACHE_DATA_INT(off, fp);					\
+}
+
+static int msgcache_write_cache_heap(MsgCache *cache, FILE *fp)
+{
+	GPtrArray *msgs, *strings;
+	GHashTable *offsets;
+	gsize heap_len = 0;
 	int w_err = 0, wrote = 0;
+	guint i;
+
+	msgs = g_ptr_array_sized_new(g_hash_table_size(cache->msgnum_table));
+	g_hash_table_foreach(cache->msgnum_table, msgcache_collect_func, msgs);
+	strings = g_ptr_array_new();
+	offsets = g_hash_table_new(g_str_hash, g_str_equal);
+
+	WRITE_CACHE_DATA_INT(msgs->len, fp);
+
+	for (i = 0; i < msgs->len && w_err == 0; i++) {
+		MsgInfo *msginfo = g_ptr_array_index(msgs, i);
+		MsgTmpFlags flags = msginfo->flags.tmp_flags & MSG_CACHED_FLAG_MASK;
+		guint32 refs_off = MSGCACHE_HEAP_NONE, refs_num = 0, parent;
+		GSList *cur;
+
+		WRITE_CACHE_DATA_INT(msginfo->msgnum, fp);
+		WRITE_CACHE_DATA_INT(msginfo->size, fp);
+		WRITE_CACHE_DATA_INT(msginfo->mtime, fp);
+		WRITE_CACHE_DATA_INT(msginfo->date_t, fp);
+		WRITE_CACHE_DATA_INT(flags, fp);
+		WRITE_CACHE_DATA_INT(msginfo->planned_download, fp);
+		WRITE_CACHE_DATA_INT(msginfo->total_size, fp);
+
+		WRITE_HEAP_STR(msginfo->fromname, fp);
+		WRITE_HEAP_STR(msginfo->date, fp);
+		WRITE_HEAP_STR(msginfo->from, fp);
+		WRITE_HEAP_STR(msginfo->to, fp);
+		WRITE_HEAP_STR(msginfo->cc, fp);
+		WRITE_HEAP_STR(msginfo->newsgroups, fp);
+		WRITE_HEAP_STR(msginfo->subject, fp);
+		WRITE_HEAP_STR(msginfo->msgid, fp);
+		WRITE_HEAP_STR(msginfo->inreplyto, fp);
+		WRITE_HEAP_STR(msginfo->xref, fp);
+
+		/* references are stored as one contiguous run */
+		for (cur = msginfo->references; cur != NULL; cur = cur->next) {
+			if (cur->data == NULL)
+				continue;
+			if (refs_num == 0)
+				refs_off = heap_len;
+			g_ptr_array_add(strings, cur->data);
+			heap_len += strlen((gchar *)cur->data) + 1;
+			refs_num++;
+		}
+		WRITE_CACHE_DATA_INT(refs_off, fp);
+		WRITE_CACHE_DATA_INT(refs_num, fp);
+		parent = msgcache_thread_get_parent(cache, msginfo->msgnum);
+		WRITE_CACHE_DATA_INT(parent, fp);
+	}
 
-	WRITE_CACHE_DATA_INT(msginfo->msgnum, fp);
-	WRITE_CACHE_DATA_INT(msginfo->size, fp);
-	WRITE_CACHE_DATA_INT(msginfo->mtime, fp);
-	WRITE_CACHE_DATA_INT(msginfo->date_t, fp);
-	WRITE_CACHE_DATA_INT(flags, fp);
+	if (heap_len >= MSGCACHE_HEAP_NONE) {
+		g_warning("cache heap too large (%"G_GSIZE_FORMAT" bytes)", heap_len);
+		w_err = 1;
+	}
 
-	WRITE_CACHE_DATA(msginfo->fromname, fp);
-
-	WRITE_CACHE_DATA(msginfo->date, fp);
-	WRITE_CACHE_DATA(msginfo->from, fp);
-	WRITE_CACHE_DATA(msginfo->to, fp);
-	WRITE_CACHE_DATA(msginfo->cc, fp);
-	WRITE_CACHE_DATA(msginfo->newsgroups, fp);
-	WRITE_CACHE_DATA(msginfo->subject, fp);
-	WRITE_CACHE_DATA(msginfo->msgid, fp);
-	WRITE_CACHE_DATA(msginfo->inreplyto, fp);
-	WRITE_CACHE_DATA(msginfo->xref, fp);
-	WRITE_CACHE_DATA_INT(msginfo->planned_download, fp);
-	WRITE_CACHE_DATA_INT(msginfo->total_size, fp);
-        
-	WRITE_CACHE_DATA_INT(g_slist_length(msginfo->references), fp);
+	for (i = 0; i < strings->len && w_err == 0; i++) {
+		const gchar *str = g_ptr_array_index(strings, i);
+		size_t len = strlen(str) + 1;
 
-	for (cur = msginfo->references; cur != NULL; cur = cur->next) {
-		WRITE_CACHE_DATA((gchar *)cur->data, fp);
+		if (claws_fwrite(str, 1, len, fp) != len)
+			w_err = 1;
+		wrote += len;
 	}
+
+	g_hash_table_destroy(offsets);
+	g_ptr_array_free(strings, TRUE);
+	g_ptr_array_free(msgs, TRUE);
+
 	return w_err ? -1 : wrote;
 }
 
+#undef WRITE_HEAP_STR
+
 static int msgcache_write_flags(MsgInfo *msginfo, FILE *fp)
 {
 	MsgPermFlags flags = msginfo->flags.perm_flags;
@@ -1079,13 +1669,6 @@ static void msgcache_write_func(gpointer key, gpointer value, gpointer user_data
 	msginfo = (MsgInfo *)value;
 	write_fps = user_data;
 
-	if (write_fps->cache_fp) {
-		tmp = msgcache_write_cache(msginfo, write_fps->cache_fp);
-		if (tmp < 0)
-			write_fps->error = 1;
-		else
-			write_fps->cache_size += tmp;
-	}
 	if (write_fps->mark_fp) {
 	tmp= msgcache_write_flags(msginfo, write_fps->mark_fp);
 		if (tmp < 0)
@@ -1199,6 +1782,13 @@ gint msgcache_write(const gchar *cache_file, const gchar *mark_file, const gchar
 		write_fps.tags_size = ftell(write_fps.tags_fp);
 
 	/* write data to the files */
+	if (write_fps.cache_fp) {
+		gint tmp = msgcache_write_cache_heap(cache, write_fps.cache_fp);
+		if (tmp < 0)
+			write_fps.error = 1;
+		else
+			write_fps.cache_size += tmp;
+	}
 	g_hash_table_foreach(cache->msgnum_table, msgcache_write_func, (gpointer)&write_fps);
 
 	/* close files */
@@ -56,5 +56,10 @@ MsgInfo	   	*msgcache_get_msg_by_id			(MsgCache *cache,
 MsgInfoList	*msgcache_get_msg_list			(MsgCache *cache);
 time_t	   	 msgcache_get_last_access_time		(MsgCache *cache);
 gint	   	 msgcache_get_memory_usage		(MsgCache *cache);
+guint		 msgcache_get_thread_parent		(MsgCache *cache,
+							 guint num);
+
+MsgCacheHeap	*msgcache_heap_ref			(MsgCacheHeap *heap);
+void		 msgcache_heap_unref			(MsgCacheHeap *heap);
 
 #endif
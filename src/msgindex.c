@@ -0,0 +1,1015 @@
+/*
+ * Claws Mail -- a GTK based, lightweight, and fast e-mail client
+ * Copyright (C) 2024 the Claws Mail team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The text of a message, as the matcher sees it for ~body_part and
+ * ~message conditions (decoded header bodies and the lines of the text
+ * parts), is cut into trigrams of lowercased bytes. Lines which aren't
+ * ASCII also give the trigrams of their casefolded form, so that case
+ * insensitive matches are found too.
+ *
+ * The index keeps, for each trigram, the list of the messages having
+ * it. A string can only be in the messages found in the lists of all of
+ * its trigrams, so a search reads the lists of the few trigrams of the
+ * string, and only those messages need to be matched.
+ *
+ * The index file is mapped and its lists are read as needed. Messages
+ * indexed since it was read are kept apart in memory, with the sorted
+ * trigrams of each, and merged into the lists when it's written again.
+ * Messages are indexed on a thread of their own, so that adding them
+ * or searching for the first time doesn't wait for it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#include "claws-features.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <string.h>
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "msgindex.h"
+#include "account.h"
+#include "procmime.h"
+#include "procheader.h"
+#include "folder.h"
+#include "utils.h"
+#include "file-utils.h"
+
+#define MSGINDEX_VERSION	2
+
+#define MSGINDEX_TRIGRAM(a, b, c) \
+	((guint32)(a) << 16 | (guint32)(b) << 8 | (guint32)(c))
+
+/* the message has non-text parts, which ~message conditions look
+ * into but which aren't indexed */
+#define MSGINDEX_HAS_BINARY	(1 << 0)
+
+/* searched strings whose candidates are kept */
+#define MSGINDEX_MAX_QUERIES	16
+
+#define MSGINDEX_HEADER_SIZE	(4 * sizeof(guint32))
+#define MSGINDEX_ENTRY_SIZE	(2 * sizeof(guint32))
+#define MSGINDEX_DIR_SIZE	(3 * sizeof(guint32))
+
+typedef struct _MsgIndexQuery {
+	GArray *trigrams;	/* of the string, sorted */
+	GArray *msgnums;	/* having them all in the file, sorted */
+} MsgIndexQuery;
+
+struct _MsgIndex {
+	guint refcnt;
+	gboolean destroyed;
+
+	/* the file as last read or written */
+	GMappedFile *mapped;
+	const guchar *postings;
+	gsize postings_len;
+	const guchar *dir;
+	guint32 dir_len;
+
+	/* msgnum -> flags, of all the indexed messages */
+	GHashTable *entries;
+	/* msgnum -> sorted GArray of trigrams, indexed since then */
+	GHashTable *added;
+	/* msgnums whose lists in the file are outdated */
+	GHashTable *dropped;
+	/* msgnum -> job serial, being indexed */
+	GHashTable *pending;
+	guint serial;
+
+	GHashTable *queries;
+	gboolean dirty;
+};
+
+static void msgindex_query_free(gpointer data)
+{
+	MsgIndexQuery *query = (MsgIndexQuery *)data;
+
+	g_array_free(query->trigrams, TRUE);
+	g_array_free(query->msgnums, TRUE);
+	g_free(query);
+}
+
+static void msgindex_trigrams_free(gpointer data)
+{
+	g_array_free((GArray *)data, TRUE);
+}
+
+MsgIndex *msgindex_new(void)
+{
+	MsgIndex *index = g_new0(MsgIndex, 1);
+
+	index->refcnt = 1;
+	index->entries = g_hash_table_new(g_direct_hash, g_direct_equal);
+	index->added = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					     NULL, msgindex_trigrams_free);
+	index->dropped = g_hash_table_new(g_direct_hash, g_direct_equal);
+	index->pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+	index->queries = g_hash_table_new_full(g_str_hash, g_str_equal,
+					       g_free, msgindex_query_free);
+	return index;
+}
+
+static void msgindex_unmap(MsgIndex *index)
+{
+	if (index->mapped != NULL)
+		g_mapped_file_unref(index->mapped);
+	index->mapped = NULL;
+	index->postings = NULL;
+	index->postings_len = 0;
+	index->dir = NULL;
+	index->dir_len = 0;
+	g_hash_table_remove_all(index->queries);
+}
+
+static void msgindex_unref(MsgIndex *index)
+{
+	if (--index->refcnt > 0)
+		return;
+
+	msgindex_unmap(index);
+	g_hash_table_destroy(index->entries);
+	g_hash_table_destroy(index->added);
+	g_hash_table_destroy(index->dropped);
+	g_hash_table_destroy(index->pending);
+	g_hash_table_destroy(index->queries);
+	g_free(index);
+}
+
+/* Messages still being indexed hold a reference; their results are
+ * dropped when they come back. */
+void msgindex_destroy(MsgIndex *index)
+{
+	cm_return_if_fail(index != NULL);
+
+	index->destroyed = TRUE;
+	g_hash_table_remove_all(index->pending);
+	msgindex_unref(index);
+}
+
+gboolean msgindex_is_dirty(MsgIndex *index)
+{
+	cm_return_val_if_fail(index != NULL, FALSE);
+
+	return index->dirty;
+}
+
+static guint32 msgindex_get_uint32(const guchar *p)
+{
+	guint32 n;
+
+	memcpy(&n, p, sizeof(n));
+	return GUINT32_FROM_BE(n);
+}
+
+static gint msgindex_uint32_cmp(gconstpointer a, gconstpointer b)
+{
+	guint32 ua = *(const guint32 *)a;
+	guint32 ub = *(const guint32 *)b;
+
+	return ua < ub ? -1 : (ua > ub ? 1 : 0);
+}
+
+static gboolean msgindex_array_contains(GArray *array, guint32 n)
+{
+	guint lo = 0, hi = array->len;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		guint32 value = g_array_index(array, guint32, mid);
+
+		if (n < value)
+			hi = mid;
+		else if (n > value)
+			lo = mid + 1;
+		else
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* The file is, all numbers being big endian:
+ *   the version, the number of messages, the number of trigrams and
+ *   the length of the lists;
+ *   for each message by number, its number and its flags;
+ *   the lists of messages, each one as the differences between
+ *   ascending numbers, 7 bits per byte, lowest first;
+ *   for each trigram by value, the trigram, the offset of its list
+ *   from the first one, and the number of messages in it.
+ * Unreadable or outdated files give an empty index, rebuilt as
+ * messages are indexed again. */
+static gboolean msgindex_map(MsgIndex *index, const gchar *index_file)
+{
+	GMappedFile *mapped;
+	GError *error = NULL;
+	const guchar *data;
+	gsize length, entries_end;
+	guint32 n_msgs, n_trigrams, postings_len, i;
+
+	mapped = g_mapped_file_new(index_file, FALSE, &error);
+	if (mapped == NULL) {
+		g_warning("couldn't read message index %s: %s", index_file,
+			  error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	data = (const guchar *)g_mapped_file_get_contents(mapped);
+	length = g_mapped_file_get_length(mapped);
+
+	if (length < MSGINDEX_HEADER_SIZE ||
+	    msgindex_get_uint32(data) != MSGINDEX_VERSION) {
+		g_mapped_file_unref(mapped);
+		return FALSE;
+	}
+	n_msgs = msgindex_get_uint32(data + sizeof(guint32));
+	n_trigrams = msgindex_get_uint32(data + 2 * sizeof(guint32));
+	postings_len = msgindex_get_uint32(data + 3 * sizeof(guint32));
+	if ((length - MSGINDEX_HEADER_SIZE) / MSGINDEX_ENTRY_SIZE < n_msgs) {
+		g_mapped_file_unref(mapped);
+		return FALSE;
+	}
+	entries_end = MSGINDEX_HEADER_SIZE + (gsize)n_msgs * MSGINDEX_ENTRY_SIZE;
+	if (length - entries_end != postings_len + (gsize)n_trigrams * MSGINDEX_DIR_SIZE) {
+		g_mapped_file_unref(mapped);
+		return FALSE;
+	}
+
+	for (i = 0; i < n_msgs; i++) {
+		const guchar *p = data + MSGINDEX_HEADER_SIZE + i * MSGINDEX_ENTRY_SIZE;
+
+		g_hash_table_insert(index->entries,
+				    GUINT_TO_POINTER(msgindex_get_uint32(p)),
+				    GUINT_TO_POINTER(msgindex_get_uint32(p + sizeof(guint32))));
+	}
+
+	index->mapped = mapped;
+	index->postings = data + entries_end;
+	index->postings_len = postings_len;
+	index->dir = index->postings + index->postings_len;
+	index->dir_len = n_trigrams;
+
+	return TRUE;
+}
+
+MsgIndex *msgindex_read(const gchar *index_file)
+{
+	MsgIndex *index;
+
+	cm_return_val_if_fail(index_file != NULL, NULL);
+
+	index = msgindex_new();
+	if (!is_file_exist(index_file))
+		return index;
+
+	if (!msgindex_map(index, index_file)) {
+		debug_print("message index %s is outdated, discarding it\n",
+			    index_file);
+		g_hash_table_remove_all(index->entries);
+		index->dirty = TRUE;
+		return index;
+	}
+
+	debug_print("read message index %s: %u messages, %u trigrams\n",
+		    index_file, g_hash_table_size(index->entries),
+		    index->dir_len);
+
+	return index;
+}
+
+/* The directory record of a trigram in the file, or NULL */
+static const guchar *msgindex_dir_lookup(MsgIndex *index, guint32 trigram)
+{
+	guint32 lo = 0, hi = index->dir_len;
+
+	while (lo < hi) {
+		guint32 mid = lo + (hi - lo) / 2;
+		const guchar *rec = index->dir + (gsize)mid * MSGINDEX_DIR_SIZE;
+		guint32 value = msgindex_get_uint32(rec);
+
+		if (trigram < value)
+			hi = mid;
+		else if (trigram > value)
+			lo = mid + 1;
+		else
+			return rec;
+	}
+	return NULL;
+}
+
+/* Appends the messages of the list of a directory record to out, but
+ * the ones in skip. A list running past the file ends early. */
+static void msgindex_dir_decode(MsgIndex *index, const guchar *rec,
+				GHashTable *skip, GArray *out)
+{
+	guint32 offset = msgindex_get_uint32(rec + sizeof(guint32));
+	guint32 count = msgindex_get_uint32(rec + 2 * sizeof(guint32));
+	const guchar *p = index->postings + offset;
+	const guchar *end = index->postings + index->postings_len;
+	guint32 msgnum = 0;
+
+	if (offset > index->postings_len)
+		return;
+
+	while (count-- > 0) {
+		guint32 delta = 0;
+		guint shift = 0;
+
+		do {
+			if (p >= end || shift > 28)
+				return;
+			delta |= (guint32)(*p & 0x7f) << shift;
+			shift += 7;
+		} while (*p++ & 0x80);
+
+		msgnum += delta;
+		if (skip == NULL ||
+		    !g_hash_table_contains(skip, GUINT_TO_POINTER(msgnum)))
+			g_array_append_val(out, msgnum);
+	}
+}
+
+static void msgindex_put_uint32(GByteArray *buf, guint32 n)
+{
+	n = GUINT32_TO_BE(n);
+	g_byte_array_append(buf, (const guint8 *)&n, sizeof(n));
+}
+
+static void msgindex_put_varint(GByteArray *buf, guint32 n)
+{
+	guint8 byte;
+
+	do {
+		byte = n & 0x7f;
+		n >>= 7;
+		if (n != 0)
+			byte |= 0x80;
+		g_byte_array_append(buf, &byte, 1);
+	} while (n != 0);
+}
+
+/* Merges the sorted lists a and b into out, without duplicates */
+static void msgindex_merge(GArray *a, GArray *b, GArray *out)
+{
+	guint i = 0, j = 0;
+
+	g_array_set_size(out, 0);
+	while (i < a->len || j < b->len) {
+		guint32 n;
+
+		if (j >= b->len ||
+		    (i < a->len && g_array_index(a, guint32, i) < g_array_index(b, guint32, j)))
+			n = g_array_index(a, guint32, i++);
+		else if (i >= a->len ||
+			 g_array_index(b, guint32, j) < g_array_index(a, guint32, i))
+			n = g_array_index(b, guint32, j++);
+		else {
+			n = g_array_index(a, guint32, i++);
+			j++;
+		}
+		g_array_append_val(out, n);
+	}
+}
+
+/* Writes the list of one trigram, and its directory record */
+static gboolean msgindex_write_list(FILE *fp, guint32 trigram, GArray *msgnums,
+				    GByteArray *buf, GByteArray *dir,
+				    guint32 *offset)
+{
+	guint32 prev = 0;
+	guint i;
+
+	if (msgnums->len == 0)
+		return TRUE;
+
+	g_byte_array_set_size(buf, 0);
+	for (i = 0; i < msgnums->len; i++) {
+		guint32 msgnum = g_array_index(msgnums, guint32, i);
+
+		msgindex_put_varint(buf, msgnum - prev);
+		prev = msgnum;
+	}
+
+	msgindex_put_uint32(dir, trigram);
+	msgindex_put_uint32(dir, *offset);
+	msgindex_put_uint32(dir, msgnums->len);
+	*offset += buf->len;
+
+	return claws_fwrite(buf->data, 1, buf->len, fp) == buf->len;
+}
+
+/* Writes the lists of the file, without the outdated messages, merged
+ * with the ones of the messages indexed since */
+static gboolean msgindex_write_lists(MsgIndex *index, FILE *fp,
+				     GByteArray *dir, guint32 *postings_len)
+{
+	GHashTable *added_lists;
+	GHashTableIter iter;
+	gpointer key, value;
+	GArray *added_trigrams, *from_file, *merged;
+	GByteArray *buf;
+	guint32 offset = 0, i = 0, j = 0;
+	gboolean ok = TRUE;
+
+	/* trigram -> messages, for the messages indexed since */
+	added_lists = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					    NULL, msgindex_trigrams_free);
+	g_hash_table_iter_init(&iter, index->added);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GArray *trigrams = (GArray *)value;
+		guint32 msgnum = GPOINTER_TO_UINT(key);
+		guint k;
+
+		for (k = 0; k < trigrams->len; k++) {
+			gpointer trigram = GUINT_TO_POINTER(g_array_index(trigrams, guint32, k));
+			GArray *list = g_hash_table_lookup(added_lists, trigram);
+
+			if (list == NULL) {
+				list = g_array_new(FALSE, FALSE, sizeof(guint32));
+				g_hash_table_insert(added_lists, trigram, list);
+			}
+			g_array_append_val(list, msgnum);
+		}
+	}
+	added_trigrams = g_array_sized_new(FALSE, FALSE, sizeof(guint32),
+					   g_hash_table_size(added_lists));
+	g_hash_table_iter_init(&iter, added_lists);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		guint32 trigram = GPOINTER_TO_UINT(key);
+
+		g_array_sort((GArray *)value, msgindex_uint32_cmp);
+		g_array_append_val(added_trigrams, trigram);
+	}
+	g_array_sort(added_trigrams, msgindex_uint32_cmp);
+
+	from_file = g_array_new(FALSE, FALSE, sizeof(guint32));
+	merged = g_array_new(FALSE, FALSE, sizeof(guint32));
+	buf = g_byte_array_new();
+
+	/* both the directory and added_trigrams are sorted */
+	while (ok && (i < index->dir_len || j < added_trigrams->len)) {
+		const guchar *rec = i < index->dir_len
+			? index->dir + (gsize)i * MSGINDEX_DIR_SIZE : NULL;
+		guint32 file_trigram = rec ? msgindex_get_uint32(rec) : 0;
+		guint32 added_trigram = j < added_trigrams->len
+			? g_array_index(added_trigrams, guint32, j) : 0;
+		GArray *added_list = NULL;
+		guint32 trigram;
+
+		g_array_set_size(from_file, 0);
+		if (rec != NULL &&
+		    (j >= added_trigrams->len || file_trigram <= added_trigram)) {
+			msgindex_dir_decode(index, rec, index->dropped, from_file);
+			trigram = file_trigram;
+			i++;
+		} else {
+			trigram = added_trigram;
+		}
+		if (j < added_trigrams->len && added_trigram == trigram) {
+			added_list = g_hash_table_lookup(added_lists,
+							 GUINT_TO_POINTER(trigram));
+			j++;
+		}
+
+		if (added_list != NULL) {
+			msgindex_merge(from_file, added_list, merged);
+			ok = msgindex_write_list(fp, trigram, merged, buf, dir, &offset);
+		} else {
+			ok = msgindex_write_list(fp, trigram, from_file, buf, dir, &offset);
+		}
+	}
+
+	g_byte_array_free(buf, TRUE);
+	g_array_free(merged, TRUE);
+	g_array_free(from_file, TRUE);
+	g_array_free(added_trigrams, TRUE);
+	g_hash_table_destroy(added_lists);
+	*postings_len = offset;
+
+	return ok;
+}
+
+gint msgindex_write(MsgIndex *index, const gchar *index_file)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GArray *msgnums;
+	GByteArray *buf, *dir;
+	gchar *new_file;
+	FILE *fp;
+	guint32 postings_len = 0;
+	gboolean ok;
+	guint i;
+
+	cm_return_val_if_fail(index != NULL, -1);
+	cm_return_val_if_fail(index_file != NULL, -1);
+
+	new_file = g_strconcat(index_file, ".new", NULL);
+	if ((fp = claws_fopen(new_file, "wb")) == NULL) {
+		FILE_OP_ERROR(new_file, "claws_fopen");
+		g_free(new_file);
+		return -1;
+	}
+	if (change_file_mode_rw(fp, new_file) < 0)
+		FILE_OP_ERROR(new_file, "chmod");
+
+	msgnums = g_array_sized_new(FALSE, FALSE, sizeof(guint32),
+				    g_hash_table_size(index->entries));
+	g_hash_table_iter_init(&iter, index->entries);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		guint32 msgnum = GPOINTER_TO_UINT(key);
+
+		g_array_append_val(msgnums, msgnum);
+	}
+	g_array_sort(msgnums, msgindex_uint32_cmp);
+
+	/* the sizes of the lists are filled in once known */
+	buf = g_byte_array_new();
+	msgindex_put_uint32(buf, MSGINDEX_VERSION);
+	msgindex_put_uint32(buf, msgnums->len);
+	msgindex_put_uint32(buf, 0);
+	msgindex_put_uint32(buf, 0);
+	for (i = 0; i < msgnums->len; i++) {
+		guint32 msgnum = g_array_index(msgnums, guint32, i);
+
+		value = g_hash_table_lookup(index->entries, GUINT_TO_POINTER(msgnum));
+		msgindex_put_uint32(buf, msgnum);
+		msgindex_put_uint32(buf, GPOINTER_TO_UINT(value));
+	}
+	g_array_free(msgnums, TRUE);
+	ok = claws_fwrite(buf->data, 1, buf->len, fp) == buf->len;
+
+	dir = g_byte_array_new();
+	ok = ok && msgindex_write_lists(index, fp, dir, &postings_len);
+	ok = ok && claws_fwrite(dir->data, 1, dir->len, fp) == dir->len;
+	if (ok) {
+		g_byte_array_set_size(buf, 0);
+		msgindex_put_uint32(buf, dir->len / MSGINDEX_DIR_SIZE);
+		msgindex_put_uint32(buf, postings_len);
+		ok = fseek(fp, 2 * sizeof(guint32), SEEK_SET) == 0 &&
+		     claws_fwrite(buf->data, 1, buf->len, fp) == buf->len;
+	}
+	g_byte_array_free(dir, TRUE);
+	g_byte_array_free(buf, TRUE);
+
+	if (claws_safe_fclose(fp) != 0)
+		ok = FALSE;
+	if (!ok) {
+		g_warning("failed to write message index %s", new_file);
+		claws_unlink(new_file);
+		g_free(new_file);
+		return -1;
+	}
+
+	/* what was merged is read from the new file from now on */
+	msgindex_unmap(index);
+	g_hash_table_remove_all(index->entries);
+	g_hash_table_remove_all(index->added);
+	g_hash_table_remove_all(index->dropped);
+
+	if (move_file(new_file, index_file, TRUE) < 0 ||
+	    !msgindex_map(index, index_file)) {
+		claws_unlink(new_file);
+		g_free(new_file);
+		g_hash_table_remove_all(index->entries);
+		index->dirty = TRUE;
+		return -1;
+	}
+	g_free(new_file);
+	index->dirty = FALSE;
+
+	return 0;
+}
+
+static void msgindex_trigrams_add(GHashTable *set, const gchar *str)
+{
+	const guchar *p = (const guchar *)str;
+	guchar a, b, c;
+
+	if (p[0] == '\0' || p[1] == '\0')
+		return;
+
+	a = g_ascii_tolower(p[0]);
+	b = g_ascii_tolower(p[1]);
+	for (p += 2; *p != '\0'; p++) {
+		c = g_ascii_tolower(*p);
+		g_hash_table_add(set, GUINT_TO_POINTER(MSGINDEX_TRIGRAM(a, b, c)));
+		a = b;
+		b = c;
+	}
+}
+
+static void msgindex_trigrams_add_line(GHashTable *set, const gchar *str)
+{
+	gchar *folded;
+
+	if (str == NULL)
+		return;
+
+	msgindex_trigrams_add(set, str);
+	if (!is_ascii_str(str)) {
+		folded = g_utf8_casefold(str, -1);
+		msgindex_trigrams_add(set, folded);
+		g_free(folded);
+	}
+}
+
+/* The trigrams of a set, sorted */
+static GArray *msgindex_trigrams_sorted(GHashTable *set)
+{
+	GArray *trigrams;
+	GHashTableIter iter;
+	gpointer key;
+
+	trigrams = g_array_sized_new(FALSE, FALSE, sizeof(guint32),
+				     g_hash_table_size(set));
+	g_hash_table_iter_init(&iter, set);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		guint32 trigram = GPOINTER_TO_UINT(key);
+
+		g_array_append_val(trigrams, trigram);
+	}
+	g_array_sort(trigrams, msgindex_uint32_cmp);
+
+	return trigrams;
+}
+
+static gboolean msgindex_scan_cb(const gchar *str, gpointer data)
+{
+	msgindex_trigrams_add_line((GHashTable *)data, str);
+	return FALSE;
+}
+
+/* Reads the text of a message file the way the matcher reads it. Uses
+ * neither the folder nor the cache, so it can run on any thread.
+ * Returns NULL if the message can't be read entirely. */
+static GArray *msgindex_scan_file(const gchar *file, gboolean queue_file,
+				  guint32 *flags)
+{
+	GHashTable *set;
+	GArray *trigrams = NULL;
+	MimeInfo *mimeinfo, *partinfo;
+	gchar *buf = NULL;
+	FILE *fp;
+
+	*flags = 0;
+	if ((fp = claws_fopen(file, "rb")) == NULL) {
+		FILE_OP_ERROR(file, "claws_fopen");
+		return NULL;
+	}
+
+	set = g_hash_table_new(g_direct_hash, g_direct_equal);
+	while (procheader_get_one_field(&buf, fp, NULL) != -1) {
+		Header *header = procheader_parse_header(buf);
+
+		if (header != NULL) {
+			msgindex_trigrams_add_line(set, header->body);
+			procheader_header_free(header);
+		}
+		g_free(buf);
+		buf = NULL;
+	}
+	claws_fclose(fp);
+
+	mimeinfo = queue_file ? procmime_scan_queue_file(file)
+			      : procmime_scan_file(file);
+	if (mimeinfo == NULL)
+		goto out;
+
+	/* the first one is the message itself */
+	for (partinfo = procmime_mimeinfo_next(mimeinfo); partinfo != NULL;
+	     partinfo = procmime_mimeinfo_next(partinfo)) {
+		if (partinfo->type != MIMETYPE_TEXT) {
+			*flags |= MSGINDEX_HAS_BINARY;
+			continue;
+		}
+		if (procmime_scan_text_content(partinfo, msgindex_scan_cb, set)) {
+			procmime_mimeinfo_free_all(&mimeinfo);
+			goto out;
+		}
+	}
+	procmime_mimeinfo_free_all(&mimeinfo);
+
+	trigrams = msgindex_trigrams_sorted(set);
+out:
+	g_hash_table_destroy(set);
+
+	return trigrams;
+}
+
+static void msgindex_add_scanned(MsgIndex *index, guint msgnum,
+				 guint32 flags, GArray *trigrams)
+{
+	g_hash_table_insert(index->entries, GUINT_TO_POINTER(msgnum),
+			    GUINT_TO_POINTER(flags));
+	g_hash_table_insert(index->added, GUINT_TO_POINTER(msgnum), trigrams);
+	index->dirty = TRUE;
+}
+
+#ifdef USE_PTHREAD
+/* Only the main thread uses the indexes: it queues the files to read,
+ * and takes the trigrams back when the main loop runs or when it has
+ * to wait for them. It also keeps the signature separators alive
+ * while a file is queued, so the thread never builds them itself. */
+typedef struct _MsgIndexJob {
+	MsgIndex *index;
+	guint msgnum;
+	guint serial;
+	gchar *file;
+	gboolean queue_file;
+	guint32 flags;
+	GArray *trigrams;
+} MsgIndexJob;
+
+static GAsyncQueue *msgindex_jobs = NULL;
+static GAsyncQueue *msgindex_done = NULL;
+
+static void msgindex_job_apply(MsgIndexJob *job)
+{
+	MsgIndex *index = job->index;
+	gpointer serial;
+
+	if (!index->destroyed &&
+	    g_hash_table_lookup_extended(index->pending,
+					 GUINT_TO_POINTER(job->msgnum),
+					 NULL, &serial) &&
+	    GPOINTER_TO_UINT(serial) == job->serial) {
+		g_hash_table_remove(index->pending, GUINT_TO_POINTER(job->msgnum));
+		if (job->trigrams != NULL) {
+			msgindex_add_scanned(index, job->msgnum, job->flags,
+					     job->trigrams);
+			job->trigrams = NULL;
+		}
+	}
+
+	if (job->trigrams != NULL)
+		g_array_free(job->trigrams, TRUE);
+	g_free(job->file);
+	g_free(job);
+	msgindex_unref(index);
+	account_sigsep_matchlist_delete();
+}
+
+static gboolean msgindex_done_idle(gpointer data)
+{
+	MsgIndexJob *job;
+
+	while ((job = g_async_queue_try_pop(msgindex_done)) != NULL)
+		msgindex_job_apply(job);
+
+	return FALSE;
+}
+
+static void *msgindex_thread(void *data)
+{
+	MsgIndexJob *job;
+
+	for (;;) {
+		job = g_async_queue_pop(msgindex_jobs);
+		job->trigrams = msgindex_scan_file(job->file, job->queue_file,
+						   &job->flags);
+		g_async_queue_push(msgindex_done, job);
+		g_idle_add(msgindex_done_idle, NULL);
+	}
+
+	return NULL;
+}
+
+static gboolean msgindex_thread_start(void)
+{
+	pthread_t pt;
+
+	if (msgindex_jobs != NULL)
+		return TRUE;
+
+	msgindex_jobs = g_async_queue_new();
+	msgindex_done = g_async_queue_new();
+	if (pthread_create(&pt, NULL, msgindex_thread, NULL) != 0) {
+		g_async_queue_unref(msgindex_jobs);
+		g_async_queue_unref(msgindex_done);
+		msgindex_jobs = msgindex_done = NULL;
+		return FALSE;
+	}
+	pthread_detach(pt);
+
+	return TRUE;
+}
+#endif
+
+/*!
+ *\brief	Index the text of a message the way the matcher reads it.
+ *		The message is read on another thread when possible, and
+ *		is searched as if unindexed until it's done. Messages
+ *		which can't be read entirely are left out, so that
+ *		they're always searched.
+ */
+void msgindex_add_msg(MsgIndex *index, MsgInfo *msginfo)
+{
+	gchar *file;
+	gboolean queue_file;
+	guint32 flags;
+	GArray *trigrams;
+
+	cm_return_if_fail(index != NULL);
+	cm_return_if_fail(msginfo != NULL);
+
+	msgindex_remove_msg(index, msginfo->msgnum);
+
+	file = procmsg_get_message_file_path(msginfo);
+	if (file == NULL)
+		return;
+	queue_file = folder_has_parent_of_type(msginfo->folder, F_QUEUE) ||
+		     folder_has_parent_of_type(msginfo->folder, F_DRAFT);
+
+#ifdef USE_PTHREAD
+	if (msgindex_thread_start()) {
+		MsgIndexJob *job = g_new0(MsgIndexJob, 1);
+
+		job->index = index;
+		index->refcnt++;
+		job->msgnum = msginfo->msgnum;
+		job->serial = ++index->serial;
+		job->file = file;
+		job->queue_file = queue_file;
+		g_hash_table_insert(index->pending,
+				    GUINT_TO_POINTER(job->msgnum),
+				    GUINT_TO_POINTER(job->serial));
+		account_sigsep_matchlist_create();
+		g_async_queue_push(msgindex_jobs, job);
+		return;
+	}
+#endif
+
+	trigrams = msgindex_scan_file(file, queue_file, &flags);
+	g_free(file);
+	if (trigrams != NULL)
+		msgindex_add_scanned(index, msginfo->msgnum, flags, trigrams);
+}
+
+/*!
+ *\brief	Wait for the messages of an index being read on another
+ *		thread to be indexed
+ */
+void msgindex_flush(MsgIndex *index)
+{
+	cm_return_if_fail(index != NULL);
+
+#ifdef USE_PTHREAD
+	while (msgindex_done != NULL && g_hash_table_size(index->pending) > 0)
+		msgindex_job_apply(g_async_queue_pop(msgindex_done));
+#endif
+}
+
+void msgindex_remove_msg(MsgIndex *index, guint msgnum)
+{
+	gpointer key = GUINT_TO_POINTER(msgnum);
+
+	cm_return_if_fail(index != NULL);
+
+	g_hash_table_remove(index->pending, key);
+	if (!g_hash_table_remove(index->entries, key))
+		return;
+
+	/* its lists in the file are left for msgindex_write() to prune */
+	if (!g_hash_table_remove(index->added, key) || index->mapped != NULL)
+		g_hash_table_add(index->dropped, key);
+	index->dirty = TRUE;
+}
+
+/*!
+ *\brief	Tell if a message is indexed, or being indexed
+ */
+gboolean msgindex_has_msg(MsgIndex *index, guint msgnum)
+{
+	cm_return_val_if_fail(index != NULL, FALSE);
+
+	return g_hash_table_contains(index->entries, GUINT_TO_POINTER(msgnum)) ||
+	       g_hash_table_contains(index->pending, GUINT_TO_POINTER(msgnum));
+}
+
+/* The trigrams of a searched string, and the messages of the file
+ * having all of them; kept for the next messages of the search */
+static MsgIndexQuery *msgindex_get_query(MsgIndex *index, const gchar *str)
+{
+	MsgIndexQuery *query;
+	GHashTable *set;
+	GArray *list;
+	guint i;
+
+	if ((query = g_hash_table_lookup(index->queries, str)) != NULL)
+		return query;
+
+	if (g_hash_table_size(index->queries) >= MSGINDEX_MAX_QUERIES)
+		g_hash_table_remove_all(index->queries);
+
+	set = g_hash_table_new(g_direct_hash, g_direct_equal);
+	msgindex_trigrams_add(set, str);
+	query = g_new0(MsgIndexQuery, 1);
+	query->trigrams = msgindex_trigrams_sorted(set);
+	query->msgnums = g_array_new(FALSE, FALSE, sizeof(guint32));
+	g_hash_table_destroy(set);
+
+	list = g_array_new(FALSE, FALSE, sizeof(guint32));
+	for (i = 0; i < query->trigrams->len; i++) {
+		guint32 trigram = g_array_index(query->trigrams, guint32, i);
+		const guchar *rec = msgindex_dir_lookup(index, trigram);
+		guint j, k;
+
+		if (rec == NULL) {
+			g_array_set_size(query->msgnums, 0);
+			break;
+		}
+		if (i == 0) {
+			msgindex_dir_decode(index, rec, NULL, query->msgnums);
+			continue;
+		}
+
+		/* keeps what's in both */
+		g_array_set_size(list, 0);
+		msgindex_dir_decode(index, rec, NULL, list);
+		for (j = 0, k = 0; j < query->msgnums->len; j++) {
+			guint32 msgnum = g_array_index(query->msgnums, guint32, j);
+
+			if (msgindex_array_contains(list, msgnum))
+				g_array_index(query->msgnums, guint32, k++) = msgnum;
+		}
+		g_array_set_size(query->msgnums, k);
+		if (k == 0)
+			break;
+	}
+	g_array_free(list, TRUE);
+
+	g_hash_table_insert(index->queries, g_strdup(str), query);
+
+	return query;
+}
+
+/*!
+ *\brief	Tell if a message may have a line containing a string
+ *
+ *\param	index Message index
+ *\param	msgnum Number of the message
+ *\param	str String, as the matcher looks for it (casefolded
+ *		when case insensitive)
+ *\param	whole_message TRUE for ~message, which also looks into
+ *		non-text parts
+ *
+ *\return	gboolean FALSE if the message surely doesn't have it,
+ *		TRUE if it has to be read to know
+ */
+gboolean msgindex_may_contain(MsgIndex *index, guint msgnum,
+			      const gchar *str, gboolean whole_message)
+{
+	MsgIndexQuery *query;
+	GArray *trigrams;
+	gpointer flags;
+	guint i;
+
+	cm_return_val_if_fail(index != NULL, TRUE);
+	cm_return_val_if_fail(str != NULL, TRUE);
+
+	if (!g_hash_table_lookup_extended(index->entries, GUINT_TO_POINTER(msgnum),
+					  NULL, &flags))
+		return TRUE;
+	if (whole_message && (GPOINTER_TO_UINT(flags) & MSGINDEX_HAS_BINARY))
+		return TRUE;
+
+	/* too short to have a trigram: can't tell */
+	if (str[0] == '\0' || str[1] == '\0' || str[2] == '\0')
+		return TRUE;
+
+	query = msgindex_get_query(index, str);
+
+	if ((trigrams = g_hash_table_lookup(index->added,
+					    GUINT_TO_POINTER(msgnum))) != NULL) {
+		for (i = 0; i < query->trigrams->len; i++) {
+			if (!msgindex_array_contains(trigrams,
+					g_array_index(query->trigrams, guint32, i)))
+				return FALSE;
+		}
+		return TRUE;
+	}
+
+	return msgindex_array_contains(query->msgnums, msgnum);
+}
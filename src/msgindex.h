@@ -0,0 +1,52 @@
+/*
+ * Claws Mail -- a GTK based, lightweight, and fast e-mail client
+ * Copyright (C) 2024 the Claws Mail team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __MSGINDEX_H__
+#define __MSGINDEX_H__
+
+#ifdef HAVE_CONFIG_H
+#include "claws-features.h"
+#endif
+
+#include <glib.h>
+
+typedef struct _MsgIndex MsgIndex;
+
+#include "procmsg.h"
+
+MsgIndex	*msgindex_new		(void);
+void		 msgindex_destroy	(MsgIndex	*index);
+MsgIndex	*msgindex_read		(const gchar	*index_file);
+gint		 msgindex_write		(MsgIndex	*index,
+					 const gchar	*index_file);
+gboolean	 msgindex_is_dirty	(MsgIndex	*index);
+
+void		 msgindex_add_msg	(MsgIndex	*index,
+					 MsgInfo	*msginfo);
+void		 msgindex_flush		(MsgIndex	*index);
+void		 msgindex_remove_msg	(MsgIndex	*index,
+					 guint		 msgnum);
+gboolean	 msgindex_has_msg	(MsgIndex	*index,
+					 guint		 msgnum);
+gboolean	 msgindex_may_contain	(MsgIndex	*index,
+					 guint		 msgnum,
+					 const gchar	*str,
+					 gboolean	 whole_message);
+
+#endif
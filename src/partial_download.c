@@ -65,87 +65,68 @@
 #include "msgcache.h"
 #include "file-utils.h"
 
+typedef struct _PartialUIDLLookup {
+	const gchar *uidl;
+	gboolean found;
+	time_t recv_time;
+	gchar *partial_recv;
+} PartialUIDLLookup;
+
+static void partial_uidl_lookup_func(const gchar *uidl, time_t recv_time,
+				     const gchar *partial_recv, gpointer data)
+{
+	PartialUIDLLookup *lookup = (PartialUIDLLookup *)data;
+
+	/* the last line of a UIDL is the one in effect */
+	if (strcmp(uidl, lookup->uidl))
+		return;
+	lookup->found = TRUE;
+	lookup->recv_time = recv_time;
+	g_free(lookup->partial_recv);
+	lookup->partial_recv = g_strdup(partial_recv);
+}
+
+/* returns -1 if the account has no UIDL list */
+static gint partial_uidl_lookup(const gchar *server, const gchar *login,
+				PartialUIDLLookup *lookup)
+{
+	lookup->found = FALSE;
+	lookup->recv_time = RECV_TIME_NONE;
+	lookup->partial_recv = NULL;
+
+	return pop3_uidl_read(server, login, partial_uidl_lookup_func, lookup);
+}
+
 int partial_msg_in_uidl_list(MsgInfo *msginfo)
 {
-	gchar *path;
-	FILE *fp;
-	gchar buf[POPBUFSIZE];
-	gchar uidl[POPBUFSIZE];
-	time_t recv_time;
-	time_t now;
-	gchar *sanitized_uid = NULL;
-	
+	PartialUIDLLookup lookup;
+
 	if (!msginfo->extradata)
 		return FALSE;
 
-	sanitized_uid = g_strdup(msginfo->extradata->account_login);
-	
-	subst_for_filename(sanitized_uid);
-
 	if (!msginfo->extradata->account_server
 	||  !msginfo->extradata->account_login
 	||  !msginfo->extradata->partial_recv)
 		return FALSE;
-	
-	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-			   "uidl", G_DIR_SEPARATOR_S, msginfo->extradata->account_server,
-			   "-", msginfo->extradata->account_login, NULL);
-	if ((fp = claws_fopen(path, "rb")) == NULL) {
-		if (ENOENT != errno) FILE_OP_ERROR(path, "claws_fopen");
-		g_free(path);
-		path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-				   "uidl-", msginfo->extradata->account_server,
-				   "-", sanitized_uid, NULL);
-		if ((fp = claws_fopen(path, "rb")) == NULL) {
-			if (ENOENT != errno) FILE_OP_ERROR(path, "claws_fopen");
-			g_free(sanitized_uid);
-			g_free(path);
-			return FALSE;
-		}
-	}
-	g_free(sanitized_uid);
-	g_free(path);
-
-	now = time(NULL);
-
-	while (claws_fgets(buf, sizeof(buf), fp) != NULL) {
-		gchar tmp[POPBUFSIZE];
-		strretchomp(buf);
-		recv_time = RECV_TIME_NONE;
-		
-		if (sscanf(buf, "%s\t%ld\t%s", uidl, (long int *) &recv_time, 
-			   tmp) < 2) {
-			if (sscanf(buf, "%s", uidl) != 1)
-				continue;
-			else {
-				recv_time = now;
-			}
-		}
-		if (!strcmp(uidl, msginfo->extradata->partial_recv)) {
-			claws_fclose(fp);
-			return TRUE;
-		}
-	}
 
-	claws_fclose(fp);	
-	return FALSE;
+	lookup.uidl = msginfo->extradata->partial_recv;
+	partial_uidl_lookup(msginfo->extradata->account_server,
+			    msginfo->extradata->account_login, &lookup);
+	g_free(lookup.partial_recv);
+
+	return lookup.found;
 }
 
 static int partial_uidl_mark_mail(MsgInfo *msginfo, int download)
 {
-	gchar *path;
 	gchar *pathnew;
 	FILE *fp;
 	FILE *fpnew;
 	gchar buf[POPBUFSIZE];
-	gchar uidl[POPBUFSIZE];
-	time_t recv_time;
-	time_t now;
-	gchar partial_recv[POPBUFSIZE];
+	PartialUIDLLookup lookup;
 	int err = -1;
 	gchar *filename;
 	MsgInfo *tinfo;
-	gchar *sanitized_uid = NULL;	
 
 	filename = procmsg_get_message_file_path(msginfo);
 	if (!filename) {
@@ -159,109 +140,41 @@ static int partial_uidl_mark_mail(MsgInfo *msginfo, int download)
 		return err;
 	}
 
-	sanitized_uid = g_strdup(tinfo->extradata->account_login);
-	subst_for_filename(sanitized_uid);
-
 	if (!tinfo->extradata->account_server
 	||  !tinfo->extradata->account_login
 	||  !tinfo->extradata->partial_recv) {
 		goto bail;
 	}
-	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-			   "uidl", G_DIR_SEPARATOR_S, tinfo->extradata->account_server,
-			   "-", sanitized_uid, NULL);
-
-	if ((fp = claws_fopen(path, "rb")) == NULL) {
-		if (ENOENT != errno) FILE_OP_ERROR(path, "claws_fopen");
-		g_free(path);
-		path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-				   "uidl-", tinfo->extradata->account_server,
-				   "-", tinfo->extradata->account_login, NULL);
-		if ((fp = claws_fopen(path, "rb")) == NULL) {
-			if (ENOENT != errno) FILE_OP_ERROR(path, "claws_fopen");
-			g_free(path);
-			goto bail;
-		}
-	}
-
-	pathnew = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-			   "uidl", G_DIR_SEPARATOR_S, tinfo->extradata->account_server,
-			   "-", sanitized_uid, ".new", NULL);
-	
-	g_free(sanitized_uid);
 
-	if ((fpnew = claws_fopen(pathnew, "wb")) == NULL) {
-		FILE_OP_ERROR(pathnew, "claws_fopen");
-		claws_fclose(fp);
-		g_free(path);
-		g_free(pathnew);
+	lookup.uidl = tinfo->extradata->partial_recv;
+	if (partial_uidl_lookup(tinfo->extradata->account_server,
+				tinfo->extradata->account_login, &lookup) < 0)
 		goto bail;
-	}
-	
-	now = time(NULL);
-
-	while (claws_fgets(buf, sizeof(buf), fp) != NULL) {
-		strretchomp(buf);
-		recv_time = RECV_TIME_NONE;
-		sprintf(partial_recv,"0");
-		
-		if (sscanf(buf, "%s\t%ld\t%s", 
-			   uidl, (long int *) &recv_time, partial_recv) < 2) {
-			if (sscanf(buf, "%s", uidl) != 1)
-				continue;
-			else {
-				recv_time = now;
-			}
+	g_free(lookup.partial_recv);
+
+	if (lookup.found) {
+		gchar *stat = NULL;
+		gint ret;
+
+		if (download == POP3_PARTIAL_DLOAD_DLOAD) {
+			gchar *folder_id = folder_item_get_identifier(
+						msginfo->folder);
+			stat = g_strdup_printf("%s:%d",
+				folder_id, msginfo->msgnum);
+			g_free(folder_id);
 		}
-		if (strcmp(tinfo->extradata->partial_recv, uidl)) {
-			if (fprintf(fpnew, "%s\t%ld\t%s\n", 
-				uidl, (long int) recv_time, partial_recv) < 0) {
-				FILE_OP_ERROR(pathnew, "fprintf");
-				claws_fclose(fpnew);
-				claws_fclose(fp);
-				g_free(path);
-				g_free(pathnew);
-				goto bail;
-			}
-		} else {
-			gchar *stat = NULL;
-			if (download == POP3_PARTIAL_DLOAD_DLOAD) {
-				gchar *folder_id = folder_item_get_identifier(
-							msginfo->folder);
-				stat = g_strdup_printf("%s:%d",
-					folder_id, msginfo->msgnum);
-				g_free(folder_id);
-			}
-			else if (download == POP3_PARTIAL_DLOAD_UNKN)
-				stat = g_strdup("1");
-			else if (download == POP3_PARTIAL_DLOAD_DELE)
-				stat = g_strdup("0");
-			
-			if (fprintf(fpnew, "%s\t%ld\t%s\n", 
-				uidl, (long int) recv_time, stat) < 0) {
-				FILE_OP_ERROR(pathnew, "fprintf");
-				claws_fclose(fpnew);
-				claws_fclose(fp);
-				g_free(path);
-				g_free(pathnew);
-				goto bail;
-			}
-			g_free(stat);
-		}
-	}
-	if (claws_safe_fclose(fpnew) == EOF) {
-		FILE_OP_ERROR(pathnew, "claws_fclose");
-		claws_fclose(fp);
-		g_free(path);
-		g_free(pathnew);
-		goto bail;
+		else if (download == POP3_PARTIAL_DLOAD_UNKN)
+			stat = g_strdup("1");
+		else if (download == POP3_PARTIAL_DLOAD_DELE)
+			stat = g_strdup("0");
+
+		ret = pop3_uidl_append(tinfo->extradata->account_server,
+				       tinfo->extradata->account_login,
+				       lookup.uidl, lookup.recv_time, stat);
+		g_free(stat);
+		if (ret < 0)
+			goto bail;
 	}
-	claws_fclose(fp);
-
-	move_file(pathnew, path, TRUE);
-
-	g_free(path);
-	g_free(pathnew);
 	
 	if ((fp = claws_fopen(filename,"rb")) == NULL) {
 		FILE_OP_ERROR(filename, "claws_fopen");
@@ -381,58 +294,10 @@ void partial_delete_old(const gchar *file)
 gchar *partial_get_filename(const gchar *server, const gchar *login,
 				   const gchar *muidl)
 {
-	gchar *path;
-	gchar *result = NULL;
-	FILE *fp;
-	gchar buf[POPBUFSIZE];
-	gchar uidl[POPBUFSIZE];
-	time_t recv_time;
-	time_t now;
-	gchar *sanitized_uid = g_strdup(login);	
-
-	subst_for_filename(sanitized_uid);
-
-	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-			   "uidl", G_DIR_SEPARATOR_S, 
-			   server, "-", sanitized_uid, NULL);
-	if ((fp = claws_fopen(path, "rb")) == NULL) {
-		if (ENOENT != errno) FILE_OP_ERROR(path, "claws_fopen");
-		g_free(path);
-		path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-				   "uidl-", server,
-				   "-", sanitized_uid, NULL);
-		if ((fp = claws_fopen(path, "rb")) == NULL) {
-			if (ENOENT != errno) FILE_OP_ERROR(path, "claws_fopen");
-			g_free(sanitized_uid);
-			g_free(path);
-			return result;
-		}
-	}
-	g_free(sanitized_uid);
-	g_free(path);
-
-	now = time(NULL);
-
-	while (claws_fgets(buf, sizeof(buf), fp) != NULL) {
-		gchar tmp[POPBUFSIZE];
-		strretchomp(buf);
-		recv_time = RECV_TIME_NONE;
-		
-		if (sscanf(buf, "%s\t%ld\t%s", uidl, (long int *) &recv_time, 
-			   tmp) < 2) {
-			if (sscanf(buf, "%s", uidl) != 1)
-				continue;
-			else {
-				recv_time = now;
-			}
-		}
-		if (!strcmp(muidl, uidl)) {
-			result = g_strdup(tmp);
-			break;
-		}
-	}
+	PartialUIDLLookup lookup;
 
-	claws_fclose(fp);
-	
-	return result;
+	lookup.uidl = muidl;
+	partial_uidl_lookup(server, login, &lookup);
+
+	return lookup.partial_recv;
 }
@@ -51,6 +51,10 @@ static gint pop3_getauth_apop_send	(Pop3Session *session);
 static gint pop3_stls_send		(Pop3Session *session);
 static gint pop3_stls_recv		(Pop3Session *session);
 #endif
+static gint pop3_capa_send		(Pop3Session *session);
+static gint pop3_capa_recv		(Pop3Session *session,
+					 const gchar *data,
+					 guint        len);
 static gint pop3_getrange_stat_send	(Pop3Session *session);
 static gint pop3_getrange_stat_recv	(Pop3Session *session,
 					 const gchar *msg);
@@ -65,11 +69,13 @@ static gint pop3_getsize_list_send	(Pop3Session *session);
 static gint pop3_getsize_list_recv	(Pop3Session *session,
 					 const gchar *data,
 					 guint        len);
-static gint pop3_retr_send		(Pop3Session *session);
+static gint pop3_retr_send		(Pop3Session *session,
+					 gint         num);
 static gint pop3_retr_recv		(Pop3Session *session,
 					 const gchar *data,
 					 guint        len);
-static gint pop3_delete_send		(Pop3Session *session);
+static gint pop3_delete_send		(Pop3Session *session,
+					 gint         num);
 static gint pop3_delete_recv		(Pop3Session *session);
 static gint pop3_logout_send		(Pop3Session *session);
 
@@ -83,7 +89,17 @@ static gint pop3_write_msg_to_file	(const gchar	*file,
 					 guint		 len,
 					 const gchar 	*prefix);
 
+static Pop3State pop3_lookup_msg	(Pop3Session	*session,
+					 gint		*num);
 static Pop3State pop3_lookup_next	(Pop3Session	*session);
+static gint pop3_next_msg		(Pop3Session	*session);
+
+static void pop3_pipeline_start		(Pop3Session	*session);
+static void pop3_pipeline_stop		(Pop3Session	*session);
+static void pop3_pipeline_push		(Pop3Session	*session,
+					 Pop3State	 state,
+					 gint		 num);
+static gint pop3_pipeline_continue	(Pop3Session	*session);
 static Pop3ErrorValue pop3_ok		(Pop3Session	*session,
 					 const gchar	*msg);
 
@@ -253,6 +269,33 @@ static gint pop3_getauth_oauth2_send(Pop3Session *session)
 }
 #endif
 
+static gint pop3_capa_send(Pop3Session *session)
+{
+	session->state = POP3_CAPA;
+	pop3_gen_send(session, "CAPA");
+	return PS_SUCCESS;
+}
+
+static gint pop3_capa_recv(Pop3Session *session, const gchar *data, guint len)
+{
+	const gchar *p = data;
+	const gchar *lastp = data + len;
+	const gchar *newline;
+
+	while (p < lastp) {
+		if ((newline = memchr(p, '\r', lastp - p)) == NULL)
+			return -1;
+
+		if (newline - p == 10 && !g_ascii_strncasecmp(p, "PIPELINING", 10))
+			session->pipelining_offered = TRUE;
+
+		p = newline + 1;
+		if (p < lastp && *p == '\n') p++;
+	}
+
+	return PS_SUCCESS;
+}
+
 static gint pop3_getrange_stat_send(Pop3Session *session)
 {
 	session->state = POP3_GETRANGE_STAT;
@@ -416,13 +459,15 @@ static gint pop3_getsize_list_recv(Pop3Session *session, const gchar *data,
 	return PS_SUCCESS;
 }
 
-static gint pop3_retr_send(Pop3Session *session)
+static gint pop3_retr_send(Pop3Session *session, gint num)
 {
-	session->state = POP3_RETR;
-	debug_print("retrieving %d [%s]\n", session->cur_msg,
-		session->msg[session->cur_msg].uidl ?
-		 session->msg[session->cur_msg].uidl:" ");
-	pop3_gen_send(session, "RETR %d", session->cur_msg);
+	if (!session->pipelining)
+		session->state = POP3_RETR;
+	debug_print("retrieving %d [%s]\n", num,
+		session->msg[num].uidl ?
+		 session->msg[num].uidl:" ");
+	pop3_pipeline_push(session, POP3_RETR, num);
+	pop3_gen_send(session, "RETR %d", num);
 	return PS_SUCCESS;
 }
 
@@ -486,11 +531,13 @@ static gint pop3_retr_recv(Pop3Session *session, const gchar *data, guint len)
 	return PS_SUCCESS;
 }
 
-static gint pop3_top_send(Pop3Session *session, gint max_size)
+static gint pop3_top_send(Pop3Session *session, gint num, gint max_size)
 {
 	gint num_lines = (max_size*1024)/82; /* consider lines to be 80 chars */
-	session->state = POP3_TOP;
-	pop3_gen_send(session, "TOP %d %d", session->cur_msg, num_lines);
+	if (!session->pipelining)
+		session->state = POP3_TOP;
+	pop3_pipeline_push(session, POP3_TOP, num);
+	pop3_gen_send(session, "TOP %d %d", num, num_lines);
 	return PS_SUCCESS;
 }
 
@@ -552,10 +599,12 @@ static gint pop3_top_recv(Pop3Session *session, const gchar *data, guint len)
 	return PS_SUCCESS;
 }
 
-static gint pop3_delete_send(Pop3Session *session)
+static gint pop3_delete_send(Pop3Session *session, gint num)
 {
-	session->state = POP3_DELETE;
-	pop3_gen_send(session, "DELE %d", session->cur_msg);
+	if (!session->pipelining)
+		session->state = POP3_DELETE;
+	pop3_pipeline_push(session, POP3_DELETE, num);
+	pop3_gen_send(session, "DELE %d", num);
 	return PS_SUCCESS;
 }
 
@@ -595,7 +644,13 @@ static void pop3_gen_send(Pop3Session *session, const gchar *format, ...)
 	else
 		log_print(LOG_PROTOCOL, "POP> %s\n", buf);
 
-	session_send_msg(SESSION(session), buf);
+	if (session->pipelining) {
+		/* written by pop3_pipeline_continue() */
+		if (session->pipeline_buf->len > 0)
+			g_string_append(session->pipeline_buf, "\r\n");
+		g_string_append(session->pipeline_buf, buf);
+	} else
+		session_send_msg(SESSION(session), buf);
 }
 
 Session *pop3_session_new(PrefsAccount *account)
@@ -657,6 +712,8 @@ static void pop3_session_destroy(Session *session)
 		g_hash_table_destroy(pop3_session->partial_recv_table);
 	}
 
+	pop3_pipeline_stop(pop3_session);
+
 	g_free(pop3_session->greeting);
 	g_free(pop3_session->user);
 	g_free(pop3_session->pass);
@@ -665,84 +722,227 @@ static void pop3_session_destroy(Session *session)
 	pop3_session->ac_prefs->receive_in_progress = FALSE;
 }
 
-static void pop3_get_uidl_table(PrefsAccount *ac_prefs, Pop3Session *session)
+/* The UIDL list of an account is a log of "uidl\trecv_time\tpartial_recv"
+ * lines, the last line of a UIDL overriding the previous ones. Sessions
+ * and partial_download.c only append the entries they change; the file is
+ * rewritten when a UIDL leaves it or when it holds too many stale lines.
+ * Lists written by older versions, with one line per UIDL, are read as
+ * they are. */
+#define POP3_UIDL_LOG_SLACK	64
+
+static gchar *pop3_uidl_path(const gchar *server, const gchar *login,
+			     gboolean legacy)
 {
-	GHashTable *table;
-	GHashTable *partial_recv_table;
+	gchar *sanitized_uid;
 	gchar *path;
-	FILE *fp;
-	gchar buf[POPBUFSIZE];
-	gchar uidl[POPBUFSIZE];
-	time_t recv_time;
-	time_t now;
-	gint partial_recv;
-	gchar *sanitized_uid = g_strdup(ac_prefs->userid);
-
-	subst_for_filename(sanitized_uid);
 
-	table = g_hash_table_new(g_str_hash, g_str_equal);
-	partial_recv_table = g_hash_table_new(g_str_hash, g_str_equal);
+	if (legacy)
+		return g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
+				   "uidl-", server, "-", login, NULL);
 
+	sanitized_uid = g_strdup(login);
+	subst_for_filename(sanitized_uid);
 	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-			   "uidl", G_DIR_SEPARATOR_S, ac_prefs->recv_server,
+			   "uidl", G_DIR_SEPARATOR_S, server,
 			   "-", sanitized_uid, NULL);
-
 	g_free(sanitized_uid);
+
+	return path;
+}
+
+/* returns the list in use, the legacy one only if it's the only one */
+static gchar *pop3_uidl_find(const gchar *server, const gchar *login,
+			     gboolean *legacy)
+{
+	gchar *path = pop3_uidl_path(server, login, FALSE);
+	gchar *legacy_path;
+
+	*legacy = FALSE;
+	if (is_file_exist(path))
+		return path;
+
+	legacy_path = pop3_uidl_path(server, login, TRUE);
+	if (is_file_exist(legacy_path)) {
+		g_free(path);
+		*legacy = TRUE;
+		return legacy_path;
+	}
+	g_free(legacy_path);
+
+	return path;
+}
+
+static gboolean pop3_uidl_parse_line(gchar *buf, time_t now, gchar **uidl,
+				     time_t *recv_time,
+				     const gchar **partial_recv)
+{
+	gchar *p, *ep;
+	glong val;
+
+	strretchomp(buf);
+	while (g_ascii_isspace(*buf))
+		buf++;
+	if (*buf == '\0')
+		return FALSE;
+
+	*uidl = buf;
+	*recv_time = now;
+	*partial_recv = "0";
+
+	if ((p = strchr(buf, '\t')) == NULL)
+		return TRUE;
+	*p++ = '\0';
+
+	val = strtol(p, &ep, 10);
+	if (ep == p || (*ep != '\0' && *ep != '\t'))
+		return TRUE;
+	*recv_time = (time_t)val;
+
+	if (*ep == '\t' && *(ep + 1) != '\0')
+		*partial_recv = ep + 1;
+
+	return TRUE;
+}
+
+static gint pop3_uidl_read_file(const gchar *path, Pop3UIDLFunc func,
+				gpointer data)
+{
+	FILE *fp;
+	gchar buf[POPBUFSIZE];
+	gchar *uidl;
+	const gchar *partial_recv;
+	time_t recv_time;
+	time_t now;
+	gint lines = 0;
+
 	if ((fp = claws_fopen(path, "rb")) == NULL) {
 		if (ENOENT != errno) FILE_OP_ERROR(path, "claws_fopen");
-		g_free(path);
-		path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-				   "uidl-", ac_prefs->recv_server,
-				   "-", ac_prefs->userid, NULL);
-		if ((fp = claws_fopen(path, "rb")) == NULL) {
-			if (ENOENT != errno) FILE_OP_ERROR(path, "claws_fopen");
-			g_free(path);
-			session->uidl_table = table;
-			session->partial_recv_table = partial_recv_table;
-			return;
-		}
+		return -1;
 	}
-	g_free(path);
 
 	now = time(NULL);
 
 	while (claws_fgets(buf, sizeof(buf), fp) != NULL) {
-		gchar tmp[POPBUFSIZE];
-		strretchomp(buf);
-		recv_time = RECV_TIME_NONE;
-		partial_recv = POP3_TOTALLY_RECEIVED;
-
-		if (sscanf(buf, "%s\t%ld\t%s", uidl, (long int *) &recv_time, tmp) < 3) {
-			if (sscanf(buf, "%s\t%ld", uidl, (long int *) &recv_time) != 2) {
-				if (sscanf(buf, "%s", uidl) != 1)
-					continue;
-				else {
-					recv_time = now;
-					strcpy(tmp, "0");
-				}
-			} else {
-				strcpy(tmp, "0");
-			}
-		}
+		if (!pop3_uidl_parse_line(buf, now, &uidl, &recv_time,
+					  &partial_recv))
+			continue;
+		func(uidl, recv_time, partial_recv, data);
+		lines++;
+	}
 
-		if (recv_time == RECV_TIME_NONE)
-			recv_time = RECV_TIME_RECEIVED;
-		g_hash_table_insert(table, g_strdup(uidl),
-				    GINT_TO_POINTER(recv_time));
-		if (strlen(tmp) == 1)
-			partial_recv = atoi(tmp); /* totally received ?*/
-		else
-			partial_recv = POP3_MUST_COMPLETE_RECV;
+	claws_fclose(fp);
 
-		g_hash_table_insert(partial_recv_table, g_strdup(uidl),
-				    GINT_TO_POINTER(partial_recv));
+	return lines;
+}
+
+gint pop3_uidl_read(const gchar *server, const gchar *login,
+		    Pop3UIDLFunc func, gpointer data)
+{
+	gboolean legacy;
+	gchar *path = pop3_uidl_find(server, login, &legacy);
+	gint lines;
+
+	lines = pop3_uidl_read_file(path, func, data);
+	g_free(path);
+
+	return lines;
+}
+
+static gint pop3_uidl_append_lines(const gchar *server, const gchar *login,
+				   const gchar *lines)
+{
+	gboolean legacy;
+	gchar *path = pop3_uidl_find(server, login, &legacy);
+	FILE *fp;
+
+	if ((fp = claws_fopen(path, "ab")) == NULL) {
+		FILE_OP_ERROR(path, "claws_fopen");
+		g_free(path);
+		return -1;
+	}
+	if (claws_fputs(lines, fp) == EOF) {
+		FILE_OP_ERROR(path, "claws_fputs");
+		claws_fclose(fp);
+		g_free(path);
+		return -1;
+	}
+	if (claws_safe_fclose(fp) == EOF) {
+		FILE_OP_ERROR(path, "claws_fclose");
+		g_free(path);
+		return -1;
 	}
+	g_free(path);
 
-	claws_fclose(fp);
-	session->uidl_table = table;
-	session->partial_recv_table = partial_recv_table;
+	return 0;
+}
+
+gint pop3_uidl_append(const gchar *server, const gchar *login,
+		      const gchar *uidl, time_t recv_time,
+		      const gchar *partial_recv)
+{
+	gchar *line;
+	gint ret;
+
+	line = g_strdup_printf("%s\t%ld\t%s\n", uidl, (long int)recv_time,
+			       partial_recv);
+	ret = pop3_uidl_append_lines(server, login, line);
+	g_free(line);
+
+	return ret;
+}
+
+static void pop3_uidl_table_set(GHashTable *table, const gchar *uidl,
+				gint value)
+{
+	gpointer key;
+
+	if (!g_hash_table_lookup_extended(table, uidl, &key, NULL))
+		key = g_strdup(uidl);
+	g_hash_table_insert(table, key, GINT_TO_POINTER(value));
+}
+
+static void pop3_uidl_table_add(const gchar *uidl, time_t recv_time,
+				const gchar *partial_recv, gpointer data)
+{
+	Pop3Session *session = (Pop3Session *)data;
+
+	if (recv_time == RECV_TIME_NONE)
+		recv_time = RECV_TIME_RECEIVED;
+	pop3_uidl_table_set(session->uidl_table, uidl, (gint)recv_time);
+
+	pop3_uidl_table_set(session->partial_recv_table, uidl,
+			    strlen(partial_recv) == 1 ?
+			    atoi(partial_recv) /* totally received ?*/ :
+			    POP3_MUST_COMPLETE_RECV);
+}
+
+static void pop3_get_uidl_table(PrefsAccount *ac_prefs, Pop3Session *session)
+{
+	gchar *path;
+	gint lines;
+
+	session->uidl_table = g_hash_table_new(g_str_hash, g_str_equal);
+	session->partial_recv_table = g_hash_table_new(g_str_hash, g_str_equal);
 
-	return;
+	path = pop3_uidl_find(ac_prefs->recv_server, ac_prefs->userid,
+			      &session->uidl_log_legacy);
+	lines = pop3_uidl_read_file(path, pop3_uidl_table_add, session);
+	session->uidl_log_lines = MAX(lines, 0);
+	g_free(path);
+}
+
+static gboolean pop3_uidl_msg_changed(Pop3Session *session, Pop3MsgInfo *msg)
+{
+	gpointer recv_time;
+
+	if (!g_hash_table_lookup_extended(session->uidl_table, msg->uidl,
+					  NULL, &recv_time))
+		return TRUE;
+
+	return (time_t)GPOINTER_TO_INT(recv_time) != msg->recv_time ||
+		GPOINTER_TO_INT(g_hash_table_lookup(session->partial_recv_table,
+						    msg->uidl))
+		!= msg->partial_recv;
 }
 
 #define TRY(func) \
@@ -752,43 +952,34 @@ if (!(func)) \
 	goto err_write;			\
 } \
 
-gint pop3_write_uidl_list(Pop3Session *session)
+static gint pop3_compact_uidl_list(Pop3Session *session)
 {
 	gchar *path, *tmp_path;
 	FILE *fp;
 	Pop3MsgInfo *msg;
 	gint n;
-	gchar *sanitized_uid = g_strdup(session->ac_prefs->userid);
 
-	subst_for_filename(sanitized_uid);
-
-	if (!session->uidl_is_valid) {
-		g_free(sanitized_uid);
-		return 0;
-	}
-
-	path = g_strconcat(get_rc_dir(), G_DIR_SEPARATOR_S,
-			   "uidl", G_DIR_SEPARATOR_S,
-			   session->ac_prefs->recv_server,
-			   "-", sanitized_uid, NULL);
+	path = pop3_uidl_path(session->ac_prefs->recv_server,
+			      session->ac_prefs->userid, FALSE);
 	tmp_path = g_strconcat(path, ".tmp", NULL);
 
-	g_free(sanitized_uid);
-
 	if ((fp = claws_fopen(tmp_path, "wb")) == NULL) {
 		FILE_OP_ERROR(tmp_path, "claws_fopen");
 		goto err_write;
 	}
 
+	session->uidl_log_lines = 0;
 	for (n = 1; n <= session->count; n++) {
 		msg = &session->msg[n];
 		if (msg->uidl && msg->received &&
-		    (!msg->deleted || session->state != POP3_DONE))
+		    (!msg->deleted || session->state != POP3_DONE)) {
 			TRY(fprintf(fp, "%s\t%ld\t%d\n",
 				msg->uidl, (long int)
 				msg->recv_time,
 				msg->partial_recv)
 			    > 0);
+			session->uidl_log_lines++;
+		}
 	}
 
 	if (claws_safe_fclose(fp) == EOF) {
@@ -804,6 +995,7 @@ gint pop3_write_uidl_list(Pop3Session *session)
 		FILE_OP_ERROR(path, "rename");
 		goto err_write;
 	}
+	session->uidl_log_legacy = FALSE;
 	g_free(path);
 	g_free(tmp_path);
 	return 0;
@@ -817,6 +1009,65 @@ err_write:
 
 #undef TRY
 
+gint pop3_write_uidl_list(Pop3Session *session)
+{
+	GString *log;
+	Pop3MsgInfo *msg;
+	gint live = 0, known = 0, appended = 0;
+	gint n, ret = 0;
+
+	if (!session->uidl_is_valid)
+		return 0;
+
+	log = g_string_new(NULL);
+	for (n = 1; n <= session->count; n++) {
+		msg = &session->msg[n];
+		if (!msg->uidl || !msg->received ||
+		    (msg->deleted && session->state == POP3_DONE))
+			continue;
+		live++;
+		if (g_hash_table_lookup_extended(session->uidl_table,
+						 msg->uidl, NULL, NULL))
+			known++;
+		if (!pop3_uidl_msg_changed(session, msg))
+			continue;
+		g_string_append_printf(log, "%s\t%ld\t%d\n", msg->uidl,
+				       (long int)msg->recv_time,
+				       msg->partial_recv);
+		appended++;
+	}
+
+	/* rewrite the list when migrating it, when a UIDL it holds was
+	 * deleted or is gone from the server (the server may give it to
+	 * a new message), or once it has grown to mostly superseded lines */
+	if (session->uidl_log_legacy ||
+	    (guint)known < g_hash_table_size(session->uidl_table) ||
+	    session->uidl_log_lines + appended > 2 * live + POP3_UIDL_LOG_SLACK) {
+		ret = pop3_compact_uidl_list(session);
+	} else if (appended > 0) {
+		ret = pop3_uidl_append_lines(session->ac_prefs->recv_server,
+					     session->ac_prefs->userid,
+					     log->str);
+		if (ret == 0)
+			session->uidl_log_lines += appended;
+	}
+	g_string_free(log, TRUE);
+
+	if (ret == 0 && appended > 0) {
+		for (n = 1; n <= session->count; n++) {
+			msg = &session->msg[n];
+			if (!msg->uidl || !msg->received)
+				continue;
+			pop3_uidl_table_set(session->uidl_table, msg->uidl,
+					    (gint)msg->recv_time);
+			pop3_uidl_table_set(session->partial_recv_table,
+					    msg->uidl, msg->partial_recv);
+		}
+	}
+
+	return ret;
+}
+
 static gint pop3_write_msg_to_file(const gchar *file, const gchar *data,
 				   guint len, const gchar *prefix)
 {
@@ -901,7 +1152,9 @@ static gint pop3_write_msg_to_file(const gchar *file, const gchar *data,
 	return 0;
 }
 
-static Pop3State pop3_lookup_next(Pop3Session *session)
+/* What to do with message *num or the ones after it: POP3_RETR,
+ * POP3_TOP or POP3_DELETE of *num, or POP3_LOGOUT once none is left */
+static Pop3State pop3_lookup_msg(Pop3Session *session, gint *num)
 {
 	Pop3MsgInfo *msg;
 	PrefsAccount *ac = session->ac_prefs;
@@ -909,7 +1162,7 @@ static Pop3State pop3_lookup_next(Pop3Session *session)
 	gboolean size_limit_over;
 
 	for (;;) {
-		msg = &session->msg[session->cur_msg];
+		msg = &session->msg[*num];
 		size = msg->size;
 		size_limit_over =
 		    (ac->enable_size_limit &&
@@ -925,40 +1178,169 @@ static Pop3State pop3_lookup_next(Pop3Session *session)
 		     (ac->msg_leave_hour * 60 * 60))) {
 			log_message(LOG_PROTOCOL,
 					_("POP: Deleting expired message %d [%s]\n"),
-					session->cur_msg, msg->uidl?msg->uidl:" ");
+					*num, msg->uidl?msg->uidl:" ");
 			session->cur_total_bytes += size;
-			pop3_delete_send(session);
 			return POP3_DELETE;
 		}
 
 		if (size_limit_over) {
 			if (!msg->received && msg->partial_recv !=
 			    POP3_MUST_COMPLETE_RECV) {
-				pop3_top_send(session, ac->size_limit);
 				return POP3_TOP;
 			} else if (msg->partial_recv == POP3_MUST_COMPLETE_RECV)
 				break;
 
 			log_message(LOG_PROTOCOL,
 					_("POP: Skipping message %d [%s] (%d bytes)\n"),
-					session->cur_msg, msg->uidl?msg->uidl:" ", size);
+					*num, msg->uidl?msg->uidl:" ", size);
 		}
 
 		if (size == 0 || msg->received || size_limit_over) {
 			session->cur_total_bytes += size;
-			if (session->cur_msg == session->count) {
-				pop3_logout_send(session);
+			if (*num == session->count)
 				return POP3_LOGOUT;
-			} else
-				session->cur_msg++;
+			else
+				(*num)++;
 		} else
 			break;
 	}
 
-	pop3_retr_send(session);
 	return POP3_RETR;
 }
 
+static Pop3State pop3_lookup_next(Pop3Session *session)
+{
+	Pop3State next = pop3_lookup_msg(session, &session->cur_msg);
+
+	switch (next) {
+	case POP3_DELETE:
+		pop3_delete_send(session, session->cur_msg);
+		break;
+	case POP3_TOP:
+		pop3_top_send(session, session->cur_msg,
+			      session->ac_prefs->size_limit);
+		break;
+	case POP3_LOGOUT:
+		pop3_logout_send(session);
+		break;
+	default:
+		pop3_retr_send(session, session->cur_msg);
+		break;
+	}
+
+	return next;
+}
+
+/* Moves on once the reply about cur_msg is dealt with */
+static gint pop3_next_msg(Pop3Session *session)
+{
+	if (session->pipelining)
+		return pop3_pipeline_continue(session);
+
+	if (session->cur_msg == session->count)
+		pop3_logout_send(session);
+	else {
+		session->cur_msg++;
+		if (pop3_lookup_next(session) == POP3_ERROR)
+			return -1;
+	}
+
+	return PS_SUCCESS;
+}
+
+typedef struct _Pop3Command
+{
+	Pop3State state;
+	gint num;
+} Pop3Command;
+
+static void pop3_pipeline_start(Pop3Session *session)
+{
+	debug_print("POP: pipelining commands\n");
+	session->pipelining = TRUE;
+	session->pipeline_buf = g_string_new(NULL);
+	session->next_msg = session->cur_msg;
+}
+
+static void pop3_pipeline_stop(Pop3Session *session)
+{
+	Pop3Command *cmd;
+
+	while ((cmd = g_queue_pop_head(&session->pipeline)) != NULL)
+		g_free(cmd);
+	if (session->pipeline_buf)
+		g_string_free(session->pipeline_buf, TRUE);
+	session->pipeline_buf = NULL;
+	session->pipelining = FALSE;
+}
+
+static void pop3_pipeline_push(Pop3Session *session, Pop3State state, gint num)
+{
+	Pop3Command *cmd;
+
+	if (!session->pipelining)
+		return;
+
+	cmd = g_new(Pop3Command, 1);
+	cmd->state = state;
+	cmd->num = num;
+	g_queue_push_tail(&session->pipeline, cmd);
+}
+
+/* Takes the reply being read off the queue */
+static void pop3_pipeline_pop(Pop3Session *session)
+{
+	Pop3Command *cmd = g_queue_pop_head(&session->pipeline);
+
+	if (cmd == NULL)
+		return;
+
+	session->state = cmd->state;
+	session->cur_msg = cmd->num;
+	g_free(cmd);
+}
+
+/* Tops the queue up with the commands for the next messages, writes
+ * whatever is pending in one go and reads the next reply; logs out
+ * once nothing is left */
+static gint pop3_pipeline_continue(Pop3Session *session)
+{
+	while (g_queue_get_length(&session->pipeline) < POP3_PIPELINE_DEPTH &&
+	       session->next_msg <= session->count) {
+		gint num = session->next_msg;
+
+		switch (pop3_lookup_msg(session, &num)) {
+		case POP3_DELETE:
+			pop3_delete_send(session, num);
+			break;
+		case POP3_TOP:
+			pop3_top_send(session, num, session->ac_prefs->size_limit);
+			break;
+		case POP3_LOGOUT:
+			break;
+		default:
+			pop3_retr_send(session, num);
+			break;
+		}
+		session->next_msg = num + 1;
+	}
+
+	if (session->pipeline_buf->len > 0) {
+		/* its reply is read once it is written */
+		if (session_send_msg(SESSION(session),
+				     session->pipeline_buf->str) < 0)
+			return -1;
+		g_string_truncate(session->pipeline_buf, 0);
+	} else if (!g_queue_is_empty(&session->pipeline)) {
+		session_recv_msg(SESSION(session));
+	} else {
+		pop3_pipeline_stop(session);
+		pop3_logout_send(session);
+	}
+
+	return PS_SUCCESS;
+}
+
 static Pop3ErrorValue pop3_ok(Pop3Session *session, const gchar *msg)
 {
 	Pop3ErrorValue ok;
@@ -992,6 +1374,7 @@ static Pop3ErrorValue pop3_ok(Pop3Session *session, const gchar *msg)
 				log_error(LOG_PROTOCOL, _("error occurred on authentication\n"));
 				ok = PS_AUTHFAIL;
 				break;
+			case POP3_CAPA:
 			case POP3_GETRANGE_LAST:
 			case POP3_GETRANGE_UIDL:
 			case POP3_TOP:
@@ -1021,6 +1404,10 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 	Pop3ErrorValue val = PS_SUCCESS;
 	const gchar *body;
 
+	/* with pipelining, the reply is to the oldest command sent */
+	if (pop3_session->pipelining)
+		pop3_pipeline_pop(pop3_session);
+
 	body = msg;
 	if (pop3_session->state != POP3_GETRANGE_UIDL_RECV &&
 	    pop3_session->state != POP3_GETSIZE_LIST_RECV) {
@@ -1087,10 +1474,19 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 	case POP3_GETAUTH_OAUTH2:
 #endif
 		if (!pop3_session->pop_before_smtp)
-			val = pop3_getrange_stat_send(pop3_session);
+			val = pop3_capa_send(pop3_session);
 		else
 			val = pop3_logout_send(pop3_session);
 		break;
+	case POP3_CAPA:
+		if (val == PS_NOTSUPPORTED) {
+			pop3_session->error_val = PS_SUCCESS;
+			val = pop3_getrange_stat_send(pop3_session);
+		} else {
+			pop3_session->state = POP3_CAPA_RECV;
+			session_recv_data(session, 0, ".\r\n");
+		}
+		break;
 	case POP3_GETRANGE_STAT:
 		if (pop3_getrange_stat_recv(pop3_session, body) < 0)
 			return -1;
@@ -1136,13 +1532,8 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 		break;
 	case POP3_DELETE:
 		pop3_delete_recv(pop3_session);
-		if (pop3_session->cur_msg == pop3_session->count)
-			val = pop3_logout_send(pop3_session);
-		else {
-			pop3_session->cur_msg++;
-			if (pop3_lookup_next(pop3_session) == POP3_ERROR)
-				return -1;
-		}
+		if (pop3_next_msg(pop3_session) < 0)
+			return -1;
 		break;
 	case POP3_LOGOUT:
 		pop3_session->state = POP3_DONE;
@@ -1163,6 +1554,11 @@ static gint pop3_session_recv_data_finished(Session *session, guchar *data,
 	Pop3ErrorValue val = PS_SUCCESS;
 
 	switch (pop3_session->state) {
+	case POP3_CAPA_RECV:
+		if (pop3_capa_recv(pop3_session, data, len) < 0)
+			log_warning(LOG_PROTOCOL, _("invalid CAPA response\n"));
+		pop3_getrange_stat_send(pop3_session);
+		break;
 	case POP3_GETRANGE_UIDL_RECV:
 		val = pop3_getrange_uidl_recv(pop3_session, data, len);
 		if (val == PS_SUCCESS) {
@@ -1176,7 +1572,11 @@ static gint pop3_session_recv_data_finished(Session *session, guchar *data,
 	case POP3_GETSIZE_LIST_RECV:
 		val = pop3_getsize_list_recv(pop3_session, data, len);
 		if (val == PS_SUCCESS) {
-			if (pop3_lookup_next(pop3_session) == POP3_ERROR)
+			if (pop3_session->pipelining_offered) {
+				pop3_pipeline_start(pop3_session);
+				if (pop3_pipeline_continue(pop3_session) < 0)
+					return -1;
+			} else if (pop3_lookup_next(pop3_session) == POP3_ERROR)
 				return -1;
 		} else
 			return -1;
@@ -1189,37 +1589,26 @@ static gint pop3_session_recv_data_finished(Session *session, guchar *data,
 		    pop3_session->ac_prefs->msg_leave_time == 0 &&
 		    pop3_session->ac_prefs->msg_leave_hour == 0 &&
 		    pop3_session->msg[pop3_session->cur_msg].recv_time
-		    != RECV_TIME_KEEP)
-			pop3_delete_send(pop3_session);
-		else if (pop3_session->cur_msg == pop3_session->count)
-			pop3_logout_send(pop3_session);
-		else {
-			pop3_session->cur_msg++;
-			if (pop3_lookup_next(pop3_session) == POP3_ERROR)
-				return -1;
+		    != RECV_TIME_KEEP) {
+			pop3_delete_send(pop3_session, pop3_session->cur_msg);
+			/* queued, goes out with the next batch */
+			if (!pop3_session->pipelining)
+				break;
 		}
+		if (pop3_next_msg(pop3_session) < 0)
+			return -1;
 		break;
 	case POP3_TOP_RECV:
 		if (pop3_top_recv(pop3_session, data, len) < 0)
 			return -1;
 
-		if (pop3_session->cur_msg == pop3_session->count)
-			pop3_logout_send(pop3_session);
-		else {
-			pop3_session->cur_msg++;
-			if (pop3_lookup_next(pop3_session) == POP3_ERROR)
-				return -1;
-		}
+		if (pop3_next_msg(pop3_session) < 0)
+			return -1;
 		break;
 	case POP3_TOP:
 		log_warning(LOG_PROTOCOL, _("TOP command unsupported\n"));
-		if (pop3_session->cur_msg == pop3_session->count)
-			pop3_logout_send(pop3_session);
-		else {
-			pop3_session->cur_msg++;
-			if (pop3_lookup_next(pop3_session) == POP3_ERROR)
-				return -1;
-		}
+		if (pop3_next_msg(pop3_session) < 0)
+			return -1;
 		break;
 	case POP3_ERROR:
 	default:
@@ -54,6 +54,8 @@ typedef enum {
 	POP3_GETAUTH_PASS,
 	POP3_GETAUTH_APOP,
 	POP3_GETAUTH_OAUTH2,
+	POP3_CAPA,
+	POP3_CAPA_RECV,
 	POP3_GETRANGE_STAT,
 	POP3_GETRANGE_LAST,
 	POP3_GETRANGE_UIDL,
@@ -139,6 +141,20 @@ struct _Pop3Session
 	gboolean new_msg_exist;
 	gboolean uidl_is_valid;
 
+	/* lines in the UIDL list file, and whether it's still the old
+	 * uidl-<server>-<login> one */
+	gint uidl_log_lines;
+	gboolean uidl_log_legacy;
+
+	/* RFC 2449 PIPELINING: announced by the server, and in use while
+	 * messages are retrieved. Commands are then written in batches,
+	 * and their replies read back in the order of the queue. */
+	gboolean pipelining_offered;
+	gboolean pipelining;
+	GQueue pipeline;
+	GString *pipeline_buf;
+	gint next_msg;
+
 	time_t current_time;
 
 	Pop3ErrorValue error_val;
@@ -152,10 +168,26 @@ struct _Pop3Session
 };
 
 #define POPBUFSIZE	8192
+/* commands in flight while pipelining */
+#define POP3_PIPELINE_DEPTH	16
 /* #define IDLEN	128 */
 #define IDLEN		POPBUFSIZE
 
+typedef void (*Pop3UIDLFunc)	(const gchar	*uidl,
+				 time_t		 recv_time,
+				 const gchar	*partial_recv,
+				 gpointer	 data);
+
 Session *pop3_session_new	(PrefsAccount	*account);
 gint pop3_write_uidl_list	(Pop3Session	*session);
+gint pop3_uidl_read		(const gchar	*server,
+				 const gchar	*login,
+				 Pop3UIDLFunc	 func,
+				 gpointer	 data);
+gint pop3_uidl_append		(const gchar	*server,
+				 const gchar	*login,
+				 const gchar	*uidl,
+				 time_t		 recv_time,
+				 const gchar	*partial_recv);
 
 #endif /* __POP_H__ */
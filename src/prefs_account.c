@@ -185,7 +185,9 @@ typedef struct ReceivePage
 	GtkWidget *imapdir_entry;
 	GtkWidget *subsonly_checkbtn;
 	GtkWidget *low_bandwidth_checkbtn;
+	GtkWidget *imap_use_idle_checkbtn;
 	GtkWidget *imap_batch_size_spinbtn;
+	GtkWidget *imap_pool_size_spinbtn;
 
 	GtkWidget *frame_maxarticle;
 	GtkWidget *maxarticle_label;
@@ -610,10 +612,18 @@ static PrefParam receive_param[] = {
 	 &receive_page.low_bandwidth_checkbtn,
 	 prefs_set_data_from_toggle, prefs_set_toggle},
 
+	{"imap_use_idle", "FALSE", &tmp_ac_prefs.imap_use_idle, P_BOOL,
+	 &receive_page.imap_use_idle_checkbtn,
+	 prefs_set_data_from_toggle, prefs_set_toggle},
+
 	{"imap_batch_size", "500", &tmp_ac_prefs.imap_batch_size, P_INT,
 	 &receive_page.imap_batch_size_spinbtn,
 	 prefs_set_data_from_spinbtn, prefs_set_spinbtn},
 
+	{"imap_pool_size", "1", &tmp_ac_prefs.imap_pool_size, P_INT,
+	 &receive_page.imap_pool_size_spinbtn,
+	 prefs_set_data_from_spinbtn, prefs_set_spinbtn},
+
 	{"autochk_use_default", "TRUE", &tmp_ac_prefs.autochk_use_default, P_BOOL,
 		&receive_page.autochk_use_default_checkbtn,
 		prefs_set_data_from_toggle, prefs_set_toggle},
@@ -1572,7 +1582,9 @@ static void receive_create_widget_func(PrefsPage * _page,
 	GtkWidget *imapdir_entry;
 	GtkWidget *subsonly_checkbtn;
 	GtkWidget *low_bandwidth_checkbtn;
+	GtkWidget *imap_use_idle_checkbtn;
 	GtkWidget *imap_batch_size_spinbtn;
+	GtkWidget *imap_pool_size_spinbtn;
 	GtkWidget *local_frame;
 	GtkWidget *local_vbox;
 	GtkWidget *local_hbox;
@@ -1844,6 +1856,16 @@ static void receive_create_widget_func(PrefsPage * _page,
 	gtk_widget_show (hbox1);
 	gtk_box_pack_start (GTK_BOX (vbox2), hbox1, FALSE, FALSE, 4);
 
+	PACK_CHECK_BUTTON (hbox1, imap_use_idle_checkbtn,
+			   _("Get notified of new mail in Inbox immediately (IDLE)"));
+	CLAWS_SET_TIP(imap_use_idle_checkbtn,
+			     _("Keeps a second connection open to the server, which "
+			       "announces new mail as soon as it arrives."));
+
+	hbox1 = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 8);
+	gtk_widget_show (hbox1);
+	gtk_box_pack_start (GTK_BOX (vbox2), hbox1, FALSE, FALSE, 4);
+
 	label = gtk_label_new(_("Batch size"));
 	gtk_widget_show (label);
 	gtk_box_pack_start(GTK_BOX(hbox1), label, FALSE, FALSE, 0);
@@ -1857,6 +1879,19 @@ static void receive_create_widget_func(PrefsPage * _page,
 	gtk_widget_show (hbox1);
 	gtk_box_pack_start (GTK_BOX (vbox2), hbox1, FALSE, FALSE, 4);
 
+	label = gtk_label_new(_("Extra connections for reading messages"));
+	gtk_widget_show (label);
+	gtk_box_pack_start(GTK_BOX(hbox1), label, FALSE, FALSE, 0);
+
+	imap_pool_size_spinbtn = gtk_spin_button_new_with_range(0, 4, 1);
+	gtk_widget_set_size_request(imap_pool_size_spinbtn, 64, -1);
+	gtk_widget_show (imap_pool_size_spinbtn);
+	gtk_box_pack_start(GTK_BOX(hbox1), imap_pool_size_spinbtn, FALSE, FALSE, 0);
+	CLAWS_SET_TIP(imap_pool_size_spinbtn,
+			     _("Messages are fetched over these while the main "
+			       "connection is busy, for example scanning a large "
+			       "folder. 0 disables them."));
+
 	/* Auto-checking */
 	vbox4 = gtkut_get_options_frame(vbox1, &frame, _("Automatic checking"));
 
@@ -1951,7 +1986,9 @@ static void receive_create_widget_func(PrefsPage * _page,
 	page->imapdir_entry		= imapdir_entry;
 	page->subsonly_checkbtn		= subsonly_checkbtn;
 	page->low_bandwidth_checkbtn	= low_bandwidth_checkbtn;
+	page->imap_use_idle_checkbtn	= imap_use_idle_checkbtn;
 	page->imap_batch_size_spinbtn	= imap_batch_size_spinbtn;
+	page->imap_pool_size_spinbtn	= imap_pool_size_spinbtn;
 	page->local_frame		= local_frame;
 	page->local_inbox_label	= local_inbox_label;
 	page->local_inbox_entry	= local_inbox_entry;
@@ -5504,7 +5541,9 @@ static void prefs_account_protocol_changed(GtkComboBox *combobox, gpointer data)
 		gtk_widget_hide(receive_page.imapdir_entry);
 		gtk_widget_hide(receive_page.subsonly_checkbtn);
 		gtk_widget_hide(receive_page.low_bandwidth_checkbtn);
+		gtk_widget_hide(receive_page.imap_use_idle_checkbtn);
 		gtk_widget_hide(receive_page.imap_batch_size_spinbtn);
+		gtk_widget_hide(receive_page.imap_pool_size_spinbtn);
 		break;
 	case A_LOCAL:
 		gtk_widget_show(send_page.msgid_checkbtn);
@@ -5588,7 +5627,9 @@ static void prefs_account_protocol_changed(GtkComboBox *combobox, gpointer data)
 		gtk_widget_hide(receive_page.imapdir_entry);
 		gtk_widget_hide(receive_page.subsonly_checkbtn);
 		gtk_widget_hide(receive_page.low_bandwidth_checkbtn);
+		gtk_widget_hide(receive_page.imap_use_idle_checkbtn);
 		gtk_widget_hide(receive_page.imap_batch_size_spinbtn);
+		gtk_widget_hide(receive_page.imap_pool_size_spinbtn);
 		break;
 	case A_IMAP4:
 #ifndef HAVE_LIBETPAN
@@ -5681,7 +5722,9 @@ static void prefs_account_protocol_changed(GtkComboBox *combobox, gpointer data)
 		gtk_widget_show(receive_page.imapdir_entry);
 		gtk_widget_show(receive_page.subsonly_checkbtn);
 		gtk_widget_show(receive_page.low_bandwidth_checkbtn);
+		gtk_widget_show(receive_page.imap_use_idle_checkbtn);
 		gtk_widget_show(receive_page.imap_batch_size_spinbtn);
+		gtk_widget_show(receive_page.imap_pool_size_spinbtn);
 		break;
 	case A_NONE:
 		gtk_widget_show(send_page.msgid_checkbtn);
@@ -5763,7 +5806,9 @@ static void prefs_account_protocol_changed(GtkComboBox *combobox, gpointer data)
 		gtk_widget_hide(receive_page.imapdir_entry);
 		gtk_widget_hide(receive_page.subsonly_checkbtn);
 		gtk_widget_hide(receive_page.low_bandwidth_checkbtn);
+		gtk_widget_hide(receive_page.imap_use_idle_checkbtn);
 		gtk_widget_hide(receive_page.imap_batch_size_spinbtn);
+		gtk_widget_hide(receive_page.imap_pool_size_spinbtn);
 		break;
 	case A_POP3:
 		/* continue to default: */
@@ -5852,7 +5897,9 @@ static void prefs_account_protocol_changed(GtkComboBox *combobox, gpointer data)
 		gtk_widget_hide(receive_page.imapdir_entry);
 		gtk_widget_hide(receive_page.subsonly_checkbtn);
 		gtk_widget_hide(receive_page.low_bandwidth_checkbtn);
+		gtk_widget_hide(receive_page.imap_use_idle_checkbtn);
 		gtk_widget_hide(receive_page.imap_batch_size_spinbtn);
+		gtk_widget_hide(receive_page.imap_pool_size_spinbtn);
 		break;
 	}
 
@@ -118,6 +118,7 @@ struct _PrefsAccount
 
 	gint imap_auth_type;
 	guint imap_batch_size;
+	guint imap_pool_size;
 
 	gboolean receive_in_progress;
 
@@ -211,6 +212,7 @@ struct _PrefsAccount
 	gchar *imap_dir;
 	gboolean imap_subsonly;
 	gboolean low_bandwidth;
+	gboolean imap_use_idle;
 
 	gboolean set_sent_folder;
 	gchar *sent_folder;
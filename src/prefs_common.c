@@ -172,6 +172,8 @@ static PrefParam param[] = {
 	 P_BOOL, NULL, NULL, NULL},
 	{"scan_all_after_inc", "FALSE", &prefs_common.scan_all_after_inc,
 	 P_BOOL, NULL, NULL, NULL},
+	{"mh_watch_folders", "FALSE", &prefs_common.mh_watch_folders,
+	 P_BOOL, NULL, NULL, NULL},
 	{"newmail_notify_manu", "FALSE", &prefs_common.newmail_notify_manu,
 	 P_BOOL, NULL, NULL, NULL},
  	{"newmail_notify_auto", "FALSE", &prefs_common.newmail_notify_auto,
@@ -207,6 +209,8 @@ static PrefParam param[] = {
 	 NULL, NULL, NULL},
 	{"sendwin_height", "-1", &prefs_common.sendwin_height, P_INT,
 	 NULL, NULL, NULL},
+	{"send_queue_max_accounts", "4", &prefs_common.send_queue_max_accounts,
+	 P_INT, NULL, NULL, NULL},
 
 	{"outgoing_charset", CS_AUTO, &prefs_common.outgoing_charset, P_STRING,
 	 NULL, NULL, NULL},
@@ -1213,6 +1217,8 @@ static PrefParam param[] = {
 	{"cache_min_keep_time", "0", &prefs_common.cache_min_keep_time, P_INT,
 	 NULL, NULL, NULL},
 #endif
+	{"index_messages", "FALSE", &prefs_common.index_messages, P_BOOL,
+	 NULL, NULL, NULL},
 	{"thread_by_subject_max_age", "10", &prefs_common.thread_by_subject_max_age,
 	P_INT, NULL, NULL, NULL },
 	{"last_opened_folder", "", &prefs_common.last_opened_folder,
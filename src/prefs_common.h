@@ -151,6 +151,7 @@ struct _PrefsCommon
 	gboolean use_extinc;
 	gchar *extinc_cmd;
 	gboolean scan_all_after_inc;
+	gboolean mh_watch_folders;
 	gboolean autochk_newmail;
 	gint autochk_itv;
 	gboolean chk_on_startup;
@@ -171,6 +172,7 @@ struct _PrefsCommon
 	gboolean send_dialog_invisible;
 	gint sendwin_width;
 	gint sendwin_height;
+	gint send_queue_max_accounts;
 	gchar *outgoing_charset;
 	TransferEncodingMethod encoding_method;
 	gboolean outgoing_fallback_to_ascii;
@@ -469,6 +471,7 @@ struct _PrefsCommon
 	/* Memory cache*/
 	gint cache_max_mem_usage;
 	gint cache_min_keep_time;
+	gboolean index_messages;
 	
 	/* boolean for work offline 
 	   stored here for use in inc.c */
@@ -46,16 +46,19 @@ static gchar monthstr[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
 typedef char *(*getlinefunc) (char *, size_t, void *);
 typedef int (*peekcharfunc) (void *);
 typedef int (*getcharfunc) (void *);
-typedef gint (*get_one_field_func) (gchar **, void *, HeaderEntry[]);
+typedef gint (*get_one_field_func) (gchar **, void *, HeaderEntry[], GHashTable *);
 
+static gint file_get_one_field(gchar **buf, FILE *fp,
+			       HeaderEntry hentry[], GHashTable *hindex);
 static gint string_get_one_field(gchar **buf, char **str,
-				 HeaderEntry hentry[]);
+				 HeaderEntry hentry[], GHashTable *hindex);
 
 static char *string_getline(char *buf, size_t len, char **str);
 static int string_peekchar(char **str);
 static int file_peekchar(FILE *fp);
 static gint generic_get_one_field(gchar **bufptr, void *data,
 				  HeaderEntry hentry[],
+				  GHashTable *hindex,
 				  getlinefunc getline, 
 				  peekcharfunc peekchar,
 				  gboolean unfold);
@@ -66,15 +69,21 @@ static MsgInfo *parse_stream(void *data, gboolean isstring, MsgFlags flags,
 gint procheader_get_one_field(gchar **buf, FILE *fp,
 			      HeaderEntry hentry[])
 {
-	return generic_get_one_field(buf, fp, hentry,
+	return file_get_one_field(buf, fp, hentry, NULL);
+}
+
+static gint file_get_one_field(gchar **buf, FILE *fp,
+			       HeaderEntry hentry[], GHashTable *hindex)
+{
+	return generic_get_one_field(buf, fp, hentry, hindex,
 				     (getlinefunc)fgets_crlf, (peekcharfunc)file_peekchar,
 				     TRUE);
 }
 
 static gint string_get_one_field(gchar **buf, char **str,
-				 HeaderEntry hentry[])
+				 HeaderEntry hentry[], GHashTable *hindex)
 {
-	return generic_get_one_field(buf, str, hentry,
+	return generic_get_one_field(buf, str, hentry, hindex,
 				     (getlinefunc)string_getline,
 				     (peekcharfunc)string_peekchar,
 				     TRUE);
@@ -134,8 +143,29 @@ static int file_peekchar(FILE *fp)
 	return ungetc(getc(fp), fp);
 }
 
+/* Matches the name of the header line against an index built by
+ * procheader_get_header_index(); returns the entry number or -1. */
+static gint header_index_lookup(GHashTable *hindex, const gchar *line)
+{
+	gchar name[64];
+	gint i;
+
+	for (i = 0; i < (gint)sizeof(name) - 1; i++) {
+		gchar c = line[i];
+
+		if (c == '\0' || c == '\r' || c == '\n')
+			return -1;
+		name[i] = g_ascii_tolower(c);
+		if (c == ':' || c == ' ') {
+			name[i + 1] = '\0';
+			return GPOINTER_TO_INT(g_hash_table_lookup(hindex, name)) - 1;
+		}
+	}
+	return -1;
+}
+
 static gint generic_get_one_field(gchar **bufptr, void *data,
-			  HeaderEntry *hentry,
+			  HeaderEntry *hentry, GHashTable *hindex,
 			  getlinefunc getline, peekcharfunc peekchar,
 			  gboolean unfold)
 {
@@ -149,61 +179,58 @@ static gint generic_get_one_field(gchar **bufptr, void *data,
 	HeaderEntry *hp = NULL;
 	size_t len;
 	gchar *buf;
+	gchar line[BUFFSIZE];
 
 	cm_return_val_if_fail(bufptr != NULL, -1);
 
-	len = BUFFSIZE;
-	buf = g_malloc(len);
-
 	if (hentry != NULL) {
 		/* skip non-required headers */
 		/* and get hentry header line */
 		do {
 			do {
-				if (getline(buf, len, data) == NULL) {
+				if (getline(line, sizeof(line), data) == NULL) {
 					debug_print("generic_get_one_field: getline\n");
-					g_free(buf);
 					*bufptr = NULL;
 					return -1;
 				}
-				if (buf[0] == '\r' || buf[0] == '\n') {
+				if (line[0] == '\r' || line[0] == '\n') {
 					debug_print("generic_get_one_field: empty line\n");
-					g_free(buf);
 					*bufptr = NULL;
 					return -1;
 				}
-			} while (buf[0] == ' ' || buf[0] == '\t');
+			} while (line[0] == ' ' || line[0] == '\t');
 
+			if (hindex != NULL) {
+				hnum = header_index_lookup(hindex, line);
+				hp = hnum >= 0 ? &hentry[hnum] : NULL;
+				continue;
+			}
 			for (hp = hentry, hnum = 0; hp->name != NULL;
 			     hp++, hnum++) {
-				if (!g_ascii_strncasecmp(hp->name, buf,
+				if (!g_ascii_strncasecmp(hp->name, line,
 						 strlen(hp->name)))
 					break;
 			}
-		} while (hp->name == NULL);
+			if (hp->name == NULL)
+				hp = NULL;
+		} while (hp == NULL);
 	} else {
 		/* read first line */
-		if (getline(buf, len, data) == NULL) {
+		if (getline(line, sizeof(line), data) == NULL) {
 			debug_print("generic_get_one_field: getline\n");
-			g_free(buf);
 			*bufptr = NULL;
 			return -1;
 		}
-		if (buf[0] == '\r' || buf[0] == '\n') {
+		if (line[0] == '\r' || line[0] == '\n') {
 			debug_print("generic_get_one_field: empty line\n");
-			g_free(buf);
 			*bufptr = NULL;
 			return -1;
 		}
 	}
-	/* reduce initial buffer to its useful part */
-	len = strlen(buf)+1;
-	buf = g_realloc(buf, len);
-	if (buf == NULL) {
-		debug_print("generic_get_one_field: reallocation error\n");
-		*bufptr = NULL;
-		return -1;
-	}
+	/* keep the useful part only */
+	len = strlen(line)+1;
+	buf = g_malloc(len);
+	memcpy(buf, line, len);
 
 	/* unfold line */
 	while (1) {
@@ -211,7 +238,6 @@ static gint generic_get_one_field(gchar **bufptr, void *data,
 		/* ([*WSP CRLF] 1*WSP) */
 		if (nexthead == ' ' || nexthead == '\t') {
 			size_t buflen;
-			gchar *tmpbuf;
 			size_t tmplen;
 
 			gboolean skiptab = (nexthead == '\t');
@@ -223,25 +249,14 @@ static gint generic_get_one_field(gchar **bufptr, void *data,
 			buflen = strlen(buf);
 			
 			/* read next line */
-			tmpbuf = g_malloc(BUFFSIZE);
-
-			if (getline(tmpbuf, BUFFSIZE, data) == NULL) {
-				g_free(tmpbuf);
+			if (getline(line, sizeof(line), data) == NULL)
 				break;
-			}
-			tmplen = strlen(tmpbuf)+1;
+			tmplen = strlen(line)+1;
 
 			/* extend initial buffer and concatenate next line */
-			len += tmplen;
+			len = buflen + tmplen;
 			buf = g_realloc(buf, len);
-			if (buf == NULL) {
-				debug_print("generic_get_one_field: reallocation error\n");
-				g_free(buf);
-				*bufptr = NULL;
-				return -1;
-			}
-			memcpy(buf+buflen, tmpbuf, tmplen);
-			g_free(tmpbuf);
+			memcpy(buf+buflen, line, tmplen);
 			if (skiptab) { /* replace tab with space */
 				*(buf + buflen) = ' ';
 			}
@@ -259,7 +274,7 @@ static gint generic_get_one_field(gchar **bufptr, void *data,
 
 gint procheader_get_one_field_asis(gchar **buf, FILE *fp)
 {
-	return generic_get_one_field(buf, fp, NULL,
+	return generic_get_one_field(buf, fp, NULL, NULL,
 				     (getlinefunc)fgets_crlf, 
 				     (peekcharfunc)file_peekchar,
 				     FALSE);
@@ -577,6 +592,41 @@ static HeaderEntry* procheader_get_headernames(gboolean full)
 	return full ? hentry_full : hentry_short;
 }
 
+/* Header name (lowercase) -> entry number + 1, for the tables above */
+static GHashTable *procheader_build_header_index(HeaderEntry *hentry)
+{
+	GHashTable *hindex;
+	gint hnum;
+
+	hindex = g_hash_table_new(g_str_hash, g_str_equal);
+	for (hnum = 0; hentry[hnum].name != NULL; hnum++)
+		g_hash_table_insert(hindex, g_ascii_strdown(hentry[hnum].name, -1),
+				    GINT_TO_POINTER(hnum + 1));
+
+	return hindex;
+}
+
+static GHashTable *procheader_get_header_index(gboolean full)
+{
+	static GHashTable *hindex_full = NULL;
+	static GHashTable *hindex_short = NULL;
+	static gsize init_full = 0;
+	static gsize init_short = 0;
+
+	if (full) {
+		if (g_once_init_enter(&init_full)) {
+			hindex_full = procheader_build_header_index(hentry_full);
+			g_once_init_leave(&init_full, 1);
+		}
+		return hindex_full;
+	}
+	if (g_once_init_enter(&init_short)) {
+		hindex_short = procheader_build_header_index(hentry_short);
+		g_once_init_leave(&init_short, 1);
+	}
+	return hindex_short;
+}
+
 MsgInfo *procheader_parse_stream(FILE *fp, MsgFlags flags, gboolean full,
 				 gboolean decrypted)
 {
@@ -616,14 +666,16 @@ static MsgInfo *parse_stream(void *data, gboolean isstring, MsgFlags flags,
 	gint hnum;
 	void *orig_data = data;
 
+	GHashTable *hindex;
 	get_one_field_func get_one_field =
 		isstring ? (get_one_field_func)string_get_one_field
-			 : (get_one_field_func)procheader_get_one_field;
+			 : (get_one_field_func)file_get_one_field;
 
 	hentry = procheader_get_headernames(full);
+	hindex = procheader_get_header_index(full);
 
 	if (MSG_IS_QUEUED(flags) || MSG_IS_DRAFT(flags)) {
-		while (get_one_field(&buf, data, NULL) != -1) {
+		while (get_one_field(&buf, data, NULL, NULL) != -1) {
 			if ((!strncmp(buf, "X-Claws-End-Special-Headers: 1",
 				strlen("X-Claws-End-Special-Headers:"))) ||
 			    (!strncmp(buf, "X-Sylpheed-End-Special-Headers: 1",
@@ -669,7 +721,7 @@ static MsgInfo *parse_stream(void *data, gboolean isstring, MsgFlags flags,
 		avatar_hook_id = HOOK_NONE;
 	}
 
-	while ((hnum = get_one_field(&buf, data, hentry)) != -1) {
+	while ((hnum = get_one_field(&buf, data, hentry, hindex)) != -1) {
 		hp = buf + strlen(hentry[hnum].name);
 		while (*hp == ' ' || *hp == '\t') hp++;
 
@@ -28,6 +28,7 @@
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <string.h>
+#include <stdlib.h>
 #if HAVE_LOCALE_H
 #  include <locale.h>
 #endif
@@ -96,14 +97,18 @@ static gboolean procmime_mimeinfo_parameters_destroy(gpointer key, gpointer valu
 	return TRUE;
 }
 
+/* set from the main thread, read by the search and indexing threads */
 static gchar *forced_charset = NULL;
+static GMutex forced_charset_mutex;
 
 void procmime_force_charset(const gchar *str)
 {
+	g_mutex_lock(&forced_charset_mutex);
 	g_free(forced_charset);
 	forced_charset = NULL;
 	if (str)
 		forced_charset = g_strdup(str);
+	g_mutex_unlock(&forced_charset_mutex);
 }
 
 static EncodingType forced_encoding = 0;
@@ -289,54 +294,59 @@ const gchar *procmime_mimeinfo_get_parameter(MimeInfo *mimeinfo, const gchar *na
 	strcpy(lastline, buf);							\
 }
 
-gboolean procmime_decode_content(MimeInfo *mimeinfo)
+/* Whether the content of a part has to be decoded before it's used */
+static gboolean procmime_needs_decoding(MimeInfo *mimeinfo,
+					EncodingType *encoding,
+					gboolean *flowed, gboolean *delsp)
 {
-	gchar buf[BUFFSIZE];
-	gint readend;
-	gchar *tmpfilename;
-	FILE *outfp, *infp;
-	GStatBuf statbuf;
-	gboolean tmp_file = FALSE;
-	gboolean flowed = FALSE;
-	gboolean delsp = FALSE; 
-	gboolean err = FALSE;
-	gint state = 0;
-	guint save = 0;
-
-	cm_return_val_if_fail(mimeinfo != NULL, FALSE);
-
-	EncodingType encoding = forced_encoding 
-				? forced_encoding
-				: mimeinfo->encoding_type;
-	gchar lastline[BUFFSIZE];
-	memset(lastline, 0, BUFFSIZE);
+	*encoding = forced_encoding
+		    ? forced_encoding
+		    : mimeinfo->encoding_type;
+	*flowed = FALSE;
+	*delsp = FALSE;
 
 	if (prefs_common.respect_flowed_format &&
 	    mimeinfo->type == MIMETYPE_TEXT && 
 	    !strcasecmp(mimeinfo->subtype, "plain")) {
 		if (procmime_mimeinfo_get_parameter(mimeinfo, "format") != NULL &&
 		    !strcasecmp(procmime_mimeinfo_get_parameter(mimeinfo, "format"),"flowed"))
-			flowed = TRUE;
-		if (flowed &&
+			*flowed = TRUE;
+		if (*flowed &&
 		    procmime_mimeinfo_get_parameter(mimeinfo, "delsp") != NULL &&
 		    !strcasecmp(procmime_mimeinfo_get_parameter(mimeinfo, "delsp"),"yes"))
-			delsp = TRUE;
+			*delsp = TRUE;
 	}
 	
-	if (!flowed && (
-	     encoding == ENC_UNKNOWN ||
-	     encoding == ENC_BINARY ||
-	     encoding == ENC_7BIT ||
-	     encoding == ENC_8BIT
+	if (!*flowed && (
+	     *encoding == ENC_UNKNOWN ||
+	     *encoding == ENC_BINARY ||
+	     *encoding == ENC_7BIT ||
+	     *encoding == ENC_8BIT
 	    ))
-		return TRUE;
+		return FALSE;
 
 	if (mimeinfo->type == MIMETYPE_MULTIPART || mimeinfo->type == MIMETYPE_MESSAGE)
-		return TRUE;
-
-	if (mimeinfo->data.filename == NULL)
 		return FALSE;
 
+	return TRUE;
+}
+
+/* Decodes the content of a part from its file to outfp */
+static gboolean procmime_decode_content_to_fp(MimeInfo *mimeinfo,
+					      EncodingType encoding,
+					      gboolean flowed, gboolean delsp,
+					      FILE *outfp)
+{
+	gchar buf[BUFFSIZE];
+	gint readend;
+	FILE *infp;
+	gboolean err = FALSE;
+	gint state = 0;
+	guint save = 0;
+	gchar lastline[BUFFSIZE];
+
+	memset(lastline, 0, BUFFSIZE);
+
 	infp = claws_fopen(mimeinfo->data.filename, "rb");
 	if (!infp) {
 		FILE_OP_ERROR(mimeinfo->data.filename, "claws_fopen");
@@ -348,15 +358,6 @@ gboolean procmime_decode_content(MimeInfo *mimeinfo)
 		return FALSE;
 	}
 
-	outfp = get_tmpfile_in_dir(get_mime_tmp_dir(), &tmpfilename);
-	if (!outfp) {
-		perror("tmpfile");
-		claws_fclose(infp);
-		g_free(tmpfilename);
-		return FALSE;
-	}
-
-	tmp_file = TRUE;
 	readend = mimeinfo->offset + mimeinfo->length;
 
 	account_sigsep_matchlist_create(); /* FLUSH_LASTLINE will use it */
@@ -381,69 +382,56 @@ gboolean procmime_decode_content(MimeInfo *mimeinfo)
 		gint len, inlen, inread;
 		gboolean got_error = FALSE;
 		gboolean uncanonicalize = FALSE;
-		FILE *tmpfp = NULL;
-		gboolean null_bytes = FALSE;
+		gboolean pending_cr = FALSE;
 		gboolean starting = TRUE;
 
 		if (mimeinfo->type == MIMETYPE_TEXT ||
-		    mimeinfo->type == MIMETYPE_MESSAGE) {
+		    mimeinfo->type == MIMETYPE_MESSAGE)
 			uncanonicalize = TRUE;
-			tmpfp = my_tmpfile();
-			if (!tmpfp) {
-				perror("my_tmpfile");
-				if (tmp_file) 
-					claws_fclose(outfp);
-				claws_fclose(infp);
-				g_free(tmpfilename);
-				return FALSE;
-			}
-		} else
-			tmpfp = outfp;
 
 		while ((inlen = MIN(readend - ftell(infp), sizeof(buf))) > 0 && !err) {
 			inread = claws_fread(buf, 1, inlen, infp);
 			memset(outbuf, 0, sizeof(buf));
 			len = g_base64_decode_step(buf, inlen, outbuf, &state, &save);
-			if (uncanonicalize == TRUE && strlen(outbuf) < len && starting) {
+			/* no line ending conversion in content with null bytes */
+			if (uncanonicalize == TRUE && strlen(outbuf) < len && starting)
 				uncanonicalize = FALSE;
-				null_bytes = TRUE;
-			}
 			starting = FALSE;
 			if (((inread != inlen) || len < 0) && !got_error) {
 				g_warning("bad BASE64 content");
 				if (claws_fwrite(_("[Error decoding BASE64]\n"),
 					sizeof(gchar),
 					strlen(_("[Error decoding BASE64]\n")),
-					tmpfp) < strlen(_("[Error decoding BASE64]\n")))
+					outfp) < strlen(_("[Error decoding BASE64]\n")))
 					g_warning("error decoding BASE64");
 				got_error = TRUE;
 				continue;
 			} else if (len >= 0) {
 				/* print out the error message only once 
 				 * per block */
-				if (null_bytes) {
-					/* we won't uncanonicalize, output to outfp directly */
+				if (!uncanonicalize) {
 					if (claws_fwrite(outbuf, sizeof(gchar), len, outfp) < len)
 						err = TRUE;
 				} else {
-					if (claws_fwrite(outbuf, sizeof(gchar), len, tmpfp) < len)
-						err = TRUE;
+					/* CRLF to LF, a CR at the end of a
+					 * block waits for the next one */
+					gint i;
+
+					for (i = 0; i < len && !err; i++) {
+						if (pending_cr && outbuf[i] != '\n' &&
+						    claws_fputc('\r', outfp) == EOF)
+							err = TRUE;
+						pending_cr = (outbuf[i] == '\r');
+						if (!pending_cr &&
+						    claws_fputc(outbuf[i], outfp) == EOF)
+							err = TRUE;
+					}
 				}
 				got_error = FALSE;
 			}
 		}
-
-		if (uncanonicalize) {
-			rewind(tmpfp);
-			while (claws_fgets(buf, sizeof(buf), tmpfp) != NULL) {
-				strcrchomp(buf);
-				if (claws_fputs(buf, outfp) == EOF)
-					err = TRUE;
-			}
-		}
-		if (tmpfp != outfp) {
-			claws_fclose(tmpfp);
-		}
+		if (pending_cr && claws_fputc('\r', outfp) == EOF)
+			err = TRUE;
 	} else if (encoding == ENC_X_UUENCODE) {
 		gchar outbuf[BUFFSIZE];
 		gint len;
@@ -479,12 +467,45 @@ gboolean procmime_decode_content(MimeInfo *mimeinfo)
 			g_warning("write error");
 	}
 
-	claws_fclose(outfp);
 	claws_fclose(infp);
 
 	account_sigsep_matchlist_delete();
 
+	return !err;
+}
+
+gboolean procmime_decode_content(MimeInfo *mimeinfo)
+{
+	gchar *tmpfilename;
+	FILE *outfp;
+	GStatBuf statbuf;
+	EncodingType encoding;
+	gboolean flowed, delsp;
+	gboolean err = FALSE;
+
+	cm_return_val_if_fail(mimeinfo != NULL, FALSE);
+
+	if (!procmime_needs_decoding(mimeinfo, &encoding, &flowed, &delsp))
+		return TRUE;
+
+	if (mimeinfo->data.filename == NULL)
+		return FALSE;
+
+	outfp = get_tmpfile_in_dir(get_mime_tmp_dir(), &tmpfilename);
+	if (!outfp) {
+		perror("tmpfile");
+		g_free(tmpfilename);
+		return FALSE;
+	}
+
+	if (!procmime_decode_content_to_fp(mimeinfo, encoding, flowed, delsp,
+					   outfp))
+		err = TRUE;
+	if (claws_fclose(outfp) == EOF)
+		err = TRUE;
+
 	if (err == TRUE) {
+		claws_unlink(tmpfilename);
 		g_free(tmpfilename);
 		return FALSE;
 	}
@@ -752,50 +773,242 @@ gint procmime_get_part(const gchar *outfile, MimeInfo *mimeinfo)
 	return result;
 }
 
+#if defined(HAVE_FMEMOPEN) && defined(HAVE_OPEN_MEMSTREAM)
+/* Parts up to this size are decoded in memory by
+ * procmime_open_decoded_part() */
+#define PROCMIME_MEM_DECODE_MAX	(1024 * 1024)
+
+static FILE *procmime_open_decoded_part_mem(MimeInfo *mimeinfo, gchar **mem)
+{
+	EncodingType encoding;
+	gboolean flowed, delsp;
+	FILE *outfp, *fp;
+	gchar *buf = NULL;
+	size_t size = 0;
+	gboolean err = FALSE;
+
+	if ((outfp = open_memstream(&buf, &size)) == NULL) {
+		FILE_OP_ERROR("procmime_open_decoded_part", "open_memstream");
+		return NULL;
+	}
+
+	if (procmime_needs_decoding(mimeinfo, &encoding, &flowed, &delsp)) {
+		if (!procmime_decode_content_to_fp(mimeinfo, encoding, flowed,
+						   delsp, outfp))
+			err = TRUE;
+	} else {
+		FILE *infp;
+
+		if ((infp = claws_fopen(mimeinfo->data.filename, "rb")) == NULL) {
+			FILE_OP_ERROR(mimeinfo->data.filename, "claws_fopen");
+			err = TRUE;
+		} else {
+			if (copy_file_part_to_fp(infp, mimeinfo->offset,
+						 mimeinfo->length, outfp) < 0)
+				err = TRUE;
+			claws_fclose(infp);
+		}
+	}
+	if (fclose(outfp) == EOF || err) {
+		free(buf);
+		return NULL;
+	}
+
+	/* fmemopen() may not take an empty buffer */
+	if (size == 0) {
+		free(buf);
+		return my_tmpfile();
+	}
+
+	if ((fp = fmemopen(buf, size, "r")) == NULL) {
+		FILE_OP_ERROR("procmime_open_decoded_part", "fmemopen");
+		free(buf);
+		return NULL;
+	}
+	*mem = buf;
+
+	return fp;
+}
+#endif
+
+#ifdef HAVE_FOPENCOOKIE
+/* A stream reading a range of another one */
+typedef struct _ProcMimeRange {
+	FILE *fp;
+	off_t left;
+} ProcMimeRange;
+
+static ssize_t procmime_range_read(void *cookie, char *buf, size_t size)
+{
+	ProcMimeRange *range = (ProcMimeRange *)cookie;
+	size_t len;
+
+	if (range->left <= 0)
+		return 0;
+	if ((off_t)size > range->left)
+		size = range->left;
+	len = claws_fread(buf, 1, size, range->fp);
+	if (len == 0 && claws_ferror(range->fp))
+		return -1;
+	range->left -= len;
+
+	return len;
+}
+
+static int procmime_range_close(void *cookie)
+{
+	ProcMimeRange *range = (ProcMimeRange *)cookie;
+	int r;
+
+	r = claws_fclose(range->fp);
+	g_free(range);
+
+	return r;
+}
+
+/* Opens a stream on the part as it is in its file, for parts which
+ * need no decoding */
+static FILE *procmime_open_part_range(MimeInfo *mimeinfo)
+{
+	cookie_io_functions_t io = { procmime_range_read, NULL, NULL,
+				     procmime_range_close };
+	ProcMimeRange *range;
+	FILE *infp, *fp;
+
+	if ((infp = claws_fopen(mimeinfo->data.filename, "rb")) == NULL) {
+		FILE_OP_ERROR(mimeinfo->data.filename, "claws_fopen");
+		return NULL;
+	}
+	if (fseek(infp, mimeinfo->offset, SEEK_SET) < 0) {
+		FILE_OP_ERROR(mimeinfo->data.filename, "fseek");
+		claws_fclose(infp);
+		return NULL;
+	}
+
+	range = g_new(ProcMimeRange, 1);
+	range->fp = infp;
+	range->left = mimeinfo->length;
+	if ((fp = fopencookie(range, "r", io)) == NULL) {
+		FILE_OP_ERROR(mimeinfo->data.filename, "fopencookie");
+		claws_fclose(infp);
+		g_free(range);
+		return NULL;
+	}
+
+	return fp;
+}
+#endif
+
+/*!
+ *\brief	Open a stream on the decoded content of a part.
+ *		Small parts are decoded in memory, without writing
+ *		temporary files and leaving the MimeInfo as it is.
+ *		Bigger ones which need no decoding are read from
+ *		their file, others are decoded as by
+ *		procmime_decode_content().
+ *
+ *\param	mimeinfo Part
+ *\param	mem Set to the memory the stream reads, if any, to give
+ *		to procmime_close_decoded_part()
+ *
+ *\return	FILE * The stream, NULL on error
+ */
+FILE *procmime_open_decoded_part(MimeInfo *mimeinfo, gchar **mem)
+{
+	FILE *fp;
+	EncodingType encoding;
+	gboolean flowed, delsp, decoded;
+	gint r;
+
+	cm_return_val_if_fail(mimeinfo != NULL, NULL);
+	cm_return_val_if_fail(mem != NULL, NULL);
+
+	*mem = NULL;
+
+	if (mimeinfo->content == MIMECONTENT_MEM)
+		return str_open_as_stream(mimeinfo->data.mem);
+
+#if defined(HAVE_FMEMOPEN) && defined(HAVE_OPEN_MEMSTREAM)
+	if (mimeinfo->content == MIMECONTENT_FILE &&
+	    mimeinfo->data.filename != NULL &&
+	    mimeinfo->length <= PROCMIME_MEM_DECODE_MAX)
+		return procmime_open_decoded_part_mem(mimeinfo, mem);
+#endif
+
+	decoded = procmime_needs_decoding(mimeinfo, &encoding, &flowed, &delsp);
+#ifdef HAVE_FOPENCOOKIE
+	/* read in place rather than copied */
+	if (!decoded && mimeinfo->content == MIMECONTENT_FILE &&
+	    mimeinfo->data.filename != NULL)
+		return procmime_open_part_range(mimeinfo);
+#endif
+	if (!procmime_decode_content(mimeinfo))
+		return NULL;
+
+	/* decoded to a file of its own */
+	if (decoded) {
+		if ((fp = claws_fopen(mimeinfo->data.filename, "rb")) == NULL)
+			FILE_OP_ERROR(mimeinfo->data.filename, "claws_fopen");
+		return fp;
+	}
+
+	if ((fp = my_tmpfile()) == NULL) {
+		FILE_OP_ERROR("tmpfile", "open");
+		return NULL;
+	}
+	if ((r = procmime_get_part_to_stream(fp, mimeinfo)) < 0) {
+		g_warning("procmime_get_part_to_stream error %d", r);
+		claws_fclose(fp);
+		return NULL;
+	}
+
+	return fp;
+}
+
+void procmime_close_decoded_part(FILE *fp, gchar *mem)
+{
+	if (fp != NULL)
+		claws_fclose(fp);
+	free(mem);
+}
+
 gboolean procmime_scan_text_content(MimeInfo *mimeinfo,
 		gboolean (*scan_callback)(const gchar *str, gpointer cb_data),
 		gpointer cb_data) 
 {
 	FILE *tmpfp;
+	gchar *mem;
 	const gchar *src_codeset;
 	gboolean conv_fail = FALSE;
 	gchar buf[BUFFSIZE];
 	gchar *str;
 	gboolean scan_ret = FALSE;
-	int r;
+	gchar *charset;
 
 	cm_return_val_if_fail(mimeinfo != NULL, TRUE);
 	cm_return_val_if_fail(scan_callback != NULL, TRUE);
 
-	if (!procmime_decode_content(mimeinfo))
+	if ((tmpfp = procmime_open_decoded_part(mimeinfo, &mem)) == NULL)
 		return TRUE;
 
-	tmpfp = my_tmpfile();
-
-	if (tmpfp == NULL) {
-		FILE_OP_ERROR("tmpfile", "open");
-		return TRUE;
-	}
-
-	if ((r = procmime_get_part_to_stream(tmpfp, mimeinfo)) < 0) {
-		g_warning("procmime_get_part_to_stream error %d", r);
-		return TRUE;
-	}
+	g_mutex_lock(&forced_charset_mutex);
+	charset = g_strdup(forced_charset);
+	g_mutex_unlock(&forced_charset_mutex);
 
-	src_codeset = forced_charset
-		      ? forced_charset : 
+	src_codeset = charset
+		      ? charset : 
 		      procmime_mimeinfo_get_parameter(mimeinfo, "charset");
 
 	/* use supersets transparently when possible */
-	if (!forced_charset && src_codeset && !strcasecmp(src_codeset, CS_ISO_8859_1))
+	if (!charset && src_codeset && !strcasecmp(src_codeset, CS_ISO_8859_1))
 		src_codeset = CS_WINDOWS_1252;
-	else if (!forced_charset && src_codeset && !strcasecmp(src_codeset, CS_X_GBK))
+	else if (!charset && src_codeset && !strcasecmp(src_codeset, CS_X_GBK))
 		src_codeset = CS_GB18030;
-	else if (!forced_charset && src_codeset && !strcasecmp(src_codeset, CS_GBK))
+	else if (!charset && src_codeset && !strcasecmp(src_codeset, CS_GBK))
 		src_codeset = CS_GB18030;
-	else if (!forced_charset && src_codeset && !strcasecmp(src_codeset, CS_GB2312))
+	else if (!charset && src_codeset && !strcasecmp(src_codeset, CS_GB2312))
 		src_codeset = CS_GB18030;
-	else if (!forced_charset && src_codeset && !strcasecmp(src_codeset, CS_X_VIET_VPS))
+	else if (!charset && src_codeset && !strcasecmp(src_codeset, CS_X_VIET_VPS))
 		src_codeset = CS_WINDOWS_874;
 
 	if (mimeinfo->type == MIMETYPE_TEXT && !g_ascii_strcasecmp(mimeinfo->subtype, "html")) {
@@ -842,7 +1055,8 @@ gboolean procmime_scan_text_content(MimeInfo *mimeinfo,
 	if (conv_fail)
 		g_warning("procmime_get_text_content(): code conversion failed");
 
-	claws_fclose(tmpfp);
+	procmime_close_decoded_part(tmpfp, mem);
+	g_free(charset);
 
 	return scan_ret;
 }
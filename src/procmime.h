@@ -239,6 +239,13 @@ void procmime_mimeparser_unregister(MimeParser *mimeparser);
 FILE *procmime_get_text_content(MimeInfo *mimeinfo);
 FILE *procmime_get_binary_content(MimeInfo *mimeinfo);
 
+/* opens a stream on the decoded content of mimeinfo, decoding it in
+ * memory when it is small enough. close it with
+ * procmime_close_decoded_part(), giving it what was set in mem.
+ */
+FILE *procmime_open_decoded_part(MimeInfo *mimeinfo, gchar **mem);
+void procmime_close_decoded_part(FILE *fp, gchar *mem);
+
 /* scans mimeinfo contents, calling scan_callback() once per line.
  * return TRUE and scan is aborted if scan_callback returns TRUE.
  * return TRUE on error.
@@ -54,8 +54,36 @@
 
 extern SessionStats session_stats;
 
+/* A queued message on its way out */
+typedef struct _QueuedSend QueuedSend;
+
+struct _QueuedSend {
+	const gchar *file;
+	FolderItem *queue;
+	gint msgnum;
+
+	FILE *fp;		/* positioned after the special headers */
+	gint filepos;
+	gchar *from;
+	gchar *smtpserver;
+	GSList *to_list;
+	GSList *newsgroup_list;
+	gchar *savecopyfolder;
+	gchar *replymessageid;
+	gchar *fwdmessageid;
+	PrefsAccount *mailac;
+	PrefsAccount *newsac;
+	gboolean encrypt;
+};
+
 static gint procmsg_send_message_queue_full(const gchar *file, gboolean keep_session, gchar **errstr,
 					    FolderItem *queue, gint msgnum, gboolean *queued_removed);
+static gint procmsg_queued_send_open(QueuedSend *qs, const gchar *file, FolderItem *queue,
+				     gint msgnum, gchar **errstr);
+static gboolean procmsg_queued_send_is_smtp(QueuedSend *qs);
+static gint procmsg_queued_send_mail(QueuedSend *qs, gboolean keep_session, gchar **errstr);
+static gint procmsg_queued_send_finish(QueuedSend *qs, gint mailval, gchar **errstr,
+				       gboolean *queued_removed);
 static void procmsg_update_unread_children	(MsgInfo 	*info,
 					 gboolean 	 newly_marked);
 enum
@@ -206,22 +234,22 @@ static void subject_hashtable_free(gpointer key, gpointer value, gpointer data)
 	g_slist_free(value);
 }
 
-/* return the reversed thread tree */
-GNode *procmsg_get_thread_tree(GSList *mlist)
+static void procmsg_thread_node_free(gpointer key, gpointer value, gpointer data)
 {
-	GNode *root, *parent, *node, *next;
+	g_node_destroy(value);
+}
+
+/* builds the tree from the References/In-Reply-To headers */
+static void procmsg_thread_tree_from_headers(GNode *root, GSList *mlist,
+					     GHashTable *subject_hashtable)
+{
+	GNode *parent, *node, *next;
 	GHashTable *msgid_table;
-	GHashTable *subject_hashtable = NULL;
 	MsgInfo *msginfo;
 	const gchar *msgid;
         GSList *reflist;
-	START_TIMING("");
-	root = g_node_new(NULL);
+
 	msgid_table = g_hash_table_new(g_str_hash, g_str_equal);
-	
-	if (prefs_common.thread_by_subject) {
-		subject_hashtable = g_hash_table_new(g_str_hash, g_str_equal);
-	}
 
 	for (; mlist != NULL; mlist = mlist->next) {
 		msginfo = (MsgInfo *)mlist->data;
@@ -240,7 +268,7 @@ GNode *procmsg_get_thread_tree(GSList *mlist)
 			g_hash_table_insert(msgid_table, (gchar *)msgid, node);
 
 		/* CLAWS: add subject to hashtable (without prefix) */
-		if (prefs_common.thread_by_subject) {
+		if (subject_hashtable) {
 			subject_hashtable_insert(subject_hashtable, node);
 		}
 	}
@@ -275,6 +303,115 @@ GNode *procmsg_get_thread_tree(GSList *mlist)
 		node = next;
 	}
 
+	g_hash_table_destroy(msgid_table);
+}
+
+/* returns the folder whose thread index can be used to thread mlist,
+   i.e. the one all of its messages are cached in */
+static FolderItem *procmsg_thread_index_item(GSList *mlist)
+{
+	FolderItem *item;
+
+	if (mlist == NULL)
+		return NULL;
+
+	item = ((MsgInfo *)mlist->data)->folder;
+	if (item == NULL || item->cache == NULL)
+		return NULL;
+
+	for (; mlist != NULL; mlist = mlist->next) {
+		if (((MsgInfo *)mlist->data)->folder != item)
+			return NULL;
+	}
+
+	return item;
+}
+
+/* builds the tree from the folder's thread index; a message whose
+   parent isn't in mlist is threaded by its own References instead,
+   from the closest one, as procmsg_thread_tree_from_headers() does */
+static gboolean procmsg_thread_tree_from_index(GNode *root, GSList *mlist,
+					       MsgCache *cache,
+					       GHashTable *subject_hashtable)
+{
+	GHashTable *node_table, *msgid_table;
+	GNode *parent, *node;
+	MsgInfo *msginfo;
+	GSList *cur, *reflist;
+	guint num;
+
+	node_table = g_hash_table_new(g_direct_hash, g_direct_equal);
+	msgid_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		if (g_hash_table_lookup(node_table,
+					GUINT_TO_POINTER(msginfo->msgnum)) != NULL) {
+			/* duplicate numbers, leave it to the headers */
+			g_hash_table_foreach(node_table, procmsg_thread_node_free, NULL);
+			g_hash_table_destroy(node_table);
+			g_hash_table_destroy(msgid_table);
+			return FALSE;
+		}
+		node = g_node_new(msginfo);
+		g_hash_table_insert(node_table, GUINT_TO_POINTER(msginfo->msgnum),
+				    node);
+		if (msginfo->msgid != NULL &&
+		    g_hash_table_lookup(msgid_table, msginfo->msgid) == NULL)
+			g_hash_table_insert(msgid_table, msginfo->msgid, node);
+	}
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		node = g_hash_table_lookup(node_table, GUINT_TO_POINTER(msginfo->msgnum));
+		parent = NULL;
+
+		num = msgcache_get_thread_parent(cache, msginfo->msgnum);
+		if (num != 0)
+			parent = g_hash_table_lookup(node_table, GUINT_TO_POINTER(num));
+
+		if (parent == NULL && msginfo->inreplyto)
+			parent = g_hash_table_lookup(msgid_table, msginfo->inreplyto);
+		for (reflist = msginfo->references;
+		     parent == NULL && reflist != NULL; reflist = reflist->next)
+			parent = g_hash_table_lookup(msgid_table, reflist->data);
+
+		if (parent && parent != node &&
+		    !g_node_is_ancestor(node, parent))
+			g_node_append(parent, node);
+		else
+			g_node_prepend(root, node);
+
+		if (subject_hashtable) {
+			subject_hashtable_insert(subject_hashtable, node);
+		}
+	}
+
+	g_hash_table_destroy(msgid_table);
+	g_hash_table_destroy(node_table);
+	return TRUE;
+}
+
+/* return the reversed thread tree */
+GNode *procmsg_get_thread_tree(GSList *mlist)
+{
+	GNode *root, *parent, *node, *next;
+	GHashTable *subject_hashtable = NULL;
+	FolderItem *item;
+	MsgInfo *msginfo;
+	START_TIMING("");
+	root = g_node_new(NULL);
+	
+	if (prefs_common.thread_by_subject) {
+		subject_hashtable = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+
+	item = procmsg_thread_index_item(mlist);
+	if (item == NULL ||
+	    !procmsg_thread_tree_from_index(root, mlist, item->cache,
+					    subject_hashtable))
+		procmsg_thread_tree_from_headers(root, mlist, subject_hashtable);
+
 	if (prefs_common.thread_by_subject) {
 		START_TIMING("thread by subject");
 		for (node = root->children; node && node != NULL;) {
@@ -309,7 +446,6 @@ GNode *procmsg_get_thread_tree(GSList *mlist)
 		g_hash_table_destroy(subject_hashtable);
 	}
 
-	g_hash_table_destroy(msgid_table);
 	END_TIMING();
 	return root;
 }
@@ -972,6 +1108,229 @@ void procmsg_queue_unlock(void)
 {
 	send_queue_lock = FALSE;
 }
+static void procmsg_send_queue_sent(FolderItem *queue, MsgInfo *msginfo, gint val,
+				    gboolean queued_removed, gint *sent, gint *err)
+{
+	if (val < 0) {
+		g_warning("sending queued message %d failed",
+			  msginfo->msgnum);
+		(*err)++;
+	} else {
+		(*sent)++;
+		if (!queued_removed)
+			folder_item_remove_msg(queue, msginfo->msgnum);
+	}
+}
+
+static void procmsg_send_queue_serial(FolderItem *queue, GSList *sorted_list,
+				      gchar **errstr, gint *sent, gint *err)
+{
+	GSList *elem;
+
+	for (elem = sorted_list; elem != NULL; elem = elem->next) {
+		gchar *file;
+		MsgInfo *msginfo;
+			
+		msginfo = (MsgInfo *)(elem->data);
+		if (!MSG_IS_LOCKED(msginfo->flags) && !MSG_IS_DELETED(msginfo->flags)) {
+			file = folder_item_fetch_msg(queue, msginfo->msgnum);
+			if (file) {
+				gboolean queued_removed = FALSE;
+				gint val;
+
+				val = procmsg_send_message_queue_full(file, 
+						!procmsg_is_last_for_account(queue, msginfo, elem),
+						errstr, queue, msginfo->msgnum, &queued_removed);
+				procmsg_send_queue_sent(queue, msginfo, val,
+							queued_removed, sent, err);
+				g_free(file);
+			}
+		}
+	}
+}
+
+/* The queued messages of one account. They go one after the other on
+ * the account's SMTP session, while other accounts' batches run
+ * alongside from the main loop. */
+typedef struct _SendQueueBatch SendQueueBatch;
+
+struct _SendQueueBatch {
+	FolderItem *queue;
+	PrefsAccount *account;
+	GSList *msgs;
+	GSList *cur;
+
+	/* the message being sent, if session isn't NULL */
+	MsgInfo *msginfo;
+	gchar *file;
+	QueuedSend qs;
+	Session *session;
+
+	/* the account whose SMTP session may have been kept for the next
+	 * message */
+	PrefsAccount *kept;
+};
+
+/* Closes the session kept for a next message that won't go through it */
+static void procmsg_send_queue_batch_release(SendQueueBatch *batch)
+{
+	if (batch->kept != NULL) {
+		send_message_smtp_close(batch->kept);
+		batch->kept = NULL;
+	}
+}
+
+/* Starts the next message of the batch; those that can't go through an
+ * SMTP session of their own (news only, sendmail command...) are sent
+ * right away. Leaves batch->session NULL once the batch is done. */
+static void procmsg_send_queue_batch_next(SendQueueBatch *batch, gchar **errstr,
+					  gint *sent, gint *err)
+{
+	while (batch->cur != NULL) {
+		MsgInfo *msginfo = (MsgInfo *)batch->cur->data;
+		gboolean queued_removed = FALSE;
+		gchar *file;
+		gint val;
+
+		batch->cur = batch->cur->next;
+		if (MSG_IS_LOCKED(msginfo->flags) || MSG_IS_DELETED(msginfo->flags))
+			continue;
+		file = folder_item_fetch_msg(batch->queue, msginfo->msgnum);
+		if (!file)
+			continue;
+
+		if (procmsg_queued_send_open(&batch->qs, file, batch->queue,
+					     msginfo->msgnum, errstr) < 0) {
+			val = -1;
+		} else if (procmsg_queued_send_is_smtp(&batch->qs)) {
+			if (batch->kept != batch->qs.mailac)
+				procmsg_send_queue_batch_release(batch);
+			batch->session = send_message_smtp_start(batch->qs.mailac,
+					batch->qs.to_list, batch->qs.fp);
+			if (batch->session != NULL) {
+				batch->msginfo = msginfo;
+				batch->file = file;
+				return;
+			}
+			if (errstr) {
+				if (*errstr) g_free(*errstr);
+				*errstr = g_strdup_printf(_("An error happened during SMTP session."));
+			}
+			val = procmsg_queued_send_finish(&batch->qs, -1, errstr,
+							 &queued_removed);
+		} else {
+			procmsg_send_queue_batch_release(batch);
+			val = procmsg_queued_send_finish(&batch->qs,
+					procmsg_queued_send_mail(&batch->qs, FALSE, errstr),
+					errstr, &queued_removed);
+		}
+		procmsg_send_queue_sent(batch->queue, msginfo, val,
+					queued_removed, sent, err);
+		g_free(file);
+	}
+	procmsg_send_queue_batch_release(batch);
+}
+
+/* Finishes the message whose session is no longer running */
+static void procmsg_send_queue_batch_done(SendQueueBatch *batch, gchar **errstr,
+					  gint *sent, gint *err)
+{
+	gboolean queued_removed = FALSE;
+	gboolean keep_session;
+	gint mailval, val;
+
+	/* messages without an account can end up on any of them, so they
+	 * don't leave a session behind that a running batch could want */
+	keep_session = batch->account != NULL &&
+		!procmsg_is_last_for_account(batch->queue, batch->msginfo, batch->cur);
+
+	mailval = send_message_smtp_finish(batch->qs.mailac, batch->session,
+					   keep_session);
+	batch->session = NULL;
+	if (keep_session && mailval == 0)
+		batch->kept = batch->qs.mailac;
+	if (mailval == -1 && errstr) {
+		if (*errstr) g_free(*errstr);
+		*errstr = g_strdup_printf(_("An error happened during SMTP session."));
+	}
+
+	val = procmsg_queued_send_finish(&batch->qs, mailval, errstr, &queued_removed);
+	procmsg_send_queue_sent(batch->queue, batch->msginfo, val,
+				queued_removed, sent, err);
+	g_free(batch->file);
+	batch->file = NULL;
+	batch->msginfo = NULL;
+}
+
+static void procmsg_send_queue_parallel(FolderItem *queue, GSList *sorted_list,
+					gchar **errstr, gint *sent, gint *err)
+{
+	GHashTable *by_account;
+	GSList *batches = NULL, *waiting, *running = NULL;
+	GSList *cur, *next;
+	SendQueueBatch *batch;
+	gboolean done;
+
+	by_account = g_hash_table_new(g_direct_hash, g_direct_equal);
+	for (cur = sorted_list; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		gchar *file = folder_item_fetch_msg(queue, msginfo->msgnum);
+		PrefsAccount *ac = file ? procmsg_get_account_from_file(file) : NULL;
+
+		g_free(file);
+		batch = g_hash_table_lookup(by_account, ac);
+		if (batch == NULL) {
+			batch = g_new0(SendQueueBatch, 1);
+			batch->queue = queue;
+			batch->account = ac;
+			g_hash_table_insert(by_account, ac, batch);
+			batches = g_slist_append(batches, batch);
+		}
+		batch->msgs = g_slist_append(batch->msgs, msginfo);
+	}
+	g_hash_table_destroy(by_account);
+
+	debug_print("sending queue with %d accounts, %d at a time\n",
+		    g_slist_length(batches), prefs_common.send_queue_max_accounts);
+
+	waiting = batches;
+	while (TRUE) {
+		while (waiting != NULL &&
+		       (gint)g_slist_length(running) < prefs_common.send_queue_max_accounts) {
+			batch = (SendQueueBatch *)waiting->data;
+			waiting = waiting->next;
+			batch->cur = batch->msgs;
+			procmsg_send_queue_batch_next(batch, errstr, sent, err);
+			if (batch->session != NULL)
+				running = g_slist_append(running, batch);
+		}
+		if (running == NULL)
+			break;
+
+		done = FALSE;
+		for (cur = running; cur != NULL; cur = next) {
+			next = cur->next;
+			batch = (SendQueueBatch *)cur->data;
+			if (send_message_smtp_is_running(batch->session))
+				continue;
+			done = TRUE;
+			procmsg_send_queue_batch_done(batch, errstr, sent, err);
+			procmsg_send_queue_batch_next(batch, errstr, sent, err);
+			if (batch->session == NULL)
+				running = g_slist_delete_link(running, cur);
+		}
+		if (!done)
+			gtk_main_iteration();
+	}
+
+	for (cur = batches; cur != NULL; cur = cur->next) {
+		batch = (SendQueueBatch *)cur->data;
+		g_slist_free(batch->msgs);
+		g_free(batch);
+	}
+	g_slist_free(batches);
+}
+
 /*!
  *\brief	Send messages in queue
  *
@@ -1011,36 +1370,20 @@ gint procmsg_send_queue(FolderItem *queue, gboolean save_msgs, gchar **errstr)
 
 	/* sort the list per sender account; this helps reusing the same SMTP server */
 	sorted_list = procmsg_list_sort_by_account(queue, list);
-	
+
+	if (prefs_common.send_queue_max_accounts > 1)
+		procmsg_send_queue_parallel(queue, sorted_list, errstr, &sent, &err);
+	else
+		procmsg_send_queue_serial(queue, sorted_list, errstr, &sent, &err);
+
 	for (elem = sorted_list; elem != NULL; elem = elem->next) {
-		gchar *file;
-		MsgInfo *msginfo;
-			
-		msginfo = (MsgInfo *)(elem->data);
-		if (!MSG_IS_LOCKED(msginfo->flags) && !MSG_IS_DELETED(msginfo->flags)) {
-			file = folder_item_fetch_msg(queue, msginfo->msgnum);
-			if (file) {
-				gboolean queued_removed = FALSE;
-				if (procmsg_send_message_queue_full(file, 
-						!procmsg_is_last_for_account(queue, msginfo, elem),
-						errstr, queue, msginfo->msgnum, &queued_removed) < 0) {
-					g_warning("sending queued message %d failed",
-						  msginfo->msgnum);
-					err++;
-				} else {
-					sent++; 
-					if (!queued_removed)
-						folder_item_remove_msg(queue, msginfo->msgnum);
-				}
-				g_free(file);
-			}
-		}
+		MsgInfo *msginfo = (MsgInfo *)(elem->data);
+
 		/* FIXME: supposedly if only one message is locked, and queue
 		 * is being flushed, the following free says something like 
 		 * "freeing msg ## in folder (nil)". */
 		procmsg_msginfo_free(&msginfo);
 	}
-
 	g_slist_free(sorted_list);
 	folder_item_scan(queue);
 
@@ -1421,17 +1764,19 @@ void procmsg_msginfo_free(MsgInfo **msginfo_ptr)
 
 	FREENULL(msginfo->fromspace);
 
-	FREENULL(msginfo->fromname);
+	if (msginfo->heap == NULL) {
+		FREENULL(msginfo->fromname);
 
-	FREENULL(msginfo->date);
-	FREENULL(msginfo->from);
-	FREENULL(msginfo->to);
-	FREENULL(msginfo->cc);
-	FREENULL(msginfo->newsgroups);
-	FREENULL(msginfo->subject);
-	FREENULL(msginfo->msgid);
-	FREENULL(msginfo->inreplyto);
-	FREENULL(msginfo->xref);
+		FREENULL(msginfo->date);
+		FREENULL(msginfo->from);
+		FREENULL(msginfo->to);
+		FREENULL(msginfo->cc);
+		FREENULL(msginfo->newsgroups);
+		FREENULL(msginfo->subject);
+		FREENULL(msginfo->msgid);
+		FREENULL(msginfo->inreplyto);
+		FREENULL(msginfo->xref);
+	}
 
 	if (msginfo->extradata) {
 		if (msginfo->extradata->avatars) {
@@ -1455,13 +1800,21 @@ void procmsg_msginfo_free(MsgInfo **msginfo_ptr)
 		FREENULL(msginfo->extradata->resent_from);
 		FREENULL(msginfo->extradata);
 	}
-	slist_free_strings_full(msginfo->references);
+	if (msginfo->heap == NULL)
+		slist_free_strings_full(msginfo->references);
+	else
+		g_slist_free(msginfo->references);
 	msginfo->references = NULL;
 	g_slist_free(msginfo->tags);
 	msginfo->tags = NULL;
 
 	FREENULL(msginfo->plaintext_file);
 
+	if (msginfo->heap != NULL) {
+		msgcache_heap_unref(msginfo->heap);
+		msginfo->heap = NULL;
+	}
+
 	g_free(msginfo);
 	*msginfo_ptr = NULL;
 }
@@ -1473,28 +1826,35 @@ guint procmsg_msginfo_memusage(MsgInfo *msginfo)
 	GSList *tmp;
 	
 	memusage += sizeof(MsgInfo);
-	if (msginfo->fromname)
-		memusage += strlen(msginfo->fromname);
-	if (msginfo->date)
-		memusage += strlen(msginfo->date);
-	if (msginfo->from)
-		memusage += strlen(msginfo->from);
-	if (msginfo->to)
-		memusage += strlen(msginfo->to);
-	if (msginfo->cc)
-		memusage += strlen(msginfo->cc);
-	if (msginfo->newsgroups)
-		memusage += strlen(msginfo->newsgroups);
-	if (msginfo->subject)
-		memusage += strlen(msginfo->subject);
-	if (msginfo->msgid)
-		memusage += strlen(msginfo->msgid);
-	if (msginfo->inreplyto)
-		memusage += strlen(msginfo->inreplyto);
+	/* strings living in a cache heap are accounted for by the heap,
+	 * not by each message */
+	if (msginfo->heap == NULL) {
+		if (msginfo->fromname)
+			memusage += strlen(msginfo->fromname);
+		if (msginfo->date)
+			memusage += strlen(msginfo->date);
+		if (msginfo->from)
+			memusage += strlen(msginfo->from);
+		if (msginfo->to)
+			memusage += strlen(msginfo->to);
+		if (msginfo->cc)
+			memusage += strlen(msginfo->cc);
+		if (msginfo->newsgroups)
+			memusage += strlen(msginfo->newsgroups);
+		if (msginfo->subject)
+			memusage += strlen(msginfo->subject);
+		if (msginfo->msgid)
+			memusage += strlen(msginfo->msgid);
+		if (msginfo->inreplyto)
+			memusage += strlen(msginfo->inreplyto);
+	}
 
 	for (tmp = msginfo->references; tmp; tmp=tmp->next) {
 		gchar *r = (gchar *)tmp->data;
-		memusage += r?strlen(r):0 + sizeof(GSList);
+		if (msginfo->heap == NULL)
+			memusage += r?strlen(r):0 + sizeof(GSList);
+		else
+			memusage += sizeof(GSList);
 	}
 	if (msginfo->fromspace)
 		memusage += strlen(msginfo->fromspace);
@@ -1541,8 +1901,23 @@ guint procmsg_msginfo_memusage(MsgInfo *msginfo)
 	return memusage;
 }
 
-static gint procmsg_send_message_queue_full(const gchar *file, gboolean keep_session, gchar **errstr,
-					    FolderItem *queue, gint msgnum, gboolean *queued_removed)
+static void procmsg_queued_send_free(QueuedSend *qs)
+{
+	if (qs->fp != NULL)
+		claws_fclose(qs->fp);
+	g_free(qs->from);
+	g_free(qs->smtpserver);
+	slist_free_strings_full(qs->to_list);
+	slist_free_strings_full(qs->newsgroup_list);
+	g_free(qs->savecopyfolder);
+	g_free(qs->replymessageid);
+	g_free(qs->fwdmessageid);
+}
+
+/* Reads the special headers of a queued message, leaving qs->fp on the
+ * message itself */
+static gint procmsg_queued_send_open(QueuedSend *qs, const gchar *file, FolderItem *queue,
+				     gint msgnum, gchar **errstr)
 {
 	static HeaderEntry qentry[] = {
 				       {"S:",    NULL, FALSE}, /* 0 */
@@ -1563,25 +1938,12 @@ static gint procmsg_send_message_queue_full(const gchar *file, gboolean keep_ses
 				       {"X-Sylpheed-Encrypt-Data:", NULL, FALSE}, /* 15 */
 				       {"X-Sylpheed-End-Special-Headers:", NULL, FALSE},
 				       {NULL,    NULL, FALSE}};
-	FILE *fp;
-	gint filepos;
-	gint mailval = 0, newsval = 0;
-	gchar *from = NULL;
-	gchar *smtpserver = NULL;
-	GSList *to_list = NULL;
-	GSList *newsgroup_list = NULL;
-	gchar *savecopyfolder = NULL;
-	gchar *replymessageid = NULL;
-	gchar *fwdmessageid = NULL;
 	gchar *buf;
 	gint hnum;
-	PrefsAccount *mailac = NULL, *newsac = NULL;
-	gboolean encrypt = FALSE;
-	FolderItem *outbox;
 
-	cm_return_val_if_fail(file != NULL, -1);
+	memset(qs, 0, sizeof(QueuedSend));
 
-	if ((fp = claws_fopen(file, "rb")) == NULL) {
+	if ((qs->fp = claws_fopen(file, "rb")) == NULL) {
 		FILE_OP_ERROR(file, "claws_fopen");
 		if (errstr) {
 			if (*errstr) g_free(*errstr);
@@ -1589,91 +1951,118 @@ static gint procmsg_send_message_queue_full(const gchar *file, gboolean keep_ses
 		}
 		return -1;
 	}
+	qs->file = file;
+	qs->queue = queue;
+	qs->msgnum = msgnum;
 
-	while ((hnum = procheader_get_one_field(&buf, fp, qentry)) != -1 && buf != NULL) {
+	while ((hnum = procheader_get_one_field(&buf, qs->fp, qentry)) != -1 && buf != NULL) {
 		gchar *p = buf + strlen(qentry[hnum].name);
 
 		switch (hnum) {
 		case Q_SENDER:
-			if (from == NULL) 
-				from = g_strdup(p);
+			if (qs->from == NULL) 
+				qs->from = g_strdup(p);
 			break;
 		case Q_SMTPSERVER:
-			if (smtpserver == NULL) 
-				smtpserver = g_strdup(p);
+			if (qs->smtpserver == NULL) 
+				qs->smtpserver = g_strdup(p);
 			break;
 		case Q_RECIPIENTS:
-			to_list = address_list_append(to_list, p);
+			qs->to_list = address_list_append(qs->to_list, p);
 			break;
 		case Q_NEWSGROUPS:
-			newsgroup_list = newsgroup_list_append(newsgroup_list, p);
+			qs->newsgroup_list = newsgroup_list_append(qs->newsgroup_list, p);
 			break;
 		case Q_MAIL_ACCOUNT_ID:
-			mailac = account_find_from_id(atoi(p));
+			qs->mailac = account_find_from_id(atoi(p));
 			break;
 		case Q_NEWS_ACCOUNT_ID:
-			newsac = account_find_from_id(atoi(p));
+			qs->newsac = account_find_from_id(atoi(p));
 			break;
 		case Q_SAVE_COPY_FOLDER:
-			if (savecopyfolder == NULL) 
-				savecopyfolder = g_strdup(p);
+			if (qs->savecopyfolder == NULL) 
+				qs->savecopyfolder = g_strdup(p);
 			break;
 		case Q_REPLY_MESSAGE_ID:
-			if (replymessageid == NULL) 
-				replymessageid = g_strdup(p);
+			if (qs->replymessageid == NULL) 
+				qs->replymessageid = g_strdup(p);
 			break;
 		case Q_FWD_MESSAGE_ID:
-			if (fwdmessageid == NULL) 
-				fwdmessageid = g_strdup(p);
+			if (qs->fwdmessageid == NULL) 
+				qs->fwdmessageid = g_strdup(p);
 			break;
 		case Q_ENCRYPT:
 		case Q_ENCRYPT_OLD:
 			if (p[0] == '1') 
-				encrypt = TRUE;
+				qs->encrypt = TRUE;
 			break;
 		case Q_CLAWS_HDRS:
 		case Q_CLAWS_HDRS_OLD:
 			/* end of special headers reached */
 			g_free(buf);
-			goto send_mail; /* can't "break;break;" */
+			goto headers_done; /* can't "break;break;" */
 		}
 		g_free(buf);
 	}
 
-send_mail:
-	filepos = ftell(fp);
-	if (filepos < 0) {
+headers_done:
+	qs->filepos = ftell(qs->fp);
+	if (qs->filepos < 0) {
 		FILE_OP_ERROR(file, "ftell");
 		if (errstr) {
 			if (*errstr) g_free(*errstr);
 			*errstr = g_strdup_printf(_("Couldn't open file %s."), file);
 		}
+		procmsg_queued_send_free(qs);
 		return -1;
 	}
 
-	if (to_list) {
+	return 0;
+}
+
+/* The account whose SMTP server takes the mail */
+static PrefsAccount *procmsg_queued_send_account(QueuedSend *qs)
+{
+	if (!qs->mailac) {
+		qs->mailac = account_find_from_smtp_server(qs->from, qs->smtpserver);
+		if (!qs->mailac) {
+			g_warning("account not found, "
+				    "using current account...");
+			qs->mailac = cur_account;
+		}
+	}
+	return qs->mailac;
+}
+
+/* Whether the mail part can go through send_message_smtp_start() */
+static gboolean procmsg_queued_send_is_smtp(QueuedSend *qs)
+{
+	if (!qs->to_list || !qs->from)
+		return FALSE;
+	if (qs->mailac && qs->mailac->use_mail_command &&
+	    qs->mailac->mail_command && (* qs->mailac->mail_command))
+		return FALSE;
+	return procmsg_queued_send_account(qs) != NULL;
+}
+
+static gint procmsg_queued_send_mail(QueuedSend *qs, gboolean keep_session, gchar **errstr)
+{
+	gint mailval = 0;
+
+	if (qs->to_list) {
 		debug_print("Sending message by mail\n");
-		if (!from) {
+		if (!qs->from) {
 			if (errstr) {
 				if (*errstr) g_free(*errstr);
 				*errstr = g_strdup_printf(_("Queued message header is broken."));
 			}
 			mailval = -1;
-		} else if (mailac && mailac->use_mail_command &&
-			   mailac->mail_command && (* mailac->mail_command)) {
-			mailval = send_message_local(mailac->mail_command, fp);
+		} else if (qs->mailac && qs->mailac->use_mail_command &&
+			   qs->mailac->mail_command && (* qs->mailac->mail_command)) {
+			mailval = send_message_local(qs->mailac->mail_command, qs->fp);
 		} else {
-			if (!mailac) {
-				mailac = account_find_from_smtp_server(from, smtpserver);
-				if (!mailac) {
-					g_warning("account not found, "
-						    "using current account...");
-					mailac = cur_account;
-				}
-			}
-
-			if (mailac) {
-				mailval = send_message_smtp_full(mailac, to_list, fp, keep_session);
+			if (procmsg_queued_send_account(qs)) {
+				mailval = send_message_smtp_full(qs->mailac, qs->to_list, qs->fp, keep_session);
 				if (mailval == -1 && errstr) {
 					if (*errstr) g_free(*errstr);
 					*errstr = g_strdup_printf(_("An error happened during SMTP session."));
@@ -1684,10 +2073,10 @@ send_mail:
 				g_warning("account not found");
 
 				memset(&tmp_ac, 0, sizeof(PrefsAccount));
-				tmp_ac.address = from;
-				tmp_ac.smtp_server = smtpserver;
+				tmp_ac.address = qs->from;
+				tmp_ac.smtp_server = qs->smtpserver;
 				tmp_ac.smtpport = SMTP_PORT;
-				mailval = send_message_smtp(&tmp_ac, to_list, fp);
+				mailval = send_message_smtp(&tmp_ac, qs->to_list, qs->fp);
 				if (mailval == -1 && errstr) {
 					if (*errstr) g_free(*errstr);
 					*errstr = g_strdup_printf(_("No specific account has been found to "
@@ -1695,7 +2084,7 @@ send_mail:
 				}
 			}
 		}
-	} else if (!to_list && !newsgroup_list) {
+	} else if (!qs->to_list && !qs->newsgroup_list) {
 		if (errstr) {
 			if (*errstr) g_free(*errstr);
 			*errstr = g_strdup(_("Couldn't determine sending information. "
@@ -1704,12 +2093,26 @@ send_mail:
 		mailval = -1;
 	}
 
-	if (fseek(fp, filepos, SEEK_SET) < 0) {
+	return mailval;
+}
+
+/* Everything after the mail went (or failed to): news, the outbox, the
+ * replied/forwarded flags. Frees qs. */
+static gint procmsg_queued_send_finish(QueuedSend *qs, gint mailval, gchar **errstr,
+				       gboolean *queued_removed)
+{
+	const gchar *file = qs->file;
+	FolderItem *queue = qs->queue;
+	gint msgnum = qs->msgnum;
+	gint newsval = 0;
+	FolderItem *outbox;
+
+	if (fseek(qs->fp, qs->filepos, SEEK_SET) < 0) {
 		FILE_OP_ERROR(file, "fseek");
 		mailval = -1;
 	}
 
-	if (newsgroup_list && newsac && (mailval == 0)) {
+	if (qs->newsgroup_list && qs->newsac && (mailval == 0)) {
 		Folder *folder;
 		gchar *tmp = NULL;
 		gchar buf[BUFFSIZE];
@@ -1728,7 +2131,7 @@ send_mail:
 				g_warning("can't change file mode");
     			}
 
-			while ((newsval == 0) && claws_fgets(buf, sizeof(buf), fp) != NULL) {
+			while ((newsval == 0) && claws_fgets(buf, sizeof(buf), qs->fp) != NULL) {
 				if (claws_fputs(buf, tmpfp) == EOF) {
 					FILE_OP_ERROR(tmp, "claws_fputs");
 					newsval = -1;
@@ -1743,13 +2146,13 @@ send_mail:
 			if (newsval == 0) {
 				debug_print("Sending message by news\n");
 
-				folder = FOLDER(newsac->folder);
+				folder = FOLDER(qs->newsac->folder);
 
     				newsval = news_post(folder, tmp);
     				if (newsval < 0 && errstr)  {
 					if (*errstr) g_free(*errstr);
 					*errstr = g_strdup_printf(_("Error occurred while posting the message to %s."),
-                            		 newsac->nntp_server);
+                            		 qs->newsac->nntp_server);
 				}
 			}
 			claws_unlink(tmp);
@@ -1757,31 +2160,32 @@ send_mail:
 		g_free(tmp);
 	}
 
-	claws_fclose(fp);
+	claws_fclose(qs->fp);
+	qs->fp = NULL;
 
 	/* update session statistics */
 	if (mailval == 0 && newsval == 0) {
 		/* update session stats */
-		if (replymessageid)
+		if (qs->replymessageid)
 			session_stats.replied++;
-		else if (fwdmessageid)
+		else if (qs->fwdmessageid)
 			session_stats.forwarded++;
 		else
 			session_stats.sent++;
 	}
 
 	/* save message to outbox */
-	if (mailval == 0 && newsval == 0 && savecopyfolder) {
-		debug_print("saving sent message to %s...\n", savecopyfolder);
+	if (mailval == 0 && newsval == 0 && qs->savecopyfolder) {
+		debug_print("saving sent message to %s...\n", qs->savecopyfolder);
 
-		if (!encrypt || !mailac->save_encrypted_as_clear_text) {
-			outbox = folder_find_item_from_identifier(savecopyfolder);
+		if (!qs->encrypt || !qs->mailac->save_encrypted_as_clear_text) {
+			outbox = folder_find_item_from_identifier(qs->savecopyfolder);
 			if (!outbox) {
 				gchar *id;
 				outbox = folder_get_default_outbox();
 				if (outbox != NULL) {
 					id = folder_item_get_identifier(outbox);
-					debug_print("%s not found, using %s\n", savecopyfolder, id);
+					debug_print("%s not found, using %s\n", qs->savecopyfolder, id);
 					g_free(id);
 				} else {
 					debug_print("could not find outbox\n");
@@ -1809,14 +2213,14 @@ send_mail:
 		}
 	}
 
-	if (replymessageid != NULL || fwdmessageid != NULL) {
+	if (qs->replymessageid != NULL || qs->fwdmessageid != NULL) {
 		gchar **tokens;
 		FolderItem *item;
 		
-		if (replymessageid != NULL)
-			tokens = g_strsplit(replymessageid, "\t", 0);
+		if (qs->replymessageid != NULL)
+			tokens = g_strsplit(qs->replymessageid, "\t", 0);
 		else
-			tokens = g_strsplit(fwdmessageid, "\t", 0);
+			tokens = g_strsplit(qs->fwdmessageid, "\t", 0);
 		item = folder_find_item_from_identifier(tokens[0]);
 
 		/* check if queued message has valid folder and message id */
@@ -1838,7 +2242,7 @@ send_mail:
 			}
 			
 			if (msginfo != NULL) {
-				if (replymessageid != NULL) {
+				if (qs->replymessageid != NULL) {
 					MsgPermFlags to_unset = 0;
 
 					if (prefs_common.mark_as_read_on_new_window)
@@ -1855,17 +2259,27 @@ send_mail:
 		g_strfreev(tokens);
 	}
 
-	g_free(from);
-	g_free(smtpserver);
-	slist_free_strings_full(to_list);
-	slist_free_strings_full(newsgroup_list);
-	g_free(savecopyfolder);
-	g_free(replymessageid);
-	g_free(fwdmessageid);
+	procmsg_queued_send_free(qs);
 
 	return (newsval != 0 ? newsval : mailval);
 }
 
+static gint procmsg_send_message_queue_full(const gchar *file, gboolean keep_session, gchar **errstr,
+					    FolderItem *queue, gint msgnum, gboolean *queued_removed)
+{
+	QueuedSend qs;
+	gint mailval;
+
+	cm_return_val_if_fail(file != NULL, -1);
+
+	if (procmsg_queued_send_open(&qs, file, queue, msgnum, errstr) < 0)
+		return -1;
+
+	mailval = procmsg_queued_send_mail(&qs, keep_session, errstr);
+
+	return procmsg_queued_send_finish(&qs, mailval, errstr, queued_removed);
+}
+
 gint procmsg_send_message_queue(const gchar *file, gchar **errstr, FolderItem *queue, gint msgnum, gboolean *queued_removed)
 {
 	gint result = procmsg_send_message_queue_full(file, FALSE, errstr, queue, msgnum, queued_removed);
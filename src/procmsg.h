@@ -232,6 +232,11 @@ struct _MsgInfo
 	GSList *tags;
 
 	MsgInfoExtraData *extradata;
+
+	/* if set, the header strings above (fromname to xref, and the
+	 * references) point into this shared cache heap and are not
+	 * owned by the MsgInfo */
+	MsgCacheHeap *heap;
 };
 
 struct _MsgInfoExtraData
@@ -67,10 +67,13 @@ struct _SendProgressDialog
 {
 	ProgressDialog *dialog;
 	Session *session;
+	gint row;
 	gboolean cancelled;
 };
 
-static SendProgressDialog *send_dialog = NULL;
+/* sessions running at the same time share the window, with a row each */
+static ProgressDialog *send_progress = NULL;
+static GSList *send_dialogs = NULL;
 
 static gint send_recv_message		(Session		*session,
 					 const gchar		*msg,
@@ -96,13 +99,13 @@ static void send_put_error		(Session	*session);
 
 void send_cancel(void)
 {
-	if (send_dialog)
-		send_cancel_button_cb(NULL, send_dialog);
+	if (send_dialogs)
+		send_cancel_button_cb(NULL, NULL);
 }
 
 gboolean send_is_active(void)
 {
-	return (send_dialog != NULL);
+	return (send_dialogs != NULL);
 }
 
 gint send_message(const gchar *file, PrefsAccount *ac_prefs, GSList *to_list)
@@ -214,13 +217,16 @@ gint send_message_local(const gchar *command, FILE *fp)
 	return 0;
 }
 
-gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, gboolean keep_session)
+/* Connects (or reuses ac_prefs->session) and starts sending; the session
+ * then runs from the main loop until send_message_smtp_is_running() is
+ * FALSE, and send_message_smtp_finish() gets the result. */
+Session *send_message_smtp_start(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
 {
 	Session *session;
 	SMTPSession *smtp_session;
+	SendProgressDialog *send_dialog;
 	gushort port = 0;
 	gchar buf[BUFFSIZE];
-	gint ret = 0;
 	gboolean was_inited = FALSE;
 	MsgInfo *tmp_msginfo = NULL;
 	MsgFlags flags = {0, 0};
@@ -228,11 +234,11 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 	gchar spec_from[BUFFSIZE];
 	ProxyInfo *proxy_info = NULL;
 
-	cm_return_val_if_fail(ac_prefs != NULL, -1);
-	cm_return_val_if_fail(ac_prefs->address != NULL, -1);
-	cm_return_val_if_fail(ac_prefs->smtp_server != NULL, -1);
-	cm_return_val_if_fail(to_list != NULL, -1);
-	cm_return_val_if_fail(fp != NULL, -1);
+	cm_return_val_if_fail(ac_prefs != NULL, NULL);
+	cm_return_val_if_fail(ac_prefs->address != NULL, NULL);
+	cm_return_val_if_fail(ac_prefs->smtp_server != NULL, NULL);
+	cm_return_val_if_fail(to_list != NULL, NULL);
+	cm_return_val_if_fail(fp != NULL, NULL);
 
 	/* get the From address used, not necessarily the ac_prefs',
 	 * because it's editable. */
@@ -240,12 +246,12 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 	fp_pos = ftell(fp);
 	if (fp_pos < 0) {
 		perror("ftell");
-		return -1;
+		return NULL;
 	}
 	tmp_msginfo = procheader_parse_stream(fp, flags, TRUE, FALSE);
 	if (fseek(fp, fp_pos, SEEK_SET) < 0) {
 		perror("fseek");
-		return -1;
+		return NULL;
 	}
 
 	if (tmp_msginfo && tmp_msginfo->extradata && tmp_msginfo->extradata->resent_from) {
@@ -300,7 +306,7 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 				  NULL, _("_Cancel"), NULL, _("Con_tinue connecting"),
 				  NULL, NULL, ALERTFOCUS_FIRST, FALSE, NULL, ALERT_WARNING) != G_ALERTALTERNATE) {
 				session_destroy(session);
-				return -1;
+				return NULL;
 			}
 		}
 		port = ac_prefs->set_smtpport ? ac_prefs->smtpport : SMTP_PORT;
@@ -324,7 +330,7 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 							 &(ac_prefs->session_smtp_passwd));
 					if (!smtp_session->pass) {
 						session_destroy(session);
-						return -1;
+						return NULL;
 					}
 				}
 			} else {
@@ -342,7 +348,7 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 							 &(ac_prefs->session_smtp_passwd));
 					if (!smtp_session->pass) {
 						session_destroy(session);
-						return -1;
+						return NULL;
 					}
 				}
 			}
@@ -355,8 +361,8 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 		send_dialog->session = session;
 		smtp_session->dialog = send_dialog;
 
-		progress_dialog_list_set(send_dialog->dialog, 0, NULL, 
-					 ac_prefs->smtp_server, 
+		send_dialog->row = progress_dialog_list_set(send_dialog->dialog,
+					 -1, NULL, ac_prefs->smtp_server,
 					 _("Connecting"));
 
 		if (ac_prefs->pop_before_smtp
@@ -365,7 +371,8 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 			g_snprintf(buf, sizeof(buf), _("Doing POP before SMTP..."));
 			log_message(LOG_PROTOCOL, "%s\n", buf);
 			progress_dialog_set_label(send_dialog->dialog, buf);
-			progress_dialog_list_set_status(send_dialog->dialog, 0, _("POP before SMTP"));
+			progress_dialog_list_set_status(send_dialog->dialog, send_dialog->row,
+							_("POP before SMTP"));
 			GTK_EVENTS_FLUSH();
 			inc_pop_before_smtp(ac_prefs);
 		}
@@ -422,19 +429,42 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 		session_destroy(session);
 		send_progress_dialog_destroy(send_dialog);
 		ac_prefs->session = NULL;
-		return -1;
+		return NULL;
 	}
 
-	debug_print("send_message_smtp(): begin event loop\n");
-
 	if (was_inited) {
 		/* as the server is quiet, start sending ourselves */
 		smtp_from(smtp_session);
 	}
 
-	while (session_is_running(session) && send_dialog->cancelled == FALSE
-		&& SMTP_SESSION(session)->state != SMTP_MAIL_SENT_OK)
+	return session;
+}
+
+gboolean send_message_smtp_is_running(Session *session)
+{
+	SendProgressDialog *send_dialog = SMTP_SESSION(session)->dialog;
+
+	return session_is_running(session) && send_dialog->cancelled == FALSE
+		&& SMTP_SESSION(session)->state != SMTP_MAIL_SENT_OK;
+}
+
+static void send_message_smtp_quit(Session *session)
+{
+	SendProgressDialog *send_dialog = SMTP_SESSION(session)->dialog;
+
+	if (session_is_connected(session))
+		smtp_quit(SMTP_SESSION(session));
+	while (session_is_connected(session) && !send_dialog->cancelled)
 		gtk_main_iteration();
+	session_destroy(session);
+	send_progress_dialog_destroy(send_dialog);
+}
+
+gint send_message_smtp_finish(PrefsAccount *ac_prefs, Session *session, gboolean keep_session)
+{
+	SMTPSession *smtp_session = SMTP_SESSION(session);
+	SendProgressDialog *send_dialog = smtp_session->dialog;
+	gint ret = 0;
 
 	if (SMTP_SESSION(session)->error_val == SM_AUTHFAIL) {
 		if (ac_prefs->session_smtp_passwd) {
@@ -470,13 +500,8 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 	 * easier.
 	 */
 	if (!keep_session || ret != 0) {
-		if (session_is_connected(session))
-			smtp_quit(smtp_session);
-		while (session_is_connected(session) && !send_dialog->cancelled)
-			gtk_main_iteration();
-		session_destroy(session);
+		send_message_smtp_quit(session);
 		ac_prefs->session = NULL;
-		send_progress_dialog_destroy(send_dialog);
 	} else {
 		g_free(smtp_session->from);
 		g_free(smtp_session->send_data);
@@ -491,6 +516,38 @@ gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, g
 	return ret;
 }
 
+/* Closes the session send_message_smtp_finish() kept for the next
+ * message of the account, if the next message won't use it */
+void send_message_smtp_close(PrefsAccount *ac_prefs)
+{
+	Session *session;
+
+	cm_return_if_fail(ac_prefs != NULL);
+
+	if (ac_prefs->session == NULL)
+		return;
+
+	session = SESSION(ac_prefs->session);
+	ac_prefs->session = NULL;
+	send_message_smtp_quit(session);
+}
+
+gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp, gboolean keep_session)
+{
+	Session *session;
+
+	session = send_message_smtp_start(ac_prefs, to_list, fp);
+	if (session == NULL)
+		return -1;
+
+	debug_print("send_message_smtp(): begin event loop\n");
+
+	while (send_message_smtp_is_running(session))
+		gtk_main_iteration();
+
+	return send_message_smtp_finish(ac_prefs, session, keep_session);
+}
+
 gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
 {
 	return send_message_smtp_full(ac_prefs, to_list, fp, FALSE);
@@ -547,7 +604,7 @@ static gint send_recv_message(Session *session, const gchar *msg, gpointer data)
 	}
 
 	progress_dialog_set_label(dialog->dialog, buf);
-	progress_dialog_list_set_status(dialog->dialog, 0, state_str);
+	progress_dialog_list_set_status(dialog->dialog, dialog->row, state_str);
 
 	return 0;
 }
@@ -615,14 +672,20 @@ static SendProgressDialog *send_progress_dialog_create(void)
 	static GdkGeometry geometry;
 
 	dialog = g_new0(SendProgressDialog, 1);
+	send_dialogs = g_slist_append(send_dialogs, dialog);
+
+	if (send_progress != NULL) {
+		dialog->dialog = send_progress;
+		return dialog;
+	}
 
 	progress = progress_dialog_create();
 	gtk_window_set_title(GTK_WINDOW(progress->window),
 			     _("Sending message"));
 	g_signal_connect(G_OBJECT(progress->showlog_btn), "clicked",
-			 G_CALLBACK(send_showlog_button_cb), dialog);
+			 G_CALLBACK(send_showlog_button_cb), NULL);
 	g_signal_connect(G_OBJECT(progress->cancel_btn), "clicked",
-			 G_CALLBACK(send_cancel_button_cb), dialog);
+			 G_CALLBACK(send_cancel_button_cb), NULL);
 	g_signal_connect(G_OBJECT(progress->window), "delete_event",
 			 G_CALLBACK(gtk_true), NULL);
 	gtk_window_set_modal(GTK_WINDOW(progress->window), TRUE);
@@ -646,6 +709,7 @@ static SendProgressDialog *send_progress_dialog_create(void)
 		gtk_widget_show_now(progress->window);
 	}
 	
+	send_progress = progress;
 	dialog->dialog = progress;
 
 	return dialog;
@@ -654,11 +718,14 @@ static SendProgressDialog *send_progress_dialog_create(void)
 static void send_progress_dialog_destroy(SendProgressDialog *dialog)
 {
 	cm_return_if_fail(dialog != NULL);
-	if (!prefs_common.send_dialog_invisible) {
-		progress_dialog_destroy(dialog->dialog);
+	send_dialogs = g_slist_remove(send_dialogs, dialog);
+	if (send_dialogs == NULL) {
+		if (!prefs_common.send_dialog_invisible) {
+			progress_dialog_destroy(dialog->dialog);
+		}
+		send_progress = NULL;
 	}
 	g_free(dialog);
-	send_dialog = NULL;
 }
 
 static void send_showlog_button_cb(GtkWidget *widget, gpointer data)
@@ -670,10 +737,11 @@ static void send_showlog_button_cb(GtkWidget *widget, gpointer data)
 
 static void send_cancel_button_cb(GtkWidget *widget, gpointer data)
 {
-	SendProgressDialog *dialog = (SendProgressDialog *)data;
+	GSList *cur;
 	statusbar_progress_all(0,0,0);
 
-	dialog->cancelled = TRUE;
+	for (cur = send_dialogs; cur != NULL; cur = cur->next)
+		((SendProgressDialog *)cur->data)->cancelled = TRUE;
 }
 
 static void send_put_error(Session *session)
@@ -23,6 +23,7 @@
 #include <glib.h>
 
 #include "prefs_account.h"
+#include "session.h"
 
 #define SMTP_PORT	25
 #ifdef USE_GNUTLS
@@ -41,6 +42,14 @@ gint send_message_smtp_full	(PrefsAccount *ac_prefs,
 				 GSList *to_list, 
 				 FILE *fp, 
 				 gboolean keep_session);
+Session *send_message_smtp_start	(PrefsAccount *ac_prefs,
+				 GSList *to_list,
+				 FILE *fp);
+gboolean send_message_smtp_is_running	(Session *session);
+gint send_message_smtp_finish	(PrefsAccount *ac_prefs,
+				 Session *session,
+				 gboolean keep_session);
+void send_message_smtp_close	(PrefsAccount *ac_prefs);
 void send_cancel	(void);
 gboolean send_is_active	(void);
 
@@ -3092,7 +3092,11 @@ void summary_sort(SummaryView *summaryview,
 		gtk_cmclist_set_compare_func(clist, cmp_func);
 
 		gtk_cmclist_set_sort_type(clist, (GtkSortType)sort_type);
+		summaryview->sort_keys = g_hash_table_new_full(g_direct_hash,
+				g_direct_equal, NULL, g_free);
 		gtk_sctree_sort_recursive(ctree, NULL);
+		g_hash_table_destroy(summaryview->sort_keys);
+		summaryview->sort_keys = NULL;
 
 		gtk_cmctree_node_moveto(ctree, summaryview->selected, 0, 0.5, 0);
 
@@ -7701,6 +7705,50 @@ static void summary_drag_data_received(GtkWidget        *widget,
 
 /* custom compare functions for sorting */
 
+static gchar *summary_get_sort_key(const SummaryView *summaryview,
+				   const GtkCMCListRow *row,
+				   const gchar *str, gboolean subject)
+{
+	gchar *key;
+
+	if (g_hash_table_lookup_extended(summaryview->sort_keys, row,
+					 NULL, (gpointer *)&key))
+		return key;
+
+	if (subject)
+		key = subject_collate_key_for_sort(str);
+	else
+		key = g_utf8_collate_key(str, -1);
+	g_hash_table_insert(summaryview->sort_keys, (gpointer)row, key);
+
+	return key;
+}
+
+/* Compares like g_utf8_collate(), or subject_compare_for_sort(), using
+ * the keys cached for the rows when sorting the whole summary */
+static gint summary_collate(const SummaryView *summaryview,
+			    const GtkCMCListRow *r1, const gchar *str1,
+			    const GtkCMCListRow *r2, const gchar *str2,
+			    gboolean subject)
+{
+	const gchar *key1, *key2;
+
+	if (!summaryview->sort_keys) {
+		if (subject)
+			return subject_compare_for_sort(str1, str2);
+		return g_utf8_collate(str1, str2);
+	}
+
+	key1 = summary_get_sort_key(summaryview, r1, str1, subject);
+	key2 = summary_get_sort_key(summaryview, r2, str2, subject);
+
+	/* a subject failing UTF-8 validation */
+	if (!key1 || !key2)
+		return 0;
+
+	return strcmp(key1, key2);
+}
+
 static gint summary_cmp_by_date(GtkCMCList *clist,
 		      gconstpointer ptr1, gconstpointer ptr2)
 {
@@ -7754,15 +7802,17 @@ static gint summary_cmp_by_subject(GtkCMCList *clist,
 {
 	MsgInfo *msginfo1 = ((GtkCMCListRow *)ptr1)->data;
 	MsgInfo *msginfo2 = ((GtkCMCListRow *)ptr2)->data;
+	const SummaryView *sv = g_object_get_data(G_OBJECT(clist), "summaryview");
 	gint res;
 
+	cm_return_val_if_fail(sv, -1);
 	if (!msginfo1->subject)
 		return (msginfo2->subject != NULL);
 	if (!msginfo2->subject)
 		return -1;
 
-	res = subject_compare_for_sort
-		(msginfo1->subject, msginfo2->subject);
+	res = summary_collate(sv, ptr1, msginfo1->subject,
+			      ptr2, msginfo2->subject, TRUE);
 	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
 }
 
@@ -7806,7 +7856,7 @@ static gint summary_cmp_by_from(GtkCMCList *clist, gconstpointer ptr1,
 	if (!str2)
  		return -1;
  
-	res = g_utf8_collate(str1, str2);
+	res = summary_collate(sv, r1, str1, r2, str2, FALSE);
 	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
 }
  
@@ -7836,7 +7886,7 @@ static gint summary_cmp_by_to(GtkCMCList *clist, gconstpointer ptr1,
 	if (!str2)
  		return -1;
  
-	res = g_utf8_collate(str1, str2);
+	res = summary_collate(sv, r1, str1, r2, str2, FALSE);
 	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
 }
  
@@ -7870,7 +7920,7 @@ static gint summary_cmp_by_tags(GtkCMCList *clist, gconstpointer ptr1,
  		return -1;
 	}
  
-	res = g_utf8_collate(str1, str2);
+	res = summary_collate(sv, r1, str1, r2, str2, FALSE);
 	g_free(str1);
 	g_free(str2);
 	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
@@ -7911,7 +7961,7 @@ static gint summary_cmp_by_simplified_subject
 	if (!prefs)
 		return -1;
 	
-	res = subject_compare_for_sort(str1, str2);
+	res = summary_collate(sv, r1, str1, r2, str2, TRUE);
 	return (res != 0)? res: summary_cmp_by_date(clist, ptr1, ptr2);
 }
 
@@ -140,6 +140,8 @@ struct _SummaryView
 
 	/* Extra data for summaryview */
 	regex_t *simplify_subject_preg;
+	/* collation keys of the rows, while summary_sort() runs */
+	GHashTable *sort_keys;
 
 	/* current message status */
 	gint   unreadmarked;
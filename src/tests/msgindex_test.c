@@ -0,0 +1,435 @@
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "msgindex.h"
+#include "account.h"
+#include "procmime.h"
+#include "procmsg.h"
+#include "folder.h"
+#include "prefs_common.h"
+
+#include "tests/mock_prefs_common_get_use_shred.h"
+#include "tests/mock_prefs_common_get_flush_metadata.h"
+
+/* What msgindex.o and procheader.o need from the rest of the program.
+ * The messages are single text parts, whose body is what follows the
+ * first empty line. */
+PrefsCommon prefs_common;
+
+static gchar *test_dir = NULL;
+
+MsgInfo *procmsg_msginfo_new(void)
+{
+	MsgInfo *msginfo = g_new0(MsgInfo, 1);
+
+	msginfo->refcnt = 1;
+	return msginfo;
+}
+
+void procmsg_msginfo_add_avatar(MsgInfo *msginfo, gint type, const gchar *data)
+{
+}
+
+gchar *procmsg_get_message_file_path(MsgInfo *msginfo)
+{
+	return g_strdup_printf("%s%c%u", test_dir, G_DIR_SEPARATOR,
+			       msginfo->msgnum);
+}
+
+gboolean folder_has_parent_of_type(FolderItem *item, SpecialFolderItemType type)
+{
+	return FALSE;
+}
+
+void account_sigsep_matchlist_create(void)
+{
+}
+
+void account_sigsep_matchlist_delete(void)
+{
+}
+
+MimeInfo *procmime_scan_file(const gchar *filename)
+{
+	MimeInfo *mimeinfo, *partinfo;
+
+	mimeinfo = g_new0(MimeInfo, 1);
+	mimeinfo->type = MIMETYPE_MULTIPART;
+	mimeinfo->node = g_node_new(mimeinfo);
+
+	partinfo = g_new0(MimeInfo, 1);
+	partinfo->type = MIMETYPE_TEXT;
+	partinfo->content = MIMECONTENT_FILE;
+	partinfo->data.filename = g_strdup(filename);
+	partinfo->node = g_node_append_data(mimeinfo->node, partinfo);
+
+	return mimeinfo;
+}
+
+MimeInfo *procmime_scan_queue_file(const gchar *filename)
+{
+	return procmime_scan_file(filename);
+}
+
+MimeInfo *procmime_mimeinfo_next(MimeInfo *mimeinfo)
+{
+	GNode *node = mimeinfo->node;
+
+	if (node->children != NULL)
+		return (MimeInfo *)node->children->data;
+	if (node->next != NULL)
+		return (MimeInfo *)node->next->data;
+	return NULL;
+}
+
+static gboolean free_part(GNode *node, gpointer data)
+{
+	MimeInfo *mimeinfo = (MimeInfo *)node->data;
+
+	if (mimeinfo->content == MIMECONTENT_FILE)
+		g_free(mimeinfo->data.filename);
+	g_free(mimeinfo);
+	return FALSE;
+}
+
+void procmime_mimeinfo_free_all(MimeInfo **mimeinfo_ptr)
+{
+	GNode *node = (*mimeinfo_ptr)->node;
+
+	g_node_traverse(node, G_IN_ORDER, G_TRAVERSE_ALL, -1, free_part, NULL);
+	g_node_destroy(node);
+	*mimeinfo_ptr = NULL;
+}
+
+gboolean procmime_scan_text_content(MimeInfo *mimeinfo,
+		gboolean (*scan_callback)(const gchar *str, gpointer cb_data),
+		gpointer cb_data)
+{
+	gchar *contents, **lines;
+	const gchar *body;
+	gboolean ret = FALSE;
+	guint i;
+
+	if (!g_file_get_contents(mimeinfo->data.filename, &contents, NULL, NULL))
+		return TRUE;
+
+	body = strstr(contents, "\n\n");
+	lines = g_strsplit(body != NULL ? body + 2 : "", "\n", -1);
+	for (i = 0; lines[i] != NULL && !ret; i++)
+		ret = scan_callback(lines[i], cb_data);
+	g_strfreev(lines);
+	g_free(contents);
+
+	return ret;
+}
+
+static MsgInfo *
+write_msg(guint msgnum, const gchar *subject, const gchar *body)
+{
+	MsgInfo *msginfo = procmsg_msginfo_new();
+	gchar *path, *contents;
+
+	msginfo->msgnum = msgnum;
+	path = procmsg_get_message_file_path(msginfo);
+	contents = g_strdup_printf("From: someone@example.org\n"
+				   "Subject: %s\n"
+				   "\n"
+				   "%s\n", subject, body);
+	g_assert_true(g_file_set_contents(path, contents, -1, NULL));
+	g_free(contents);
+	g_free(path);
+
+	return msginfo;
+}
+
+static void
+add_msg(MsgIndex *index, guint msgnum, const gchar *subject,
+	const gchar *body)
+{
+	MsgInfo *msginfo = write_msg(msgnum, subject, body);
+
+	msgindex_add_msg(index, msginfo);
+	g_assert_true(msgindex_has_msg(index, msgnum));
+	g_free(msginfo);
+}
+
+static MsgIndex *
+write_and_read(MsgIndex *index, const gchar *index_file)
+{
+	g_assert_true(msgindex_is_dirty(index));
+	g_assert_cmpint(msgindex_write(index, index_file), ==, 0);
+	g_assert_false(msgindex_is_dirty(index));
+	msgindex_destroy(index);
+
+	index = msgindex_read(index_file);
+	g_assert_nonnull(index);
+	g_assert_false(msgindex_is_dirty(index));
+
+	return index;
+}
+
+static gchar *
+setup_index_file(void)
+{
+	test_dir = g_dir_make_tmp("msgindex_test-XXXXXX", NULL);
+	g_assert_nonnull(test_dir);
+
+	return g_build_filename(test_dir, ".claws_index", NULL);
+}
+
+static void
+teardown_index_file(gchar *index_file)
+{
+	GDir *dir = g_dir_open(test_dir, 0, NULL);
+	const gchar *name;
+
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		gchar *path = g_build_filename(test_dir, name, NULL);
+
+		g_unlink(path);
+		g_free(path);
+	}
+	g_dir_close(dir);
+	g_rmdir(test_dir);
+	g_free(test_dir);
+	test_dir = NULL;
+	g_free(index_file);
+}
+
+static void
+check_build(MsgIndex *index)
+{
+	g_assert_true(msgindex_has_msg(index, 1));
+	g_assert_true(msgindex_has_msg(index, 2));
+	g_assert_false(msgindex_has_msg(index, 4));
+
+	g_assert_true(msgindex_may_contain(index, 1, "apple", FALSE));
+	g_assert_false(msgindex_may_contain(index, 2, "apple", FALSE));
+	g_assert_true(msgindex_may_contain(index, 2, "cherry", TRUE));
+	g_assert_false(msgindex_may_contain(index, 1, "cherry", TRUE));
+	/* headers are indexed too */
+	g_assert_true(msgindex_may_contain(index, 1, "first", FALSE));
+	g_assert_false(msgindex_may_contain(index, 2, "first", FALSE));
+	/* both trigrams are there, but not the string: can't tell */
+	g_assert_true(msgindex_may_contain(index, 1, "pplemonade", FALSE));
+	/* unknown messages and short strings have to be read */
+	g_assert_true(msgindex_may_contain(index, 4, "apple", FALSE));
+	g_assert_true(msgindex_may_contain(index, 2, "ap", FALSE));
+}
+
+static void
+test_msgindex_build(void)
+{
+	gchar *index_file = setup_index_file();
+	MsgIndex *index;
+
+	/* no file yet */
+	index = msgindex_read(index_file);
+	g_assert_nonnull(index);
+	g_assert_false(msgindex_is_dirty(index));
+
+	add_msg(index, 1, "first", "an apple\nsome lemonade");
+	add_msg(index, 2, "second", "a cherry");
+	msgindex_flush(index);
+	check_build(index);
+
+	index = write_and_read(index, index_file);
+	check_build(index);
+
+	/* added to what's in the file */
+	add_msg(index, 3, "third", "a banana");
+	msgindex_flush(index);
+	g_assert_true(msgindex_may_contain(index, 3, "banana", FALSE));
+	g_assert_false(msgindex_may_contain(index, 3, "apple", FALSE));
+	g_assert_false(msgindex_may_contain(index, 1, "banana", FALSE));
+
+	index = write_and_read(index, index_file);
+	g_assert_true(msgindex_may_contain(index, 3, "banana", FALSE));
+	g_assert_false(msgindex_may_contain(index, 1, "banana", FALSE));
+	check_build(index);
+
+	msgindex_destroy(index);
+	teardown_index_file(index_file);
+}
+
+static void
+test_msgindex_update(void)
+{
+	gchar *index_file = setup_index_file();
+	MsgIndex *index = msgindex_new();
+
+	add_msg(index, 1, "first", "an apple");
+	msgindex_flush(index);
+	index = write_and_read(index, index_file);
+	g_assert_true(msgindex_may_contain(index, 1, "apple", FALSE));
+
+	/* the file changed: its text in the file is outdated */
+	add_msg(index, 1, "first", "a banana");
+	msgindex_flush(index);
+	g_assert_false(msgindex_may_contain(index, 1, "apple", FALSE));
+	g_assert_true(msgindex_may_contain(index, 1, "banana", FALSE));
+
+	index = write_and_read(index, index_file);
+	g_assert_false(msgindex_may_contain(index, 1, "apple", FALSE));
+	g_assert_true(msgindex_may_contain(index, 1, "banana", FALSE));
+
+	/* queued twice: only the last one counts */
+	add_msg(index, 1, "first", "a cherry");
+	add_msg(index, 1, "first", "a damson");
+	msgindex_flush(index);
+	g_assert_false(msgindex_may_contain(index, 1, "cherry", FALSE));
+	g_assert_true(msgindex_may_contain(index, 1, "damson", FALSE));
+
+	msgindex_destroy(index);
+	teardown_index_file(index_file);
+}
+
+static void
+test_msgindex_prune(void)
+{
+	gchar *index_file = setup_index_file();
+	MsgIndex *index = msgindex_new();
+	GStatBuf s;
+
+	add_msg(index, 1, "first", "an apple");
+	add_msg(index, 2, "second", "a cherry");
+	msgindex_flush(index);
+	index = write_and_read(index, index_file);
+
+	msgindex_remove_msg(index, 2);
+	g_assert_false(msgindex_has_msg(index, 2));
+	g_assert_true(msgindex_may_contain(index, 2, "apple", FALSE));
+	index = write_and_read(index, index_file);
+	g_assert_false(msgindex_has_msg(index, 2));
+	g_assert_true(msgindex_has_msg(index, 1));
+
+	/* a new message with the same number doesn't get the old text */
+	add_msg(index, 2, "other", "a banana");
+	msgindex_flush(index);
+	index = write_and_read(index, index_file);
+	g_assert_false(msgindex_may_contain(index, 2, "cherry", FALSE));
+	g_assert_false(msgindex_may_contain(index, 2, "second", FALSE));
+	g_assert_true(msgindex_may_contain(index, 2, "banana", FALSE));
+
+	/* removed while being indexed */
+	add_msg(index, 3, "third", "a damson");
+	msgindex_remove_msg(index, 3);
+	msgindex_flush(index);
+	g_assert_false(msgindex_has_msg(index, 3));
+
+	/* with all of them gone, only the header is left */
+	msgindex_remove_msg(index, 1);
+	msgindex_remove_msg(index, 2);
+	index = write_and_read(index, index_file);
+	g_assert_cmpint(g_stat(index_file, &s), ==, 0);
+	g_assert_cmpint(s.st_size, ==, 4 * sizeof(guint32));
+
+	msgindex_destroy(index);
+	teardown_index_file(index_file);
+}
+
+static const gchar *nfn_lines[] = {
+	"The Quick Brown Fox Jumps Over The Lazy Dog",
+	"Grüße aus Köln, ÉTÉ 2024",
+	"tabs\tand  spaces, punctuation!?",
+};
+
+/* Every substring of three bytes or more of the text, as typed or
+ * casefolded the way the matcher does it, is found */
+static void
+check_no_false_negatives(MsgIndex *index)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(nfn_lines); i++) {
+		const gchar *line = nfn_lines[i];
+		const gchar *start, *end;
+
+		for (start = line; *start != '\0'; start = g_utf8_next_char(start)) {
+			for (end = g_utf8_next_char(start); ; end = g_utf8_next_char(end)) {
+				gchar *sub = g_strndup(start, end - start);
+				gchar *folded = g_utf8_casefold(sub, -1);
+				gchar *upper = g_utf8_strup(sub, -1);
+
+				g_assert_true(msgindex_may_contain(index, 1, sub, FALSE));
+				g_assert_true(msgindex_may_contain(index, 1, folded, FALSE));
+				g_assert_true(msgindex_may_contain(index, 1, folded, TRUE));
+				if (is_ascii_str(sub))
+					g_assert_true(msgindex_may_contain(index, 1, upper, FALSE));
+				g_free(upper);
+				g_free(folded);
+				g_free(sub);
+
+				if (*end == '\0')
+					break;
+			}
+		}
+	}
+	g_assert_false(msgindex_may_contain(index, 1, "fox jumps under", FALSE));
+}
+
+static void
+test_msgindex_no_false_negatives(void)
+{
+	gchar *index_file = setup_index_file();
+	MsgIndex *index = msgindex_new();
+	gchar *body = g_strjoinv("\n", (gchar **)nfn_lines);
+
+	add_msg(index, 1, "subject", body);
+	add_msg(index, 2, "other", "nothing in common");
+	msgindex_flush(index);
+	check_no_false_negatives(index);
+
+	index = write_and_read(index, index_file);
+	check_no_false_negatives(index);
+	g_assert_false(msgindex_may_contain(index, 2, "quick brown", FALSE));
+
+	g_free(body);
+	msgindex_destroy(index);
+	teardown_index_file(index_file);
+}
+
+static void
+test_msgindex_bad_file(void)
+{
+	gchar *index_file = setup_index_file();
+	MsgIndex *index = msgindex_new();
+	gchar *contents;
+	gsize length;
+
+	add_msg(index, 1, "first", "an apple");
+	msgindex_flush(index);
+	index = write_and_read(index, index_file);
+	msgindex_destroy(index);
+
+	/* truncated: discarded, and written again */
+	g_assert_true(g_file_get_contents(index_file, &contents, &length, NULL));
+	g_assert_true(g_file_set_contents(index_file, contents, length - 1, NULL));
+	g_free(contents);
+	index = msgindex_read(index_file);
+	g_assert_nonnull(index);
+	g_assert_true(msgindex_is_dirty(index));
+	g_assert_false(msgindex_has_msg(index, 1));
+
+	msgindex_destroy(index);
+	teardown_index_file(index_file);
+}
+
+int
+main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/core/msgindex/build", test_msgindex_build);
+	g_test_add_func("/core/msgindex/update", test_msgindex_update);
+	g_test_add_func("/core/msgindex/prune", test_msgindex_prune);
+	g_test_add_func("/core/msgindex/no_false_negatives",
+			test_msgindex_no_false_negatives);
+	g_test_add_func("/core/msgindex/bad_file", test_msgindex_bad_file);
+
+	return g_test_run();
+}
@@ -0,0 +1,238 @@
+#include "config.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "procheader.h"
+#include "procmsg.h"
+#include "prefs_common.h"
+
+#include "tests/mock_prefs_common_get_use_shred.h"
+#include "tests/mock_prefs_common_get_flush_metadata.h"
+
+/* What procheader.o needs from the rest of the program */
+PrefsCommon prefs_common;
+
+MsgInfo *procmsg_msginfo_new(void)
+{
+	MsgInfo *msginfo = g_new0(MsgInfo, 1);
+
+	msginfo->refcnt = 1;
+	return msginfo;
+}
+
+void procmsg_msginfo_add_avatar(MsgInfo *msginfo, gint type, const gchar *data)
+{
+}
+
+gchar *procmsg_get_message_file_path(MsgInfo *msginfo)
+{
+	return NULL;
+}
+
+static void
+msginfo_free(MsgInfo *msginfo)
+{
+	MsgInfoExtraData *extra = msginfo->extradata;
+
+	g_free(msginfo->fromname);
+	g_free(msginfo->date);
+	g_free(msginfo->from);
+	g_free(msginfo->to);
+	g_free(msginfo->cc);
+	g_free(msginfo->newsgroups);
+	g_free(msginfo->subject);
+	g_free(msginfo->msgid);
+	g_free(msginfo->inreplyto);
+	g_free(msginfo->fromspace);
+	g_slist_free_full(msginfo->references, g_free);
+	if (extra) {
+		g_free(extra->dispositionnotificationto);
+		g_free(extra->returnreceiptto);
+		g_free(extra->resent_from);
+		g_free(extra->partial_recv);
+		g_free(extra->account_server);
+		g_free(extra->account_login);
+		g_free(extra->list_post);
+		g_free(extra->list_subscribe);
+		g_free(extra->list_unsubscribe);
+		g_free(extra->list_help);
+		g_free(extra->list_archive);
+		g_free(extra->list_owner);
+		g_free(extra);
+	}
+	g_free(msginfo);
+}
+
+static const gchar *sample_msg =
+	"From someone@example.org Mon Jan  1 00:00:00 2024\n"
+	"Received: from mx.example.org (mx.example.org [192.0.2.1])\n"
+	"\tby mail.example.com with ESMTP id 12345\n"
+	"\tfor <me@example.com>; Mon, 1 Jan 2024 00:00:00 +0000\n"
+	"DATE: Mon, 1 Jan 2024 00:00:00 +0000\n"
+	"from: Some One <someone@example.org>\n"
+	"To: me@example.com\n"
+	"X-Mailer: Something\n"
+	"Subject: a folded\n"
+	" subject\n"
+	"To: you@example.com\n"
+	"Message-Id: <1234@example.org>\n"
+	"References: <1@example.org> <2@example.org>\n"
+	"List-Post: <mailto:list@example.org>\n"
+	"Subject : not a subject\n"
+	"Content-Type: multipart/mixed; boundary=\"xyz\"\n"
+	"\n"
+	"body\n";
+
+static void
+test_procheader_parse_str(void)
+{
+	MsgFlags flags = { 0, 0 };
+	MsgInfo *msginfo;
+
+	msginfo = procheader_parse_str(sample_msg, flags, TRUE, FALSE);
+	g_assert_nonnull(msginfo);
+
+	g_assert_cmpstr(msginfo->fromspace, ==,
+			"someone@example.org Mon Jan  1 00:00:00 2024");
+	g_assert_cmpstr(msginfo->date, ==, "Mon, 1 Jan 2024 00:00:00 +0000");
+	g_assert_cmpstr(msginfo->from, ==, "Some One <someone@example.org>");
+	g_assert_cmpstr(msginfo->fromname, ==, "Some One");
+	g_assert_cmpstr(msginfo->to, ==, "me@example.com, you@example.com");
+	g_assert_cmpstr(msginfo->subject, ==, "a folded subject");
+	g_assert_cmpstr(msginfo->msgid, ==, "1234@example.org");
+	g_assert_cmpstr(msginfo->inreplyto, ==, "2@example.org");
+	g_assert_cmpuint(g_slist_length(msginfo->references), ==, 2);
+	g_assert_nonnull(msginfo->extradata);
+	g_assert_cmpstr(msginfo->extradata->list_post, ==,
+			"<mailto:list@example.org>");
+	g_assert_true(MSG_IS_MULTIPART(msginfo->flags));
+
+	msginfo_free(msginfo);
+
+	/* the short table doesn't know about List-Post */
+	msginfo = procheader_parse_str(sample_msg, flags, FALSE, FALSE);
+	g_assert_nonnull(msginfo);
+	g_assert_cmpstr(msginfo->subject, ==, "a folded subject");
+	g_assert_null(msginfo->extradata);
+	msginfo_free(msginfo);
+}
+
+static void
+test_procheader_get_one_field(void)
+{
+	HeaderEntry hentry[] = {
+		{ "Subject:", NULL, TRUE },
+		{ "Received:", NULL, FALSE },
+		{ NULL, NULL, FALSE } };
+	gchar *buf = NULL;
+	FILE *fp;
+	gint hnum;
+
+	fp = fmemopen((void *)sample_msg, strlen(sample_msg), "r");
+	g_assert_nonnull(fp);
+
+	hnum = procheader_get_one_field(&buf, fp, hentry);
+	g_assert_cmpint(hnum, ==, 1);
+	g_assert_cmpstr(buf, ==, "Received: from mx.example.org (mx.example.org [192.0.2.1])\n"
+			" by mail.example.com with ESMTP id 12345\n"
+			" for <me@example.com>; Mon, 1 Jan 2024 00:00:00 +0000");
+	g_free(buf);
+
+	hnum = procheader_get_one_field(&buf, fp, hentry);
+	g_assert_cmpint(hnum, ==, 0);
+	g_assert_cmpstr(buf, ==, "Subject: a folded subject");
+	g_free(buf);
+
+	/* "Subject :" isn't a Subject: header, then the body is reached */
+	hnum = procheader_get_one_field(&buf, fp, hentry);
+	g_assert_cmpint(hnum, ==, -1);
+	g_assert_null(buf);
+
+	fclose(fp);
+}
+
+/* Reads the messages of $CLAWS_BENCH_CORPUS (a directory, an MH folder
+ * for example), or uses the sample above */
+static GPtrArray *
+bench_load_corpus(guint *n_headers)
+{
+	const gchar *dir_path = g_getenv("CLAWS_BENCH_CORPUS");
+	GPtrArray *corpus = g_ptr_array_new_with_free_func(g_free);
+	GDir *dir;
+	const gchar *name;
+	guint i;
+
+	if (dir_path != NULL && (dir = g_dir_open(dir_path, 0, NULL)) != NULL) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			gchar *path = g_build_filename(dir_path, name, NULL);
+			gchar *contents;
+
+			if (g_file_get_contents(path, &contents, NULL, NULL))
+				g_ptr_array_add(corpus, contents);
+			g_free(path);
+		}
+		g_dir_close(dir);
+	}
+	if (corpus->len == 0)
+		g_ptr_array_add(corpus, g_strdup(sample_msg));
+
+	*n_headers = 0;
+	for (i = 0; i < corpus->len; i++) {
+		const gchar *p = g_ptr_array_index(corpus, i);
+
+		while (*p != '\0' && *p != '\n' && *p != '\r') {
+			if (*p != ' ' && *p != '\t')
+				(*n_headers)++;
+			p = strchr(p, '\n');
+			if (p == NULL)
+				break;
+			p++;
+		}
+	}
+
+	return corpus;
+}
+
+static void
+test_procheader_bench(void)
+{
+	MsgFlags flags = { 0, 0 };
+	GPtrArray *corpus;
+	GTimer *timer;
+	guint n_headers, rounds = 0, i;
+	gdouble elapsed;
+
+	corpus = bench_load_corpus(&n_headers);
+	timer = g_timer_new();
+
+	do {
+		for (i = 0; i < corpus->len; i++)
+			msginfo_free(procheader_parse_str(g_ptr_array_index(corpus, i),
+							  flags, TRUE, FALSE));
+		rounds++;
+	} while ((elapsed = g_timer_elapsed(timer, NULL)) < 2.0);
+
+	g_test_message("%u messages, %u headers, %u rounds in %.2fs",
+		       corpus->len, n_headers, rounds, elapsed);
+	g_test_maximized_result((gdouble)n_headers * rounds / elapsed,
+				"%.0f headers/second",
+				(gdouble)n_headers * rounds / elapsed);
+
+	g_timer_destroy(timer);
+	g_ptr_array_free(corpus, TRUE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/core/procheader/parse_str", test_procheader_parse_str);
+	g_test_add_func("/core/procheader/get_one_field", test_procheader_get_one_field);
+	if (g_test_perf())
+		g_test_add_func("/core/procheader/bench", test_procheader_bench);
+
+	return g_test_run();
+}
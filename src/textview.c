@@ -1017,7 +1017,8 @@ static void textview_write_body(TextView *textview, MimeInfo *mimeinfo)
 #endif
 	GSList *cur;
 	gboolean continue_write = TRUE;
-	size_t wrote = 0, i = 0;
+	size_t wrote = 0;
+	gchar *mem;
 
 	if (textview->messageview->forced_charset)
 		charset = textview->messageview->forced_charset;
@@ -1046,37 +1047,21 @@ static void textview_write_body(TextView *textview, MimeInfo *mimeinfo)
 	textview->is_attachment = FALSE;
 	textview->is_in_git_patch = FALSE;
 
-	procmime_decode_content(mimeinfo);
-
 	account_sigsep_matchlist_create();
 
 	if (!g_ascii_strcasecmp(mimeinfo->subtype, "html") &&
 	    prefs_common.render_html) {
-		gchar *filename;
-		
-		filename = procmime_get_tmp_file_name(mimeinfo);
-		if (procmime_get_part(filename, mimeinfo) == 0) {
-			tmpfp = claws_fopen(filename, "rb");
-			if (tmpfp) {
-				textview_show_html(textview, tmpfp, conv);
-				claws_fclose(tmpfp);
-			}
-			claws_unlink(filename);
+		tmpfp = procmime_open_decoded_part(mimeinfo, &mem);
+		if (tmpfp) {
+			textview_show_html(textview, tmpfp, conv);
+			procmime_close_decoded_part(tmpfp, mem);
 		}
-		g_free(filename);
 	} else if (!g_ascii_strcasecmp(mimeinfo->subtype, "enriched")) {
-		gchar *filename;
-		
-		filename = procmime_get_tmp_file_name(mimeinfo);
-		if (procmime_get_part(filename, mimeinfo) == 0) {
-			tmpfp = claws_fopen(filename, "rb");
-			if (tmpfp) {
-				textview_show_ertf(textview, tmpfp, conv);
-				claws_fclose(tmpfp);
-			}
-			claws_unlink(filename);
+		tmpfp = procmime_open_decoded_part(mimeinfo, &mem);
+		if (tmpfp) {
+			textview_show_ertf(textview, tmpfp, conv);
+			procmime_close_decoded_part(tmpfp, mem);
 		}
-		g_free(filename);
 #ifndef G_OS_WIN32
 	} else if ( g_ascii_strcasecmp(mimeinfo->subtype, "plain") &&
 		   (cmd = prefs_common.mime_textviewer) && *cmd &&
@@ -1156,42 +1141,29 @@ textview_default:
 				mimeinfo->type != MIMETYPE_MESSAGE)
 			textview->is_attachment = TRUE;
 
-		if (mimeinfo->content == MIMECONTENT_MEM)
-			tmpfp = str_open_as_stream(mimeinfo->data.mem);
-		else
-			tmpfp = claws_fopen(mimeinfo->data.filename, "rb");
+		tmpfp = procmime_open_decoded_part(mimeinfo, &mem);
 		if (!tmpfp) {
-			FILE_OP_ERROR(mimeinfo->data.filename, "claws_fopen");
-			account_sigsep_matchlist_delete();
-			conv_code_converter_destroy(conv);
-			return;
-		}
-		if (fseek(tmpfp, mimeinfo->offset, SEEK_SET) < 0) {
-			FILE_OP_ERROR(mimeinfo->data.filename, "fseek");
-			claws_fclose(tmpfp);
 			account_sigsep_matchlist_delete();
 			conv_code_converter_destroy(conv);
 			return;
 		}
 		debug_print("Viewing text content of type: %s (length: %d)\n", mimeinfo->subtype, mimeinfo->length);
-		while (((i = ftell(tmpfp)) < mimeinfo->offset + mimeinfo->length) &&
-		       (claws_fgets(buf, sizeof(buf), tmpfp) != NULL)
+		while ((claws_fgets(buf, sizeof(buf), tmpfp) != NULL)
 		       && continue_write) {
 			textview_write_line(textview, buf, conv, TRUE);
 			if (textview->stop_loading) {
-				claws_fclose(tmpfp);
+				procmime_close_decoded_part(tmpfp, mem);
 				account_sigsep_matchlist_delete();
 				conv_code_converter_destroy(conv);
 				return;
 			}
-			wrote += ftell(tmpfp)-i;
-			if (mimeinfo->length > 1024*1024 
-			&&  wrote > 1024*1024
+			wrote += strlen(buf);
+			if (wrote > 1024*1024
 			&& !textview->messageview->show_full_text) {
 				continue_write = FALSE;
 			}
 		}
-		claws_fclose(tmpfp);
+		procmime_close_decoded_part(tmpfp, mem);
 	}
 
 	account_sigsep_matchlist_delete();